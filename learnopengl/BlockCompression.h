@@ -0,0 +1,680 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+// EXT_texture_sRGB's S3TC formats, missing from the headers generated without it
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// The block compressed formats, 4x4 texel blocks
+enum BlockFormat
+{
+	BLOCK_BC1, // RGB, 8 bytes a block (DXT1, 4 bits per texel)
+	BLOCK_BC3, // RGBA, BC1 color + BC4 alpha, 16 bytes (DXT5)
+	BLOCK_BC5, // RG, two BC4 channels, 16 bytes: normal maps (RGTC2)
+	BLOCK_BC7  // RGBA, 16 bytes, much better quality than BC1/BC3 (BPTC), mode 6 only
+};
+
+//
+// CPU encoder and decoder of the BC formats.
+// BC1/BC3/BC5 endpoints come from the principal axis of the block's colors and are refined by
+// least squares. BC7 only uses mode 6 (one subset, RGBA 7.7.7.7 endpoints with a p-bit,
+// 16 interpolation steps), which already beats BC1/BC3 on most content and is quick to search.
+// The decoder is the fallback for drivers without the format, and the reference of the tests.
+//
+class BlockCompressor
+{
+public:
+	static unsigned int blockBytes(BlockFormat format) { return format == BLOCK_BC1 ? 8 : 16; }
+	static size_t compressedSize(BlockFormat format, int width, int height);
+	static const char* formatName(BlockFormat format);
+
+	// RGBA8 pixels, tightly packed (BC5 keeps R and G, BC1 ignores alpha). The partial blocks
+	// of the sizes that are not multiples of 4 repeat the last column / row.
+	// Rows of blocks are spread over numThreads threads, 0 uses every core
+	static void encode(BlockFormat format, const unsigned char* pixels, int width, int height, unsigned char* blocks, unsigned int numThreads = 0);
+	// Back to RGBA8 (BC5: B = 0, A = 255)
+	static void decode(BlockFormat format, const unsigned char* blocks, int width, int height, unsigned char* pixels);
+
+	// Peak signal to noise ratio of the decoded blocks against pixels, on the channels the format keeps
+	static double psnr(BlockFormat format, const unsigned char* pixels, int width, int height, const unsigned char* blocks);
+
+	// Whether the driver takes the format as is, and its GL internal format
+	static bool supported(BlockFormat format, bool srgb);
+	static GLenum glFormat(BlockFormat format, bool srgb);
+
+private:
+	// a block is 16 RGBA texels, row by row
+	static void encodeColor(const unsigned char* texels, unsigned char* out);
+	static void encodeChannel(const unsigned char* texels, int channel, unsigned char* out);
+	static void encodeBC7(const unsigned char* texels, unsigned char* out);
+	static void decodeColor(const unsigned char* block, bool alwaysFourColors, unsigned char* texels);
+	static void decodeChannel(const unsigned char* block, int channel, unsigned char* texels);
+	static void decodeBC7(const unsigned char* block, unsigned char* texels);
+
+	template<typename Function> static void parallelFor(size_t count, unsigned int numThreads, Function function);
+};
+
+
+size_t BlockCompressor::compressedSize(BlockFormat format, int width, int height)
+{
+	return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+}
+
+const char* BlockCompressor::formatName(BlockFormat format)
+{
+	static const char* names[] = { "BC1", "BC3", "BC5", "BC7" };
+	return names[format];
+}
+
+bool BlockCompressor::supported(BlockFormat format, bool srgb)
+{
+	switch (format)
+	{
+	case BLOCK_BC1:
+	case BLOCK_BC3:
+		return GLAD_GL_EXT_texture_compression_s3tc && (!srgb || GLAD_GL_EXT_texture_sRGB);
+	case BLOCK_BC5:
+		return !srgb; // core since GL 3.0, no sRGB version
+	case BLOCK_BC7:
+		return GLAD_GL_ARB_texture_compression_bptc != 0;
+	}
+	return false;
+}
+
+GLenum BlockCompressor::glFormat(BlockFormat format, bool srgb)
+{
+	switch (format)
+	{
+	case BLOCK_BC1: return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+	case BLOCK_BC3: return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+	case BLOCK_BC5: return GL_COMPRESSED_RG_RGTC2;
+	case BLOCK_BC7: return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+	}
+	return 0;
+}
+
+template<typename Function>
+void BlockCompressor::parallelFor(size_t count, unsigned int numThreads, Function function)
+{
+	if (numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	numThreads = (unsigned int)std::min<size_t>(numThreads, count);
+	if (numThreads <= 1)
+	{
+		function((size_t)0, count);
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	size_t perThread = (count + numThreads - 1) / numThreads;
+	for (unsigned int i = 1; i < numThreads; i++)
+	{
+		size_t begin = std::min(count, i * perThread), end = std::min(count, begin + perThread);
+		workers.emplace_back([=]() { function(begin, end); });
+	}
+	function((size_t)0, std::min(count, perThread));
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+void BlockCompressor::encode(BlockFormat format, const unsigned char* pixels, int width, int height, unsigned char* blocks, unsigned int numThreads)
+{
+	int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+	unsigned int bytes = blockBytes(format);
+	parallelFor((size_t)blocksHigh, numThreads, [&](size_t begin, size_t end)
+	{
+		unsigned char texels[64];
+		for (size_t by = begin; by < end; by++)
+			for (int bx = 0; bx < blocksWide; bx++)
+			{
+				for (int y = 0; y < 4; y++)
+					for (int x = 0; x < 4; x++)
+					{
+						int px = std::min(bx * 4 + x, width - 1), py = std::min((int)by * 4 + y, height - 1);
+						memcpy(texels + (y * 4 + x) * 4, pixels + ((size_t)py * width + px) * 4, 4);
+					}
+				unsigned char* out = blocks + (by * blocksWide + bx) * bytes;
+				switch (format)
+				{
+				case BLOCK_BC1: encodeColor(texels, out); break;
+				case BLOCK_BC3: encodeChannel(texels, 3, out); encodeColor(texels, out + 8); break;
+				case BLOCK_BC5: encodeChannel(texels, 0, out); encodeChannel(texels, 1, out + 8); break;
+				case BLOCK_BC7: encodeBC7(texels, out); break;
+				}
+			}
+	});
+}
+
+void BlockCompressor::decode(BlockFormat format, const unsigned char* blocks, int width, int height, unsigned char* pixels)
+{
+	int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+	unsigned int bytes = blockBytes(format);
+	unsigned char texels[64];
+	for (int by = 0; by < blocksHigh; by++)
+		for (int bx = 0; bx < blocksWide; bx++)
+		{
+			const unsigned char* block = blocks + ((size_t)by * blocksWide + bx) * bytes;
+			switch (format)
+			{
+			case BLOCK_BC1: decodeColor(block, false, texels); break;
+			case BLOCK_BC3: decodeColor(block + 8, true, texels); decodeChannel(block, 3, texels); break;
+			case BLOCK_BC5:
+				for (int i = 0; i < 16; i++)
+				{
+					texels[i * 4 + 2] = 0;
+					texels[i * 4 + 3] = 255;
+				}
+				decodeChannel(block, 0, texels);
+				decodeChannel(block + 8, 1, texels);
+				break;
+			case BLOCK_BC7: decodeBC7(block, texels); break;
+			}
+			for (int y = 0; y < 4 && by * 4 + y < height; y++)
+				for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+					memcpy(pixels + ((size_t)(by * 4 + y) * width + bx * 4 + x) * 4, texels + (y * 4 + x) * 4, 4);
+		}
+}
+
+double BlockCompressor::psnr(BlockFormat format, const unsigned char* pixels, int width, int height, const unsigned char* blocks)
+{
+	std::vector<unsigned char> decoded((size_t)width * height * 4);
+	decode(format, blocks, width, height, decoded.data());
+	int channels = format == BLOCK_BC1 ? 3 : format == BLOCK_BC5 ? 2 : 4;
+	double error = 0.0;
+	for (size_t i = 0; i < (size_t)width * height; i++)
+		for (int c = 0; c < channels; c++)
+		{
+			double difference = (double)pixels[i * 4 + c] - decoded[i * 4 + c];
+			error += difference * difference;
+		}
+	error /= (double)width * height * channels;
+	return error > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / error) : 99.0;
+}
+
+// --------------------------------------------------------------------------------------
+// BC1 color block: two RGB565 endpoints, 2 bit indices into endpoint0, endpoint1 and the
+// two colors at 1/3 and 2/3 between them
+// --------------------------------------------------------------------------------------
+
+static inline uint16_t blockPack565(const float* color)
+{
+	int r = std::min(std::max((int)(color[0] * 31.0f / 255.0f + 0.5f), 0), 31);
+	int g = std::min(std::max((int)(color[1] * 63.0f / 255.0f + 0.5f), 0), 63);
+	int b = std::min(std::max((int)(color[2] * 31.0f / 255.0f + 0.5f), 0), 31);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static inline void blockUnpack565(uint16_t value, int* color)
+{
+	int r = (value >> 11) & 31, g = (value >> 5) & 63, b = value & 31;
+	color[0] = (r << 3) | (r >> 2);
+	color[1] = (g << 2) | (g >> 4);
+	color[2] = (b << 3) | (b >> 2);
+}
+
+// Best 2 bit indices for the four color palette of the endpoints, returns the squared error
+static inline int blockColorIndices(const unsigned char* texels, uint16_t endpoint0, uint16_t endpoint1, unsigned char* indices)
+{
+	int palette[4][3];
+	blockUnpack565(endpoint0, palette[0]);
+	blockUnpack565(endpoint1, palette[1]);
+	for (int c = 0; c < 3; c++)
+	{
+		palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+		palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+	}
+	int total = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 0, bestError = 1 << 30;
+		for (int p = 0; p < 4; p++)
+		{
+			int dr = texels[i * 4] - palette[p][0], dg = texels[i * 4 + 1] - palette[p][1], db = texels[i * 4 + 2] - palette[p][2];
+			int error = dr * dr + dg * dg + db * db;
+			if (error < bestError)
+			{
+				bestError = error;
+				best = p;
+			}
+		}
+		indices[i] = (unsigned char)best;
+		total += bestError;
+	}
+	return total;
+}
+
+void BlockCompressor::encodeColor(const unsigned char* texels, unsigned char* out)
+{
+	// principal axis of the colors, by power iteration on their covariance
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 3; c++)
+			mean[c] += texels[i * 4 + c] / 16.0f;
+	float covariance[6] = { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+	float low[3] = { 255.0f, 255.0f, 255.0f }, high[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++)
+	{
+		float r = texels[i * 4] - mean[0], g = texels[i * 4 + 1] - mean[1], b = texels[i * 4 + 2] - mean[2];
+		covariance[0] += r * r; covariance[1] += r * g; covariance[2] += r * b;
+		covariance[3] += g * g; covariance[4] += g * b; covariance[5] += b * b;
+		for (int c = 0; c < 3; c++)
+		{
+			low[c] = std::min(low[c], (float)texels[i * 4 + c]);
+			high[c] = std::max(high[c], (float)texels[i * 4 + c]);
+		}
+	}
+	float axis[3] = { high[0] - low[0], high[1] - low[1], high[2] - low[2] };
+	for (int iteration = 0; iteration < 4; iteration++)
+	{
+		float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+		float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+		float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+		float length = std::max(std::max(std::fabs(x), std::fabs(y)), std::fabs(z));
+		if (length < 1e-6f)
+			break;
+		axis[0] = x / length;
+		axis[1] = y / length;
+		axis[2] = z / length;
+	}
+
+	// the texels furthest along the axis are the first endpoints
+	int minTexel = 0, maxTexel = 0;
+	float minDot = 1e30f, maxDot = -1e30f;
+	for (int i = 0; i < 16; i++)
+	{
+		float dot = texels[i * 4] * axis[0] + texels[i * 4 + 1] * axis[1] + texels[i * 4 + 2] * axis[2];
+		if (dot < minDot) { minDot = dot; minTexel = i; }
+		if (dot > maxDot) { maxDot = dot; maxTexel = i; }
+	}
+	float endpoints[2][3];
+	for (int c = 0; c < 3; c++)
+	{
+		endpoints[0][c] = texels[maxTexel * 4 + c];
+		endpoints[1][c] = texels[minTexel * 4 + c];
+	}
+	uint16_t best0 = blockPack565(endpoints[0]), best1 = blockPack565(endpoints[1]);
+	unsigned char indices[16], candidate[16];
+	int bestError = blockColorIndices(texels, best0, best1, indices);
+
+	// least squares endpoints for the indices found, twice
+	static const float weights[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	memcpy(candidate, indices, 16);
+	for (int iteration = 0; iteration < 2; iteration++)
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[3] = { 0.0f, 0.0f, 0.0f }, bx[3] = { 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; i++)
+		{
+			float a = weights[candidate[i]], b = 1.0f - a;
+			aa += a * a; ab += a * b; bb += b * b;
+			for (int c = 0; c < 3; c++)
+			{
+				ax[c] += a * texels[i * 4 + c];
+				bx[c] += b * texels[i * 4 + c];
+			}
+		}
+		float determinant = aa * bb - ab * ab;
+		if (std::fabs(determinant) < 1e-6f)
+			break;
+		for (int c = 0; c < 3; c++)
+		{
+			endpoints[0][c] = (ax[c] * bb - bx[c] * ab) / determinant;
+			endpoints[1][c] = (bx[c] * aa - ax[c] * ab) / determinant;
+		}
+		uint16_t endpoint0 = blockPack565(endpoints[0]), endpoint1 = blockPack565(endpoints[1]);
+		int error = blockColorIndices(texels, endpoint0, endpoint1, candidate);
+		if (error >= bestError)
+			break;
+		bestError = error;
+		best0 = endpoint0;
+		best1 = endpoint1;
+		memcpy(indices, candidate, 16);
+	}
+
+	// endpoint0 > endpoint1 selects the four color mode (BC3 always uses it)
+	if (best0 < best1)
+	{
+		std::swap(best0, best1);
+		static const unsigned char swapped[4] = { 1, 0, 3, 2 };
+		for (int i = 0; i < 16; i++)
+			indices[i] = swapped[indices[i]];
+	}
+	else if (best0 == best1)
+		memset(indices, 0, 16);
+
+	uint32_t bits = 0;
+	for (int i = 15; i >= 0; i--)
+		bits = (bits << 2) | indices[i];
+	out[0] = (unsigned char)(best0 & 0xFF); out[1] = (unsigned char)(best0 >> 8);
+	out[2] = (unsigned char)(best1 & 0xFF); out[3] = (unsigned char)(best1 >> 8);
+	for (int i = 0; i < 4; i++)
+		out[4 + i] = (unsigned char)(bits >> (8 * i));
+}
+
+void BlockCompressor::decodeColor(const unsigned char* block, bool alwaysFourColors, unsigned char* texels)
+{
+	uint16_t endpoint0 = (uint16_t)(block[0] | (block[1] << 8)), endpoint1 = (uint16_t)(block[2] | (block[3] << 8));
+	int palette[4][4];
+	blockUnpack565(endpoint0, palette[0]);
+	blockUnpack565(endpoint1, palette[1]);
+	palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+	for (int c = 0; c < 3; c++)
+	{
+		if (endpoint0 > endpoint1 || alwaysFourColors)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+		else
+		{
+			// three colors and transparent black
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+			palette[3][c] = 0;
+			palette[3][3] = 0;
+		}
+	}
+	uint32_t bits = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint32_t)block[7] << 24);
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 4; c++)
+			texels[i * 4 + c] = (unsigned char)palette[(bits >> (2 * i)) & 3][c];
+}
+
+// --------------------------------------------------------------------------------------
+// BC4 channel block (BC3 alpha, BC5 red and green): two 8 bit endpoints, 3 bit indices into
+// them and the 6 values between
+// --------------------------------------------------------------------------------------
+
+void BlockCompressor::encodeChannel(const unsigned char* texels, int channel, unsigned char* out)
+{
+	int high = 0, low = 255;
+	for (int i = 0; i < 16; i++)
+	{
+		high = std::max(high, (int)texels[i * 4 + channel]);
+		low = std::min(low, (int)texels[i * 4 + channel]);
+	}
+	out[0] = (unsigned char)high;
+	out[1] = (unsigned char)low;
+	uint64_t bits = 0;
+	if (high > low)
+	{
+		// index 0 is high, 1 is low, 2..7 go from high to low
+		int palette[8] = { high, low };
+		for (int i = 2; i < 8; i++)
+			palette[i] = ((8 - i) * high + (i - 1) * low) / 7;
+		for (int i = 15; i >= 0; i--)
+		{
+			int value = texels[i * 4 + channel], best = 0, bestError = 1 << 30;
+			for (int p = 0; p < 8; p++)
+			{
+				int error = std::abs(value - palette[p]);
+				if (error < bestError)
+				{
+					bestError = error;
+					best = p;
+				}
+			}
+			bits = (bits << 3) | (uint64_t)best;
+		}
+	}
+	for (int i = 0; i < 6; i++)
+		out[2 + i] = (unsigned char)(bits >> (8 * i));
+}
+
+void BlockCompressor::decodeChannel(const unsigned char* block, int channel, unsigned char* texels)
+{
+	int palette[8] = { block[0], block[1] };
+	if (palette[0] > palette[1])
+	{
+		for (int i = 2; i < 8; i++)
+			palette[i] = ((8 - i) * palette[0] + (i - 1) * palette[1]) / 7;
+	}
+	else
+	{
+		for (int i = 2; i < 6; i++)
+			palette[i] = ((6 - i) * palette[0] + (i - 1) * palette[1]) / 5;
+		palette[6] = 0;
+		palette[7] = 255;
+	}
+	uint64_t bits = 0;
+	for (int i = 0; i < 6; i++)
+		bits |= (uint64_t)block[2 + i] << (8 * i);
+	for (int i = 0; i < 16; i++)
+		texels[i * 4 + channel] = (unsigned char)palette[(bits >> (3 * i)) & 7];
+}
+
+// --------------------------------------------------------------------------------------
+// BC7 mode 6: 7 bits of mode (0000001), RGBA endpoints of 7 bits and a p-bit each (the low bit),
+// 4 bit indices, the first one stored on 3 bits with its high bit implied 0
+// --------------------------------------------------------------------------------------
+
+static const int bc7Weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+static inline int bc7Interpolate(int endpoint0, int endpoint1, int weight)
+{
+	return ((64 - weight) * endpoint0 + weight * endpoint1 + 32) >> 6;
+}
+
+// Best indices for two quantized RGBA endpoints, returns the squared error
+static inline int bc7Indices(const unsigned char* texels, const int* endpoint0, const int* endpoint1, unsigned char* indices)
+{
+	int palette[16][4];
+	for (int p = 0; p < 16; p++)
+		for (int c = 0; c < 4; c++)
+			palette[p][c] = bc7Interpolate(endpoint0[c], endpoint1[c], bc7Weights4[p]);
+	int total = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		int best = 0, bestError = 1 << 30;
+		for (int p = 0; p < 16; p++)
+		{
+			int error = 0;
+			for (int c = 0; c < 4; c++)
+			{
+				int difference = texels[i * 4 + c] - palette[p][c];
+				error += difference * difference;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				best = p;
+			}
+		}
+		indices[i] = (unsigned char)best;
+		total += bestError;
+	}
+	return total;
+}
+
+// 8 bit value of an endpoint as 7 bits + shared p-bit, the p-bit that fits its four channels best
+static inline void bc7Quantize(const float* endpoint, int* quantized)
+{
+	int bestError = 1 << 30;
+	for (int pbit = 0; pbit < 2; pbit++)
+	{
+		int candidate[4], error = 0;
+		for (int c = 0; c < 4; c++)
+		{
+			int high = std::min(std::max((int)std::floor((endpoint[c] - pbit) / 2.0f + 0.5f), 0), 127);
+			candidate[c] = (high << 1) | pbit;
+			float difference = candidate[c] - endpoint[c];
+			error += (int)(difference * difference);
+		}
+		if (error < bestError)
+		{
+			bestError = error;
+			memcpy(quantized, candidate, sizeof(candidate));
+		}
+	}
+}
+
+void BlockCompressor::encodeBC7(const unsigned char* texels, unsigned char* out)
+{
+	// principal axis in RGBA, the extreme texels along it as endpoints
+	float mean[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++)
+		for (int c = 0; c < 4; c++)
+			mean[c] += texels[i * 4 + c] / 16.0f;
+	float covariance[4][4] = {};
+	float low[4] = { 255.0f, 255.0f, 255.0f, 255.0f }, high[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++)
+		for (int a = 0; a < 4; a++)
+		{
+			for (int b = 0; b < 4; b++)
+				covariance[a][b] += (texels[i * 4 + a] - mean[a]) * (texels[i * 4 + b] - mean[b]);
+			low[a] = std::min(low[a], (float)texels[i * 4 + a]);
+			high[a] = std::max(high[a], (float)texels[i * 4 + a]);
+		}
+	float axis[4] = { high[0] - low[0], high[1] - low[1], high[2] - low[2], high[3] - low[3] };
+	for (int iteration = 0; iteration < 6; iteration++)
+	{
+		float next[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, length = 0.0f;
+		for (int a = 0; a < 4; a++)
+		{
+			for (int b = 0; b < 4; b++)
+				next[a] += covariance[a][b] * axis[b];
+			length = std::max(length, std::fabs(next[a]));
+		}
+		if (length < 1e-6f)
+			break;
+		for (int c = 0; c < 4; c++)
+			axis[c] = next[c] / length;
+	}
+	float minDot = 1e30f, maxDot = -1e30f;
+	for (int i = 0; i < 16; i++)
+	{
+		float dot = 0.0f;
+		for (int c = 0; c < 4; c++)
+			dot += (texels[i * 4 + c] - mean[c]) * axis[c];
+		minDot = std::min(minDot, dot);
+		maxDot = std::max(maxDot, dot);
+	}
+	float lengthSquared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] + axis[3] * axis[3];
+	float endpoints[2][4];
+	for (int c = 0; c < 4; c++)
+	{
+		float direction = lengthSquared > 1e-12f ? axis[c] / lengthSquared : 0.0f;
+		endpoints[0][c] = std::min(std::max(mean[c] + minDot * direction, 0.0f), 255.0f);
+		endpoints[1][c] = std::min(std::max(mean[c] + maxDot * direction, 0.0f), 255.0f);
+	}
+
+	int best[2][4];
+	bc7Quantize(endpoints[0], best[0]);
+	bc7Quantize(endpoints[1], best[1]);
+	unsigned char indices[16], candidate[16];
+	int bestError = bc7Indices(texels, best[0], best[1], indices);
+
+	// least squares refinement of the endpoints for the indices found
+	memcpy(candidate, indices, 16);
+	for (int iteration = 0; iteration < 2 && bestError > 0; iteration++)
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[4] = { 0.0f, 0.0f, 0.0f, 0.0f }, bx[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		for (int i = 0; i < 16; i++)
+		{
+			float b = bc7Weights4[candidate[i]] / 64.0f, a = 1.0f - b;
+			aa += a * a; ab += a * b; bb += b * b;
+			for (int c = 0; c < 4; c++)
+			{
+				ax[c] += a * texels[i * 4 + c];
+				bx[c] += b * texels[i * 4 + c];
+			}
+		}
+		float determinant = aa * bb - ab * ab;
+		if (std::fabs(determinant) < 1e-6f)
+			break;
+		for (int c = 0; c < 4; c++)
+		{
+			endpoints[0][c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / determinant, 0.0f), 255.0f);
+			endpoints[1][c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / determinant, 0.0f), 255.0f);
+		}
+		int quantized[2][4];
+		bc7Quantize(endpoints[0], quantized[0]);
+		bc7Quantize(endpoints[1], quantized[1]);
+		int error = bc7Indices(texels, quantized[0], quantized[1], candidate);
+		if (error >= bestError)
+			break;
+		bestError = error;
+		memcpy(best, quantized, sizeof(best));
+		memcpy(indices, candidate, 16);
+	}
+
+	// the first index is stored without its high bit: swap the endpoints when it is set
+	if (indices[0] & 8)
+	{
+		for (int c = 0; c < 4; c++)
+			std::swap(best[0][c], best[1][c]);
+		for (int i = 0; i < 16; i++)
+			indices[i] = (unsigned char)(15 - indices[i]);
+	}
+
+	uint64_t words[2] = { 0, 0 };
+	int position = 0;
+	auto write = [&](uint64_t value, int bits)
+	{
+		for (int i = 0; i < bits; i++, position++)
+			words[position / 64] |= ((value >> i) & 1) << (position % 64);
+	};
+	write(1 << 6, 7);
+	for (int c = 0; c < 4; c++)
+	{
+		write(best[0][c] >> 1, 7);
+		write(best[1][c] >> 1, 7);
+	}
+	write(best[0][0] & 1, 1);
+	write(best[1][0] & 1, 1);
+	write(indices[0], 3);
+	for (int i = 1; i < 16; i++)
+		write(indices[i], 4);
+	for (int i = 0; i < 16; i++)
+		out[i] = (unsigned char)(words[i / 8] >> (8 * (i % 8)));
+}
+
+void BlockCompressor::decodeBC7(const unsigned char* block, unsigned char* texels)
+{
+	if ((block[0] & 0x7F) != 1 << 6)
+	{
+		// another mode, never written by encodeBC7: magenta
+		for (int i = 0; i < 16; i++)
+		{
+			texels[i * 4] = 255; texels[i * 4 + 1] = 0; texels[i * 4 + 2] = 255; texels[i * 4 + 3] = 255;
+		}
+		return;
+	}
+	uint64_t words[2] = { 0, 0 };
+	for (int i = 0; i < 16; i++)
+		words[i / 8] |= (uint64_t)block[i] << (8 * (i % 8));
+	int position = 7;
+	auto read = [&](int bits)
+	{
+		int value = 0;
+		for (int i = 0; i < bits; i++, position++)
+			value |= (int)((words[position / 64] >> (position % 64)) & 1) << i;
+		return value;
+	};
+	int endpoints[2][4];
+	for (int c = 0; c < 4; c++)
+	{
+		endpoints[0][c] = read(7) << 1;
+		endpoints[1][c] = read(7) << 1;
+	}
+	int pbit0 = read(1), pbit1 = read(1);
+	for (int c = 0; c < 4; c++)
+	{
+		endpoints[0][c] |= pbit0;
+		endpoints[1][c] |= pbit1;
+	}
+	for (int i = 0; i < 16; i++)
+	{
+		int index = read(i == 0 ? 3 : 4);
+		for (int c = 0; c < 4; c++)
+			texels[i * 4 + c] = (unsigned char)bc7Interpolate(endpoints[0][c], endpoints[1][c], bc7Weights4[index]);
+	}
+}
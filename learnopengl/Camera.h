@@ -2,6 +2,10 @@
 
 #include <GLFW/glfw3.h>
 #include <glm/gtc/matrix_transform.hpp> // glm::translate, glm::rotate, glm::scale, glm::perspective
+#include <glm/vec4.hpp>
+#include <algorithm>
+
+#include "MathKernels.h"
 
 enum CameraMovement
 {
@@ -11,21 +15,80 @@ enum CameraMovement
 	CAM_RIGHT
 };
 
+// Six planes (xyz = normal pointing inside, w = distance) bounding what the camera sees
+struct Frustum
+{
+	enum { PLANE_LEFT, PLANE_RIGHT, PLANE_BOTTOM, PLANE_TOP, PLANE_NEAR, PLANE_FAR };
+	glm::vec4 planes[6];
+
+	bool intersectsSphere(glm::vec3 center, float radius) const;
+	bool intersectsBox(glm::vec3 boxMin, glm::vec3 boxMax) const;
+};
+
+// Pose of the camera: what the simulation advances at a fixed rate and the renderer interpolates
+struct CameraState
+{
+	glm::vec3 position;
+	float yaw;
+	float pitch;
+	float fov;
+};
+
+//
+// Fly camera owning its view and projection.
+// The matrices are cached and only rebuilt when something they depend on changed, so every
+// consumer can ask for them as often as it wants during a frame.
+//
 class Camera
 {
 public:
 	Camera(glm::vec3 pos);
 	~Camera();
 
-	glm::mat4 getViewMatrix() { return glm::lookAt(cameraPos, cameraPos + front, up); }
+	const glm::mat4& getViewMatrix();
+	const glm::mat4& getProjectionMatrix();
+	const glm::mat4& getViewProjectionMatrix();
+	const glm::mat4& getInverseViewMatrix();
+	const glm::mat4& getInverseProjectionMatrix();
+	const glm::mat4& getInverseViewProjectionMatrix();
+	const Frustum& getFrustum();
 
 	void keyboardMovement(CameraMovement type, float deltaTime);
 	void mouseMovement(float xOffset, float yOffset);
 	void scrollMovement(float yOffset);
+
+	CameraState getState() { return { cameraPos, yaw, pitch, fov }; }
+	// Only what changed is marked dirty, setting the same state again is free
+	void setState(const CameraState& state);
+	static CameraState interpolate(const CameraState& a, const CameraState& b, float t);
+
+	// Projection parameters, fov in degrees
+	void setAspect(float aspect);
+	void setClipPlanes(float nearPlane, float farPlane);
+	// Reverse-Z maps the near plane to depth 1 and the far plane to 0 in a [0, 1] depth range,
+	// the GL has to be set up with glClipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE) and glDepthFunc(GL_GREATER)
+	void setReverseZ(bool enabled);
+	// Push the far plane to infinity, the far clip distance is then ignored
+	void setInfiniteFar(bool enabled);
+
 	float getFOV() { return fov; }
+	float getAspect() { return aspect; }
+	float getNearPlane() { return nearPlane; }
+	float getFarPlane() { return farPlane; }
+	bool isReverseZ() { return reverseZ; }
+	bool isInfiniteFar() { return infiniteFar; }
+	glm::vec3 getPosition() { return cameraPos; }
+	glm::vec3 getFront() { return front; }
+
+	// Pixels covered on screen by a length 'size' at 'center' (viewportHeight in pixels), used to
+	// pick mesh LODs and texture mips. Grows without bound as the camera gets inside 'size'.
+	float projectedSize(glm::vec3 center, float size, float viewportHeight);
 
 private:
 	void updateCameraVectors();
+	void updateView();
+	void updateProjection();
+	void updateCombined();
 
 	glm::vec3 cameraPos; 
 	glm::vec3 up;
@@ -35,9 +98,27 @@ private:
 	float yaw;
 	float pitch;
 	float fov;
+	float aspect;
+	float nearPlane;
+	float farPlane;
+	bool reverseZ;
+	bool infiniteFar;
 	  
 	float speed = 2.0f;
-	const float sensitivity = 1.0f; 
+	const float sensitivity = 0.1f; // degrees per pixel
+
+	// cached matrices, rebuilt on demand
+	glm::mat4 view;
+	glm::mat4 inverseView;
+	glm::mat4 projection;
+	glm::mat4 inverseProjection;
+	glm::mat4 viewProjection;
+	glm::mat4 inverseViewProjection;
+	Frustum frustum;
+	bool viewDirty;
+	bool projectionDirty;
+	bool combinedDirty;        // viewProjection, its inverse and the frustum
+	bool inverseCombinedDirty; // inverseViewProjection is only computed when asked for
 };
 
 Camera::Camera(glm::vec3 pos = glm::vec3(0.0f, 0.0f, 3.0f))
@@ -46,6 +127,16 @@ Camera::Camera(glm::vec3 pos = glm::vec3(0.0f, 0.0f, 3.0f))
 	yaw = -90.0f;
 	pitch = 0.0f; 
 	fov = 45.0f;
+	aspect = 4.0f / 3.0f;
+	nearPlane = 0.1f;
+	farPlane = 100.0f;
+	reverseZ = false;
+	infiniteFar = false;
+
+	viewDirty = true;
+	projectionDirty = true;
+	combinedDirty = true;
+	inverseCombinedDirty = true;
 
 	updateCameraVectors();
 	 
@@ -78,7 +169,8 @@ void Camera::keyboardMovement(CameraMovement type, float deltaTime)
 		this->cameraPos += velocity * right;
 	}
 
-	updateCameraVectors();
+	// only the position changed, the direction vectors are still valid
+	viewDirty = true;
 }
 
 
@@ -117,6 +209,69 @@ void Camera::scrollMovement(float yOffset)
 		fov = 1.0f;
 	if (fov > 45.0f)
 		fov = 45.0f;
+	projectionDirty = true;
+}
+
+void Camera::setState(const CameraState& state)
+{
+	if (state.position.x != cameraPos.x || state.position.y != cameraPos.y || state.position.z != cameraPos.z)
+	{
+		cameraPos = state.position;
+		viewDirty = true;
+	}
+	if (state.yaw != yaw || state.pitch != pitch)
+	{
+		yaw = state.yaw;
+		pitch = state.pitch;
+		updateCameraVectors();
+	}
+	if (state.fov != fov)
+	{
+		fov = state.fov;
+		projectionDirty = true;
+	}
+}
+
+CameraState Camera::interpolate(const CameraState& a, const CameraState& b, float t)
+{
+	// yaw is not wrapped, so a plain lerp never takes the long way around
+	return { a.position + (b.position - a.position) * t, a.yaw + (b.yaw - a.yaw) * t,
+		a.pitch + (b.pitch - a.pitch) * t, a.fov + (b.fov - a.fov) * t };
+}
+
+float Camera::projectedSize(glm::vec3 center, float size, float viewportHeight)
+{
+	float pixelsPerUnit = viewportHeight / (2.0f * tan(glm::radians(fov) / 2.0f));
+	float distance = std::max(glm::length(center - cameraPos), 1e-4f);
+	return size * pixelsPerUnit / distance;
+}
+
+void Camera::setAspect(float aspect)
+{
+	if (aspect > 0.0f && aspect != this->aspect) // a minimized window reports 0x0
+	{
+		this->aspect = aspect;
+		projectionDirty = true;
+	}
+}
+
+void Camera::setClipPlanes(float nearPlane, float farPlane)
+{
+	this->nearPlane = nearPlane;
+	this->farPlane = farPlane;
+	projectionDirty = true;
+}
+
+void Camera::setReverseZ(bool enabled)
+{
+	reverseZ = enabled;
+	projectionDirty = true;
+}
+
+void Camera::setInfiniteFar(bool enabled)
+{
+	infiniteFar = enabled;
+	projectionDirty = true;
 }
 
 void Camera::updateCameraVectors()
@@ -129,4 +284,153 @@ void Camera::updateCameraVectors()
 
 	right = glm::normalize(glm::cross(front, glm::vec3(0.0f, 1.0f, 0.0f)));
 	up = glm::normalize(glm::cross(right, front));
-}
\ No newline at end of file
+
+	viewDirty = true;
+}
+
+void Camera::updateView()
+{
+	view = glm::lookAt(cameraPos, cameraPos + front, up);
+	inverseView = glm::inverse(view);
+	viewDirty = false;
+	combinedDirty = true;
+}
+
+void Camera::updateProjection()
+{
+	if (reverseZ)
+	{
+		// [0, 1] depth with near -> 1 and far -> 0, the float depth buffer then keeps its precision where it is needed
+		float f = 1.0f / tan(glm::radians(fov) / 2.0f);
+		projection = glm::mat4(0.0f);
+		projection[0][0] = f / aspect;
+		projection[1][1] = f;
+		projection[2][3] = -1.0f;
+		if (infiniteFar)
+		{
+			// limit of the finite version when far -> infinity: depth = near / distance
+			projection[2][2] = 0.0f;
+			projection[3][2] = nearPlane;
+		}
+		else
+		{
+			projection[2][2] = nearPlane / (farPlane - nearPlane);
+			projection[3][2] = nearPlane * farPlane / (farPlane - nearPlane);
+		}
+	}
+	else if (infiniteFar)
+	{
+		projection = glm::infinitePerspective(glm::radians(fov), aspect, nearPlane);
+	}
+	else
+	{
+		projection = glm::perspective(glm::radians(fov), aspect, nearPlane, farPlane);
+	}
+	inverseProjection = glm::inverse(projection);
+	projectionDirty = false;
+	combinedDirty = true;
+}
+
+void Camera::updateCombined()
+{
+	if (viewDirty)
+		updateView();
+	if (projectionDirty)
+		updateProjection();
+	if (!combinedDirty)
+		return;
+
+	MathKernels::multiply(projection, view, viewProjection);
+
+	// the planes come from the camera basis, they do not depend on the depth convention
+	float halfHeight = tan(glm::radians(fov) / 2.0f);
+	float halfWidth = halfHeight * aspect;
+	auto plane = [&](glm::vec3 normal, glm::vec3 point) { return glm::vec4(normal, -glm::dot(normal, point)); };
+	frustum.planes[Frustum::PLANE_LEFT] = plane(glm::normalize(right + halfWidth * front), cameraPos);
+	frustum.planes[Frustum::PLANE_RIGHT] = plane(glm::normalize(-right + halfWidth * front), cameraPos);
+	frustum.planes[Frustum::PLANE_BOTTOM] = plane(glm::normalize(up + halfHeight * front), cameraPos);
+	frustum.planes[Frustum::PLANE_TOP] = plane(glm::normalize(-up + halfHeight * front), cameraPos);
+	frustum.planes[Frustum::PLANE_NEAR] = plane(front, cameraPos + front * nearPlane);
+	if (infiniteFar)
+		frustum.planes[Frustum::PLANE_FAR] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f); // everything is in front of it
+	else
+		frustum.planes[Frustum::PLANE_FAR] = plane(-front, cameraPos + front * farPlane);
+
+	combinedDirty = false;
+	inverseCombinedDirty = true;
+}
+
+const glm::mat4& Camera::getViewMatrix()
+{
+	if (viewDirty)
+		updateView();
+	return view;
+}
+
+const glm::mat4& Camera::getInverseViewMatrix()
+{
+	if (viewDirty)
+		updateView();
+	return inverseView;
+}
+
+const glm::mat4& Camera::getProjectionMatrix()
+{
+	if (projectionDirty)
+		updateProjection();
+	return projection;
+}
+
+const glm::mat4& Camera::getInverseProjectionMatrix()
+{
+	if (projectionDirty)
+		updateProjection();
+	return inverseProjection;
+}
+
+const glm::mat4& Camera::getViewProjectionMatrix()
+{
+	updateCombined();
+	return viewProjection;
+}
+
+const glm::mat4& Camera::getInverseViewProjectionMatrix()
+{
+	updateCombined();
+	if (inverseCombinedDirty)
+	{
+		MathKernels::multiply(inverseView, inverseProjection, inverseViewProjection);
+		inverseCombinedDirty = false;
+	}
+	return inverseViewProjection;
+}
+
+const Frustum& Camera::getFrustum()
+{
+	updateCombined();
+	return frustum;
+}
+
+bool Frustum::intersectsSphere(glm::vec3 center, float radius) const
+{
+	for (int i = 0; i < 6; i++)
+	{
+		if (glm::dot(glm::vec3(planes[i]), center) + planes[i].w < -radius)
+			return false;
+	}
+	return true;
+}
+
+bool Frustum::intersectsBox(glm::vec3 boxMin, glm::vec3 boxMax) const
+{
+	for (int i = 0; i < 6; i++)
+	{
+		// the corner furthest along the plane normal
+		glm::vec3 corner(planes[i].x >= 0.0f ? boxMax.x : boxMin.x,
+			planes[i].y >= 0.0f ? boxMax.y : boxMin.y,
+			planes[i].z >= 0.0f ? boxMax.z : boxMin.z);
+		if (glm::dot(glm::vec3(planes[i]), corner) + planes[i].w < 0.0f)
+			return false;
+	}
+	return true;
+}
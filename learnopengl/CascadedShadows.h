@@ -0,0 +1,462 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Camera.h"
+#include "Shader.h"
+#include "Mesh.h"
+#include "Framebuffer.h" // DepthConfig
+#include "RenderThread.h"
+
+// Something drawn into the shadow maps
+struct ShadowCaster
+{
+	Mesh* mesh;
+	glm::mat4 model;
+	glm::vec3 boundsMin; // world space box
+	glm::vec3 boundsMax;
+	int lod;
+	bool isStatic;       // static casters are all the cached cascades hold
+};
+
+struct ShadowSettings
+{
+	int cascadeCount = 4;       // 1 to 4, the atlas is 2x2 tiles
+	int tileSize = 1024;        // texels across a cascade
+	float distance = 60.0f;     // shadows stop there, the camera's far plane may be at infinity
+	float splitLambda = 0.75f;  // cascade ends from even (0) to logarithmic (1)
+	int firstCachedCascade = 2; // from this one on the cascades are cached
+	float cachedMargin = 1.25f; // a cached cascade covers that much more than its slice, the camera moves a while before a re-render
+};
+
+//
+// Cascaded shadow maps for one directional light.
+// The view up to settings.distance is cut into slices, each cascade is an orthographic depth map
+// of the casters around its slice, from the light. The cascades share one depth texture, an atlas
+// of 2x2 tiles, sampled with hardware comparison (sampler2DShadow) and 4 taps.
+// Stable cascades: each one is fitted to the bounding sphere of its slice, whose size only
+// depends on the split distances and the projection, not on where the camera looks, and its
+// center is snapped to whole texels in light space. The shadow edges do not crawl as the camera
+// turns and moves.
+// Casters are culled per cascade against its box in light space, extended toward the light:
+// whatever is between the light and the slice can shade it. Those in front of the near plane are
+// flattened onto it by the depth clamp instead of clipped.
+// Cached cascades: the far ones hold the static casters only and are drawn with some margin. They
+// are re-rendered when the light or the static casters change, or when the camera leaves the
+// margin, not every frame. Dynamic casters only shadow the near cascades.
+//
+class CascadedShadows
+{
+public:
+	static const int maxCascades = 4;
+
+	// depthConfig gives the clip space depth range and the compare to restore after the shadow pass
+	CascadedShadows(const DepthConfig& depthConfig, const ShadowSettings& settings = ShadowSettings());
+	// Deletes the atlas, needs the context
+	~CascadedShadows();
+
+	CascadedShadows(const CascadedShadows&) = delete;
+	CascadedShadows& operator=(const CascadedShadows&) = delete;
+
+	// The atlas and its framebuffer, needs the context. Without them apply() turns the light off.
+	bool create();
+
+	void setEnabled(bool enabled) { this->enabled = enabled && fbo != 0; }
+	bool isEnabled() const { return enabled; }
+	// Keep the far cascades from frame to frame, otherwise every cascade is drawn every frame
+	void setCaching(bool caching);
+	// direction: where the light goes (world space). The cached cascades are redrawn if it changed.
+	void setLight(glm::vec3 direction, glm::vec3 color);
+	// The static casters moved, appeared or went away: redraw the cached cascades
+	void invalidateStatic();
+
+	// Fit the cascades to the camera and draw the casters of each into the atlas with depthShader
+	// (projection, view and model, depth only). Leaves the atlas framebuffer bound: record it
+	// before binding the scene's target.
+	void render(CommandList& commands, Shader* depthShader, Camera& camera, const std::vector<ShadowCaster>& casters);
+	// Bind the atlas to unit 15 and set the light and the cascades on the bound shader, for the
+	// draws shaded after this. Also needed with the shadows off: it sets cascadeCount to 0.
+	void apply(CommandList& commands, Shader* shader, Camera& camera);
+
+	// cascades and caster draws a frame on average since the last reset
+	double getCascadesPerFrame() const { return frames ? (double)cascadesRendered / frames : 0.0; }
+	double getCasterDrawsPerFrame() const { return frames ? (double)casterDraws / frames : 0.0; }
+	void resetStatistics();
+	void report() const;
+
+private:
+	static const unsigned int atlasUnit = 15;
+
+	struct Cascade
+	{
+		glm::mat4 projection; // light space to the tile, depth in [0, 1]
+		glm::vec3 center;     // light space, snapped to texels
+		float radius;
+		bool valid;           // cached: the tile holds the static casters for this projection
+	};
+
+	// slice i: view distances [start, end] to its bounding sphere, center as the distance along the view axis
+	void sliceSphere(float start, float end, float tanX, float tanY, float& centerDistance, float& radius) const;
+	void fit(Cascade& cascade, glm::vec3 worldCenter, float radius) const;
+	bool contains(const Cascade& cascade, glm::vec3 lightCenter, float radius) const;
+	bool touches(const Cascade& cascade, const ShadowCaster& caster) const;
+	bool isCached(int cascade) const { return caching && cascade >= settings.firstCachedCascade; }
+
+	ShadowSettings settings;
+	bool zeroToOne;       // clip space depth range of the scene's clip control
+	GLenum compareFunc;
+	float clearDepth;
+
+	GLuint fbo;
+	GLuint atlas;
+	bool enabled;
+	bool caching;
+
+	glm::vec3 direction;
+	glm::vec3 color;
+	glm::mat4 lightRotation; // world to light space, the light looking down -z
+	Cascade cascades[maxCascades];
+	float cascadeEnds[maxCascades];
+
+	// statistics
+	unsigned int frameCasterDraws;
+	unsigned int frameCascadesRendered;
+	unsigned int frames;
+	unsigned long long casterDraws;
+	unsigned long long cascadesRendered;
+	unsigned int cachedRenders;       // cached cascades drawn again
+	unsigned int casterCount;
+};
+
+
+CascadedShadows::CascadedShadows(const DepthConfig& depthConfig, const ShadowSettings& settings)
+{
+	this->settings = settings;
+	this->settings.cascadeCount = std::max(1, std::min(settings.cascadeCount, (int)maxCascades));
+	zeroToOne = depthConfig.reverseZ; // the reverse-Z clip control
+	compareFunc = depthConfig.compareFunc();
+	clearDepth = depthConfig.clearDepth();
+	fbo = 0;
+	atlas = 0;
+	enabled = false;
+	caching = true;
+	for (Cascade& cascade : cascades)
+		cascade = Cascade{ glm::mat4(1.0f), glm::vec3(0.0f), 0.0f, false };
+	for (float& end : cascadeEnds)
+		end = 0.0f;
+	direction = glm::vec3(0.0f);
+	setLight(glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(1.0f));
+	frameCasterDraws = frameCascadesRendered = 0;
+	casterCount = 0;
+	resetStatistics();
+}
+
+CascadedShadows::~CascadedShadows()
+{
+	if (atlas != 0)
+		glDeleteTextures(1, &atlas);
+	if (fbo != 0)
+		glDeleteFramebuffers(1, &fbo);
+}
+
+bool CascadedShadows::create()
+{
+	int size = settings.tileSize * 2;
+	glGenTextures(1, &atlas);
+	glBindTexture(GL_TEXTURE_2D, atlas);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, size, size, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+	// bilinear comparison: each tap is already a 2x2 filter
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, atlas, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "ERROR::CascadedShadows::create:: incomplete framebuffer, status 0x" << std::hex << status << std::dec << std::endl;
+		glDeleteTextures(1, &atlas);
+		glDeleteFramebuffers(1, &fbo);
+		atlas = fbo = 0;
+		return false;
+	}
+	return true;
+}
+
+void CascadedShadows::setCaching(bool caching)
+{
+	if (caching == this->caching)
+		return;
+	this->caching = caching;
+	invalidateStatic();
+}
+
+void CascadedShadows::setLight(glm::vec3 direction, glm::vec3 color)
+{
+	this->color = color;
+	direction = glm::normalize(direction);
+	if (direction == this->direction)
+		return;
+	this->direction = direction;
+	glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+	lightRotation = glm::lookAt(glm::vec3(0.0f), direction, up);
+	invalidateStatic();
+}
+
+void CascadedShadows::invalidateStatic()
+{
+	for (Cascade& cascade : cascades)
+		cascade.valid = false;
+}
+
+void CascadedShadows::sliceSphere(float start, float end, float tanX, float tanY, float& centerDistance, float& radius) const
+{
+	// the center on the view axis at the same distance from the near and the far corners,
+	// or the far plane's center when the slice is too wide for that
+	float k = tanX * tanX + tanY * tanY;
+	centerDistance = (start + end) * (1.0f + k) * 0.5f;
+	if (centerDistance >= end)
+	{
+		centerDistance = end;
+		radius = end * std::sqrt(k);
+	}
+	else
+		radius = std::sqrt(start * start * k + (centerDistance - start) * (centerDistance - start));
+	// rounded up, so float noise does not change the texel size from frame to frame
+	radius = std::ceil(radius * 16.0f) / 16.0f;
+}
+
+void CascadedShadows::fit(Cascade& cascade, glm::vec3 worldCenter, float radius) const
+{
+	// whole texels in light space: the map moves by texels and the same casters land on the same texels
+	float texel = 2.0f * radius / settings.tileSize;
+	glm::vec3 center = glm::vec3(lightRotation * glm::vec4(worldCenter, 1.0f));
+	center.x = std::floor(center.x / texel) * texel;
+	center.y = std::floor(center.y / texel) * texel;
+	cascade.center = center;
+	cascade.radius = radius;
+
+	// orthographic around the sphere, depth 0 at its front (toward the light) and 1 at its back
+	float nearDistance = -(center.z + radius), depthRange = 2.0f * radius;
+	glm::mat4 projection(1.0f);
+	projection[0][0] = 1.0f / radius;
+	projection[1][1] = 1.0f / radius;
+	projection[2][2] = -1.0f / depthRange;
+	projection[3][0] = -center.x / radius;
+	projection[3][1] = -center.y / radius;
+	projection[3][2] = -nearDistance / depthRange;
+	cascade.projection = projection;
+}
+
+bool CascadedShadows::contains(const Cascade& cascade, glm::vec3 lightCenter, float radius) const
+{
+	glm::vec3 offset = glm::abs(lightCenter - cascade.center) + glm::vec3(radius);
+	return offset.x <= cascade.radius && offset.y <= cascade.radius && offset.z <= cascade.radius;
+}
+
+bool CascadedShadows::touches(const Cascade& cascade, const ShadowCaster& caster) const
+{
+	// the caster's box in light space: center and extent through the rotation's absolute values
+	glm::vec3 center = glm::vec3(lightRotation * glm::vec4((caster.boundsMin + caster.boundsMax) * 0.5f, 1.0f));
+	glm::vec3 half = (caster.boundsMax - caster.boundsMin) * 0.5f;
+	glm::mat3 rotation(lightRotation);
+	glm::vec3 extent = glm::abs(rotation[0]) * half.x + glm::abs(rotation[1]) * half.y + glm::abs(rotation[2]) * half.z;
+	// across the light, and not all behind the back of the cascade. No front test: everything
+	// toward the light casts on the slice.
+	return std::abs(center.x - cascade.center.x) <= cascade.radius + extent.x
+		&& std::abs(center.y - cascade.center.y) <= cascade.radius + extent.y
+		&& center.z + extent.z >= cascade.center.z - cascade.radius;
+}
+
+void CascadedShadows::render(CommandList& commands, Shader* depthShader, Camera& camera, const std::vector<ShadowCaster>& casters)
+{
+	frameCasterDraws = frameCascadesRendered = 0;
+	if (!enabled)
+		return;
+	frames++;
+	casterCount = (unsigned int)casters.size();
+
+	// cascade ends between the even and the logarithmic split
+	float nearPlane = camera.getNearPlane();
+	float farPlane = camera.isInfiniteFar() ? settings.distance : std::min(settings.distance, camera.getFarPlane());
+	for (int i = 0; i < settings.cascadeCount; i++)
+	{
+		float t = (float)(i + 1) / settings.cascadeCount;
+		float logarithmic = nearPlane * std::pow(farPlane / nearPlane, t);
+		float even = nearPlane + (farPlane - nearPlane) * t;
+		cascadeEnds[i] = settings.splitLambda * logarithmic + (1.0f - settings.splitLambda) * even;
+	}
+
+	float tanY = std::tan(glm::radians(camera.getFOV()) * 0.5f);
+	float tanX = tanY * camera.getAspect();
+	const glm::mat4& inverseView = camera.getInverseViewMatrix();
+	// the atlas is drawn in the [0, 1] depth of the projections, the clip control may want [-1, 1]
+	glm::mat4 clipDepth(1.0f);
+	if (!zeroToOne)
+	{
+		clipDepth[2][2] = 2.0f;
+		clipDepth[3][2] = -1.0f;
+	}
+
+	int tileSize = settings.tileSize;
+	commands.call([this]()
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glEnable(GL_SCISSOR_TEST);
+		glEnable(GL_DEPTH_CLAMP);
+		glEnable(GL_POLYGON_OFFSET_FILL);
+		glPolygonOffset(1.5f, 2.0f); // slope scaled, against the acne of surfaces facing the light at an angle
+		glDepthFunc(GL_LESS);
+		glClearDepth(1.0f);
+	});
+	commands.useShader(depthShader);
+	commands.setMat4(depthShader, "view", lightRotation);
+
+	for (int i = 0; i < settings.cascadeCount; i++)
+	{
+		Cascade& cascade = cascades[i];
+		float start = i ? cascadeEnds[i - 1] : nearPlane;
+		float centerDistance, radius;
+		sliceSphere(start, cascadeEnds[i], tanX, tanY, centerDistance, radius);
+		glm::vec3 worldCenter = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -centerDistance, 1.0f));
+
+		bool cached = isCached(i);
+		if (cached)
+		{
+			// kept while the slice stays inside what was drawn
+			glm::vec3 lightCenter = glm::vec3(lightRotation * glm::vec4(worldCenter, 1.0f));
+			if (cascade.valid && contains(cascade, lightCenter, radius))
+				continue;
+			fit(cascade, worldCenter, radius * settings.cachedMargin);
+			cascade.valid = true;
+			cachedRenders++;
+		}
+		else
+		{
+			fit(cascade, worldCenter, radius);
+			cascade.valid = false;
+		}
+
+		frameCascadesRendered++;
+		int x = (i & 1) * tileSize, y = (i >> 1) * tileSize;
+		commands.call([x, y, tileSize]()
+		{
+			glViewport(x, y, tileSize, tileSize);
+			glScissor(x, y, tileSize, tileSize);
+			glClear(GL_DEPTH_BUFFER_BIT);
+		});
+		commands.setMat4(depthShader, "projection", clipDepth * cascade.projection);
+		for (const ShadowCaster& caster : casters)
+		{
+			if ((cached && !caster.isStatic) || !touches(cascade, caster))
+				continue;
+			commands.setMat4(depthShader, "model", caster.model);
+			commands.drawDepth(caster.mesh, caster.lod);
+			frameCasterDraws++;
+		}
+	}
+	casterDraws += frameCasterDraws;
+	cascadesRendered += frameCascadesRendered;
+
+	GLenum compareFunc = this->compareFunc;
+	float clearDepth = this->clearDepth;
+	commands.call([compareFunc, clearDepth]()
+	{
+		glDisable(GL_POLYGON_OFFSET_FILL);
+		glDisable(GL_DEPTH_CLAMP);
+		glDisable(GL_SCISSOR_TEST);
+		glDepthFunc(compareFunc);
+		glClearDepth(clearDepth);
+	});
+}
+
+void CascadedShadows::apply(CommandList& commands, Shader* shader, Camera& camera)
+{
+	// what the shaders read, staged with the frame
+	struct Uniforms
+	{
+		glm::mat4 matrices[maxCascades]; // view space to the atlas and the depth in the cascade
+		glm::vec4 ends;
+		glm::vec4 normalOffsets;         // world size of 1.5 texels of each cascade
+		glm::vec3 direction;             // view space, toward the light
+		glm::vec3 color;
+		float texelSize;
+		int count;
+	};
+	Uniforms* uniforms = commands.stage<Uniforms>(1);
+	uniforms->count = enabled ? settings.cascadeCount : 0;
+	if (enabled)
+	{
+		const glm::mat4& inverseView = camera.getInverseViewMatrix();
+		for (int i = 0; i < settings.cascadeCount; i++)
+		{
+			// [-1, 1] to the cascade's tile of the atlas
+			glm::mat4 tile(1.0f);
+			tile[0][0] = tile[1][1] = 0.25f;
+			tile[3][0] = 0.25f + 0.5f * (i & 1);
+			tile[3][1] = 0.25f + 0.5f * (i >> 1);
+			uniforms->matrices[i] = tile * cascades[i].projection * lightRotation * inverseView;
+			uniforms->ends[i] = cascadeEnds[i];
+			uniforms->normalOffsets[i] = 1.5f * 2.0f * cascades[i].radius / settings.tileSize;
+		}
+		uniforms->direction = glm::normalize(glm::mat3(camera.getViewMatrix()) * -direction);
+		uniforms->color = color;
+		uniforms->texelSize = 0.5f / settings.tileSize;
+	}
+
+	GLuint atlas = this->atlas;
+	commands.call([shader, uniforms, atlas]()
+	{
+		glActiveTexture(GL_TEXTURE0 + atlasUnit);
+		glBindTexture(GL_TEXTURE_2D, atlas);
+		glActiveTexture(GL_TEXTURE0);
+		glUniform1i(shader->getUniformLocation("shadowAtlas"), atlasUnit);
+		glUniform1i(shader->getUniformLocation("cascadeCount"), uniforms->count);
+		if (uniforms->count == 0)
+			return;
+		glUniformMatrix4fv(shader->getUniformLocation("shadowMatrices"), uniforms->count, GL_FALSE, glm::value_ptr(uniforms->matrices[0]));
+		glUniform4fv(shader->getUniformLocation("cascadeEnds"), 1, glm::value_ptr(uniforms->ends));
+		glUniform4fv(shader->getUniformLocation("shadowNormalOffsets"), 1, glm::value_ptr(uniforms->normalOffsets));
+		glUniform3fv(shader->getUniformLocation("sunDirection"), 1, glm::value_ptr(uniforms->direction));
+		glUniform3fv(shader->getUniformLocation("sunColor"), 1, glm::value_ptr(uniforms->color));
+		glUniform1f(shader->getUniformLocation("shadowTexelSize"), uniforms->texelSize);
+	});
+}
+
+void CascadedShadows::resetStatistics()
+{
+	frames = 0;
+	casterDraws = 0;
+	cascadesRendered = 0;
+	cachedRenders = 0;
+}
+
+void CascadedShadows::report() const
+{
+	std::cout << "CascadedShadows:: " << (enabled ? "" : "off, ") << settings.cascadeCount << " cascades of " << settings.tileSize << "x"
+		<< settings.tileSize << " up to " << settings.distance << ", ";
+	if (caching)
+		std::cout << "cached from cascade " << settings.firstCachedCascade << " (redrawn " << cachedRenders << " times), ";
+	else
+		std::cout << "no caching, ";
+	std::cout << casterCount << " casters, " << getCascadesPerFrame() << " cascades and " << getCasterDrawsPerFrame()
+		<< " caster draws a frame on average over " << frames << " frames (last frame " << frameCascadesRendered << " and " << frameCasterDraws << ")" << std::endl;
+}
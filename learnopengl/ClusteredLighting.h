@@ -0,0 +1,654 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "Camera.h"
+#include "Shader.h"
+#include "RenderThread.h"
+#include "WorkerPool.h"
+#include "MathKernels.h" // SIMD level, transformPoints and target macros
+
+struct PointLight
+{
+	glm::vec3 position; // world space
+	float radius;       // the light fades out to nothing there
+	glm::vec3 color;    // intensity included
+};
+
+struct ClusterSettings
+{
+	int tilesX = 16;          // screen tiles across
+	int tilesY = 9;           // and down
+	int slices = 24;          // depth slices, exponentially spaced from the near plane
+	float farPlane = 100.0f;  // end of the slicing, the last slice also takes everything behind it
+};
+
+//
+// Clustered forward lighting.
+// The view frustum is cut into froxels: tilesX x tilesY screen tiles by depth slices whose
+// thickness grows with the distance. Every frame the lights are assigned on the CPU to the
+// froxels their sphere touches, and the fragment shader finds its froxel from gl_FragCoord
+// and its view depth and only goes through that froxel's lights, so the cost of a fragment
+// follows the lights around it instead of the light count.
+//
+// assign() first bounds each light by a range of tiles and slices (threads over the lights),
+// then every slice builds its froxel lists on its own (threads over the slices): the lights of
+// each row of tiles are gathered in a structure of arrays and tested against each froxel's box
+// 4 (SSE) or 8 (AVX2, when the build targets it) at a time, following MathKernels' level.
+// The GL 3.3 context has no storage buffers: lights, froxels and light indices go to the
+// shader as texture buffers, staged in the frame's command list.
+//
+class ClusteredLighting
+{
+public:
+	ClusteredLighting(const ClusterSettings& settings = ClusterSettings());
+	// Deletes the GL buffers, needs the context
+	~ClusteredLighting();
+
+	ClusteredLighting(const ClusteredLighting&) = delete;
+	ClusteredLighting& operator=(const ClusteredLighting&) = delete;
+
+	static const int maxLights = 65535; // the light indices are 16 bit
+
+	// Returns the light's index, -1 when there are already maxLights
+	int addLight(const PointLight& light);
+	PointLight& getLight(int index) { return lights[index]; }
+	const std::vector<PointLight>& getLights() const { return lights; }
+	int getLightCount() const { return (int)lights.size(); }
+	void clearLights() { lights.clear(); }
+
+	// Assign the lights to the froxels of a view, fovY in degrees. pool NULL runs on this thread.
+	void assign(const glm::mat4& view, float fovY, float aspect, float nearPlane, WorkerPool* pool);
+	// assign() for the camera, then stage the light, froxel and index buffers in the command list.
+	// width and height are the viewport's, before the draws using the lights.
+	void update(CommandList& commands, Camera& camera, int width, int height, WorkerPool* pool);
+	// Bind the buffers to units firstUnit to firstUnit + 2 and set the shader's uniforms for the
+	// next draws. allLights: every visible light lights every fragment, the unclustered reference.
+	void apply(CommandList& commands, Shader* shader, unsigned int firstUnit, bool allLights = false);
+
+	// statistics of the last assign()
+	int getVisibleLightCount() const { return visibleCount; }
+	size_t getIndexCount() const { return indexCount; }
+	double getAssignMs() const { return assignMs; }
+	void report() const;
+
+	// Time assign() per SIMD level on one thread and on every core, 1 to 10000 lights, and check
+	// the froxel lists against the scalar version
+	static void benchmark();
+
+private:
+	// the lights of a row of froxels, what the SIMD tests read
+	struct LightRow
+	{
+		std::vector<float> x;
+		std::vector<float> y;
+		std::vector<float> depth;  // -z in view space
+		std::vector<float> radius;
+		std::vector<int32_t> tileBegin; // columns the light may touch, both included
+		std::vector<int32_t> tileEnd;
+		std::vector<int32_t> index;  // visible light
+	};
+	// box: min x, max x, min y, max y, min depth, max depth of the froxel. Writes the lights of
+	// the row that touch it to out, returns how many. The row is followed by 8 lights that touch
+	// no tile, so the SIMD versions go past count instead of finishing one light at a time.
+	typedef size_t (*FroxelKernel)(const LightRow& row, size_t count, const float* box, int tile, uint16_t* out);
+	static size_t froxelScalar(const LightRow& row, size_t count, const float* box, int tile, uint16_t* out);
+#ifdef MATH_KERNELS_X86
+	static size_t froxelSSE(const LightRow& row, size_t count, const float* box, int tile, uint16_t* out);
+	MATH_TARGET_AVX2 static size_t froxelAVX2(const LightRow& row, size_t count, const float* box, int tile, uint16_t* out);
+#endif
+	static FroxelKernel froxelKernel();
+
+	// tiles and slices a light's sphere may touch, firstSlice -1 when it is out of the view
+	struct LightBounds
+	{
+		int32_t firstTileX, lastTileX;
+		int32_t firstTileY, lastTileY;
+		int32_t firstSlice, lastSlice;
+	};
+	void boundLight(int light, LightBounds& bounds) const;
+	int sliceOf(float depth) const;
+	float sliceStart(int slice) const;
+	void assignSlice(int slice, unsigned int threadIndex, FroxelKernel kernel);
+
+	ClusterSettings settings;
+	std::vector<PointLight> lights;
+	std::vector<glm::vec3> positions;     // world space, for transformPoints
+	std::vector<glm::vec3> viewPositions;
+	std::vector<LightBounds> bounds;
+
+	// visible lights, the shader's light indices
+	int visibleCount;
+	std::vector<int> visible;             // index in lights
+	std::vector<LightBounds> visibleBounds;
+
+	std::vector<std::vector<int>> sliceLights;        // visible lights touching each slice
+	std::vector<std::vector<uint16_t>> sliceIndices;  // each slice's froxel lists one after the other
+	std::vector<size_t> sliceIndexCounts;
+	std::vector<uint32_t> froxels;        // per froxel: first light index (in its slice, then overall), count
+	std::vector<LightRow> rows;           // per thread
+	size_t indexCount;
+
+	// the view of the last assign()
+	float tanX, tanY;
+	float nearPlane;
+	float lastSliceEnd;                   // the farthest light, at least settings.farPlane
+	float sliceScale, sliceBias;          // slice = log(depth) * sliceScale + sliceBias
+	float tileScaleX, tileScaleY;         // tiles per pixel of the viewport given to update()
+
+	// GL objects, made and used by the render thread
+	GLuint buffers[3];                    // lights, froxels, light indices
+	GLuint textures[3];
+
+	// statistics
+	double assignMs;
+	double totalAssignMs;
+	unsigned int assignCount;
+	unsigned int maxFroxelLights;
+};
+
+
+ClusteredLighting::ClusteredLighting(const ClusterSettings& settings)
+{
+	this->settings = settings;
+	this->settings.tilesX = std::max(1, settings.tilesX);
+	this->settings.tilesY = std::max(1, settings.tilesY);
+	this->settings.slices = std::max(1, settings.slices);
+	visibleCount = 0;
+	indexCount = 0;
+	tanX = tanY = 1.0f;
+	nearPlane = 0.1f;
+	lastSliceEnd = settings.farPlane;
+	sliceScale = 1.0f;
+	sliceBias = 0.0f;
+	tileScaleX = tileScaleY = 0.0f;
+	for (int i = 0; i < 3; i++)
+	{
+		buffers[i] = 0;
+		textures[i] = 0;
+	}
+	assignMs = 0.0;
+	totalAssignMs = 0.0;
+	assignCount = 0;
+	maxFroxelLights = 0;
+
+	sliceLights.resize(this->settings.slices);
+	sliceIndices.resize(this->settings.slices);
+	sliceIndexCounts.resize(this->settings.slices, 0);
+	froxels.resize((size_t)this->settings.tilesX * this->settings.tilesY * this->settings.slices * 2, 0);
+}
+
+ClusteredLighting::~ClusteredLighting()
+{
+	if (textures[0] != 0)
+	{
+		glDeleteTextures(3, textures);
+		glDeleteBuffers(3, buffers);
+	}
+}
+
+int ClusteredLighting::addLight(const PointLight& light)
+{
+	if ((int)lights.size() >= maxLights)
+		return -1;
+	lights.push_back(light);
+	return (int)lights.size() - 1;
+}
+
+int ClusteredLighting::sliceOf(float depth) const
+{
+	int slice = (int)floor(log(std::max(depth, nearPlane)) * sliceScale + sliceBias);
+	return std::min(std::max(slice, 0), settings.slices - 1);
+}
+
+float ClusteredLighting::sliceStart(int slice) const
+{
+	if (slice >= settings.slices)
+		return lastSliceEnd;
+	return slice == 0 ? nearPlane : (float)exp((slice - sliceBias) / sliceScale);
+}
+
+void ClusteredLighting::boundLight(int light, LightBounds& result) const
+{
+	result.firstSlice = -1;
+	glm::vec3 p = viewPositions[light];
+	float radius = lights[light].radius;
+	float depth = -p.z;
+	if (depth + radius < nearPlane || radius <= 0.0f)
+		return;
+
+	// the sphere is within [x - r, x + r] and between these depths: the smallest and largest
+	// projections of its sides bound it on screen
+	float nearest = std::max(nearPlane, depth - radius), farthest = depth + radius;
+	auto screenRange = [&](float center, float tangent, int tiles, int32_t& first, int32_t& last)
+	{
+		float low = center - radius, high = center + radius;
+		float lowNdc = low / ((low >= 0.0f ? farthest : nearest) * tangent);
+		float highNdc = high / ((high >= 0.0f ? nearest : farthest) * tangent);
+		if (highNdc < -1.0f || lowNdc > 1.0f)
+			return false;
+		first = (int32_t)std::max(0.0f, floor((lowNdc + 1.0f) * 0.5f * tiles));
+		last = (int32_t)std::min(tiles - 1.0f, floor((highNdc + 1.0f) * 0.5f * tiles));
+		return true;
+	};
+	if (!screenRange(p.x, tanX, settings.tilesX, result.firstTileX, result.lastTileX)
+		|| !screenRange(p.y, tanY, settings.tilesY, result.firstTileY, result.lastTileY))
+		return;
+	result.firstSlice = sliceOf(nearest);
+	result.lastSlice = sliceOf(farthest);
+}
+
+void ClusteredLighting::assign(const glm::mat4& view, float fovY, float aspect, float nearPlane, WorkerPool* pool)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	this->nearPlane = nearPlane;
+	tanY = tan(glm::radians(fovY) * 0.5f);
+	tanX = tanY * aspect;
+	sliceScale = settings.slices / log(std::max(settings.farPlane, nearPlane * 2.0f) / nearPlane);
+	sliceBias = -log(nearPlane) * sliceScale;
+
+	// view space, then the froxels each light may touch
+	size_t count = lights.size();
+	positions.resize(count);
+	viewPositions.resize(count);
+	bounds.resize(count);
+	for (size_t i = 0; i < count; i++)
+		positions[i] = lights[i].position;
+	MathKernels::transformPoints(view, positions.data(), viewPositions.data(), count);
+	auto boundLights = [this](size_t begin, size_t end, unsigned int)
+	{
+		for (size_t i = begin; i < end; i++)
+			boundLight((int)i, bounds[i]);
+	};
+	if (pool)
+		pool->run(count, 1024, boundLights);
+	else
+		boundLights(0, count, 0);
+
+	// the visible lights and the ones of every slice
+	visible.resize(count);
+	visibleBounds.resize(count);
+	visibleCount = 0;
+	lastSliceEnd = settings.farPlane;
+	for (std::vector<int>& list : sliceLights)
+		list.clear();
+	for (size_t i = 0; i < count; i++)
+	{
+		if (bounds[i].firstSlice < 0)
+			continue;
+		int index = visibleCount++;
+		visible[index] = (int)i;
+		visibleBounds[index] = bounds[i];
+		lastSliceEnd = std::max(lastSliceEnd, -viewPositions[i].z + lights[i].radius);
+		for (int slice = bounds[i].firstSlice; slice <= bounds[i].lastSlice; slice++)
+			sliceLights[slice].push_back(index);
+	}
+
+	// the froxel lists, a slice per batch
+	unsigned int threads = pool ? pool->getThreadCount() : 1;
+	if (rows.size() < threads)
+		rows.resize(threads);
+	for (LightRow& row : rows)
+	{
+		if (row.x.size() >= (size_t)visibleCount + 8)
+			continue;
+		size_t size = visibleCount + 8; // and the padding
+		row.x.resize(size);
+		row.y.resize(size);
+		row.depth.resize(size);
+		row.radius.resize(size);
+		row.tileBegin.resize(size);
+		row.tileEnd.resize(size);
+		row.index.resize(size);
+	}
+	FroxelKernel kernel = froxelKernel();
+	auto assignSlices = [&](size_t begin, size_t end, unsigned int threadIndex)
+	{
+		for (size_t slice = begin; slice < end; slice++)
+			assignSlice((int)slice, threadIndex, kernel);
+	};
+	if (pool)
+		pool->run(settings.slices, 1, assignSlices);
+	else
+		assignSlices(0, settings.slices, 0);
+
+	// the slices' lists one after the other
+	indexCount = 0;
+	maxFroxelLights = 0;
+	size_t froxelsPerSlice = (size_t)settings.tilesX * settings.tilesY;
+	for (int slice = 0; slice < settings.slices; slice++)
+	{
+		for (size_t froxel = slice * froxelsPerSlice; froxel < (slice + 1) * froxelsPerSlice; froxel++)
+		{
+			froxels[2 * froxel] += (uint32_t)indexCount;
+			maxFroxelLights = std::max(maxFroxelLights, froxels[2 * froxel + 1]);
+		}
+		indexCount += sliceIndexCounts[slice];
+	}
+
+	assignMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	totalAssignMs += assignMs;
+	assignCount++;
+}
+
+void ClusteredLighting::assignSlice(int slice, unsigned int threadIndex, FroxelKernel kernel)
+{
+	LightRow& row = rows[threadIndex];
+	const std::vector<int>& candidates = sliceLights[slice];
+	std::vector<uint16_t>& indices = sliceIndices[slice];
+	size_t used = 0;
+	float box[6];
+	box[4] = sliceStart(slice);
+	box[5] = sliceStart(slice + 1);
+
+	for (int tileY = 0; tileY < settings.tilesY; tileY++)
+	{
+		// the lights of this row of froxels
+		size_t count = 0;
+		for (int index : candidates)
+		{
+			const LightBounds& light = visibleBounds[index];
+			if (tileY < light.firstTileY || tileY > light.lastTileY)
+				continue;
+			glm::vec3 p = viewPositions[visible[index]];
+			row.x[count] = p.x;
+			row.y[count] = p.y;
+			row.depth[count] = -p.z;
+			row.radius[count] = lights[visible[index]].radius;
+			row.tileBegin[count] = light.firstTileX;
+			row.tileEnd[count] = light.lastTileX;
+			row.index[count] = index;
+			count++;
+		}
+		for (size_t i = count; i < count + 8; i++)
+		{
+			row.x[i] = row.y[i] = row.depth[i] = row.radius[i] = 0.0f;
+			row.tileBegin[i] = 1;
+			row.tileEnd[i] = 0;
+			row.index[i] = 0;
+		}
+		uint32_t* froxel = &froxels[2 * (((size_t)slice * settings.tilesY + tileY) * settings.tilesX)];
+		if (count == 0)
+		{
+			for (int tileX = 0; tileX < settings.tilesX; tileX++)
+			{
+				froxel[2 * tileX] = (uint32_t)used;
+				froxel[2 * tileX + 1] = 0;
+			}
+			continue;
+		}
+		// the SIMD kernels write up to 7 rejected lights past what they keep
+		if (indices.size() < used + count * settings.tilesX + 8)
+			indices.resize(std::max(indices.size() * 2, used + count * settings.tilesX + 8));
+
+		// a froxel is the piece of the tile's pyramid between the slice's depths, its box
+		// spans the tile's sides at both depths
+		float bottom = -1.0f + 2.0f * tileY / settings.tilesY, top = -1.0f + 2.0f * (tileY + 1) / settings.tilesY;
+		box[2] = std::min(bottom * box[4], bottom * box[5]) * tanY;
+		box[3] = std::max(top * box[4], top * box[5]) * tanY;
+		for (int tileX = 0; tileX < settings.tilesX; tileX++)
+		{
+			float left = -1.0f + 2.0f * tileX / settings.tilesX, right = -1.0f + 2.0f * (tileX + 1) / settings.tilesX;
+			box[0] = std::min(left * box[4], left * box[5]) * tanX;
+			box[1] = std::max(right * box[4], right * box[5]) * tanX;
+			size_t found = kernel(row, count, box, tileX, indices.data() + used);
+			froxel[2 * tileX] = (uint32_t)used;
+			froxel[2 * tileX + 1] = (uint32_t)found;
+			used += found;
+		}
+	}
+	sliceIndexCounts[slice] = used;
+}
+
+ClusteredLighting::FroxelKernel ClusteredLighting::froxelKernel()
+{
+#ifdef MATH_KERNELS_X86
+	// The kernel is called for every froxel with lights: in a build for SSE only, the switches
+	// between the 256 bit kernel and the code around it cost more than the wider test gains
+	// (10k lights: SSE 3.0 ms, AVX2 5.3 ms), built with -mavx2 it is the faster one (2.6 ms)
+#ifdef __AVX2__
+	if (MathKernels::getLevel() == MathKernels::MATH_AVX2)
+		return froxelAVX2;
+#endif
+	if (MathKernels::getLevel() != MathKernels::MATH_SCALAR)
+		return froxelSSE;
+#endif
+	return froxelScalar;
+}
+
+size_t ClusteredLighting::froxelScalar(const LightRow& row, size_t count, const float* box, int tile, uint16_t* out)
+{
+	size_t found = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		// squared distance from the sphere's center to the box
+		float dx = std::max(std::max(box[0] - row.x[i], row.x[i] - box[1]), 0.0f);
+		float dy = std::max(std::max(box[2] - row.y[i], row.y[i] - box[3]), 0.0f);
+		float dz = std::max(std::max(box[4] - row.depth[i], row.depth[i] - box[5]), 0.0f);
+		float distance = dx * dx + dy * dy + dz * dz;
+		if (tile >= row.tileBegin[i] && tile <= row.tileEnd[i] && distance <= row.radius[i] * row.radius[i])
+			out[found++] = (uint16_t)row.index[i];
+	}
+	return found;
+}
+
+#ifdef MATH_KERNELS_X86
+
+size_t ClusteredLighting::froxelSSE(const LightRow& row, size_t count, const float* box, int tile, uint16_t* out)
+{
+	const __m128 minX = _mm_set1_ps(box[0]), maxX = _mm_set1_ps(box[1]);
+	const __m128 minY = _mm_set1_ps(box[2]), maxY = _mm_set1_ps(box[3]);
+	const __m128 minZ = _mm_set1_ps(box[4]), maxZ = _mm_set1_ps(box[5]);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128i tiles = _mm_set1_epi32(tile);
+	size_t found = 0;
+	for (size_t i = 0; i < count; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(&row.x[i]), y = _mm_loadu_ps(&row.y[i]), z = _mm_loadu_ps(&row.depth[i]), r = _mm_loadu_ps(&row.radius[i]);
+		__m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minX, x), _mm_sub_ps(x, maxX)), zero);
+		__m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minY, y), _mm_sub_ps(y, maxY)), zero);
+		__m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(minZ, z), _mm_sub_ps(z, maxZ)), zero);
+		__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		__m128i outside = _mm_or_si128(_mm_cmpgt_epi32(_mm_loadu_si128((const __m128i*)&row.tileBegin[i]), tiles),
+			_mm_cmpgt_epi32(tiles, _mm_loadu_si128((const __m128i*)&row.tileEnd[i])));
+		int mask = _mm_movemask_ps(_mm_andnot_ps(_mm_castsi128_ps(outside), _mm_cmple_ps(distance, _mm_mul_ps(r, r))));
+		// written either way, only kept when the bit is set: out has room for every light of the row
+		if (mask == 0)
+			continue;
+		for (int bit = 0; bit < 4; bit++)
+		{
+			out[found] = (uint16_t)row.index[i + bit];
+			found += (mask >> bit) & 1;
+		}
+	}
+	return found;
+}
+
+MATH_TARGET_AVX2 size_t ClusteredLighting::froxelAVX2(const LightRow& row, size_t count, const float* box, int tile, uint16_t* out)
+{
+	const __m256 minX = _mm256_set1_ps(box[0]), maxX = _mm256_set1_ps(box[1]);
+	const __m256 minY = _mm256_set1_ps(box[2]), maxY = _mm256_set1_ps(box[3]);
+	const __m256 minZ = _mm256_set1_ps(box[4]), maxZ = _mm256_set1_ps(box[5]);
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256i tiles = _mm256_set1_epi32(tile);
+	size_t found = 0;
+	for (size_t i = 0; i < count; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(&row.x[i]), y = _mm256_loadu_ps(&row.y[i]), z = _mm256_loadu_ps(&row.depth[i]), r = _mm256_loadu_ps(&row.radius[i]);
+		__m256 dx = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(minX, x), _mm256_sub_ps(x, maxX)), zero);
+		__m256 dy = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(minY, y), _mm256_sub_ps(y, maxY)), zero);
+		__m256 dz = _mm256_max_ps(_mm256_max_ps(_mm256_sub_ps(minZ, z), _mm256_sub_ps(z, maxZ)), zero);
+		__m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+		__m256i outside = _mm256_or_si256(_mm256_cmpgt_epi32(_mm256_loadu_si256((const __m256i*)&row.tileBegin[i]), tiles),
+			_mm256_cmpgt_epi32(tiles, _mm256_loadu_si256((const __m256i*)&row.tileEnd[i])));
+		int mask = _mm256_movemask_ps(_mm256_andnot_ps(_mm256_castsi256_ps(outside), _mm256_cmp_ps(distance, _mm256_mul_ps(r, r), _CMP_LE_OQ)));
+		if (mask == 0)
+			continue;
+		for (int bit = 0; bit < 8; bit++)
+		{
+			out[found] = (uint16_t)row.index[i + bit];
+			found += (mask >> bit) & 1;
+		}
+	}
+	return found;
+}
+
+#endif
+
+void ClusteredLighting::update(CommandList& commands, Camera& camera, int width, int height, WorkerPool* pool)
+{
+	assign(camera.getViewMatrix(), camera.getFOV(), camera.getAspect(), camera.getNearPlane(), pool);
+
+	// the buffers' contents, in the command list's arena until the render thread ran it
+	size_t froxelCount = (size_t)settings.tilesX * settings.tilesY * settings.slices;
+	size_t lightFloats = (size_t)std::max(1, visibleCount) * 8;
+	float* lightData = commands.stage<float>(lightFloats);
+	for (int i = 0; i < visibleCount; i++)
+	{
+		const PointLight& light = lights[visible[i]];
+		glm::vec3 p = viewPositions[visible[i]];
+		float* texels = lightData + 8 * i;
+		texels[0] = p.x;
+		texels[1] = p.y;
+		texels[2] = p.z;
+		texels[3] = light.radius;
+		texels[4] = light.color.x;
+		texels[5] = light.color.y;
+		texels[6] = light.color.z;
+		texels[7] = 0.0f;
+	}
+	uint32_t* froxelData = commands.stage<uint32_t>(froxelCount * 2);
+	memcpy(froxelData, froxels.data(), froxelCount * 2 * sizeof(uint32_t));
+	size_t indexSlots = std::max<size_t>(1, indexCount);
+	uint16_t* indexData = commands.stage<uint16_t>(indexSlots);
+	size_t offset = 0;
+	for (int slice = 0; slice < settings.slices; slice++)
+	{
+		memcpy(indexData + offset, sliceIndices[slice].data(), sliceIndexCounts[slice] * sizeof(uint16_t));
+		offset += sliceIndexCounts[slice];
+	}
+
+	GLuint* buffers = this->buffers;
+	GLuint* textures = this->textures;
+	commands.call([buffers, textures, lightData, lightFloats, froxelData, froxelCount, indexData, indexSlots]()
+	{
+		if (textures[0] == 0)
+		{
+			const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+			glGenBuffers(3, buffers);
+			glGenTextures(3, textures);
+			for (int i = 0; i < 3; i++)
+			{
+				glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+				glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+				glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+				glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+			}
+		}
+		// new storage every frame: the driver does not wait for the draws of the last one
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers[0]);
+		glBufferData(GL_TEXTURE_BUFFER, lightFloats * sizeof(float), lightData, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers[1]);
+		glBufferData(GL_TEXTURE_BUFFER, froxelCount * 2 * sizeof(uint32_t), froxelData, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers[2]);
+		glBufferData(GL_TEXTURE_BUFFER, indexSlots * sizeof(uint16_t), indexData, GL_STREAM_DRAW);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	});
+
+	tileScaleX = (float)settings.tilesX / std::max(1, width);
+	tileScaleY = (float)settings.tilesY / std::max(1, height);
+}
+
+void ClusteredLighting::apply(CommandList& commands, Shader* shader, unsigned int firstUnit, bool allLights)
+{
+	const GLuint* textures = this->textures;
+	glm::vec2 tileScale(tileScaleX, tileScaleY), sliceParameters(sliceScale, sliceBias);
+	glm::ivec3 counts(settings.tilesX, settings.tilesY, settings.slices);
+	int allLightCount = allLights ? visibleCount : 0;
+	commands.call([shader, textures, firstUnit, tileScale, sliceParameters, counts, allLightCount]()
+	{
+		for (unsigned int i = 0; i < 3; i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + firstUnit + i);
+			glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+		}
+		glUniform1i(shader->getUniformLocation("lights"), firstUnit);
+		glUniform1i(shader->getUniformLocation("froxels"), firstUnit + 1);
+		glUniform1i(shader->getUniformLocation("lightIndices"), firstUnit + 2);
+		glUniform2f(shader->getUniformLocation("froxelTileScale"), tileScale.x, tileScale.y);
+		glUniform2f(shader->getUniformLocation("froxelSliceScale"), sliceParameters.x, sliceParameters.y);
+		glUniform3i(shader->getUniformLocation("froxelCounts"), counts.x, counts.y, counts.z);
+		glUniform1i(shader->getUniformLocation("allLightCount"), allLightCount);
+	});
+}
+
+void ClusteredLighting::report() const
+{
+	size_t froxelCount = (size_t)settings.tilesX * settings.tilesY * settings.slices;
+	std::cout << "ClusteredLighting:: " << lights.size() << " lights, " << visibleCount << " in view, " << settings.tilesX << "x"
+		<< settings.tilesY << "x" << settings.slices << " froxels, " << (double)indexCount / froxelCount << " lights per froxel ("
+		<< maxFroxelLights << " at most), assignment " << (assignCount ? totalAssignMs / assignCount : 0.0) << " ms on average" << std::endl;
+}
+
+void ClusteredLighting::benchmark()
+{
+	const int lightCounts[] = { 1, 100, 1000, 10000 };
+	const int runs = 5;
+	WorkerPool pool;
+	MathKernels::Level supported = MathKernels::supportedLevel(), previous = MathKernels::getLevel();
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 3.0f, 10.0f), glm::vec3(0.0f, 0.0f, -10.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	std::cout << "ClusteredLighting::benchmark:: light assignment, 16x9x24 froxels, 45 degrees 16:9 view, best of " << runs
+		<< " runs, " << pool.getThreadCount() << " threads" << std::endl;
+
+	for (int lightCount : lightCounts)
+	{
+		// lights scattered in front of the camera, most of them in view
+		ClusteredLighting lighting;
+		std::mt19937 random(lightCount);
+		std::uniform_real_distribution<float> across(-40.0f, 40.0f), height(-2.0f, 6.0f), depth(-80.0f, 5.0f), radius(1.0f, 4.0f);
+		for (int i = 0; i < lightCount; i++)
+			lighting.addLight({ glm::vec3(across(random), height(random), depth(random)), radius(random), glm::vec3(1.0f) });
+
+		std::vector<uint32_t> referenceFroxels;
+		std::vector<uint16_t> referenceIndices;
+		double scalarMs = 0.0;
+		for (int level = MathKernels::MATH_SCALAR; level <= supported; level++)
+		{
+			MathKernels::setLevel((MathKernels::Level)level);
+			double best[2] = { 1e9, 1e9 };
+			for (int threaded = 0; threaded < 2; threaded++)
+				for (int run = 0; run < runs; run++)
+				{
+					lighting.assign(view, 45.0f, 16.0f / 9.0f, 0.1f, threaded ? &pool : NULL);
+					best[threaded] = std::min(best[threaded], lighting.assignMs);
+				}
+
+			// the lists in order, they must not depend on the SIMD level
+			std::vector<uint16_t> indices;
+			for (int slice = 0; slice < lighting.settings.slices; slice++)
+				indices.insert(indices.end(), lighting.sliceIndices[slice].begin(), lighting.sliceIndices[slice].begin() + lighting.sliceIndexCounts[slice]);
+			if (level == MathKernels::MATH_SCALAR)
+			{
+				referenceFroxels = lighting.froxels;
+				referenceIndices = indices;
+				scalarMs = best[0];
+			}
+			bool same = lighting.froxels == referenceFroxels && indices == referenceIndices;
+			std::cout << "  " << lightCount << " lights (" << lighting.visibleCount << " in view, " << lighting.indexCount << " froxel entries) "
+				<< MathKernels::levelName((MathKernels::Level)level) << " \t 1 thread " << best[0] << " ms (x" << scalarMs / best[0] << ") \t "
+				<< pool.getThreadCount() << " threads " << best[1] << " ms (x" << scalarMs / best[1] << ")" << (same ? "" : " \t DIFFERENT LISTS") << std::endl;
+		}
+	}
+	MathKernels::setLevel(previous);
+}
@@ -0,0 +1,288 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include "IOFile.h"
+#include "Mesh.h"
+
+//
+// Binary cooked mesh, ready to be memory mapped and sent to glBufferData without any parsing.
+//
+// Layout (little endian, blobs aligned on 16 bytes):
+//   CookedMeshHeader
+//   CookedMeshAttribute[attributeCount]
+//   CookedMeshLod[lodCount]
+//   vertex blob
+//   index blob (the LODs are ranges of it)
+//
+
+struct CookedMeshHeader
+{
+	uint32_t magic;          // COOKED_MESH_MAGIC
+	uint32_t version;        // COOKED_MESH_VERSION, older files have to be cooked again
+	uint32_t checksum;       // CRC32 of everything after the header
+	uint32_t attributeCount;
+	uint32_t lodCount;
+	uint32_t indexType;      // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	uint32_t vertexCount;
+	uint32_t reserved;
+	uint64_t vertexOffset;   // from the start of the file
+	uint64_t vertexBytes;
+	uint64_t indexOffset;
+	uint64_t indexBytes;
+	float boundsMin[3];
+	float boundsMax[3];
+};
+
+struct CookedMeshAttribute
+{
+	uint32_t location;
+	uint32_t components;
+	uint32_t type;
+	uint32_t normalized;
+	uint32_t stride;
+	uint32_t offset;
+};
+
+struct CookedMeshLod
+{
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error;             // geometric error of the LOD in object space, 0 for the full mesh
+	uint32_t reserved;
+};
+
+const uint32_t COOKED_MESH_MAGIC = 0x484D4C4Cu; // "LLMH"
+const uint32_t COOKED_MESH_VERSION = 2; // 2: the LOD chain, version 1 files hold the full mesh only
+
+class CookedMesh
+{
+public:
+	// Write an interleaved position/normal/uv mesh (MeshData) as a cooked file, used by the --cook tool
+	static bool write(const char* path, const MeshData& meshData);
+
+	// Map a cooked file and upload it into the Mesh straight from the mapping
+	static bool load(const char* path, Mesh& mesh);
+
+	static uint32_t crc32(const void* data, size_t size, uint32_t crc = 0);
+
+private:
+	static uint64_t alignOffset(uint64_t offset) { return (offset + 15) & ~(uint64_t)15; }
+};
+
+
+uint32_t CookedMesh::crc32(const void* data, size_t size, uint32_t crc)
+{
+	// built once on first use, a function-local static so threads loading assets can race to it
+	struct Table
+	{
+		uint32_t entries[256];
+		Table()
+		{
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				uint32_t value = i;
+				for (int k = 0; k < 8; k++)
+					value = (value & 1) ? (0xEDB88320u ^ (value >> 1)) : (value >> 1);
+				entries[i] = value;
+			}
+		}
+	};
+	static const Table table;
+
+	const unsigned char* bytes = (const unsigned char*)data;
+	crc = ~crc;
+	for (size_t i = 0; i < size; i++)
+		crc = table.entries[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+bool CookedMesh::write(const char* path, const MeshData& meshData)
+{
+	const CookedMeshAttribute attributes[] = {
+		{ ATTRIB_POSITION, 3, GL_FLOAT, 0, 8 * sizeof(float), 0 },
+		{ ATTRIB_NORMAL,   3, GL_FLOAT, 0, 8 * sizeof(float), 3 * sizeof(float) },
+		{ ATTRIB_UV,       2, GL_FLOAT, 0, 8 * sizeof(float), 6 * sizeof(float) },
+	};
+	const uint32_t attributeCount = sizeof(attributes) / sizeof(attributes[0]);
+
+	std::vector<CookedMeshLod> lods;
+	for (const MeshLod& lod : meshData.lods)
+		lods.push_back({ lod.firstIndex, lod.indexCount, lod.error, 0 });
+	if (lods.empty())
+		lods.push_back({ 0, (uint32_t)meshData.indices.size(), 0.0f, 0 });
+	size_t lodBytes = lods.size() * sizeof(CookedMeshLod);
+
+	// 16 bit indices halve the index blob whenever the mesh is small enough
+	uint32_t vertexCount = meshData.vertexCount();
+	bool shortIndices = vertexCount <= 0xFFFF;
+	std::vector<uint16_t> shortIndexData;
+	if (shortIndices)
+		shortIndexData.assign(meshData.indices.begin(), meshData.indices.end());
+
+	CookedMeshHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = COOKED_MESH_MAGIC;
+	header.version = COOKED_MESH_VERSION;
+	header.attributeCount = attributeCount;
+	header.lodCount = (uint32_t)lods.size();
+	header.indexType = shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	header.vertexCount = vertexCount;
+	header.vertexBytes = meshData.vertices.size() * sizeof(float);
+	header.indexBytes = meshData.indices.size() * (shortIndices ? sizeof(uint16_t) : sizeof(uint32_t));
+	header.vertexOffset = alignOffset(sizeof(header) + sizeof(attributes) + lodBytes);
+	header.indexOffset = alignOffset(header.vertexOffset + header.vertexBytes);
+
+	glm::vec3 boundsMin, boundsMax;
+	meshData.computeBounds(boundsMin, boundsMax);
+	memcpy(header.boundsMin, &boundsMin[0], sizeof(header.boundsMin));
+	memcpy(header.boundsMax, &boundsMax[0], sizeof(header.boundsMax));
+
+	// assemble everything after the header in memory so the checksum covers the padding too
+	std::vector<char> body((size_t)(header.indexOffset + header.indexBytes - sizeof(header)), 0);
+	auto at = [&](uint64_t fileOffset) { return body.data() + (size_t)(fileOffset - sizeof(header)); };
+	memcpy(at(sizeof(header)), attributes, sizeof(attributes));
+	memcpy(at(sizeof(header) + sizeof(attributes)), lods.data(), lodBytes);
+	if (header.vertexBytes)
+		memcpy(at(header.vertexOffset), meshData.vertices.data(), (size_t)header.vertexBytes);
+	if (header.indexBytes)
+		memcpy(at(header.indexOffset), shortIndices ? (const void*)shortIndexData.data() : (const void*)meshData.indices.data(), (size_t)header.indexBytes);
+	header.checksum = crc32(body.data(), body.size());
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cout << "ERROR::CookedMesh::write::" << path << " \t cannot open file" << std::endl;
+		return false;
+	}
+	file.write((const char*)&header, sizeof(header));
+	file.write(body.data(), body.size());
+	if (!file)
+	{
+		std::cout << "ERROR::CookedMesh::write::" << path << " \t write failed" << std::endl;
+		return false;
+	}
+
+	std::cout << "CookedMesh::write::" << path << " \t" << vertexCount << " vertices, " << lods[0].indexCount / 3
+		<< " triangles, " << lods.size() << " LODs, " << (sizeof(header) + body.size()) / 1024 << " KB" << std::endl;
+	return true;
+}
+
+bool CookedMesh::load(const char* path, Mesh& mesh)
+{
+	MappedFile file;
+	if (!file.open(path))
+		return false;
+
+	CookedMeshHeader header;
+	if (file.size() < sizeof(header))
+	{
+		std::cout << "ERROR::CookedMesh::load::" << path << " \t file too small" << std::endl;
+		return false;
+	}
+	memcpy(&header, file.data(), sizeof(header));
+
+	if (header.magic != COOKED_MESH_MAGIC)
+	{
+		std::cout << "ERROR::CookedMesh::load::" << path << " \t not a cooked mesh" << std::endl;
+		return false;
+	}
+	if (header.version != COOKED_MESH_VERSION)
+	{
+		std::cout << "ERROR::CookedMesh::load::" << path << " \t version " << header.version << ", expected "
+			<< COOKED_MESH_VERSION << ", cook the mesh again" << std::endl;
+		return false;
+	}
+
+	// the sizes are checked before the offsets are added to them, a crafted 64-bit value cannot wrap around
+	uint64_t tablesEnd = sizeof(header) + (uint64_t)header.attributeCount * sizeof(CookedMeshAttribute) + (uint64_t)header.lodCount * sizeof(CookedMeshLod);
+	if (header.attributeCount == 0 || header.attributeCount > 16 || header.lodCount == 0 || tablesEnd > file.size()
+		|| header.vertexBytes > file.size() || header.vertexOffset > file.size() - header.vertexBytes
+		|| header.indexBytes > file.size() || header.indexOffset > file.size() - header.indexBytes
+		|| (header.indexType != GL_UNSIGNED_SHORT && header.indexType != GL_UNSIGNED_INT))
+	{
+		std::cout << "ERROR::CookedMesh::load::" << path << " \t corrupted header" << std::endl;
+		return false;
+	}
+	if (crc32(file.data() + sizeof(header), file.size() - sizeof(header)) != header.checksum)
+	{
+		std::cout << "ERROR::CookedMesh::load::" << path << " \t checksum mismatch" << std::endl;
+		return false;
+	}
+
+	VertexAttribute attributes[16];
+	const char* tables = file.data() + sizeof(header);
+	for (uint32_t i = 0; i < header.attributeCount; i++)
+	{
+		CookedMeshAttribute cooked;
+		memcpy(&cooked, tables + i * sizeof(cooked), sizeof(cooked));
+		attributes[i] = { cooked.location, (int)cooked.components, (GLenum)cooked.type, cooked.normalized != 0, cooked.stride, cooked.offset };
+
+		// every vertex has to be inside the vertex blob
+		unsigned int componentSize = (cooked.type == GL_BYTE || cooked.type == GL_UNSIGNED_BYTE) ? 1 : (cooked.type == GL_SHORT || cooked.type == GL_UNSIGNED_SHORT) ? 2 : 4;
+		uint64_t elementSize = (uint64_t)componentSize * cooked.components;
+		uint64_t stride = cooked.stride ? cooked.stride : elementSize;
+		if (cooked.components == 0 || cooked.components > 4 || cooked.location >= 16
+			|| (header.vertexCount > 0 && cooked.offset + stride * (header.vertexCount - 1) + elementSize > header.vertexBytes))
+		{
+			std::cout << "ERROR::CookedMesh::load::" << path << " \t attribute " << i << " outside of the vertex blob" << std::endl;
+			return false;
+		}
+	}
+	unsigned int indexSize = (header.indexType == GL_UNSIGNED_SHORT) ? 2 : 4;
+
+	// an index past the vertices would reach the GL as an out of range draw. The checksum does not help against
+	// a crafted file and neither would a maximum stored next to it, so the indices are scanned, they were just read anyway.
+	const char* indexData = file.data() + header.indexOffset;
+	size_t indexCount = (size_t)(header.indexBytes / indexSize);
+	uint32_t maxIndex = 0;
+	if (indexSize == 2)
+	{
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			uint16_t index;
+			memcpy(&index, indexData + i * 2, 2);
+			maxIndex = std::max(maxIndex, (uint32_t)index);
+		}
+	}
+	else
+	{
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			uint32_t index;
+			memcpy(&index, indexData + i * 4, 4);
+			maxIndex = std::max(maxIndex, index);
+		}
+	}
+	if (indexCount > 0 && maxIndex >= header.vertexCount)
+	{
+		std::cout << "ERROR::CookedMesh::load::" << path << " \t index " << maxIndex << " past the " << header.vertexCount << " vertices" << std::endl;
+		return false;
+	}
+	std::vector<MeshLod> lods(header.lodCount);
+	for (uint32_t i = 0; i < header.lodCount; i++)
+	{
+		CookedMeshLod lod;
+		memcpy(&lod, tables + header.attributeCount * sizeof(CookedMeshAttribute) + i * sizeof(lod), sizeof(lod));
+		if (((uint64_t)lod.firstIndex + lod.indexCount) * indexSize > header.indexBytes)
+		{
+			std::cout << "ERROR::CookedMesh::load::" << path << " \t LOD outside of the index blob" << std::endl;
+			return false;
+		}
+		lods[i] = { lod.firstIndex, lod.indexCount, lod.error };
+	}
+
+	// the GL copies straight out of the mapped pages, nothing is staged on the heap
+	mesh.CreateFromAttributes(file.data() + header.vertexOffset, (size_t)header.vertexBytes, attributes, header.attributeCount,
+		indexData, (unsigned int)indexCount, header.indexType);
+	mesh.setLods(lods);
+	mesh.setBounds(glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]),
+		glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]));
+	return true;
+}
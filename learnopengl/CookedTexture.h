@@ -0,0 +1,300 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include "IOFile.h"
+#include "ImageLoader.h"
+#include "CookedMesh.h" // crc32
+#include "MipBuilder.h"
+#include "BlockCompression.h"
+
+//
+// Cooked texture, written by --cook-texture (little endian):
+//   CookedTextureHeader
+//   CookedTextureLevel[levelCount], full size first
+//   the blocks of every level, each starting on 16 bytes, smallest level first: a streamed
+//   texture reads the coarse mips from the start of the file and refines from there
+//
+struct CookedTextureHeader
+{
+	uint32_t magic;          // COOKED_TEXTURE_MAGIC
+	uint32_t version;        // COOKED_TEXTURE_VERSION
+	uint32_t checksum;       // CRC32 of everything after the header
+	uint32_t format;         // BlockFormat
+	uint32_t flags;          // COOKED_TEXTURE_SRGB
+	uint32_t width;
+	uint32_t height;
+	uint32_t levelCount;
+};
+
+struct CookedTextureLevel
+{
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset;         // from the start of the file
+	uint64_t size;
+};
+
+const uint32_t COOKED_TEXTURE_MAGIC = 0x58544C4Cu; // "LLTX"
+const uint32_t COOKED_TEXTURE_VERSION = 2; // 2: levels stored coarse to fine
+const uint32_t COOKED_TEXTURE_SRGB = 1;            // color: the mips were filtered in linear space
+
+//
+// Block compressed texture with its mips, cooked offline so loading is a memory mapping and a
+// glCompressedTexImage2D per level. Drivers without the format get the levels decoded on the CPU.
+//
+class CookedTexture
+{
+public:
+	CookedTexture();
+
+	// Load an image, build its mips, compress them and write the cooked file, used by the
+	// --cook-texture tool. BC5 images are data (normal maps) and are not filtered as sRGB.
+	static bool cook(const char* imagePath, const char* path, BlockFormat format);
+	// Write mip levels already compressed in format, full size first
+	static bool write(const char* path, BlockFormat format, bool srgb, const std::vector<MipLevel>& levels);
+	// Whether the path names a cooked texture (.tex)
+	static bool isCooked(const char* path);
+
+	// Map a cooked file and check it
+	bool load(const char* path);
+	// Send every level to the texture bound to GL_TEXTURE_2D, straight from the mapping when the
+	// driver has the format, decoded to 8 bits per channel otherwise.
+	// srgb: sample through the sRGB version of the format
+	void upload(bool srgb) const;
+	// Send a single level to the texture bound to GL_TEXTURE_2D (TextureStreamer)
+	void uploadLevel(int level, bool srgb) const;
+	// Whether the driver takes the blocks as they are, else they are decoded on upload
+	bool isNative(bool srgb) const { return BlockCompressor::supported(getFormat(), srgb && getFormat() != BLOCK_BC5); }
+	// Bytes a level takes once uploaded, compressed or decoded
+	size_t getLevelMemory(int level, bool srgb) const;
+
+	BlockFormat getFormat() const { return (BlockFormat)header.format; }
+	int getWidth() const { return (int)header.width; }
+	int getHeight() const { return (int)header.height; }
+	int getLevelCount() const { return (int)header.levelCount; }
+	int getLevelWidth(int level) const { return (int)levels[level].width; }
+	int getLevelHeight(int level) const { return (int)levels[level].height; }
+
+	// Compress an image in every format, on one thread and on every core, and print the
+	// megapixels per second, the PSNR and the size against RGBA8
+	static void benchmark(const char* imagePath);
+
+private:
+	static uint64_t alignOffset(uint64_t offset) { return (offset + 15) & ~(uint64_t)15; }
+
+	MappedFile file;
+	CookedTextureHeader header;
+	std::vector<CookedTextureLevel> levels;
+};
+
+
+CookedTexture::CookedTexture()
+{
+	memset(&header, 0, sizeof(header));
+}
+
+bool CookedTexture::isCooked(const char* path)
+{
+	size_t length = strlen(path);
+	return length > 4 && strcmp(path + length - 4, ".tex") == 0;
+}
+
+bool CookedTexture::cook(const char* imagePath, const char* path, BlockFormat format)
+{
+	std::vector<MipLevel> levels(1);
+	if (!ImageLoader::load(imagePath, 4, levels[0]))
+	{
+		std::cout << "ERROR::CookedTexture::cook:: Failed to load texture " << imagePath << std::endl;
+		return false;
+	}
+	int width = levels[0].width, height = levels[0].height;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	MipSettings settings;
+	settings.srgb = format != BLOCK_BC5;
+	MipBuilder::build(levels, 4, settings);
+
+	std::vector<MipLevel> compressed(levels.size());
+	for (size_t level = 0; level < levels.size(); level++)
+	{
+		compressed[level] = { levels[level].width, levels[level].height,
+			std::vector<unsigned char>(BlockCompressor::compressedSize(format, levels[level].width, levels[level].height)) };
+		BlockCompressor::encode(format, levels[level].pixels.data(), levels[level].width, levels[level].height, compressed[level].pixels.data());
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+	std::cout << "CookedTexture::cook::" << imagePath << " \t" << width << "x" << height << " " << BlockCompressor::formatName(format)
+		<< ", PSNR " << BlockCompressor::psnr(format, levels[0].pixels.data(), width, height, compressed[0].pixels.data())
+		<< " dB, mips and compression in " << seconds * 1000.0 << " ms" << std::endl;
+	return write(path, format, settings.srgb, compressed);
+}
+
+bool CookedTexture::write(const char* path, BlockFormat format, bool srgb, const std::vector<MipLevel>& levels)
+{
+	CookedTextureHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = COOKED_TEXTURE_MAGIC;
+	header.version = COOKED_TEXTURE_VERSION;
+	header.format = format;
+	header.flags = srgb ? COOKED_TEXTURE_SRGB : 0;
+	header.width = levels[0].width;
+	header.height = levels[0].height;
+	header.levelCount = (uint32_t)levels.size();
+
+	std::vector<CookedTextureLevel> table(levels.size());
+	uint64_t offset = alignOffset(sizeof(header) + table.size() * sizeof(CookedTextureLevel));
+	size_t uncompressed = 0;
+	for (size_t level = levels.size(); level-- > 0; ) // coarse to fine
+	{
+		table[level] = { (uint32_t)levels[level].width, (uint32_t)levels[level].height, offset, levels[level].pixels.size() };
+		offset = alignOffset(offset + levels[level].pixels.size());
+		uncompressed += (size_t)levels[level].width * levels[level].height * 4;
+	}
+
+	// everything after the header in memory, so the checksum covers the padding too
+	std::vector<char> body((size_t)(offset - sizeof(header)), 0);
+	memcpy(body.data(), table.data(), table.size() * sizeof(CookedTextureLevel));
+	for (size_t level = 0; level < levels.size(); level++)
+		memcpy(body.data() + (size_t)(table[level].offset - sizeof(header)), levels[level].pixels.data(), levels[level].pixels.size());
+	header.checksum = CookedMesh::crc32(body.data(), body.size());
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cout << "ERROR::CookedTexture::write::" << path << " \t cannot open file" << std::endl;
+		return false;
+	}
+	file.write((const char*)&header, sizeof(header));
+	file.write(body.data(), body.size());
+	if (!file)
+	{
+		std::cout << "ERROR::CookedTexture::write::" << path << " \t write failed" << std::endl;
+		return false;
+	}
+	std::cout << "CookedTexture::write::" << path << " \t" << BlockCompressor::formatName(format) << ", " << levels.size() << " levels, "
+		<< (sizeof(header) + body.size()) / 1024 << " KB instead of " << uncompressed / 1024 << " KB as RGBA8" << std::endl;
+	return true;
+}
+
+bool CookedTexture::load(const char* path)
+{
+	if (!file.open(path))
+		return false;
+	if (file.size() < sizeof(header))
+	{
+		std::cout << "ERROR::CookedTexture::load::" << path << " \t file too small" << std::endl;
+		return false;
+	}
+	memcpy(&header, file.data(), sizeof(header));
+
+	if (header.magic != COOKED_TEXTURE_MAGIC)
+	{
+		std::cout << "ERROR::CookedTexture::load::" << path << " \t not a cooked texture" << std::endl;
+		return false;
+	}
+	if (header.version != COOKED_TEXTURE_VERSION)
+	{
+		std::cout << "ERROR::CookedTexture::load::" << path << " \t version " << header.version << ", expected "
+			<< COOKED_TEXTURE_VERSION << ", cook the texture again" << std::endl;
+		return false;
+	}
+	if (header.format > BLOCK_BC7 || header.width == 0 || header.height == 0 || header.levelCount == 0 || header.levelCount > 16
+		|| sizeof(header) + (uint64_t)header.levelCount * sizeof(CookedTextureLevel) > file.size())
+	{
+		std::cout << "ERROR::CookedTexture::load::" << path << " \t corrupted header" << std::endl;
+		return false;
+	}
+	if (CookedMesh::crc32(file.data() + sizeof(header), file.size() - sizeof(header)) != header.checksum)
+	{
+		std::cout << "ERROR::CookedTexture::load::" << path << " \t checksum mismatch" << std::endl;
+		return false;
+	}
+
+	levels.resize(header.levelCount);
+	memcpy(levels.data(), file.data() + sizeof(header), levels.size() * sizeof(CookedTextureLevel));
+	for (const CookedTextureLevel& level : levels)
+		if (level.width == 0 || level.height == 0 || level.offset + level.size > file.size()
+			|| level.size != BlockCompressor::compressedSize(getFormat(), (int)level.width, (int)level.height))
+		{
+			std::cout << "ERROR::CookedTexture::load::" << path << " \t level outside of the file" << std::endl;
+			return false;
+		}
+	return true;
+}
+
+void CookedTexture::upload(bool srgb) const
+{
+	if (!isNative(srgb))
+		std::cout << "CookedTexture::upload:: " << BlockCompressor::formatName(getFormat()) << " is not supported by the driver, decoded on the CPU" << std::endl;
+	for (int level = 0; level < getLevelCount(); level++)
+		uploadLevel(level, srgb);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, getLevelCount() - 1);
+}
+
+void CookedTexture::uploadLevel(int level, bool srgb) const
+{
+	BlockFormat format = getFormat();
+	srgb = srgb && format != BLOCK_BC5;
+	const CookedTextureLevel& source = levels[level];
+	if (BlockCompressor::supported(format, srgb))
+	{
+		// the GL copies straight out of the mapped pages
+		glCompressedTexImage2D(GL_TEXTURE_2D, level, BlockCompressor::glFormat(format, srgb), source.width, source.height,
+			0, (GLsizei)source.size, file.data() + source.offset);
+	}
+	else
+	{
+		GLint internalFormat = format == BLOCK_BC5 ? GL_RG8 : format == BLOCK_BC1 ? (srgb ? GL_SRGB8 : GL_RGB8) : (srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8);
+		std::vector<unsigned char> pixels((size_t)source.width * source.height * 4);
+		BlockCompressor::decode(format, (const unsigned char*)file.data() + source.offset, source.width, source.height, pixels.data());
+		glTexImage2D(GL_TEXTURE_2D, level, internalFormat, source.width, source.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	}
+}
+
+size_t CookedTexture::getLevelMemory(int level, bool srgb) const
+{
+	if (isNative(srgb))
+		return (size_t)levels[level].size;
+	BlockFormat format = getFormat();
+	return (size_t)levels[level].width * levels[level].height * (format == BLOCK_BC5 ? 2 : format == BLOCK_BC1 ? 3 : 4);
+}
+
+void CookedTexture::benchmark(const char* imagePath)
+{
+	MipLevel image;
+	if (!ImageLoader::load(imagePath, 4, image))
+	{
+		std::cout << "ERROR::CookedTexture::benchmark:: Failed to load texture " << imagePath << std::endl;
+		return;
+	}
+	int width = image.width, height = image.height;
+	const std::vector<unsigned char>& pixels = image.pixels;
+	double megapixels = (double)width * height / 1e6;
+	unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+	std::cout << "CookedTexture::benchmark:: " << imagePath << " " << width << "x" << height << ", best of 3 runs, " << cores << " cores" << std::endl;
+
+	for (int format = BLOCK_BC1; format <= BLOCK_BC7; format++)
+	{
+		std::vector<unsigned char> blocks(BlockCompressor::compressedSize((BlockFormat)format, width, height));
+		double seconds[2] = { 1e30, 1e30 };
+		for (int threaded = 0; threaded < 2; threaded++)
+			for (int iteration = 0; iteration < 3; iteration++)
+			{
+				auto start = std::chrono::high_resolution_clock::now();
+				BlockCompressor::encode((BlockFormat)format, pixels.data(), width, height, blocks.data(), threaded ? 0 : 1);
+				seconds[threaded] = std::min(seconds[threaded], std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count());
+			}
+		std::cout << "  " << BlockCompressor::formatName((BlockFormat)format) << " \t 1 thread " << megapixels / seconds[0] << " MP/s \t "
+			<< cores << " threads " << megapixels / seconds[1] << " MP/s \t PSNR " << BlockCompressor::psnr((BlockFormat)format, pixels.data(), width, height, blocks.data())
+			<< " dB \t " << blocks.size() / 1024 << " KB, " << pixels.size() / blocks.size() << "x smaller than RGBA8" << std::endl;
+	}
+}
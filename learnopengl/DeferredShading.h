@@ -0,0 +1,385 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Camera.h"
+#include "Shader.h"
+#include "Mesh.h"
+#include "Framebuffer.h"
+#include "RenderThread.h"
+#include "GeometryGenerator.h"
+#include "ClusteredLighting.h" // PointLight
+
+//
+// Deferred shading: the scene is drawn once into a G-buffer, then every light adds its share
+// to the pixels inside its volume, so the cost of a light is the pixels it covers.
+// G-buffer, 12 bytes a pixel and the depth:
+//   0  RGBA8       albedo (object color times texture), alpha unused
+//   1  RG16        view space normal, octahedral encoding (2 values instead of 3, no loss worth seeing)
+//   2  R11G11B10F  emissive, which is also where the lights add up: it becomes the lit image
+//   depth and stencil, 32 bit float depth with reverse-Z. The positions are rebuilt from a copy
+//   of it, taken before the lights mark the stencil of the attached one.
+// Each light volume is drawn twice: the faces behind the scene mark the stencil of the pixels
+// between the volume's front and back (depth test only, no color), then the back faces shade
+// those pixels and clear their stencil for the next light.
+//
+class DeferredShading
+{
+public:
+	DeferredShading();
+	// Deletes the GL objects, needs the context
+	~DeferredShading();
+
+	DeferredShading(const DeferredShading&) = delete;
+	DeferredShading& operator=(const DeferredShading&) = delete;
+
+	// (Re)create the G-buffer and the light volume mesh, needs the context. reverseZ as in DepthConfig.
+	bool create(int width, int height, bool reverseZ);
+
+	// Bind the G-buffer (resized to width x height first) and clear it, background is the color
+	// of the pixels nothing is drawn on. The geometry pass draws with the G-buffer shaders after this.
+	void beginGeometry(CommandList& commands, int width, int height, glm::vec3 background);
+	// Ambient for every pixel, then the lights in view through their volumes. The lit image stays
+	// bound with the scene's depth, for what is drawn forward afterwards (the light cube).
+	// The ambient pass also takes the directional light, CascadedShadows::apply() sets it on ambientShader.
+	void lightScene(CommandList& commands, Shader* ambientShader, Shader* lightShader, const std::vector<PointLight>& lights,
+		Camera& camera, float ambient);
+	// Copy the lit image to the window, or into target (resized to the screen first) for post-processing
+	void resolve(CommandList& commands, int screenWidth, int screenHeight, Framebuffer* target = NULL);
+
+	// statistics of the last lightScene()
+	int getDrawnLightCount() const { return drawnLights; }
+	// the scene's depth, for what reads it after the geometry pass (occlusion culling)
+	GLuint getDepthTexture() const { return depthTexture; }
+	void report() const;
+
+private:
+	void release();
+
+	// what a light volume draw reads, staged in the command list
+	struct LightDraw
+	{
+		glm::mat4 PVM;
+		glm::vec4 positionRadius; // view space
+		glm::vec4 color;
+	};
+
+	GLuint fbo;
+	GLuint albedoTexture;
+	GLuint normalTexture;
+	GLuint lightTexture; // emissive, then the lit image
+	GLuint depthTexture;
+	// what the lighting shaders read: the stencil marking writes depthTexture's stencil during the
+	// same draws, sampling the attached texture would be a feedback loop
+	GLuint depthCopyTexture;
+	GLuint depthCopyFbo;
+	GLuint emptyVAO;     // the full screen triangle comes from gl_VertexID
+	Mesh* volume;        // icosphere around the unit sphere
+	float volumeScale;   // radius to scale of the icosphere, its faces lie inside the vertices' sphere
+	int width;
+	int height;
+	bool reverseZ;
+
+	// statistics
+	int drawnLights;
+	int culledLights;
+	unsigned int frames;
+	double totalDrawnLights;
+};
+
+
+DeferredShading::DeferredShading()
+{
+	fbo = 0;
+	albedoTexture = normalTexture = lightTexture = depthTexture = 0;
+	depthCopyTexture = depthCopyFbo = 0;
+	emptyVAO = 0;
+	volume = NULL;
+	volumeScale = 1.0f;
+	width = height = 0;
+	reverseZ = false;
+	drawnLights = 0;
+	culledLights = 0;
+	frames = 0;
+	totalDrawnLights = 0.0;
+}
+
+DeferredShading::~DeferredShading()
+{
+	release();
+	if (emptyVAO != 0)
+		glDeleteVertexArrays(1, &emptyVAO);
+	delete volume;
+}
+
+void DeferredShading::release()
+{
+	GLuint textures[5] = { albedoTexture, normalTexture, lightTexture, depthTexture, depthCopyTexture };
+	for (GLuint texture : textures)
+		if (texture != 0)
+			glDeleteTextures(1, &texture);
+	if (fbo != 0)
+		glDeleteFramebuffers(1, &fbo);
+	if (depthCopyFbo != 0)
+		glDeleteFramebuffers(1, &depthCopyFbo);
+	fbo = albedoTexture = normalTexture = lightTexture = depthTexture = 0;
+	depthCopyFbo = depthCopyTexture = 0;
+}
+
+bool DeferredShading::create(int width, int height, bool reverseZ)
+{
+	release();
+	this->width = width;
+	this->height = height;
+	this->reverseZ = reverseZ;
+
+	struct Target { GLuint* texture; GLenum internalFormat; GLenum format; GLenum type; GLenum attachment; };
+	const Target targets[4] =
+	{
+		{ &albedoTexture, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, GL_COLOR_ATTACHMENT0 },
+		{ &normalTexture, GL_RG16, GL_RG, GL_UNSIGNED_SHORT, GL_COLOR_ATTACHMENT1 },
+		{ &lightTexture, GL_R11F_G11F_B10F, GL_RGB, GL_FLOAT, GL_COLOR_ATTACHMENT2 },
+		{ &depthTexture, (GLenum)(reverseZ ? GL_DEPTH32F_STENCIL8 : GL_DEPTH24_STENCIL8), GL_DEPTH_STENCIL,
+			(GLenum)(reverseZ ? GL_FLOAT_32_UNSIGNED_INT_24_8_REV : GL_UNSIGNED_INT_24_8), GL_DEPTH_STENCIL_ATTACHMENT }
+	};
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	for (const Target& target : targets)
+	{
+		// read with texelFetch, one texel per pixel
+		glGenTextures(1, target.texture);
+		glBindTexture(GL_TEXTURE_2D, *target.texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, target.internalFormat, width, height, 0, target.format, target.type, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, target.attachment, GL_TEXTURE_2D, *target.texture, 0);
+	}
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+
+	// the copy of the depth the lighting samples, in the same format so a blit can fill it
+	const Target& depth = targets[3];
+	glGenTextures(1, &depthCopyTexture);
+	glBindTexture(GL_TEXTURE_2D, depthCopyTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, depth.internalFormat, width, height, 0, depth.format, depth.type, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glGenFramebuffers(1, &depthCopyFbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, depthCopyFbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, depthCopyTexture, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	GLenum copyStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE || copyStatus != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "ERROR::DeferredShading::create:: incomplete G-buffer, status 0x" << std::hex << status << ", depth copy 0x" << copyStatus
+			<< std::dec << std::endl;
+		release();
+		return false;
+	}
+
+	if (emptyVAO == 0)
+		glGenVertexArrays(1, &emptyVAO);
+	if (!volume)
+	{
+		ShapeDesc sphere;
+		sphere.type = SHAPE_ICOSPHERE;
+		sphere.segments = 2;
+		sphere.radius = 1.0f;
+		size_t vertexCount, indexCount;
+		GeometryGenerator::getCounts(sphere, vertexCount, indexCount);
+		std::vector<float> vertices(vertexCount * 3);
+		std::vector<unsigned int> indices(indexCount);
+		GeometryGenerator::generate(sphere, GeneratorLayout::V(), vertices.data(), indices.data());
+
+		// the closest face decides how much the mesh must grow to hold the whole sphere
+		float inside = 1.0f;
+		for (size_t i = 0; i + 2 < indexCount; i += 3)
+		{
+			const float* pa = &vertices[3 * indices[i]];
+			const float* pb = &vertices[3 * indices[i + 1]];
+			const float* pc = &vertices[3 * indices[i + 2]];
+			glm::vec3 a(pa[0], pa[1], pa[2]), b(pb[0], pb[1], pb[2]), c(pc[0], pc[1], pc[2]);
+			inside = std::min(inside, fabs(glm::dot(glm::normalize(glm::cross(b - a, c - a)), a)));
+		}
+		volumeScale = 1.0f / inside;
+		volume = new Mesh();
+		volume->CreateV(vertices.data(), indices.data(), (unsigned int)vertices.size(), (unsigned int)indexCount); // counts floats
+	}
+	return true;
+}
+
+void DeferredShading::beginGeometry(CommandList& commands, int width, int height, glm::vec3 background)
+{
+	commands.call([this, width, height, background]()
+	{
+		if (width > 0 && height > 0 && (width != this->width || height != this->height))
+			create(width, height, reverseZ);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		glViewport(0, 0, this->width, this->height);
+		const GLenum drawBuffers[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+		glDrawBuffers(3, drawBuffers);
+
+		// no albedo where nothing is drawn, so no light either: the background stays as cleared
+		const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		const GLfloat backgroundColor[4] = { background.x, background.y, background.z, 1.0f };
+		glClearBufferfv(GL_COLOR, 0, zero);
+		glClearBufferfv(GL_COLOR, 1, zero);
+		glClearBufferfv(GL_COLOR, 2, backgroundColor);
+		glClearBufferfi(GL_DEPTH_STENCIL, 0, reverseZ ? 0.0f : 1.0f, 0);
+	});
+}
+
+void DeferredShading::lightScene(CommandList& commands, Shader* ambientShader, Shader* lightShader, const std::vector<PointLight>& lights,
+	Camera& camera, float ambient)
+{
+	// the volumes in view, with what their shader needs
+	const glm::mat4& view = camera.getViewMatrix();
+	const glm::mat4& viewProjection = camera.getViewProjectionMatrix();
+	const Frustum& frustum = camera.getFrustum();
+	LightDraw* draws = commands.stage<LightDraw>(std::max<size_t>(1, lights.size()));
+	int count = 0;
+	for (const PointLight& light : lights)
+	{
+		float scale = light.radius * volumeScale;
+		if (!frustum.intersectsSphere(light.position, light.radius))
+			continue;
+		LightDraw& draw = draws[count++];
+		glm::mat4 model(scale);
+		model[3] = glm::vec4(light.position, 1.0f);
+		draw.PVM = viewProjection * model;
+		draw.positionRadius = glm::vec4(glm::vec3(view * glm::vec4(light.position, 1.0f)), light.radius);
+		draw.color = glm::vec4(light.color, 0.0f);
+	}
+	drawnLights = count;
+	culledLights = (int)lights.size() - count;
+	frames++;
+	totalDrawnLights += count;
+
+	glm::mat4 inverseProjection = glm::inverse(camera.getProjectionMatrix());
+	// depth to clip space z: [0, 1] with the reverse-Z clip control, [-1, 1] otherwise
+	glm::vec2 depthToNDC = reverseZ ? glm::vec2(1.0f, 0.0f) : glm::vec2(2.0f, -1.0f);
+	commands.call([this, ambientShader, lightShader, draws, count, inverseProjection, depthToNDC, ambient]()
+	{
+		// the shaders read a copy of the depth: the attached one has its stencil written below
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, depthCopyFbo);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+
+		// only the lit image is written from here on, the G-buffer is read
+		glDrawBuffer(GL_COLOR_ATTACHMENT2);
+		const GLuint textures[3] = { albedoTexture, normalTexture, depthCopyTexture };
+		for (int i = 0; i < 3; i++)
+		{
+			glActiveTexture(GL_TEXTURE11 + i);
+			glBindTexture(GL_TEXTURE_2D, textures[i]);
+		}
+		glActiveTexture(GL_TEXTURE0);
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+		glDepthMask(GL_FALSE); // the volumes only test against the scene's depth
+
+		// ambient and the directional light, one triangle over the screen
+		ambientShader->use();
+		glUniform1i(ambientShader->getUniformLocation("albedoBuffer"), 11);
+		glUniform1i(ambientShader->getUniformLocation("normalBuffer"), 12);
+		glUniform1i(ambientShader->getUniformLocation("depthBuffer"), 13);
+		glUniformMatrix4fv(ambientShader->getUniformLocation("inverseProjection"), 1, GL_FALSE, glm::value_ptr(inverseProjection));
+		glUniform2f(ambientShader->getUniformLocation("depthToNDC"), depthToNDC.x, depthToNDC.y);
+		glUniform1f(ambientShader->getUniformLocation("ambient"), ambient);
+		glDisable(GL_DEPTH_TEST);
+		glBindVertexArray(emptyVAO);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+
+		lightShader->use();
+		glUniform1i(lightShader->getUniformLocation("albedoBuffer"), 11);
+		glUniform1i(lightShader->getUniformLocation("normalBuffer"), 12);
+		glUniform1i(lightShader->getUniformLocation("depthBuffer"), 13);
+		glUniformMatrix4fv(lightShader->getUniformLocation("inverseProjection"), 1, GL_FALSE, glm::value_ptr(inverseProjection));
+		glUniform2f(lightShader->getUniformLocation("depthToNDC"), depthToNDC.x, depthToNDC.y);
+		GLint pvmLocation = lightShader->getUniformLocation("PVM");
+		GLint positionLocation = lightShader->getUniformLocation("lightPositionRadius");
+		GLint colorLocation = lightShader->getUniformLocation("lightColor");
+
+		// volumes behind the near plane or past the far one would leave half marked pixels
+		glEnable(GL_DEPTH_CLAMP);
+		glEnable(GL_STENCIL_TEST);
+		for (int i = 0; i < count; i++)
+		{
+			const LightDraw& draw = draws[i];
+			glUniformMatrix4fv(pvmLocation, 1, GL_FALSE, glm::value_ptr(draw.PVM));
+			glUniform4fv(positionLocation, 1, glm::value_ptr(draw.positionRadius));
+			glUniform4fv(colorLocation, 1, glm::value_ptr(draw.color));
+
+			// mark: back faces behind the scene count up, front faces behind it count down, what
+			// is left non zero has the scene in front of the back and behind the front (the depth
+			// test is the scene's, either depth convention)
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			glEnable(GL_DEPTH_TEST);
+			glDisable(GL_CULL_FACE);
+			glStencilFunc(GL_ALWAYS, 0, 0xFF);
+			glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+			glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+			volume->draw();
+
+			// shade: every marked pixel once through the back faces, and unmark it
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			glDisable(GL_DEPTH_TEST);
+			glEnable(GL_CULL_FACE);
+			glCullFace(GL_FRONT);
+			glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+			glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+			volume->draw();
+		}
+
+		glDisable(GL_STENCIL_TEST);
+		glDisable(GL_CULL_FACE);
+		glCullFace(GL_BACK);
+		glDisable(GL_DEPTH_CLAMP);
+		glDisable(GL_BLEND);
+		glEnable(GL_DEPTH_TEST);
+		glDepthMask(GL_TRUE);
+		for (int i = 0; i < 3; i++)
+		{
+			glActiveTexture(GL_TEXTURE11 + i);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+		glActiveTexture(GL_TEXTURE0);
+	});
+}
+
+void DeferredShading::resolve(CommandList& commands, int screenWidth, int screenHeight, Framebuffer* target)
+{
+	commands.call([this, screenWidth, screenHeight, target]()
+	{
+		if (target)
+			target->resize(screenWidth, screenHeight);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+		glReadBuffer(GL_COLOR_ATTACHMENT2);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, target ? target->getFramebuffer() : 0);
+		glBlitFramebuffer(0, 0, width, height, 0, 0, screenWidth, screenHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glViewport(0, 0, screenWidth, screenHeight);
+	});
+}
+
+void DeferredShading::report() const
+{
+	std::cout << "DeferredShading:: " << width << "x" << height << " G-buffer, " << (width * height * 12) / 1024 << " KB of color and "
+		<< (width * height * (reverseZ ? 8 : 4) * 2) / 1024 << " KB of depth and stencil with the copy the lighting reads, " << (frames ? totalDrawnLights / frames : 0.0)
+		<< " light volumes a frame on average (last frame " << drawnLights << " drawn, " << culledLights << " out of view)" << std::endl;
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+
+#include <glm/glm.hpp>
+
+#include "Shader.h"
+#include "Mesh.h"
+#include "Framebuffer.h" // DepthConfig
+#include "RenderThread.h"
+
+//
+// Depth prepass: the opaque draws first write the depth alone, reading the positions only with a
+// shader that computes nothing per fragment, then the shading pass draws them again with the depth
+// test GL_EQUAL and the depth writes off. Every pixel is shaded once, by the surface in front,
+// whatever the submission order (one fragment per pixel instead of one per surface covering it).
+// Equal is the same test for reverse-Z and the standard depth: the two passes must compute the
+// same depth, their vertex shaders share the expression and declare gl_Position invariant.
+// The samples of the shading pass are counted by occlusion queries (GL_SAMPLES_PASSED), with and
+// without the prepass, so the report tells what it saves.
+//
+class DepthPrepass
+{
+public:
+	// depthConfig gives the compare restored after the shading pass
+	DepthPrepass(const DepthConfig& depthConfig);
+	// Deletes the queries, needs the context
+	~DepthPrepass();
+
+	DepthPrepass(const DepthPrepass&) = delete;
+	DepthPrepass& operator=(const DepthPrepass&) = delete;
+
+	// Color writes off and depthShader bound, it takes projection, view and model like the scene's shaders
+	void beginDepth(CommandList& commands, Shader* depthShader, const glm::mat4& projection, const glm::mat4& view);
+	// The depth of one opaque draw, the same mesh, model and LOD as its shading draw
+	void drawDepth(CommandList& commands, Shader* depthShader, Mesh* mesh, const glm::mat4& model, int lod = 0);
+	// Start counting the shaded samples; afterPrepass: color writes back on, depth test GL_EQUAL
+	// and no depth writes until endShading()
+	void beginShading(CommandList& commands, bool afterPrepass);
+	// Stop counting and restore the depth state
+	void endShading(CommandList& commands);
+
+	void report() const;
+
+private:
+	// a query is read a few frames after it ran, when the GL has its result
+	static const int queryCount = 4;
+	struct Query
+	{
+		GLuint query;
+		bool pending;      // issued, result not read yet
+		bool afterPrepass;
+	};
+	// read the result of a pending query into the statistics (render thread)
+	void collect(Query& query);
+
+	Query queries[queryCount];
+	int nextQuery;
+	bool shadingAfterPrepass; // the shading pass recorded last
+	GLenum compareFunc;
+
+	// statistics, written by the render thread (read them after RenderThread::stop())
+	unsigned long long samples[2];   // shaded samples, [0] without the prepass, [1] after it
+	unsigned int frames[2];
+	unsigned int queryWaits;         // a query was still running when its slot came back
+	// recorded by the main thread
+	unsigned int depthDraws;
+	unsigned int prepassFrames;
+};
+
+
+DepthPrepass::DepthPrepass(const DepthConfig& depthConfig)
+{
+	// the queries are made on the first frame, on the thread owning the context then
+	for (Query& query : queries)
+		query = Query{ 0, false, false };
+	nextQuery = 0;
+	shadingAfterPrepass = false;
+	compareFunc = depthConfig.compareFunc();
+	samples[0] = samples[1] = 0;
+	frames[0] = frames[1] = 0;
+	queryWaits = 0;
+	depthDraws = 0;
+	prepassFrames = 0;
+}
+
+DepthPrepass::~DepthPrepass()
+{
+	for (Query& query : queries)
+		if (query.query != 0)
+			glDeleteQueries(1, &query.query);
+}
+
+void DepthPrepass::beginDepth(CommandList& commands, Shader* depthShader, const glm::mat4& projection, const glm::mat4& view)
+{
+	prepassFrames++;
+	commands.call([]()
+	{
+		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	});
+	commands.useShader(depthShader);
+	commands.setMat4(depthShader, "projection", projection);
+	commands.setMat4(depthShader, "view", view);
+}
+
+void DepthPrepass::drawDepth(CommandList& commands, Shader* depthShader, Mesh* mesh, const glm::mat4& model, int lod)
+{
+	depthDraws++;
+	commands.setMat4(depthShader, "model", model);
+	commands.drawDepth(mesh, lod);
+}
+
+void DepthPrepass::beginShading(CommandList& commands, bool afterPrepass)
+{
+	shadingAfterPrepass = afterPrepass;
+	commands.call([this, afterPrepass]()
+	{
+		if (afterPrepass)
+		{
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			glDepthFunc(GL_EQUAL);
+			glDepthMask(GL_FALSE);
+		}
+
+		if (queries[0].query == 0)
+			for (Query& query : queries)
+				glGenQueries(1, &query.query);
+		// whatever finished, then the slot about to be reused, waiting for it if needed
+		for (Query& query : queries)
+		{
+			GLuint available = GL_FALSE;
+			if (query.pending)
+				glGetQueryObjectuiv(query.query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available)
+				collect(query);
+		}
+		Query& query = queries[nextQuery];
+		if (query.pending)
+		{
+			queryWaits++;
+			collect(query);
+		}
+		nextQuery = (nextQuery + 1) % queryCount;
+
+		glBeginQuery(GL_SAMPLES_PASSED, query.query);
+		query.pending = true;
+		query.afterPrepass = afterPrepass;
+	});
+}
+
+void DepthPrepass::endShading(CommandList& commands)
+{
+	bool afterPrepass = shadingAfterPrepass;
+	GLenum compareFunc = this->compareFunc;
+	commands.call([afterPrepass, compareFunc]()
+	{
+		glEndQuery(GL_SAMPLES_PASSED);
+		if (afterPrepass)
+		{
+			glDepthFunc(compareFunc);
+			glDepthMask(GL_TRUE);
+		}
+	});
+}
+
+void DepthPrepass::collect(Query& query)
+{
+	GLuint64 result = 0;
+	glGetQueryObjectui64v(query.query, GL_QUERY_RESULT, &result);
+	samples[query.afterPrepass ? 1 : 0] += result;
+	frames[query.afterPrepass ? 1 : 0]++;
+	query.pending = false;
+}
+
+void DepthPrepass::report() const
+{
+	double without = frames[0] ? (double)samples[0] / frames[0] : 0.0;
+	double after = frames[1] ? (double)samples[1] / frames[1] : 0.0;
+	std::cout << "DepthPrepass:: " << prepassFrames << " frames with the prepass (" << depthDraws << " depth draws), shaded samples a frame: "
+		<< without << " without it (" << frames[0] << " frames), " << after << " after it (" << frames[1] << " frames)";
+	if (frames[0] && frames[1] && without > 0.0)
+		std::cout << ", " << (1.0 - after / without) * 100.0 << "% fewer";
+	std::cout << ", " << queryWaits << " waits for a query" << std::endl;
+}
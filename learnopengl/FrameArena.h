@@ -0,0 +1,134 @@
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+
+//
+// Linear allocator for data that lives one frame: allocation bumps an offset, reset() rewinds
+// everything at once and nothing is freed individually (no destructors are run either, keep
+// it to plain data).
+// Memory comes in chunks that are kept between frames, so once the arena has grown to the
+// frame's high water mark it never touches the heap again.
+// An arena is not thread safe, one thread allocates from it at a time.
+//
+class FrameArena
+{
+public:
+	FrameArena(size_t chunkSize = 256 * 1024);
+	~FrameArena();
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	// alignment must be a power of two
+	void* allocate(size_t size, size_t alignment = 16);
+	template<typename T> T* allocate(size_t count = 1) { return (T*)allocate(sizeof(T) * count, alignof(T)); }
+
+	// Rewind the arena, the memory of the previous frame is reused
+	void reset();
+
+	// Statistics
+	size_t getUsed() const;              // bytes handed out since the last reset
+	size_t getHighWater() const;         // largest getUsed() seen at a reset
+	size_t getCapacity() const;          // bytes reserved in chunks
+	unsigned int getChunkAllocations() const; // times a chunk had to be taken from the heap
+
+private:
+	struct Chunk
+	{
+		unsigned char* data;
+		size_t size;
+	};
+
+	void nextChunk(size_t size, size_t alignment);
+
+	size_t chunkSize;
+	std::vector<Chunk> chunks;
+	size_t currentChunk;
+	size_t offset;          // in the current chunk
+	size_t usedBefore;      // bytes used in the chunks before the current one
+	size_t highWater;
+	unsigned int chunkAllocations;
+};
+
+
+FrameArena::FrameArena(size_t chunkSize)
+{
+	this->chunkSize = chunkSize;
+	currentChunk = 0;
+	offset = 0;
+	usedBefore = 0;
+	highWater = 0;
+	chunkAllocations = 0;
+}
+
+FrameArena::~FrameArena()
+{
+	for (Chunk& chunk : chunks)
+		delete[] chunk.data;
+}
+
+void FrameArena::nextChunk(size_t size, size_t alignment)
+{
+	// skip to the next kept chunk if it is large enough, otherwise insert a new one there
+	usedBefore += offset;
+	if (!chunks.empty())
+		currentChunk++;
+	if (currentChunk == chunks.size() || chunks[currentChunk].size < size + alignment)
+	{
+		size_t newSize = std::max(chunkSize, size + alignment);
+		chunks.insert(chunks.begin() + currentChunk, { new unsigned char[newSize], newSize });
+		chunkAllocations++;
+	}
+	offset = 0;
+}
+
+void* FrameArena::allocate(size_t size, size_t alignment)
+{
+	if (chunks.empty())
+		nextChunk(size, alignment);
+
+	uintptr_t base = (uintptr_t)chunks[currentChunk].data;
+	size_t aligned = (size_t)(((base + offset + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+	if (aligned + size > chunks[currentChunk].size)
+	{
+		nextChunk(size, alignment);
+		base = (uintptr_t)chunks[currentChunk].data;
+		aligned = (size_t)(((base + alignment - 1) & ~(uintptr_t)(alignment - 1)) - base);
+	}
+	offset = aligned + size;
+	return (void*)(base + aligned);
+}
+
+void FrameArena::reset()
+{
+	highWater = std::max(highWater, usedBefore + offset);
+	currentChunk = 0;
+	offset = 0;
+	usedBefore = 0;
+}
+
+size_t FrameArena::getUsed() const
+{
+	return usedBefore + offset;
+}
+
+size_t FrameArena::getHighWater() const
+{
+	return highWater;
+}
+
+size_t FrameArena::getCapacity() const
+{
+	size_t capacity = 0;
+	for (const Chunk& chunk : chunks)
+		capacity += chunk.size;
+	return capacity;
+}
+
+unsigned int FrameArena::getChunkAllocations() const
+{
+	return chunkAllocations;
+}
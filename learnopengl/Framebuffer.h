@@ -0,0 +1,176 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+
+//
+// Depth convention used for the whole frame.
+// Reverse-Z stores 1 at the near plane and 0 at the far plane (or at infinity) in a float
+// depth buffer: the float exponent then cancels the 1/z distribution of the projection and
+// the precision stays almost constant with distance.
+//
+struct DepthConfig
+{
+	bool reverseZ = false;
+
+	// glClipControl is needed so the clip space depth range is [0, 1] instead of [-1, 1],
+	// otherwise the precision gained near 0 is thrown away by the * 0.5 + 0.5 remap.
+	// It is core in GL 4.5, whose contexts need not list ARB_clip_control.
+	static bool reverseZSupported() { return (versionHasClipControl() || GLAD_GL_ARB_clip_control != 0) && glad_glClipControl != NULL; }
+	// The loader is generated for GL 3.3 (there is no GLAD_GL_VERSION_4_5) and only loads
+	// glClipControl with the extension: fetch it from a 4.5 context, after gladLoadGLLoader
+	static void loadClipControl(GLADloadproc load);
+	static bool versionHasClipControl() { return GLVersion.major > 4 || (GLVersion.major == 4 && GLVersion.minor >= 5); }
+
+	float clearDepth() const { return reverseZ ? 0.0f : 1.0f; }
+	GLenum compareFunc() const { return reverseZ ? GL_GREATER : GL_LESS; }
+	// same as compareFunc but also accepting equal depths, for passes drawing the same geometry again
+	GLenum compareFuncOrEqual() const { return reverseZ ? GL_GEQUAL : GL_LEQUAL; }
+
+	// Set the clip control, depth compare and depth clear value
+	void apply() const;
+};
+
+//
+// Offscreen render target: a color texture, RGBA8 unless another format is asked for (a float
+// one for HDR), and a depth texture. The depth is GL_DEPTH_COMPONENT32F when floatDepth is set (needed for reverse-Z),
+// GL_DEPTH_COMPONENT24 otherwise.
+//
+class Framebuffer
+{
+public:
+	Framebuffer();
+	~Framebuffer();
+
+	// (Re)create the attachments, returns false if the framebuffer is incomplete
+	bool create(int width, int height, bool floatDepth, GLenum colorFormat = GL_RGBA8);
+	// Recreate the attachments if the size changed (window resize)
+	void resize(int width, int height);
+
+	// Render into the framebuffer, also sets the viewport to its size
+	void bind();
+	// Copy the color attachment to the window and make the window the draw target again
+	void blitToScreen(int screenWidth, int screenHeight);
+
+	unsigned int getColorTexture() { return colorTexture; }
+	unsigned int getDepthTexture() { return depthTexture; }
+	unsigned int getFramebuffer() { return fbo; }
+	int getWidth() { return width; }
+	int getHeight() { return height; }
+
+private:
+	void release();
+
+	unsigned int fbo;
+	unsigned int colorTexture;
+	unsigned int depthTexture;
+	int width;
+	int height;
+	bool floatDepth;
+	GLenum colorFormat;
+};
+
+
+void DepthConfig::loadClipControl(GLADloadproc load)
+{
+	if (glad_glClipControl == NULL && versionHasClipControl())
+		glad_glClipControl = (PFNGLCLIPCONTROLPROC)load("glClipControl");
+}
+
+void DepthConfig::apply() const
+{
+	if (reverseZSupported())
+		glClipControl(GL_LOWER_LEFT, reverseZ ? GL_ZERO_TO_ONE : GL_NEGATIVE_ONE_TO_ONE);
+	glDepthFunc(compareFunc());
+	glClearDepth(clearDepth());
+}
+
+Framebuffer::Framebuffer()
+{
+	fbo = 0;
+	colorTexture = 0;
+	depthTexture = 0;
+	width = 0;
+	height = 0;
+	floatDepth = false;
+	colorFormat = GL_RGBA8;
+}
+
+Framebuffer::~Framebuffer()
+{
+	release();
+}
+
+void Framebuffer::release()
+{
+	if (colorTexture != 0)
+		glDeleteTextures(1, &colorTexture);
+	if (depthTexture != 0)
+		glDeleteTextures(1, &depthTexture);
+	if (fbo != 0)
+		glDeleteFramebuffers(1, &fbo);
+	fbo = colorTexture = depthTexture = 0;
+}
+
+bool Framebuffer::create(int width, int height, bool floatDepth, GLenum colorFormat)
+{
+	release();
+	this->width = width;
+	this->height = height;
+	this->floatDepth = floatDepth;
+	this->colorFormat = colorFormat;
+
+	glGenTextures(1, &colorTexture);
+	glBindTexture(GL_TEXTURE_2D, colorTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, colorFormat, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glGenTextures(1, &depthTexture);
+	glBindTexture(GL_TEXTURE_2D, depthTexture);
+	glTexImage2D(GL_TEXTURE_2D, 0, floatDepth ? GL_DEPTH_COMPONENT32F : GL_DEPTH_COMPONENT24, width, height, 0,
+		GL_DEPTH_COMPONENT, floatDepth ? GL_FLOAT : GL_UNSIGNED_INT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+	{
+		std::cout << "ERROR::Framebuffer::create:: incomplete framebuffer, status 0x" << std::hex << status << std::dec << std::endl;
+		release();
+		return false;
+	}
+	return true;
+}
+
+void Framebuffer::resize(int width, int height)
+{
+	if (width > 0 && height > 0 && (width != this->width || height != this->height))
+		create(width, height, floatDepth, colorFormat);
+}
+
+void Framebuffer::bind()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glViewport(0, 0, width, height);
+}
+
+void Framebuffer::blitToScreen(int screenWidth, int screenHeight)
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, screenWidth, screenHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, screenWidth, screenHeight);
+}
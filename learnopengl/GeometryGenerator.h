@@ -0,0 +1,438 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+#include "Mesh.h"
+#include "WorkerPool.h"
+
+// Which attributes the generator writes and where, as float offsets inside an interleaved vertex.
+// An offset of -1 leaves the attribute out.
+struct GeneratorLayout
+{
+	unsigned int stride; // floats per vertex
+	int positionOffset;
+	int normalOffset;
+	int uvOffset;
+	int colorOffset;
+
+	static GeneratorLayout V()   { return { 3, 0, -1, -1, -1 }; } // same as Mesh::CreateV
+	static GeneratorLayout VCT() { return { 8, 0, -1, 6, 3 }; }   // same as Mesh::CreateVCT
+	static GeneratorLayout VNT() { return { 8, 0, 3, 6, -1 }; }   // same as Mesh::CreateVNT
+
+	// the matching attribute descriptions for Mesh::CreateFromAttributes, returns their count
+	unsigned int toAttributes(VertexAttribute* attributes) const;
+};
+
+enum ShapeType
+{
+	SHAPE_CUBE,
+	SHAPE_UV_SPHERE,
+	SHAPE_ICOSPHERE,
+	SHAPE_PLANE,
+	SHAPE_TORUS,
+	SHAPE_TERRAIN
+};
+
+// Parameters of a generated shape, only the ones meaningful for its type are read
+struct ShapeDesc
+{
+	ShapeType type = SHAPE_CUBE;
+	int segments = 16;          // subdivisions: per cube face / plane side, around sphere and torus, icosphere edge frequency
+	int rings = 16;             // subdivisions from pole to pole (UV sphere) or around the tube (torus)
+	float size = 1.0f;          // cube edge, plane and terrain side
+	float radius = 0.5f;        // sphere radius, torus major radius
+	float tubeRadius = 0.2f;    // torus minor radius
+
+	// terrain: heightsWidth x heightsDepth samples, row major, scaled by heightScale
+	const float* heights = nullptr;
+	int heightsWidth = 0;
+	int heightsDepth = 0;
+	float heightScale = 1.0f;
+};
+
+class GeometryGenerator
+{
+public:
+	// Number of vertices and indices 'generate' is going to write
+	static void getCounts(const ShapeDesc& shape, size_t& vertexCount, size_t& indexCount);
+
+	// Write the shape into preallocated buffers (vertexCount * layout.stride floats, indexCount indices).
+	// Rows of the shape are spread over the pool's threads in batches of at least minBatchRows,
+	// NULL (and any shape too small to split) stays on the calling thread
+	static void generate(const ShapeDesc& shape, const GeneratorLayout& layout, float* vertices, unsigned int* indices, WorkerPool* pool = NULL);
+
+	// Generate straight into a GL mesh
+	static void createMesh(const ShapeDesc& shape, const GeneratorLayout& layout, Mesh& mesh, WorkerPool* pool = NULL);
+
+	// Generate a multi-million triangle sphere and print the triangles generated per second, one thread vs every core
+	static void benchmark();
+
+private:
+	static const size_t minBatchRows = 16; // a unit cube or a light cube is not worth waking a thread for
+
+	template<typename Function>
+	static void parallelFor(size_t count, WorkerPool* pool, Function function);
+
+	static void writeVertex(float* vertex, const GeneratorLayout& layout, float px, float py, float pz, float nx, float ny, float nz, float u, float v);
+	static void writeQuadIndices(unsigned int* indices, unsigned int rowStart, unsigned int columns);
+};
+
+
+unsigned int GeneratorLayout::toAttributes(VertexAttribute* attributes) const
+{
+	unsigned int count = 0;
+	unsigned int strideBytes = stride * sizeof(float);
+	if (positionOffset >= 0) attributes[count++] = { ATTRIB_POSITION, 3, GL_FLOAT, false, strideBytes, positionOffset * (unsigned int)sizeof(float) };
+	if (colorOffset >= 0)    attributes[count++] = { ATTRIB_COLOR,    3, GL_FLOAT, false, strideBytes, colorOffset * (unsigned int)sizeof(float) };
+	if (uvOffset >= 0)       attributes[count++] = { ATTRIB_UV,       2, GL_FLOAT, false, strideBytes, uvOffset * (unsigned int)sizeof(float) };
+	if (normalOffset >= 0)   attributes[count++] = { ATTRIB_NORMAL,   3, GL_FLOAT, false, strideBytes, normalOffset * (unsigned int)sizeof(float) };
+	return count;
+}
+
+
+template<typename Function>
+void GeometryGenerator::parallelFor(size_t count, WorkerPool* pool, Function function)
+{
+	if (!pool || count <= minBatchRows)
+	{
+		if (count > 0)
+			function((size_t)0, count);
+		return;
+	}
+	// a few batches per thread so an uneven share evens out, run() keeps the small counts on this thread
+	size_t batchSize = std::max(minBatchRows, count / (pool->getThreadCount() * 4));
+	pool->run(count, batchSize, [&function](size_t begin, size_t end, unsigned int) { function(begin, end); });
+}
+
+void GeometryGenerator::writeVertex(float* vertex, const GeneratorLayout& layout, float px, float py, float pz, float nx, float ny, float nz, float u, float v)
+{
+	if (layout.positionOffset >= 0)
+	{
+		vertex[layout.positionOffset] = px;
+		vertex[layout.positionOffset + 1] = py;
+		vertex[layout.positionOffset + 2] = pz;
+	}
+	if (layout.normalOffset >= 0)
+	{
+		vertex[layout.normalOffset] = nx;
+		vertex[layout.normalOffset + 1] = ny;
+		vertex[layout.normalOffset + 2] = nz;
+	}
+	if (layout.uvOffset >= 0)
+	{
+		vertex[layout.uvOffset] = u;
+		vertex[layout.uvOffset + 1] = v;
+	}
+	if (layout.colorOffset >= 0) // the normal as a color, handy to check the orientation of a shape
+	{
+		vertex[layout.colorOffset] = nx * 0.5f + 0.5f;
+		vertex[layout.colorOffset + 1] = ny * 0.5f + 0.5f;
+		vertex[layout.colorOffset + 2] = nz * 0.5f + 0.5f;
+	}
+}
+
+// two counter-clockwise triangles for every cell of a grid row, 'columns' cells wide
+void GeometryGenerator::writeQuadIndices(unsigned int* indices, unsigned int rowStart, unsigned int columns)
+{
+	for (unsigned int i = 0; i < columns; i++)
+	{
+		unsigned int a = rowStart + i, b = a + 1, c = a + columns + 2, d = a + columns + 1;
+		indices[0] = a; indices[1] = b; indices[2] = c;
+		indices[3] = a; indices[4] = c; indices[5] = d;
+		indices += 6;
+	}
+}
+
+void GeometryGenerator::getCounts(const ShapeDesc& shape, size_t& vertexCount, size_t& indexCount)
+{
+	size_t n = (size_t)std::max(1, shape.segments);
+	size_t m = (size_t)std::max(1, shape.rings);
+	switch (shape.type)
+	{
+	case SHAPE_CUBE:
+		vertexCount = 6 * (n + 1) * (n + 1);
+		indexCount = 6 * n * n * 6;
+		break;
+	case SHAPE_PLANE:
+		vertexCount = (n + 1) * (n + 1);
+		indexCount = n * n * 6;
+		break;
+	case SHAPE_UV_SPHERE:
+	case SHAPE_TORUS:
+		vertexCount = (n + 1) * (m + 1);
+		indexCount = n * m * 6;
+		break;
+	case SHAPE_ICOSPHERE:
+		// 20 triangular faces, each split in n * n triangles
+		vertexCount = 20 * (n + 1) * (n + 2) / 2;
+		indexCount = 20 * n * n * 3;
+		break;
+	case SHAPE_TERRAIN:
+		if (shape.heightsWidth < 2 || shape.heightsDepth < 2)
+			vertexCount = indexCount = 0;
+		else
+		{
+			vertexCount = (size_t)shape.heightsWidth * shape.heightsDepth;
+			indexCount = (size_t)(shape.heightsWidth - 1) * (shape.heightsDepth - 1) * 6;
+		}
+		break;
+	default:
+		vertexCount = indexCount = 0;
+	}
+}
+
+void GeometryGenerator::generate(const ShapeDesc& shape, const GeneratorLayout& layout, float* vertices, unsigned int* indices, WorkerPool* pool)
+{
+	const float pi = 3.14159265358979f;
+	const unsigned int n = (unsigned int)std::max(1, shape.segments);
+	const unsigned int m = (unsigned int)std::max(1, shape.rings);
+	const unsigned int stride = layout.stride;
+
+	switch (shape.type)
+	{
+	case SHAPE_CUBE:
+	case SHAPE_PLANE:
+	{
+		// every face is a grid spanned by two axes with cross(u, v) = normal so triangles face outwards
+		static const float faces[6][9] = {
+			//  normal         u axis          v axis
+			{  1, 0, 0,     0, 0, -1,     0, 1, 0 },
+			{ -1, 0, 0,     0, 0,  1,     0, 1, 0 },
+			{  0, 1, 0,     1, 0,  0,     0, 0, -1 },
+			{  0,-1, 0,     1, 0,  0,     0, 0, 1 },
+			{  0, 0, 1,     1, 0,  0,     0, 1, 0 },
+			{  0, 0,-1,    -1, 0,  0,     0, 1, 0 },
+		};
+		unsigned int faceCount = (shape.type == SHAPE_CUBE) ? 6 : 1;
+		const int firstFace = (shape.type == SHAPE_CUBE) ? 0 : 2; // the plane is the +Y face, lying at y = 0
+		float half = shape.size * 0.5f;
+		float offset = (shape.type == SHAPE_CUBE) ? half : 0.0f;
+		unsigned int faceVertices = (n + 1) * (n + 1);
+
+		parallelFor((size_t)faceCount * (n + 1), pool, [&](size_t begin, size_t end)
+		{
+			for (size_t row = begin; row < end; row++)
+			{
+				unsigned int face = (unsigned int)(row / (n + 1)), j = (unsigned int)(row % (n + 1));
+				const float* axes = faces[firstFace + face];
+				float t = (float)j / n;
+				for (unsigned int i = 0; i <= n; i++)
+				{
+					float s = (float)i / n;
+					float a = (2.0f * s - 1.0f) * half, b = (2.0f * t - 1.0f) * half;
+					writeVertex(vertices + ((size_t)face * faceVertices + j * (n + 1) + i) * stride, layout,
+						axes[0] * offset + axes[3] * a + axes[6] * b,
+						axes[1] * offset + axes[4] * a + axes[7] * b,
+						axes[2] * offset + axes[5] * a + axes[8] * b,
+						axes[0], axes[1], axes[2], s, t);
+				}
+				if (j < n)
+					writeQuadIndices(indices + ((size_t)face * n * n + (size_t)j * n) * 6, face * faceVertices + j * (n + 1), n);
+			}
+		});
+		break;
+	}
+	case SHAPE_UV_SPHERE:
+	case SHAPE_TORUS:
+	{
+		bool sphere = (shape.type == SHAPE_UV_SPHERE);
+		parallelFor((size_t)m + 1, pool, [&](size_t begin, size_t end)
+		{
+			for (size_t row = begin; row < end; row++)
+			{
+				unsigned int j = (unsigned int)row;
+				float t = (float)j / m;
+				// sphere: from the south pole up, torus: around the tube
+				float theta = sphere ? pi * (1.0f - t) : 2.0f * pi * t;
+				float cosTheta = cos(theta), sinTheta = sin(theta);
+				if (sphere && (j == 0 || j == m))
+					sinTheta = 0.0f; // sin(pi) is not exactly 0, that would fold the pole rows inside out
+				for (unsigned int i = 0; i <= n; i++)
+				{
+					float s = (float)i / n;
+					float phi = 2.0f * pi * s;
+					float cosPhi = cos(phi), sinPhi = sin(phi);
+					float* vertex = vertices + ((size_t)j * (n + 1) + i) * stride;
+					if (sphere)
+					{
+						float nx = sinTheta * cosPhi, ny = cosTheta, nz = -sinTheta * sinPhi;
+						writeVertex(vertex, layout, nx * shape.radius, ny * shape.radius, nz * shape.radius, nx, ny, nz, s, t);
+					}
+					else
+					{
+						float ring = shape.radius + shape.tubeRadius * cosTheta;
+						float nx = cosTheta * cosPhi, ny = sinTheta, nz = -cosTheta * sinPhi;
+						writeVertex(vertex, layout, ring * cosPhi, shape.tubeRadius * sinTheta, -ring * sinPhi, nx, ny, nz, s, t);
+					}
+				}
+				if (j < m)
+					writeQuadIndices(indices + (size_t)j * n * 6, j * (n + 1), n);
+			}
+		});
+		break;
+	}
+	case SHAPE_ICOSPHERE:
+	{
+		const float g = 1.61803398875f; // golden ratio
+		static const int faces[20][3] = {
+			{ 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+			{ 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+			{ 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+			{ 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 },
+		};
+		const float corners[12][3] = {
+			{ -1, g, 0 }, { 1, g, 0 }, { -1, -g, 0 }, { 1, -g, 0 },
+			{ 0, -1, g }, { 0, 1, g }, { 0, -1, -g }, { 0, 1, -g },
+			{ g, 0, -1 }, { g, 0, 1 }, { -g, 0, -1 }, { -g, 0, 1 },
+		};
+		unsigned int faceVertices = (n + 1) * (n + 2) / 2;
+
+		// each face is a triangular grid: point (i, j) = A + (B - A) * i / n + (C - A) * j / n, pushed on the sphere
+		parallelFor((size_t)20 * (n + 1), pool, [&](size_t begin, size_t end)
+		{
+			for (size_t row = begin; row < end; row++)
+			{
+				unsigned int face = (unsigned int)(row / (n + 1)), j = (unsigned int)(row % (n + 1));
+				const float* A = corners[faces[face][0]];
+				const float* B = corners[faces[face][1]];
+				const float* C = corners[faces[face][2]];
+				unsigned int rowStart = face * faceVertices + j * (n + 1) - j * (j - 1) / 2;
+				for (unsigned int i = 0; i + j <= n; i++)
+				{
+					float wb = (float)i / n, wc = (float)j / n, wa = 1.0f - wb - wc;
+					float x = A[0] * wa + B[0] * wb + C[0] * wc;
+					float y = A[1] * wa + B[1] * wb + C[1] * wc;
+					float z = A[2] * wa + B[2] * wb + C[2] * wc;
+					float length = sqrt(x * x + y * y + z * z);
+					x /= length; y /= length; z /= length;
+					writeVertex(vertices + (size_t)(rowStart + i) * stride, layout, x * shape.radius, y * shape.radius, z * shape.radius,
+						x, y, z, 0.5f + atan2(-z, x) / (2.0f * pi), 0.5f + asin(y) / pi);
+				}
+				if (j == n)
+					continue;
+
+				// triangles between this row and the next one (which is one vertex shorter)
+				unsigned int nextStart = rowStart + (n + 1 - j);
+				unsigned int* out = indices + ((size_t)face * n * n + (size_t)j * (2 * n - j + 1) - j) * 3;
+				for (unsigned int i = 0; i + j < n; i++)
+				{
+					out[0] = rowStart + i; out[1] = rowStart + i + 1; out[2] = nextStart + i;
+					out += 3;
+					if (i + j + 1 < n)
+					{
+						out[0] = rowStart + i + 1; out[1] = nextStart + i + 1; out[2] = nextStart + i;
+						out += 3;
+					}
+				}
+			}
+		});
+		break;
+	}
+	case SHAPE_TERRAIN:
+	{
+		int width = shape.heightsWidth, depth = shape.heightsDepth;
+		if (width < 2 || depth < 2 || !shape.heights)
+			break;
+		float cellX = shape.size / (width - 1), cellZ = shape.size / (depth - 1);
+		auto height = [&](int x, int z)
+		{
+			x = std::min(std::max(x, 0), width - 1);
+			z = std::min(std::max(z, 0), depth - 1);
+			return shape.heights[(size_t)z * width + x] * shape.heightScale;
+		};
+
+		parallelFor((size_t)depth, pool, [&](size_t begin, size_t end)
+		{
+			for (size_t row = begin; row < end; row++)
+			{
+				int z = (int)row;
+				for (int x = 0; x < width; x++)
+				{
+					// normal of y = f(x, z) from central differences, rows go towards -z
+					float dx = (height(x + 1, z) - height(x - 1, z)) / (2.0f * cellX);
+					float dz = (height(x, z + 1) - height(x, z - 1)) / (-2.0f * cellZ);
+					float length = sqrt(dx * dx + 1.0f + dz * dz);
+					writeVertex(vertices + ((size_t)z * width + x) * stride, layout,
+						(x * cellX) - shape.size * 0.5f, height(x, z), shape.size * 0.5f - z * cellZ,
+						-dx / length, 1.0f / length, -dz / length,
+						(float)x / (width - 1), (float)z / (depth - 1));
+				}
+				if (z < depth - 1)
+					writeQuadIndices(indices + (size_t)z * (width - 1) * 6, z * width, width - 1);
+			}
+		});
+		break;
+	}
+	}
+}
+
+void GeometryGenerator::createMesh(const ShapeDesc& shape, const GeneratorLayout& layout, Mesh& mesh, WorkerPool* pool)
+{
+	size_t vertexCount, indexCount;
+	getCounts(shape, vertexCount, indexCount);
+	std::vector<float> vertices(vertexCount * layout.stride);
+	std::vector<unsigned int> indices(indexCount);
+	generate(shape, layout, vertices.data(), indices.data(), pool);
+
+	VertexAttribute attributes[4];
+	unsigned int numAttributes = layout.toAttributes(attributes);
+	mesh.CreateFromAttributes(vertices.data(), vertices.size() * sizeof(float), attributes, numAttributes,
+		indices.data(), (unsigned int)indexCount, GL_UNSIGNED_INT);
+
+	glm::vec3 extent;
+	switch (shape.type)
+	{
+	case SHAPE_UV_SPHERE:
+	case SHAPE_ICOSPHERE: extent = glm::vec3(shape.radius); break;
+	case SHAPE_TORUS: extent = glm::vec3(shape.radius + shape.tubeRadius, shape.tubeRadius, shape.radius + shape.tubeRadius); break;
+	case SHAPE_PLANE: extent = glm::vec3(shape.size * 0.5f, 0.0f, shape.size * 0.5f); break;
+	case SHAPE_TERRAIN:
+	{
+		float highest = 0.0f;
+		for (size_t i = 0; shape.heights && i < (size_t)shape.heightsWidth * shape.heightsDepth; i++)
+			highest = std::max(highest, std::abs(shape.heights[i] * shape.heightScale));
+		extent = glm::vec3(shape.size * 0.5f, highest, shape.size * 0.5f);
+		break;
+	}
+	default: extent = glm::vec3(shape.size * 0.5f);
+	}
+	mesh.setBounds(-extent, extent);
+}
+
+void GeometryGenerator::benchmark()
+{
+	ShapeDesc shape;
+	shape.type = SHAPE_UV_SPHERE;
+	shape.segments = 2048;
+	shape.rings = 1024; // 4M triangles
+
+	size_t vertexCount, indexCount;
+	getCounts(shape, vertexCount, indexCount);
+	GeneratorLayout layout = GeneratorLayout::VNT();
+	std::vector<float> vertices(vertexCount * layout.stride);
+	std::vector<unsigned int> indices(indexCount);
+
+	unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<unsigned int> threadCounts(1, 1);
+	if (cores > 1)
+		threadCounts.push_back(cores);
+	for (unsigned int threads : threadCounts)
+	{
+		WorkerPool pool(threads);
+		double best = 1e30;
+		for (int i = 0; i < 5; i++)
+		{
+			auto startTime = std::chrono::high_resolution_clock::now();
+			generate(shape, layout, vertices.data(), indices.data(), &pool);
+			best = std::min(best, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count());
+		}
+		std::cout << "GeometryGenerator::benchmark:: " << indexCount / 3 << " triangles, " << threads << " thread(s): "
+			<< (indexCount / 3) / best / 1e6 << " M triangles/s" << std::endl;
+	}
+}
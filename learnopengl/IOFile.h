@@ -4,6 +4,18 @@
 #include<fstream>
 #include<sstream>
 
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 class IOFile
 {
 public:
@@ -11,6 +23,34 @@ public:
 	static int saveFile(const char* path); 
 };
 
+// Read-only memory mapping of a whole file.
+// The OS pages the content in on demand, so big models are never copied into a heap buffer.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	// map the file, returns false if it can't be opened
+	bool open(const char* path);
+	void close();
+
+	const char* data() const { return mappedData; }
+	size_t size() const { return mappedSize; }
+
+private:
+	// a mapping owns OS handles, copying it would unmap twice
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	const char* mappedData;
+	size_t mappedSize;
+#ifdef _WIN32
+	HANDLE fileHandle;
+	HANDLE mappingHandle;
+#endif
+};
+
 std::string IOFile::readFile(const char* path)
 { 
 	std::ifstream file;
@@ -41,4 +81,91 @@ int IOFile::saveFile(const char* path)
 { 
 	std::cout << "IOFile::saveFile::Not implemented" << std::endl;
 	return -1;
+}
+
+
+MappedFile::MappedFile()
+{
+	mappedData = nullptr;
+	mappedSize = 0;
+#ifdef _WIN32
+	fileHandle = INVALID_HANDLE_VALUE;
+	mappingHandle = NULL;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+bool MappedFile::open(const char* path)
+{
+	close();
+#ifdef _WIN32
+	fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (fileHandle == INVALID_HANDLE_VALUE)
+	{
+		std::cout << "ERROR::MappedFile::open::" << path << " \t cannot open file" << std::endl;
+		return false;
+	}
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(fileHandle, &fileSize);
+	mappedSize = (size_t)fileSize.QuadPart;
+	if (mappedSize == 0) // an empty file can't be mapped, but it is a valid (empty) file
+		return true;
+
+	mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappingHandle != NULL)
+		mappedData = (const char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+	{
+		std::cout << "ERROR::MappedFile::open::" << path << " \t cannot open file" << std::endl;
+		return false;
+	}
+	struct stat fileStat;
+	fstat(fd, &fileStat);
+	mappedSize = (size_t)fileStat.st_size;
+	if (mappedSize == 0)
+	{
+		::close(fd);
+		return true;
+	}
+
+	void* ptr = mmap(NULL, mappedSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd); // the mapping keeps its own reference to the file
+	if (ptr != MAP_FAILED)
+	{
+		madvise(ptr, mappedSize, MADV_SEQUENTIAL); // we mostly stream through the file once
+		mappedData = (const char*)ptr;
+	}
+#endif
+	if (!mappedData)
+	{
+		std::cout << "ERROR::MappedFile::open::" << path << " \t cannot map file" << std::endl;
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (mappedData)
+		UnmapViewOfFile(mappedData);
+	if (mappingHandle != NULL)
+		CloseHandle(mappingHandle);
+	if (fileHandle != INVALID_HANDLE_VALUE)
+		CloseHandle(fileHandle);
+	mappingHandle = NULL;
+	fileHandle = INVALID_HANDLE_VALUE;
+#else
+	if (mappedData)
+		munmap((void*)mappedData, mappedSize);
+#endif
+	mappedData = nullptr;
+	mappedSize = 0;
 }
\ No newline at end of file
@@ -0,0 +1,1100 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include "stb_image.h" // declarations only, Texture.h holds the implementation
+#include "IOFile.h"
+#include "CookedMesh.h" // crc32, the one PNG chunks use
+#include "MipBuilder.h" // MipLevel
+#include "MathKernels.h" // SIMD level and target macros
+
+//
+// Image loading for the textures, rows bottom to top as OpenGL wants them.
+// 8 bit RGB and RGBA PNGs, not interlaced, are decoded here: stb_image's inflate, then the rows
+// are unfiltered with SSE or AVX2 and flipped while converted to the channel count asked for.
+// Everything else (JPEG, palettes, 16 bit, a tRNS colour key...) goes to stb_image, which has
+// SSE2 JPEG kernels.
+//
+// PNGs written by writePNG() (--cook-png) also decode in parallel. The image is deflated in
+// bands of rows: every band starts on a byte boundary with nothing referring to the bands
+// before it (a deflate full flush), its first row is filtered without the row above, and a
+// private 'spLT' chunk lists where the bands start in the zlib stream. Each band can then be
+// inflated and unfiltered on its own thread, while any other PNG reader sees a normal file.
+//
+class ImageLoader
+{
+public:
+	// Load an image with 'channels' channels (3 or 4). numThreads 0 uses every core.
+	// Prints why and returns false when the image cannot be loaded.
+	static bool load(const char* path, int channels, MipLevel& image, unsigned int numThreads = 0);
+	// Same, decoded straight where allocate(width, height) says once the header is read: it returns
+	// room for width * height * channels bytes (a mapped pixel unpack buffer...), or NULL to give up.
+	// A PNG the decoder handles goes there without another copy of the image.
+	template<typename Allocate> static bool loadInto(const char* path, int channels, Allocate allocate, unsigned int numThreads = 0);
+	// The PNG path alone, false without a message for what it leaves to stb_image
+	static bool decodePNG(const unsigned char* data, size_t size, int channels, MipLevel& image, unsigned int numThreads = 0);
+
+	// Encode pixels (rows bottom to top, 3 or 4 channels) as a PNG deflated in bands of bandRows rows
+	static std::vector<unsigned char> encodePNG(const unsigned char* pixels, int width, int height, int channels, int bandRows = 64, unsigned int numThreads = 0);
+	static bool writePNG(const char* path, const unsigned char* pixels, int width, int height, int channels, int bandRows = 64);
+
+	// Decode every image with decodePNG and with stb_image, as is and cooked in bands, with
+	// 3 and 4 channels, and compare the bytes. Used by --check-png.
+	static bool check(const char* path);
+	// Decode throughput of stb_image against decodePNG per SIMD level, on one thread and on
+	// every core, for the image as it is and cooked in bands
+	static void benchmark(const char* path);
+
+private:
+	enum { FILTER_NONE, FILTER_SUB, FILTER_UP, FILTER_AVERAGE, FILTER_PAETH };
+
+	// What decodePNG needs from the chunks, the IDATs are left in the file
+	struct PNGInfo
+	{
+		uint32_t width;
+		uint32_t height;
+		int bpp;
+		std::vector<std::pair<const unsigned char*, size_t>> idat;
+		size_t idatSize;
+		const unsigned char* split; // spLT chunk, NULL without one
+		size_t splitSize;
+	};
+	// False for anything the decoder leaves to stb_image
+	static bool parsePNG(const unsigned char* data, size_t size, PNGInfo& png);
+	static bool decodePNG(const PNGInfo& png, int channels, unsigned char* pixels, unsigned int numThreads);
+
+	// Undo a row's filter in place, previous is the row above unfiltered (zeros for the first
+	// row). False for an unknown filter.
+	typedef bool (*UnfilterKernel)(int filter, unsigned char* row, const unsigned char* previous, size_t rowBytes, int bpp);
+	static bool unfilterScalar(int filter, unsigned char* row, const unsigned char* previous, size_t rowBytes, int bpp);
+#ifdef MATH_KERNELS_X86
+	// Sub, Average and Paeth depend on the pixel on the left: one pixel per SSE register
+	// like libpng, Up is 16 bytes at a time (32 with AVX2)
+	static bool unfilterSSE(int filter, unsigned char* row, const unsigned char* previous, size_t rowBytes, int bpp);
+	MATH_TARGET_AVX2 static bool unfilterAVX2(int filter, unsigned char* row, const unsigned char* previous, size_t rowBytes, int bpp);
+	template<int bpp> static void unfilterPixelsSSE(int filter, unsigned char* row, const unsigned char* previous, size_t rowBytes);
+#endif
+	static UnfilterKernel unfilterKernel();
+	static int paeth(int a, int b, int c);
+
+	// Filtered rows of a PNG (filter byte first) to the image, flipped and converted
+	static void convertRows(const unsigned char* filtered, int width, int height, int bpp, int channels, size_t rowBegin, size_t rowEnd, unsigned char* pixels);
+
+	// deflate (RFC 1951) of a band, ended by a full flush or by the final block
+	static void deflate(const unsigned char* data, size_t size, bool last, std::vector<unsigned char>& out);
+	static void huffmanLengths(const uint32_t* frequencies, int count, int maxBits, unsigned char* lengths);
+	static void canonicalCodes(const unsigned char* lengths, int count, uint16_t* codes);
+	static uint32_t adler32(const unsigned char* data, size_t size, uint32_t adler);
+	static void writeChunk(std::vector<unsigned char>& png, const char* type, const unsigned char* data, size_t size);
+
+	static uint32_t readBE32(const unsigned char* p) { return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3]; }
+	static void writeBE32(std::vector<unsigned char>& out, uint32_t v) { unsigned char b[4] = { (unsigned char)(v >> 24), (unsigned char)(v >> 16), (unsigned char)(v >> 8), (unsigned char)v }; out.insert(out.end(), b, b + 4); }
+
+	template<typename Function> static void parallelFor(size_t count, unsigned int numThreads, Function function);
+};
+
+
+template<typename Function>
+void ImageLoader::parallelFor(size_t count, unsigned int numThreads, Function function)
+{
+	if (numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	numThreads = (unsigned int)std::min<size_t>(numThreads, count);
+	if (numThreads <= 1)
+	{
+		function((size_t)0, count);
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	size_t perThread = (count + numThreads - 1) / numThreads;
+	for (unsigned int i = 1; i < numThreads; i++)
+	{
+		size_t begin = std::min(count, i * perThread), end = std::min(count, begin + perThread);
+		workers.emplace_back([=]() { function(begin, end); });
+	}
+	function((size_t)0, std::min(count, perThread));
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+template<typename Allocate>
+bool ImageLoader::loadInto(const char* path, int channels, Allocate allocate, unsigned int numThreads)
+{
+	MappedFile file;
+	if (!file.open(path))
+		return false;
+	PNGInfo png;
+	unsigned char* pixels = NULL;
+	if (parsePNG((const unsigned char*)file.data(), file.size(), png) && (channels == 3 || channels == 4))
+	{
+		pixels = allocate((int)png.width, (int)png.height);
+		if (!pixels)
+			return false;
+		if (decodePNG(png, channels, pixels, numThreads))
+			return true;
+		// a damaged stream: stb_image says what is wrong with it
+	}
+
+	int width, height, nChannels;
+	stbi_set_flip_vertically_on_load(true); // flip to be comform with OpenGL standard
+	unsigned char* data = stbi_load_from_memory((const stbi_uc*)file.data(), (int)file.size(), &width, &height, &nChannels, channels);
+	if (!data)
+	{
+		std::cout << "ERROR::ImageLoader::load::" << path << " \t " << stbi_failure_reason() << std::endl;
+		return false;
+	}
+	if (!pixels)
+		pixels = allocate(width, height);
+	if (pixels)
+		memcpy(pixels, data, (size_t)width * height * channels);
+	stbi_image_free(data);
+	return pixels != NULL;
+}
+
+bool ImageLoader::load(const char* path, int channels, MipLevel& image, unsigned int numThreads)
+{
+	return loadInto(path, channels, [&](int width, int height)
+	{
+		image.width = width;
+		image.height = height;
+		image.pixels.resize((size_t)width * height * channels);
+		return image.pixels.data();
+	}, numThreads);
+}
+
+bool ImageLoader::decodePNG(const unsigned char* data, size_t size, int channels, MipLevel& image, unsigned int numThreads)
+{
+	PNGInfo png;
+	if (!parsePNG(data, size, png) || (channels != 3 && channels != 4))
+		return false;
+	image.width = (int)png.width;
+	image.height = (int)png.height;
+	image.pixels.resize((size_t)png.width * png.height * channels);
+	return decodePNG(png, channels, image.pixels.data(), numThreads);
+}
+
+bool ImageLoader::parsePNG(const unsigned char* data, size_t size, PNGInfo& png)
+{
+	static const unsigned char signature[8] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	if (size < 8 || memcmp(data, signature, 8) != 0)
+		return false;
+
+	// the chunks, IDATs are kept where they are
+	uint32_t width = 0, height = 0;
+	int bitDepth = 0, colorType = 0, interlace = 0;
+	std::vector<std::pair<const unsigned char*, size_t>>& idat = png.idat;
+	size_t idatSize = 0;
+	const unsigned char* split = NULL;
+	size_t splitSize = 0;
+	idat.clear();
+	for (size_t pos = 8; pos + 12 <= size; )
+	{
+		uint32_t length = readBE32(data + pos);
+		const unsigned char* type = data + pos + 4;
+		const unsigned char* body = data + pos + 8;
+		if (length > size - pos - 12)
+			return false;
+		if (memcmp(type, "IHDR", 4) == 0 && length >= 13)
+		{
+			width = readBE32(body);
+			height = readBE32(body + 4);
+			bitDepth = body[8];
+			colorType = body[9];
+			interlace = body[12];
+		}
+		else if (memcmp(type, "IDAT", 4) == 0)
+		{
+			idat.push_back(std::make_pair(body, (size_t)length));
+			idatSize += length;
+		}
+		else if (memcmp(type, "spLT", 4) == 0)
+		{
+			split = body;
+			splitSize = length;
+		}
+		else if (memcmp(type, "tRNS", 4) == 0 || memcmp(type, "CgBI", 4) == 0)
+			return false; // stb_image turns the colour key into alpha and undoes Apple's CgBI, the rows above do neither
+		else if (memcmp(type, "IEND", 4) == 0)
+			break;
+		pos += 12 + (size_t)length;
+	}
+	if (width == 0 || height == 0 || bitDepth != 8 || (colorType != 2 && colorType != 6) || interlace != 0 || idatSize < 6)
+		return false;
+	int bpp = colorType == 6 ? 4 : 3;
+	size_t rowBytes = (size_t)width * bpp;
+	// stb_image's inflate counts in int
+	if ((uint64_t)height * (rowBytes + 1) >= 0x7FFFFFFF || idatSize >= 0x7FFFFFFF)
+		return false;
+
+	png.width = width;
+	png.height = height;
+	png.bpp = bpp;
+	png.idatSize = idatSize;
+	png.split = split;
+	png.splitSize = splitSize;
+	return true;
+}
+
+bool ImageLoader::decodePNG(const PNGInfo& png, int channels, unsigned char* pixels, unsigned int numThreads)
+{
+	uint32_t width = png.width, height = png.height;
+	int bpp = png.bpp;
+	size_t rowBytes = (size_t)width * bpp;
+	const std::vector<std::pair<const unsigned char*, size_t>>& idat = png.idat;
+	size_t idatSize = png.idatSize;
+	const unsigned char* split = png.split;
+	size_t splitSize = png.splitSize;
+
+	// one zlib stream, copied only when it is split over several IDATs
+	std::vector<unsigned char> joined;
+	const unsigned char* zlib = idat[0].first;
+	if (idat.size() > 1)
+	{
+		joined.reserve(idatSize);
+		for (const std::pair<const unsigned char*, size_t>& chunk : idat)
+			joined.insert(joined.end(), chunk.first, chunk.first + chunk.second);
+		zlib = joined.data();
+	}
+
+	std::vector<unsigned char> filtered((size_t)height * (rowBytes + 1));
+	UnfilterKernel unfilter = unfilterKernel();
+	std::vector<unsigned char> zeros(rowBytes, 0);
+
+	// bands listed by spLT: bandRows, then the offset of every band in the zlib stream
+	uint32_t bandRows = split && splitSize >= 8 ? readBE32(split) : 0;
+	size_t bandCount = bandRows ? (height + bandRows - 1) / bandRows : 0;
+	bool banded = bandCount > 0 && splitSize == 4 + 4 * bandCount && readBE32(split + 4) == 2;
+	for (size_t band = 1; banded && band < bandCount; band++)
+		banded = readBE32(split + 4 + 4 * band) > readBE32(split + 4 * band) && readBE32(split + 4 + 4 * band) < idatSize - 4;
+
+	if (!banded)
+	{
+		if (stbi_zlib_decode_buffer((char*)filtered.data(), (int)filtered.size(), (const char*)zlib, (int)idatSize) != (int)filtered.size())
+			return false;
+		const unsigned char* previous = zeros.data();
+		for (size_t y = 0; y < height; y++)
+		{
+			unsigned char* row = filtered.data() + y * (rowBytes + 1);
+			if (!unfilter(row[0], row + 1, previous, rowBytes, bpp))
+				return false;
+			previous = row + 1;
+		}
+		parallelFor(height, numThreads, [&](size_t begin, size_t end)
+		{
+			convertRows(filtered.data(), (int)width, (int)height, bpp, channels, begin, end, pixels);
+		});
+		return true;
+	}
+
+	// a band: inflate (all but the last get a final empty stored block appended, their own
+	// blocks are not final), unfilter from a zero row above, convert
+	std::atomic<bool> failed(false);
+	parallelFor(bandCount, numThreads, [&](size_t begin, size_t end)
+	{
+		std::vector<unsigned char> input;
+		for (size_t band = begin; band < end && !failed; band++)
+		{
+			size_t rowBegin = band * bandRows, rowEnd = std::min<size_t>(height, rowBegin + bandRows);
+			size_t offset = readBE32(split + 4 + 4 * band);
+			// the last band keeps the adler32 after it: stb_image's inflate wants bytes to look ahead into
+			size_t next = band + 1 < bandCount ? readBE32(split + 8 + 4 * band) : idatSize;
+			unsigned char* out = filtered.data() + rowBegin * (rowBytes + 1);
+			int outSize = (int)((rowEnd - rowBegin) * (rowBytes + 1));
+			int decoded;
+			if (band + 1 == bandCount)
+				decoded = stbi_zlib_decode_noheader_buffer((char*)out, outSize, (const char*)zlib + offset, (int)(next - offset));
+			else
+			{
+				static const unsigned char finalBlock[5] = { 0x01, 0x00, 0x00, 0xFF, 0xFF };
+				input.assign(zlib + offset, zlib + next);
+				input.insert(input.end(), finalBlock, finalBlock + 5);
+				decoded = stbi_zlib_decode_noheader_buffer((char*)out, outSize, (const char*)input.data(), (int)input.size());
+			}
+			if (decoded != outSize || (out[0] != FILTER_NONE && out[0] != FILTER_SUB))
+			{
+				failed = true;
+				break;
+			}
+
+			const unsigned char* previous = zeros.data();
+			for (size_t y = rowBegin; y < rowEnd; y++)
+			{
+				unsigned char* row = filtered.data() + y * (rowBytes + 1);
+				if (!unfilter(row[0], row + 1, previous, rowBytes, bpp))
+				{
+					failed = true;
+					break;
+				}
+				previous = row + 1;
+			}
+			convertRows(filtered.data(), (int)width, (int)height, bpp, channels, rowBegin, rowEnd, pixels);
+		}
+	});
+	return !failed;
+}
+
+void ImageLoader::convertRows(const unsigned char* filtered, int width, int height, int bpp, int channels, size_t rowBegin, size_t rowEnd, unsigned char* pixels)
+{
+	size_t rowBytes = (size_t)width * bpp;
+	for (size_t y = rowBegin; y < rowEnd; y++)
+	{
+		const unsigned char* source = filtered + y * (rowBytes + 1) + 1;
+		unsigned char* dest = pixels + (height - 1 - y) * (size_t)width * channels; // bottom to top
+		if (bpp == channels)
+			memcpy(dest, source, rowBytes);
+		else if (channels == 4)
+			for (int x = 0; x < width; x++, source += 3, dest += 4)
+			{
+				dest[0] = source[0];
+				dest[1] = source[1];
+				dest[2] = source[2];
+				dest[3] = 255;
+			}
+		else
+			for (int x = 0; x < width; x++, source += 4, dest += 3)
+			{
+				dest[0] = source[0];
+				dest[1] = source[1];
+				dest[2] = source[2];
+			}
+	}
+}
+
+int ImageLoader::paeth(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+	return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+}
+
+ImageLoader::UnfilterKernel ImageLoader::unfilterKernel()
+{
+#ifdef MATH_KERNELS_X86
+	if (MathKernels::getLevel() == MathKernels::MATH_SSE)
+		return unfilterSSE;
+	if (MathKernels::getLevel() == MathKernels::MATH_AVX2)
+		return unfilterAVX2;
+#endif
+	return unfilterScalar;
+}
+
+bool ImageLoader::unfilterScalar(int filter, unsigned char* row, const unsigned char* previous, size_t rowBytes, int bpp)
+{
+	switch (filter)
+	{
+	case FILTER_NONE:
+		break;
+	case FILTER_SUB:
+		for (size_t i = bpp; i < rowBytes; i++)
+			row[i] += row[i - bpp];
+		break;
+	case FILTER_UP:
+		for (size_t i = 0; i < rowBytes; i++)
+			row[i] += previous[i];
+		break;
+	case FILTER_AVERAGE:
+		for (size_t i = 0; i < (size_t)bpp; i++)
+			row[i] += previous[i] >> 1;
+		for (size_t i = bpp; i < rowBytes; i++)
+			row[i] += (row[i - bpp] + previous[i]) >> 1;
+		break;
+	case FILTER_PAETH:
+		for (size_t i = 0; i < (size_t)bpp; i++)
+			row[i] += previous[i]; // nothing on the left: b wins
+		for (size_t i = bpp; i < rowBytes; i++)
+			row[i] += (unsigned char)paeth(row[i - bpp], previous[i], previous[i - bpp]);
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+#ifdef MATH_KERNELS_X86
+
+template<int bpp>
+void ImageLoader::unfilterPixelsSSE(int filter, unsigned char* row, const unsigned char* previous, size_t rowBytes)
+{
+	// 3 byte pixels are put together in a register, a 3 byte memcpy into an int stalls the load after it
+	auto load = [](const unsigned char* p) {
+		int v;
+		if (bpp == 4)
+			memcpy(&v, p, 4);
+		else
+			v = p[0] | p[1] << 8 | p[2] << 16;
+		return _mm_cvtsi32_si128(v);
+	};
+	auto store = [](unsigned char* p, __m128i v) {
+		int x = _mm_cvtsi128_si32(v);
+		if (bpp == 4)
+			memcpy(p, &x, 4);
+		else
+		{
+			p[0] = (unsigned char)x;
+			p[1] = (unsigned char)(x >> 8);
+			p[2] = (unsigned char)(x >> 16);
+		}
+	};
+	const __m128i zero = _mm_setzero_si128();
+
+	if (filter == FILTER_SUB)
+	{
+		__m128i a = zero;
+		for (size_t i = 0; i < rowBytes; i += bpp)
+		{
+			a = _mm_add_epi8(a, load(row + i));
+			store(row + i, a);
+		}
+	}
+	else if (filter == FILTER_AVERAGE)
+	{
+		// _mm_avg_epu8 rounds up, the filter rounds down
+		const __m128i one = _mm_set1_epi8(1);
+		__m128i a = zero;
+		for (size_t i = 0; i < rowBytes; i += bpp)
+		{
+			__m128i b = load(previous + i);
+			__m128i average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+			a = _mm_add_epi8(load(row + i), average);
+			store(row + i, a);
+		}
+	}
+	else // FILTER_PAETH, in 16 bit lanes
+	{
+		__m128i a = zero, c = zero;
+		for (size_t i = 0; i < rowBytes; i += bpp)
+		{
+			__m128i b = _mm_unpacklo_epi8(load(previous + i), zero);
+			__m128i x = _mm_unpacklo_epi8(load(row + i), zero);
+			// p = a + b - c, so p - a = b - c, p - b = a - c and p - c = (b - c) + (a - c)
+			__m128i pa = _mm_sub_epi16(b, c);
+			__m128i pb = _mm_sub_epi16(a, c);
+			__m128i pc = _mm_add_epi16(pa, pb);
+			pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+			pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+			pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+			// a if it is the closest, else b unless c is strictly closer
+			__m128i useC = _mm_cmpgt_epi16(pb, pc);
+			__m128i nearest = _mm_or_si128(_mm_and_si128(useC, c), _mm_andnot_si128(useC, b));
+			__m128i notA = _mm_cmpgt_epi16(pa, _mm_min_epi16(pb, pc));
+			__m128i predictor = _mm_or_si128(_mm_and_si128(notA, nearest), _mm_andnot_si128(notA, a));
+			a = _mm_and_si128(_mm_add_epi16(x, predictor), _mm_set1_epi16(0xFF));
+			c = b;
+			store(row + i, _mm_packus_epi16(a, a));
+		}
+	}
+}
+
+bool ImageLoader::unfilterSSE(int filter, unsigned char* row, const unsigned char* previous, size_t rowBytes, int bpp)
+{
+	if (filter == FILTER_NONE)
+		return true;
+	if (filter == FILTER_UP)
+	{
+		size_t i = 0;
+		for (; i + 16 <= rowBytes; i += 16)
+			_mm_storeu_si128((__m128i*)(row + i), _mm_add_epi8(_mm_loadu_si128((const __m128i*)(row + i)), _mm_loadu_si128((const __m128i*)(previous + i))));
+		for (; i < rowBytes; i++)
+			row[i] += previous[i];
+		return true;
+	}
+	if (filter > FILTER_PAETH || (bpp != 3 && bpp != 4))
+		return unfilterScalar(filter, row, previous, rowBytes, bpp);
+	if (bpp == 3)
+		unfilterPixelsSSE<3>(filter, row, previous, rowBytes);
+	else
+		unfilterPixelsSSE<4>(filter, row, previous, rowBytes);
+	return true;
+}
+
+MATH_TARGET_AVX2 bool ImageLoader::unfilterAVX2(int filter, unsigned char* row, const unsigned char* previous, size_t rowBytes, int bpp)
+{
+	if (filter != FILTER_UP)
+		return unfilterSSE(filter, row, previous, rowBytes, bpp);
+	size_t i = 0;
+	for (; i + 32 <= rowBytes; i += 32)
+		_mm256_storeu_si256((__m256i*)(row + i), _mm256_add_epi8(_mm256_loadu_si256((const __m256i*)(row + i)), _mm256_loadu_si256((const __m256i*)(previous + i))));
+	for (; i < rowBytes; i++)
+		row[i] += previous[i];
+	return true;
+}
+
+#endif
+
+std::vector<unsigned char> ImageLoader::encodePNG(const unsigned char* pixels, int width, int height, int channels, int bandRows, unsigned int numThreads)
+{
+	size_t rowBytes = (size_t)width * channels;
+	bandRows = std::max(1, bandRows);
+	size_t bandCount = ((size_t)height + bandRows - 1) / bandRows;
+	std::vector<std::vector<unsigned char>> filtered(bandCount), deflated(bandCount);
+
+	parallelFor(bandCount, numThreads, [&](size_t begin, size_t end)
+	{
+		std::vector<unsigned char> candidate(rowBytes);
+		for (size_t band = begin; band < end; band++)
+		{
+			size_t rowBegin = band * bandRows, rowEnd = std::min<size_t>(height, rowBegin + bandRows);
+			std::vector<unsigned char>& out = filtered[band];
+			out.resize((rowEnd - rowBegin) * (rowBytes + 1));
+			for (size_t y = rowBegin; y < rowEnd; y++)
+			{
+				// PNG rows go top to bottom
+				const unsigned char* row = pixels + (height - 1 - y) * rowBytes;
+				const unsigned char* above = y > rowBegin ? row + rowBytes : NULL;
+				unsigned char* dest = out.data() + (y - rowBegin) * (rowBytes + 1);
+
+				// the filter with the smallest sum of absolute differences, the usual heuristic;
+				// a band's first row can't look at the row above
+				int filterCount = above ? 5 : 2;
+				size_t bestScore = (size_t)-1;
+				for (int filter = FILTER_NONE; filter < filterCount; filter++)
+				{
+					size_t score = 0;
+					for (size_t i = 0; i < rowBytes; i++)
+					{
+						int a = i >= (size_t)channels ? row[i - channels] : 0;
+						int b = above ? above[i] : 0;
+						int c = above && i >= (size_t)channels ? above[i - channels] : 0;
+						int predictor = filter == FILTER_SUB ? a : filter == FILTER_UP ? b : filter == FILTER_AVERAGE ? (a + b) >> 1
+							: filter == FILTER_PAETH ? paeth(a, b, c) : 0;
+						candidate[i] = (unsigned char)(row[i] - predictor);
+						score += abs((signed char)candidate[i]);
+					}
+					if (score < bestScore)
+					{
+						bestScore = score;
+						dest[0] = (unsigned char)filter;
+						memcpy(dest + 1, candidate.data(), rowBytes);
+					}
+				}
+			}
+			deflate(out.data(), out.size(), band + 1 == bandCount, deflated[band]);
+		}
+	});
+
+	// zlib stream: header, the bands, adler32 of everything inflated
+	std::vector<unsigned char> zlib = { 0x78, 0x9C };
+	std::vector<unsigned char> split;
+	writeBE32(split, (uint32_t)bandRows);
+	uint32_t adler = 1;
+	for (size_t band = 0; band < bandCount; band++)
+	{
+		writeBE32(split, (uint32_t)zlib.size());
+		zlib.insert(zlib.end(), deflated[band].begin(), deflated[band].end());
+		adler = adler32(filtered[band].data(), filtered[band].size(), adler);
+	}
+	writeBE32(zlib, adler);
+
+	std::vector<unsigned char> png = { 137, 80, 78, 71, 13, 10, 26, 10 };
+	std::vector<unsigned char> header;
+	writeBE32(header, (uint32_t)width);
+	writeBE32(header, (uint32_t)height);
+	unsigned char format[5] = { 8, (unsigned char)(channels == 4 ? 6 : 2), 0, 0, 0 }; // 8 bit RGB(A), deflate, adaptive filters, no interlace
+	header.insert(header.end(), format, format + 5);
+	writeChunk(png, "IHDR", header.data(), header.size());
+	writeChunk(png, "spLT", split.data(), split.size());
+	writeChunk(png, "IDAT", zlib.data(), zlib.size());
+	writeChunk(png, "IEND", NULL, 0);
+	return png;
+}
+
+bool ImageLoader::writePNG(const char* path, const unsigned char* pixels, int width, int height, int channels, int bandRows)
+{
+	std::vector<unsigned char> png = encodePNG(pixels, width, height, channels, bandRows);
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cout << "ERROR::ImageLoader::writePNG::" << path << " \t cannot open file" << std::endl;
+		return false;
+	}
+	file.write((const char*)png.data(), png.size());
+	if (!file)
+	{
+		std::cout << "ERROR::ImageLoader::writePNG::" << path << " \t write failed" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void ImageLoader::writeChunk(std::vector<unsigned char>& png, const char* type, const unsigned char* data, size_t size)
+{
+	writeBE32(png, (uint32_t)size);
+	png.insert(png.end(), type, type + 4);
+	if (size > 0)
+		png.insert(png.end(), data, data + size);
+	writeBE32(png, CookedMesh::crc32(data, size, CookedMesh::crc32(type, 4)));
+}
+
+uint32_t ImageLoader::adler32(const unsigned char* data, size_t size, uint32_t adler)
+{
+	uint32_t a = adler & 0xFFFF, b = adler >> 16;
+	while (size > 0)
+	{
+		size_t block = std::min<size_t>(size, 5552); // the most bytes before b can overflow
+		for (size_t i = 0; i < block; i++)
+		{
+			a += data[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+		data += block;
+		size -= block;
+	}
+	return (b << 16) | a;
+}
+
+void ImageLoader::deflate(const unsigned char* data, size_t size, bool last, std::vector<unsigned char>& out)
+{
+	static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	static const unsigned char lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	static const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	static const unsigned char distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+	static const unsigned char codeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+	const int hashBits = 15, maxChain = 48, maxDistance = 32768, maxLength = 258;
+	const size_t blockTokens = 1 << 15;
+
+	// bits go out least significant first
+	uint64_t bitBuffer = 0;
+	int bitCount = 0;
+	auto put = [&](uint32_t value, int count)
+	{
+		bitBuffer |= (uint64_t)value << bitCount;
+		bitCount += count;
+		while (bitCount >= 8)
+		{
+			out.push_back((unsigned char)bitBuffer);
+			bitBuffer >>= 8;
+			bitCount -= 8;
+		}
+	};
+	auto align = [&]()
+	{
+		if (bitCount > 0)
+			out.push_back((unsigned char)bitBuffer);
+		bitBuffer = 0;
+		bitCount = 0;
+	};
+	// the codes double their range every 4 lengths and every 2 distances
+	auto highBit = [](int n) { int bit = 0; while (n >> (bit + 1)) bit++; return bit; };
+	auto lengthCode = [&](int length)
+	{
+		int n = length - 3;
+		if (length == 258)
+			return 28;
+		if (n < 8)
+			return n;
+		int bit = highBit(n);
+		return 4 * (bit - 1) + ((n >> (bit - 2)) & 3);
+	};
+	auto distanceCode = [&](int distance)
+	{
+		int n = distance - 1;
+		if (n < 4)
+			return n;
+		int bit = highBit(n);
+		return 2 * bit + ((n >> (bit - 1)) & 1);
+	};
+
+	// a token is a literal (distance 0) or a match
+	struct Token { uint16_t length; uint16_t distance; };
+	std::vector<Token> tokens;
+	tokens.reserve(blockTokens);
+
+	auto writeBlock = [&](bool final)
+	{
+		uint32_t literalFrequencies[286] = { 0 }, distanceFrequencies[30] = { 0 };
+		for (const Token& token : tokens)
+		{
+			if (token.distance == 0)
+				literalFrequencies[token.length]++;
+			else
+			{
+				literalFrequencies[257 + lengthCode(token.length)]++;
+				distanceFrequencies[distanceCode(token.distance)]++;
+			}
+		}
+		literalFrequencies[256] = 1; // end of block
+		unsigned char literalLengths[286], distanceLengths[30];
+		huffmanLengths(literalFrequencies, 286, 15, literalLengths);
+		huffmanLengths(distanceFrequencies, 30, 15, distanceLengths);
+		int literalCount = 286, distanceCount = 30;
+		while (literalCount > 257 && !literalLengths[literalCount - 1])
+			literalCount--;
+		while (distanceCount > 1 && !distanceLengths[distanceCount - 1])
+			distanceCount--;
+		if (!distanceLengths[0] && distanceCount == 1)
+			distanceLengths[0] = 1; // a block with no match still declares one distance code
+		uint16_t literalCodes[286], distanceCodes[30];
+		canonicalCodes(literalLengths, 286, literalCodes);
+		canonicalCodes(distanceLengths, 30, distanceCodes);
+
+		// both code length lists, run length encoded with the symbols 16 (repeat), 17 and 18 (zeros)
+		unsigned char lengths[286 + 30];
+		memcpy(lengths, literalLengths, literalCount);
+		memcpy(lengths + literalCount, distanceLengths, distanceCount);
+		int total = literalCount + distanceCount;
+		struct Run { unsigned char symbol; unsigned char extra; };
+		std::vector<Run> runs;
+		uint32_t runFrequencies[19] = { 0 };
+		for (int i = 0; i < total; )
+		{
+			int value = lengths[i], run = 1;
+			while (i + run < total && lengths[i + run] == value)
+				run++;
+			i += run;
+			if (value == 0)
+			{
+				for (; run >= 11; run -= std::min(run, 138))
+					runs.push_back({ 18, (unsigned char)(std::min(run, 138) - 11) });
+				if (run >= 3)
+				{
+					runs.push_back({ 17, (unsigned char)(run - 3) });
+					run = 0;
+				}
+			}
+			else
+			{
+				runs.push_back({ (unsigned char)value, 0 });
+				run--;
+				for (; run >= 3; run -= std::min(run, 6))
+					runs.push_back({ 16, (unsigned char)(std::min(run, 6) - 3) });
+			}
+			for (; run > 0; run--)
+				runs.push_back({ (unsigned char)value, 0 });
+		}
+		for (const Run& run : runs)
+			runFrequencies[run.symbol]++;
+		unsigned char runLengths[19];
+		uint16_t runCodes[19];
+		huffmanLengths(runFrequencies, 19, 7, runLengths);
+		canonicalCodes(runLengths, 19, runCodes);
+		int runCodeCount = 19;
+		while (runCodeCount > 4 && !runLengths[codeLengthOrder[runCodeCount - 1]])
+			runCodeCount--;
+
+		put(final ? 1 : 0, 1);
+		put(2, 2); // dynamic Huffman codes
+		put(literalCount - 257, 5);
+		put(distanceCount - 1, 5);
+		put(runCodeCount - 4, 4);
+		for (int i = 0; i < runCodeCount; i++)
+			put(runLengths[codeLengthOrder[i]], 3);
+		for (const Run& run : runs)
+		{
+			put(runCodes[run.symbol], runLengths[run.symbol]);
+			if (run.symbol >= 16)
+				put(run.extra, run.symbol == 16 ? 2 : run.symbol == 17 ? 3 : 7);
+		}
+		for (const Token& token : tokens)
+		{
+			if (token.distance == 0)
+			{
+				put(literalCodes[token.length], literalLengths[token.length]);
+				continue;
+			}
+			int code = lengthCode(token.length);
+			put(literalCodes[257 + code], literalLengths[257 + code]);
+			put(token.length - lengthBase[code], lengthExtra[code]);
+			code = distanceCode(token.distance);
+			put(distanceCodes[code], distanceLengths[code]);
+			put(token.distance - distanceBase[code], distanceExtra[code]);
+		}
+		put(literalCodes[256], literalLengths[256]);
+		tokens.clear();
+	};
+
+	// LZ77 with hash chains and one step of lazy matching
+	std::vector<int32_t> head((size_t)1 << hashBits, -1), previous(size);
+	auto hash = [&](size_t i) { return (((uint32_t)data[i] << 10) ^ ((uint32_t)data[i + 1] << 5) ^ data[i + 2]) & ((1u << hashBits) - 1); };
+	auto insert = [&](size_t i)
+	{
+		if (i + 2 < size)
+		{
+			uint32_t h = hash(i);
+			previous[i] = head[h];
+			head[h] = (int32_t)i;
+		}
+	};
+	auto findMatch = [&](size_t i, int& distance)
+	{
+		if (i + 2 >= size)
+			return 0;
+		int best = 2, limit = (int)std::min<size_t>(maxLength, size - i), chain = maxChain;
+		const unsigned char* current = data + i;
+		for (int32_t candidate = head[hash(i)]; candidate >= 0 && (int)(i - candidate) <= maxDistance && chain-- > 0; candidate = previous[candidate])
+		{
+			const unsigned char* match = data + candidate;
+			if (match[best] != current[best] || match[0] != current[0] || match[1] != current[1])
+				continue;
+			int length = 2;
+			while (length < limit && match[length] == current[length])
+				length++;
+			if (length > best)
+			{
+				best = length;
+				distance = (int)(i - candidate);
+				if (length == limit)
+					break;
+			}
+		}
+		return best >= 3 ? best : 0;
+	};
+	auto emit = [&](Token token)
+	{
+		tokens.push_back(token);
+		if (tokens.size() == blockTokens)
+			writeBlock(false);
+	};
+
+	bool pending = false; // a match found at i - 1, kept unless i has a longer one
+	int pendingLength = 0, pendingDistance = 0;
+	for (size_t i = 0; i < size; )
+	{
+		int distance = 0;
+		int length = findMatch(i, distance);
+		insert(i);
+		if (pending)
+		{
+			if (length > pendingLength)
+			{
+				emit({ data[i - 1], 0 });
+				pendingLength = length;
+				pendingDistance = distance;
+				i++;
+				continue;
+			}
+			emit({ (uint16_t)pendingLength, (uint16_t)pendingDistance });
+			size_t end = i - 1 + pendingLength;
+			for (size_t j = i + 1; j < end; j++)
+				insert(j);
+			i = end;
+			pending = false;
+		}
+		else if (length >= 3)
+		{
+			pending = true;
+			pendingLength = length;
+			pendingDistance = distance;
+			i++;
+		}
+		else
+		{
+			emit({ data[i], 0 });
+			i++;
+		}
+	}
+	if (pending)
+		emit({ (uint16_t)pendingLength, (uint16_t)pendingDistance });
+
+	writeBlock(last);
+	if (!last)
+	{
+		// full flush: an empty stored block brings the stream to a byte boundary
+		put(0, 1);
+		put(0, 2);
+		align();
+		put(0x0000, 16);
+		put(0xFFFF, 16);
+	}
+	align();
+}
+
+void ImageLoader::huffmanLengths(const uint32_t* frequencies, int count, int maxBits, unsigned char* lengths)
+{
+	std::vector<uint32_t> weights(frequencies, frequencies + count);
+	for (;;)
+	{
+		memset(lengths, 0, count);
+		std::vector<int> symbols;
+		for (int i = 0; i < count; i++)
+			if (weights[i] > 0)
+				symbols.push_back(i);
+		if (symbols.empty())
+			return;
+		if (symbols.size() == 1)
+		{
+			lengths[symbols[0]] = 1;
+			return;
+		}
+		std::sort(symbols.begin(), symbols.end(), [&](int a, int b) { return weights[a] < weights[b] || (weights[a] == weights[b] && a < b); });
+
+		// two queues: the sorted leaves, and the inner nodes which come out in increasing weight
+		size_t leafCount = symbols.size(), nodeCount = 2 * leafCount - 1;
+		std::vector<uint64_t> weight(nodeCount);
+		std::vector<int> parent(nodeCount, -1), depth(nodeCount, 0);
+		for (size_t i = 0; i < leafCount; i++)
+			weight[i] = weights[symbols[i]];
+		size_t leaf = 0, inner = leafCount;
+		auto lightest = [&](size_t next) { return leaf < leafCount && (inner >= next || weight[leaf] <= weight[inner]) ? leaf++ : inner++; };
+		for (size_t next = leafCount; next < nodeCount; next++)
+		{
+			size_t a = lightest(next), b = lightest(next);
+			weight[next] = weight[a] + weight[b];
+			parent[a] = parent[b] = (int)next;
+		}
+		int maxDepth = 0;
+		for (size_t i = nodeCount - 1; i-- > 0; )
+			depth[i] = depth[parent[i]] + 1;
+		for (size_t i = 0; i < leafCount; i++)
+		{
+			lengths[symbols[i]] = (unsigned char)depth[i];
+			maxDepth = std::max(maxDepth, depth[i]);
+		}
+		if (maxDepth <= maxBits)
+			return;
+		// too deep: flatten the distribution and build again
+		for (uint32_t& w : weights)
+			if (w > 0)
+				w = std::max(1u, w >> 1);
+	}
+}
+
+void ImageLoader::canonicalCodes(const unsigned char* lengths, int count, uint16_t* codes)
+{
+	int lengthCounts[16] = { 0 }, next[16] = { 0 };
+	for (int i = 0; i < count; i++)
+		lengthCounts[lengths[i]]++;
+	lengthCounts[0] = 0;
+	int code = 0;
+	for (int bits = 1; bits < 16; bits++)
+	{
+		code = (code + lengthCounts[bits - 1]) << 1;
+		next[bits] = code;
+	}
+	for (int i = 0; i < count; i++)
+	{
+		codes[i] = 0;
+		if (lengths[i] == 0)
+			continue;
+		// Huffman codes are sent most significant bit first, the writer goes the other way
+		int value = next[lengths[i]]++;
+		for (int bit = 0; bit < lengths[i]; bit++)
+			codes[i] |= (uint16_t)(((value >> bit) & 1) << (lengths[i] - 1 - bit));
+	}
+}
+
+bool ImageLoader::check(const char* path)
+{
+	MappedFile file;
+	if (!file.open(path))
+		return false;
+	const unsigned char* data = (const unsigned char*)file.data();
+	bool ok = true;
+	for (int channels = 3; channels <= 4; channels++)
+	{
+		int width, height, nChannels;
+		stbi_set_flip_vertically_on_load(true);
+		unsigned char* reference = stbi_load_from_memory(data, (int)file.size(), &width, &height, &nChannels, channels);
+		if (!reference)
+		{
+			std::cout << "ERROR::ImageLoader::check::" << path << " \t " << stbi_failure_reason() << std::endl;
+			return false;
+		}
+		size_t bytes = (size_t)width * height * channels;
+
+		// as it is
+		MipLevel image;
+		bool decoded = decodePNG(data, file.size(), channels, image);
+		bool same = !decoded || (image.width == width && image.height == height && memcmp(image.pixels.data(), reference, bytes) == 0);
+		// cooked in bands, decoded here and by stb_image, which must see a normal PNG
+		std::vector<unsigned char> cooked = encodePNG(reference, width, height, channels, 16);
+		MipLevel banded;
+		bool sameBanded = decodePNG(cooked.data(), cooked.size(), channels, banded) && banded.width == width && banded.height == height
+			&& memcmp(banded.pixels.data(), reference, bytes) == 0;
+		int stbWidth, stbHeight;
+		unsigned char* stbCooked = stbi_load_from_memory(cooked.data(), (int)cooked.size(), &stbWidth, &stbHeight, &nChannels, channels);
+		bool sameStb = stbCooked && memcmp(stbCooked, reference, bytes) == 0;
+		stbi_image_free(stbCooked);
+		stbi_image_free(reference);
+
+		std::cout << "ImageLoader::check::" << path << " \t" << width << "x" << height << " to " << channels << " channels: "
+			<< (decoded ? (same ? "same bytes as stb_image" : "DIFFERENT from stb_image") : "left to stb_image") << ", cooked in bands "
+			<< (sameBanded ? "same bytes" : "DIFFERENT") << " (stb_image " << (sameStb ? "same bytes" : "DIFFERENT") << ")" << std::endl;
+		ok = ok && same && sameBanded && sameStb;
+	}
+	return ok;
+}
+
+void ImageLoader::benchmark(const char* path)
+{
+	MappedFile file;
+	if (!file.open(path))
+		return;
+	MipLevel image;
+	if (!load(path, 4, image))
+		return;
+	int channels = 3;
+	{
+		int width, height, nChannels;
+		if (stbi_info_from_memory((const stbi_uc*)file.data(), (int)file.size(), &width, &height, &nChannels) && (nChannels == 2 || nChannels == 4))
+			channels = 4;
+	}
+	if (channels == 3)
+		load(path, 3, image);
+	unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+	double megapixels = (double)image.width * image.height / 1e6;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	std::vector<unsigned char> cooked = encodePNG(image.pixels.data(), image.width, image.height, channels);
+	double cookSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	std::cout << "ImageLoader::benchmark:: " << path << " " << image.width << "x" << image.height << " " << channels << " channels, "
+		<< file.size() / 1024 << " KB, cooked in bands " << cooked.size() / 1024 << " KB in " << cookSeconds * 1000.0 << " ms, best of 3 runs, "
+		<< cores << " cores" << std::endl;
+
+	auto best = [](auto function)
+	{
+		double seconds = 1e30;
+		for (int iteration = 0; iteration < 3; iteration++)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			function();
+			seconds = std::min(seconds, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count());
+		}
+		return seconds;
+	};
+
+	MathKernels::Level previous = MathKernels::getLevel();
+	const char* sourceNames[] = { "as is    ", "in bands " };
+	for (int source = 0; source < 2; source++)
+	{
+		const unsigned char* data = source ? cooked.data() : (const unsigned char*)file.data();
+		size_t size = source ? cooked.size() : file.size();
+		double stbSeconds = best([&]()
+		{
+			int width, height, nChannels;
+			stbi_set_flip_vertically_on_load(true);
+			stbi_image_free(stbi_load_from_memory(data, (int)size, &width, &height, &nChannels, channels));
+		});
+		std::cout << "  " << sourceNames[source] << " stb_image  \t " << megapixels / stbSeconds << " MP/s" << std::endl;
+
+		for (int level = MathKernels::MATH_SCALAR; level <= MathKernels::supportedLevel(); level++)
+		{
+			MathKernels::setLevel((MathKernels::Level)level);
+			MipLevel decoded;
+			bool supported = true;
+			double single = best([&]() { supported = decodePNG(data, size, channels, decoded, 1); });
+			double threaded = best([&]() { supported = decodePNG(data, size, channels, decoded, 0); });
+			if (!supported)
+			{
+				std::cout << "  " << sourceNames[source] << " not a PNG decodePNG handles" << std::endl;
+				break;
+			}
+			bool same = decoded.pixels == image.pixels;
+			std::cout << "  " << sourceNames[source] << " " << MathKernels::levelName((MathKernels::Level)level) << "    \t 1 thread "
+				<< megapixels / single << " MP/s (x" << stbSeconds / single << ") \t " << cores << " threads " << megapixels / threaded
+				<< " MP/s (x" << stbSeconds / threaded << ")" << (same ? "" : " \t DIFFERENT pixels") << std::endl;
+		}
+	}
+	MathKernels::setLevel(previous);
+}
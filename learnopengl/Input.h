@@ -0,0 +1,182 @@
+#pragma once
+
+#include <GLFW/glfw3.h>
+#include <atomic>
+#include <cstring>
+
+//
+// Single producer / single consumer ring buffer without locks.
+// The producer only writes tail and the consumer only writes head, each reads the other's
+// index with acquire ordering so the item written before the index update is visible.
+// Capacity must be a power of two.
+//
+template<typename T, unsigned int Capacity>
+class SpscQueue
+{
+public:
+	SpscQueue() : head(0), tail(0) {}
+
+	// producer side, returns false when the queue is full
+	bool push(const T& item);
+	// consumer side, NULL when the queue is empty
+	const T* front();
+	void pop();
+
+private:
+	static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of two");
+
+	T items[Capacity];
+	std::atomic<unsigned int> head; // next item to read
+	std::atomic<unsigned int> tail; // next slot to write
+};
+
+template<typename T, unsigned int Capacity>
+bool SpscQueue<T, Capacity>::push(const T& item)
+{
+	unsigned int currentTail = tail.load(std::memory_order_relaxed);
+	if (currentTail - head.load(std::memory_order_acquire) == Capacity)
+		return false;
+	items[currentTail & (Capacity - 1)] = item;
+	tail.store(currentTail + 1, std::memory_order_release);
+	return true;
+}
+
+template<typename T, unsigned int Capacity>
+const T* SpscQueue<T, Capacity>::front()
+{
+	unsigned int currentHead = head.load(std::memory_order_relaxed);
+	if (currentHead == tail.load(std::memory_order_acquire))
+		return NULL;
+	return &items[currentHead & (Capacity - 1)];
+}
+
+template<typename T, unsigned int Capacity>
+void SpscQueue<T, Capacity>::pop()
+{
+	head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+
+enum InputEventType
+{
+	INPUT_KEY,
+	INPUT_MOUSE_MOVE,
+	INPUT_SCROLL
+};
+
+struct InputEvent
+{
+	InputEventType type;
+	double time;     // glfwGetTime() when the callback ran
+	int key;         // INPUT_KEY: GLFW key and action
+	int action;
+	double x, y;     // INPUT_MOUSE_MOVE: cursor position, INPUT_SCROLL: offsets
+	double dx, dy;   // INPUT_MOUSE_MOVE: movement since the previous cursor position, filled when consumed
+};
+
+//
+// Input events recorded by the GLFW callbacks and consumed by the simulation at its own pace.
+// Callbacks only timestamp and queue, the simulation step pulls the events that happened
+// before the time it simulates up to, so its result does not depend on the frame rate.
+//
+class Input
+{
+public:
+	Input();
+
+	// producer side, called from the GLFW callbacks
+	void pushKey(int key, int action);
+	void pushMouseMove(double x, double y);
+	void pushScroll(double xOffset, double yOffset);
+
+	// consumer side: take the next event that happened at or before `time`, also tracks the key states
+	bool nextEvent(double time, InputEvent& event);
+	bool isKeyDown(int key) const { return key >= 0 && key <= GLFW_KEY_LAST && keyDown[key]; }
+
+	unsigned int getDroppedEvents() const { return droppedEvents.load(std::memory_order_relaxed); }
+
+private:
+	void push(const InputEvent& event);
+
+	SpscQueue<InputEvent, 1024> events;
+	std::atomic<unsigned int> droppedEvents;
+
+	// consumer state
+	bool keyDown[GLFW_KEY_LAST + 1];
+	bool hasMousePosition;
+	double lastMouseX, lastMouseY;
+};
+
+
+Input::Input()
+{
+	droppedEvents = 0;
+	memset(keyDown, 0, sizeof(keyDown));
+	hasMousePosition = false;
+	lastMouseX = 0.0;
+	lastMouseY = 0.0;
+}
+
+void Input::push(const InputEvent& event)
+{
+	// a full queue means the simulation stalled for a long time, losing input is better than blocking the callbacks
+	if (!events.push(event))
+		droppedEvents.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Input::pushKey(int key, int action)
+{
+	InputEvent event = {};
+	event.type = INPUT_KEY;
+	event.time = glfwGetTime();
+	event.key = key;
+	event.action = action;
+	push(event);
+}
+
+void Input::pushMouseMove(double x, double y)
+{
+	InputEvent event = {};
+	event.type = INPUT_MOUSE_MOVE;
+	event.time = glfwGetTime();
+	event.x = x;
+	event.y = y;
+	push(event);
+}
+
+void Input::pushScroll(double xOffset, double yOffset)
+{
+	InputEvent event = {};
+	event.type = INPUT_SCROLL;
+	event.time = glfwGetTime();
+	event.x = xOffset;
+	event.y = yOffset;
+	push(event);
+}
+
+bool Input::nextEvent(double time, InputEvent& event)
+{
+	const InputEvent* next = events.front();
+	if (!next || next->time > time)
+		return false;
+	event = *next;
+	events.pop();
+
+	if (event.type == INPUT_KEY && event.key >= 0 && event.key <= GLFW_KEY_LAST)
+	{
+		if (event.action == GLFW_PRESS)
+			keyDown[event.key] = true;
+		else if (event.action == GLFW_RELEASE)
+			keyDown[event.key] = false;
+	}
+	else if (event.type == INPUT_MOUSE_MOVE)
+	{
+		// the first position only sets the reference, to avoid the camera jumping
+		event.dx = hasMousePosition ? event.x - lastMouseX : 0.0;
+		event.dy = hasMousePosition ? event.y - lastMouseY : 0.0;
+		lastMouseX = event.x;
+		lastMouseY = event.y;
+		hasMousePosition = true;
+	}
+	return true;
+}
@@ -0,0 +1,516 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define MATH_KERNELS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define MATH_TARGET_AVX2      // MSVC emits AVX2 intrinsics without a target flag
+#else
+#define MATH_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+#endif
+
+//
+// Batched 4x4 matrix math on glm types, with a scalar reference, an SSE version and an
+// AVX2 + FMA version picked at runtime from what the CPU supports.
+// Matrices are column major like glm and the GL.
+//
+class MathKernels
+{
+public:
+	enum Level { MATH_SCALAR, MATH_SSE, MATH_AVX2 };
+
+	// out[i] = a[i] * b[i]
+	static void multiply(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count) { kernels().multiply(a, b, out, count); }
+	// out[i] = a * b[i], e.g. the view projection times every model matrix
+	static void multiply(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, size_t count) { kernels().multiplyShared(a, b, out, count); }
+	// out = a * b for a single pair, always the SSE version when there is one (nothing to dispatch on)
+	static void multiply(const glm::mat4& a, const glm::mat4& b, glm::mat4& out);
+
+	// out[i] = (m * vec4(points[i], 1)).xyz, in and out can be the same array
+	static void transformPoints(const glm::mat4& m, const glm::vec3* points, glm::vec3* out, size_t count) { kernels().transformPoints(m, points, out, count); }
+
+	// out[i] = translate(positions[i]) * mat4_cast(rotations[i]) * scale(scales[i])
+	static void composeTRS(const glm::vec3* positions, const glm::quat* rotations, const glm::vec3* scales, glm::mat4* out, size_t count)
+	{
+		kernels().composeTRS(positions, rotations, scales, out, count);
+	}
+
+	// Best level the CPU supports, and the one in use (setLevel clamps to what is supported)
+	static Level supportedLevel();
+	static Level getLevel() { return kernels().level; }
+	static void setLevel(Level level);
+	static const char* levelName(Level level);
+
+	// Compare every level against glm on count matrices / points and print the timings
+	static void benchmark(size_t count = 100000);
+
+private:
+	struct Kernels
+	{
+		Level level;
+		void (*multiply)(const glm::mat4*, const glm::mat4*, glm::mat4*, size_t);
+		void (*multiplyShared)(const glm::mat4&, const glm::mat4*, glm::mat4*, size_t);
+		void (*transformPoints)(const glm::mat4&, const glm::vec3*, glm::vec3*, size_t);
+		void (*composeTRS)(const glm::vec3*, const glm::quat*, const glm::vec3*, glm::mat4*, size_t);
+	};
+	static Kernels& kernels();
+	static Kernels kernelsFor(Level level);
+
+	static void multiplyScalar(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count);
+	static void multiplySharedScalar(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, size_t count);
+	static void transformPointsScalar(const glm::mat4& m, const glm::vec3* points, glm::vec3* out, size_t count);
+	static void composeTRSScalar(const glm::vec3* positions, const glm::quat* rotations, const glm::vec3* scales, glm::mat4* out, size_t count);
+
+#ifdef MATH_KERNELS_X86
+	static void multiplySSE(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count);
+	static void multiplySharedSSE(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, size_t count);
+	static void transformPointsSSE(const glm::mat4& m, const glm::vec3* points, glm::vec3* out, size_t count);
+	static void composeTRSSSE(const glm::vec3* positions, const glm::quat* rotations, const glm::vec3* scales, glm::mat4* out, size_t count);
+
+	MATH_TARGET_AVX2 static void multiplyAVX2(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count);
+	MATH_TARGET_AVX2 static void multiplySharedAVX2(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, size_t count);
+	MATH_TARGET_AVX2 static void transformPointsAVX2(const glm::mat4& m, const glm::vec3* points, glm::vec3* out, size_t count);
+	MATH_TARGET_AVX2 static void composeTRSAVX2(const glm::vec3* positions, const glm::quat* rotations, const glm::vec3* scales, glm::mat4* out, size_t count);
+#endif
+};
+
+
+MathKernels::Level MathKernels::supportedLevel()
+{
+#ifdef MATH_KERNELS_X86
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int maxLeaf = info[0];
+	bool avx2 = false;
+	if (maxLeaf >= 7)
+	{
+		__cpuid(info, 1);
+		bool fma = (info[2] & (1 << 12)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		// the OS has to save the YMM registers on context switches
+		bool ymmSaved = osxsave && (_xgetbv(0) & 6) == 6;
+		__cpuidex(info, 7, 0);
+		avx2 = fma && avx && ymmSaved && (info[1] & (1 << 5)) != 0;
+	}
+	return avx2 ? MATH_AVX2 : MATH_SSE;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return MATH_AVX2;
+	return MATH_SSE;
+#endif
+#else
+	return MATH_SCALAR;
+#endif
+}
+
+MathKernels::Kernels MathKernels::kernelsFor(Level level)
+{
+	Kernels result = { MATH_SCALAR, multiplyScalar, multiplySharedScalar, transformPointsScalar, composeTRSScalar };
+#ifdef MATH_KERNELS_X86
+	if (level == MATH_SSE)
+		result = { MATH_SSE, multiplySSE, multiplySharedSSE, transformPointsSSE, composeTRSSSE };
+	else if (level == MATH_AVX2)
+		result = { MATH_AVX2, multiplyAVX2, multiplySharedAVX2, transformPointsAVX2, composeTRSAVX2 };
+#endif
+	return result;
+}
+
+MathKernels::Kernels& MathKernels::kernels()
+{
+	static Kernels current = kernelsFor(supportedLevel());
+	return current;
+}
+
+void MathKernels::setLevel(Level level)
+{
+	kernels() = kernelsFor(std::min(level, supportedLevel()));
+}
+
+const char* MathKernels::levelName(Level level)
+{
+	static const char* names[] = { "scalar", "SSE", "AVX2" };
+	return names[level];
+}
+
+// --------------------------------------------------------------------------------------
+// Scalar reference
+// --------------------------------------------------------------------------------------
+
+static inline void mathMultiplyScalar(const float* a, const float* b, float* out)
+{
+	for (int column = 0; column < 4; column++)
+	{
+		for (int row = 0; row < 4; row++)
+		{
+			out[column * 4 + row] = a[row] * b[column * 4] + a[4 + row] * b[column * 4 + 1]
+				+ a[8 + row] * b[column * 4 + 2] + a[12 + row] * b[column * 4 + 3];
+		}
+	}
+}
+
+void MathKernels::multiplyScalar(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		float result[16]; // out may alias a or b
+		mathMultiplyScalar(&a[i][0][0], &b[i][0][0], result);
+		memcpy(&out[i][0][0], result, sizeof(result));
+	}
+}
+
+void MathKernels::multiplySharedScalar(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, size_t count)
+{
+	glm::mat4 left = a; // a may be one of the outputs
+	for (size_t i = 0; i < count; i++)
+	{
+		float result[16];
+		mathMultiplyScalar(&left[0][0], &b[i][0][0], result);
+		memcpy(&out[i][0][0], result, sizeof(result));
+	}
+}
+
+void MathKernels::transformPointsScalar(const glm::mat4& m, const glm::vec3* points, glm::vec3* out, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		glm::vec3 p = points[i];
+		out[i] = glm::vec3(m[0][0] * p.x + m[1][0] * p.y + m[2][0] * p.z + m[3][0],
+			m[0][1] * p.x + m[1][1] * p.y + m[2][1] * p.z + m[3][1],
+			m[0][2] * p.x + m[1][2] * p.y + m[2][2] * p.z + m[3][2]);
+	}
+}
+
+void MathKernels::composeTRSScalar(const glm::vec3* positions, const glm::quat* rotations, const glm::vec3* scales, glm::mat4* out, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		// translate * mat4_cast(rotation) * scale, written out to skip the two matrix products
+		const glm::quat& q = rotations[i];
+		const glm::vec3& s = scales[i];
+		float xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+		float xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+		float wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+		glm::mat4& m = out[i];
+		m[0][0] = (1.0f - 2.0f * (yy + zz)) * s.x;
+		m[0][1] = (2.0f * (xy + wz)) * s.x;
+		m[0][2] = (2.0f * (xz - wy)) * s.x;
+		m[0][3] = 0.0f;
+		m[1][0] = (2.0f * (xy - wz)) * s.y;
+		m[1][1] = (1.0f - 2.0f * (xx + zz)) * s.y;
+		m[1][2] = (2.0f * (yz + wx)) * s.y;
+		m[1][3] = 0.0f;
+		m[2][0] = (2.0f * (xz + wy)) * s.z;
+		m[2][1] = (2.0f * (yz - wx)) * s.z;
+		m[2][2] = (1.0f - 2.0f * (xx + yy)) * s.z;
+		m[2][3] = 0.0f;
+		m[3][0] = positions[i].x;
+		m[3][1] = positions[i].y;
+		m[3][2] = positions[i].z;
+		m[3][3] = 1.0f;
+	}
+}
+
+#ifdef MATH_KERNELS_X86
+
+// --------------------------------------------------------------------------------------
+// SSE: one matrix at a time, one register per column
+// --------------------------------------------------------------------------------------
+
+static inline void mathMultiplySSE(__m128 a0, __m128 a1, __m128 a2, __m128 a3, const float* b, float* out)
+{
+	// load all of b first, out may alias it
+	__m128 b0 = _mm_loadu_ps(b), b1 = _mm_loadu_ps(b + 4), b2 = _mm_loadu_ps(b + 8), b3 = _mm_loadu_ps(b + 12);
+	__m128 columns[4] = { b0, b1, b2, b3 };
+	for (int i = 0; i < 4; i++)
+	{
+		__m128 c = columns[i];
+		__m128 r = _mm_mul_ps(a0, _mm_shuffle_ps(c, c, _MM_SHUFFLE(0, 0, 0, 0)));
+		r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(c, c, _MM_SHUFFLE(1, 1, 1, 1))));
+		r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(c, c, _MM_SHUFFLE(2, 2, 2, 2))));
+		r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 3, 3, 3))));
+		_mm_storeu_ps(out + i * 4, r);
+	}
+}
+
+void MathKernels::multiplySSE(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		const float* pa = &a[i][0][0];
+		mathMultiplySSE(_mm_loadu_ps(pa), _mm_loadu_ps(pa + 4), _mm_loadu_ps(pa + 8), _mm_loadu_ps(pa + 12), &b[i][0][0], &out[i][0][0]);
+	}
+}
+
+void MathKernels::multiplySharedSSE(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, size_t count)
+{
+	const float* pa = &a[0][0];
+	__m128 a0 = _mm_loadu_ps(pa), a1 = _mm_loadu_ps(pa + 4), a2 = _mm_loadu_ps(pa + 8), a3 = _mm_loadu_ps(pa + 12);
+	for (size_t i = 0; i < count; i++)
+		mathMultiplySSE(a0, a1, a2, a3, &b[i][0][0], &out[i][0][0]);
+}
+
+void MathKernels::transformPointsSSE(const glm::mat4& m, const glm::vec3* points, glm::vec3* out, size_t count)
+{
+	const float* pm = &m[0][0];
+	__m128 m0 = _mm_loadu_ps(pm), m1 = _mm_loadu_ps(pm + 4), m2 = _mm_loadu_ps(pm + 8), m3 = _mm_loadu_ps(pm + 12);
+	for (size_t i = 0; i < count; i++)
+	{
+		__m128 r = _mm_add_ps(m3, _mm_mul_ps(m0, _mm_set1_ps(points[i].x)));
+		r = _mm_add_ps(r, _mm_mul_ps(m1, _mm_set1_ps(points[i].y)));
+		r = _mm_add_ps(r, _mm_mul_ps(m2, _mm_set1_ps(points[i].z)));
+		// 12 byte store, a 16 byte one would spill into the next point
+		_mm_storel_pi((__m64*)&out[i].x, r);
+		_mm_store_ss(&out[i].z, _mm_movehl_ps(r, r));
+	}
+}
+
+// The three rotation columns from a quaternion (x, y, z, w lanes), before scaling.
+// Each column is one + a * signsA + b * signsB where a and b are shuffled products of q and 2q.
+#define MATH_TRS_COLUMNS(SHUFFLE, MUL, ADD, SET, q, c0, c1, c2)                                                      \
+	{                                                                                                                  \
+		auto q2 = ADD(q, q);                                                                                           \
+		/* column 0: (1 - 2yy - 2zz, 2xy + 2wz, 2xz - 2wy) */                                                          \
+		auto a = MUL(SHUFFLE(q, _MM_SHUFFLE(3, 0, 0, 1)), SHUFFLE(q2, _MM_SHUFFLE(3, 2, 1, 1)));                        \
+		auto b = MUL(SHUFFLE(q, _MM_SHUFFLE(3, 3, 3, 2)), SHUFFLE(q2, _MM_SHUFFLE(3, 1, 2, 2)));                        \
+		c0 = ADD(ADD(SET(0.0f, 0.0f, 0.0f, 1.0f), MUL(a, SET(0.0f, 1.0f, 1.0f, -1.0f))), MUL(b, SET(0.0f, -1.0f, 1.0f, -1.0f))); \
+		/* column 1: (2xy - 2wz, 1 - 2xx - 2zz, 2yz + 2wx) */                                                          \
+		a = MUL(SHUFFLE(q, _MM_SHUFFLE(3, 1, 0, 0)), SHUFFLE(q2, _MM_SHUFFLE(3, 2, 0, 1)));                             \
+		b = MUL(SHUFFLE(q, _MM_SHUFFLE(3, 3, 2, 3)), SHUFFLE(q2, _MM_SHUFFLE(3, 0, 2, 2)));                             \
+		c1 = ADD(ADD(SET(0.0f, 0.0f, 1.0f, 0.0f), MUL(a, SET(0.0f, 1.0f, -1.0f, 1.0f))), MUL(b, SET(0.0f, 1.0f, -1.0f, -1.0f))); \
+		/* column 2: (2xz + 2wy, 2yz - 2wx, 1 - 2xx - 2yy) */                                                          \
+		a = MUL(SHUFFLE(q, _MM_SHUFFLE(3, 0, 1, 0)), SHUFFLE(q2, _MM_SHUFFLE(3, 0, 2, 2)));                             \
+		b = MUL(SHUFFLE(q, _MM_SHUFFLE(3, 1, 3, 3)), SHUFFLE(q2, _MM_SHUFFLE(3, 1, 0, 1)));                             \
+		c2 = ADD(ADD(SET(0.0f, 1.0f, 0.0f, 0.0f), MUL(a, SET(0.0f, -1.0f, 1.0f, 1.0f))), MUL(b, SET(0.0f, -1.0f, -1.0f, 1.0f))); \
+	}
+
+#define MATH_SHUFFLE_SSE(v, imm) _mm_shuffle_ps(v, v, imm)
+
+void MathKernels::composeTRSSSE(const glm::vec3* positions, const glm::quat* rotations, const glm::vec3* scales, glm::mat4* out, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		__m128 q = _mm_loadu_ps(&rotations[i].x);
+		__m128 c0, c1, c2;
+		MATH_TRS_COLUMNS(MATH_SHUFFLE_SSE, _mm_mul_ps, _mm_add_ps, _mm_set_ps, q, c0, c1, c2);
+
+		float* po = &out[i][0][0];
+		_mm_storeu_ps(po, _mm_mul_ps(c0, _mm_set1_ps(scales[i].x)));
+		_mm_storeu_ps(po + 4, _mm_mul_ps(c1, _mm_set1_ps(scales[i].y)));
+		_mm_storeu_ps(po + 8, _mm_mul_ps(c2, _mm_set1_ps(scales[i].z)));
+		_mm_storeu_ps(po + 12, _mm_set_ps(1.0f, positions[i].z, positions[i].y, positions[i].x));
+	}
+}
+
+// --------------------------------------------------------------------------------------
+// AVX2 + FMA: two columns (or two matrices) per 256 bit register
+// --------------------------------------------------------------------------------------
+
+MATH_TARGET_AVX2 static inline void mathMultiplyAVX2(__m256 a0, __m256 a1, __m256 a2, __m256 a3, const float* b, float* out)
+{
+	// a columns are duplicated in both halves, each half computes one column of the result
+	__m256 b01 = _mm256_loadu_ps(b), b23 = _mm256_loadu_ps(b + 8);
+
+	__m256 r01 = _mm256_mul_ps(a0, _mm256_permute_ps(b01, _MM_SHUFFLE(0, 0, 0, 0)));
+	r01 = _mm256_fmadd_ps(a1, _mm256_permute_ps(b01, _MM_SHUFFLE(1, 1, 1, 1)), r01);
+	r01 = _mm256_fmadd_ps(a2, _mm256_permute_ps(b01, _MM_SHUFFLE(2, 2, 2, 2)), r01);
+	r01 = _mm256_fmadd_ps(a3, _mm256_permute_ps(b01, _MM_SHUFFLE(3, 3, 3, 3)), r01);
+
+	__m256 r23 = _mm256_mul_ps(a0, _mm256_permute_ps(b23, _MM_SHUFFLE(0, 0, 0, 0)));
+	r23 = _mm256_fmadd_ps(a1, _mm256_permute_ps(b23, _MM_SHUFFLE(1, 1, 1, 1)), r23);
+	r23 = _mm256_fmadd_ps(a2, _mm256_permute_ps(b23, _MM_SHUFFLE(2, 2, 2, 2)), r23);
+	r23 = _mm256_fmadd_ps(a3, _mm256_permute_ps(b23, _MM_SHUFFLE(3, 3, 3, 3)), r23);
+
+	_mm256_storeu_ps(out, r01);
+	_mm256_storeu_ps(out + 8, r23);
+}
+
+void MathKernels::multiplyAVX2(const glm::mat4* a, const glm::mat4* b, glm::mat4* out, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		const float* pa = &a[i][0][0];
+		mathMultiplyAVX2(_mm256_broadcast_ps((const __m128*)pa), _mm256_broadcast_ps((const __m128*)(pa + 4)),
+			_mm256_broadcast_ps((const __m128*)(pa + 8)), _mm256_broadcast_ps((const __m128*)(pa + 12)), &b[i][0][0], &out[i][0][0]);
+	}
+}
+
+void MathKernels::multiplySharedAVX2(const glm::mat4& a, const glm::mat4* b, glm::mat4* out, size_t count)
+{
+	const float* pa = &a[0][0];
+	__m256 a0 = _mm256_broadcast_ps((const __m128*)pa), a1 = _mm256_broadcast_ps((const __m128*)(pa + 4));
+	__m256 a2 = _mm256_broadcast_ps((const __m128*)(pa + 8)), a3 = _mm256_broadcast_ps((const __m128*)(pa + 12));
+	for (size_t i = 0; i < count; i++)
+		mathMultiplyAVX2(a0, a1, a2, a3, &b[i][0][0], &out[i][0][0]);
+}
+
+void MathKernels::transformPointsAVX2(const glm::mat4& m, const glm::vec3* points, glm::vec3* out, size_t count)
+{
+	const float* pm = &m[0][0];
+	__m256 m0 = _mm256_broadcast_ps((const __m128*)pm), m1 = _mm256_broadcast_ps((const __m128*)(pm + 4));
+	__m256 m2 = _mm256_broadcast_ps((const __m128*)(pm + 8)), m3 = _mm256_broadcast_ps((const __m128*)(pm + 12));
+	const __m256i splatX = _mm256_setr_epi32(0, 0, 0, 0, 3, 3, 3, 3);
+	const __m256i splatY = _mm256_setr_epi32(1, 1, 1, 1, 4, 4, 4, 4);
+	const __m256i splatZ = _mm256_setr_epi32(2, 2, 2, 2, 5, 5, 5, 5);
+	const __m256i pack = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+
+	// two points per iteration; the 8 float load reads 2 floats past the pair, so stop one point early
+	size_t i = 0;
+	for (; i + 3 <= count; i += 2)
+	{
+		__m256 p = _mm256_loadu_ps(&points[i].x);
+		__m256 r = _mm256_fmadd_ps(m0, _mm256_permutevar8x32_ps(p, splatX), m3);
+		r = _mm256_fmadd_ps(m1, _mm256_permutevar8x32_ps(p, splatY), r);
+		r = _mm256_fmadd_ps(m2, _mm256_permutevar8x32_ps(p, splatZ), r);
+		// xyz xyz packed in the low 6 floats
+		r = _mm256_permutevar8x32_ps(r, pack);
+		_mm_storeu_ps(&out[i].x, _mm256_castps256_ps128(r));
+		_mm_storel_pi((__m64*)(&out[i].x + 4), _mm256_extractf128_ps(r, 1));
+	}
+	transformPointsSSE(m, points + i, out + i, count - i);
+}
+
+#define MATH_SHUFFLE_AVX(v, imm) _mm256_permute_ps(v, imm)
+#define MATH_SET_AVX(w, z, y, x) _mm256_setr_ps(x, y, z, w, x, y, z, w)
+
+void MathKernels::composeTRSAVX2(const glm::vec3* positions, const glm::quat* rotations, const glm::vec3* scales, glm::mat4* out, size_t count)
+{
+	// two matrices per iteration, one in each half of the registers
+	size_t i = 0;
+	for (; i + 2 <= count; i += 2)
+	{
+		__m256 q = _mm256_loadu_ps(&rotations[i].x);
+		__m256 c0, c1, c2;
+		MATH_TRS_COLUMNS(MATH_SHUFFLE_AVX, _mm256_mul_ps, _mm256_add_ps, MATH_SET_AVX, q, c0, c1, c2);
+
+		const glm::vec3& s0 = scales[i];
+		const glm::vec3& s1 = scales[i + 1];
+		c0 = _mm256_mul_ps(c0, _mm256_setr_ps(s0.x, s0.x, s0.x, s0.x, s1.x, s1.x, s1.x, s1.x));
+		c1 = _mm256_mul_ps(c1, _mm256_setr_ps(s0.y, s0.y, s0.y, s0.y, s1.y, s1.y, s1.y, s1.y));
+		c2 = _mm256_mul_ps(c2, _mm256_setr_ps(s0.z, s0.z, s0.z, s0.z, s1.z, s1.z, s1.z, s1.z));
+
+		float* p0 = &out[i][0][0];
+		float* p1 = &out[i + 1][0][0];
+		_mm_storeu_ps(p0, _mm256_castps256_ps128(c0));
+		_mm_storeu_ps(p0 + 4, _mm256_castps256_ps128(c1));
+		_mm_storeu_ps(p0 + 8, _mm256_castps256_ps128(c2));
+		_mm_storeu_ps(p0 + 12, _mm_setr_ps(positions[i].x, positions[i].y, positions[i].z, 1.0f));
+		_mm_storeu_ps(p1, _mm256_extractf128_ps(c0, 1));
+		_mm_storeu_ps(p1 + 4, _mm256_extractf128_ps(c1, 1));
+		_mm_storeu_ps(p1 + 8, _mm256_extractf128_ps(c2, 1));
+		_mm_storeu_ps(p1 + 12, _mm_setr_ps(positions[i + 1].x, positions[i + 1].y, positions[i + 1].z, 1.0f));
+	}
+	composeTRSSSE(positions + i, rotations + i, scales + i, out + i, count - i);
+}
+
+#endif // MATH_KERNELS_X86
+
+void MathKernels::multiply(const glm::mat4& a, const glm::mat4& b, glm::mat4& out)
+{
+#ifdef MATH_KERNELS_X86
+	multiplySharedSSE(a, &b, &out, 1);
+#else
+	multiplySharedScalar(a, &b, &out, 1);
+#endif
+}
+
+void MathKernels::benchmark(size_t count)
+{
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::vector<glm::vec3> positions(count), scales(count), points(count), pointsOut(count), pointsReference(count);
+	std::vector<glm::quat> rotations(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		positions[i] = glm::vec3(unit(random), unit(random), unit(random)) * 10.0f;
+		scales[i] = glm::vec3(1.5f + unit(random), 1.5f + unit(random), 1.5f + unit(random));
+		rotations[i] = glm::angleAxis(unit(random) * 3.14f, glm::normalize(glm::vec3(unit(random), unit(random), 1.0f)));
+		points[i] = glm::vec3(unit(random), unit(random), unit(random));
+	}
+	std::vector<glm::mat4> models(count), products(count), reference(count);
+	glm::mat4 viewProjection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f)
+		* glm::lookAt(glm::vec3(0.0f, 2.0f, 5.0f), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	const int iterations = 20;
+	auto time = [&](auto function)
+	{
+		double best = 1e30;
+		for (int iteration = 0; iteration < iterations; iteration++)
+		{
+			auto startTime = std::chrono::high_resolution_clock::now();
+			function();
+			best = std::min(best, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count());
+		}
+		return best * 1000.0;
+	};
+	auto maxError = [&](const std::vector<glm::mat4>& a, const std::vector<glm::mat4>& b)
+	{
+		float error = 0.0f;
+		for (size_t i = 0; i < count; i++)
+			for (int c = 0; c < 4; c++)
+				for (int r = 0; r < 4; r++)
+					error = std::max(error, std::fabs(a[i][c][r] - b[i][c][r]));
+		return error;
+	};
+
+	std::cout << "MathKernels::benchmark:: " << count << " matrices, best of " << iterations << " runs, CPU supports " << levelName(supportedLevel()) << std::endl;
+
+	// glm baselines, they are also the reference results
+	double glmTRS = time([&]()
+	{
+		for (size_t i = 0; i < count; i++)
+			reference[i] = glm::translate(glm::mat4(1.0f), positions[i]) * glm::mat4_cast(rotations[i]) * glm::scale(glm::mat4(1.0f), scales[i]);
+	});
+	models = reference;
+	std::vector<glm::mat4> productsReference(count);
+	double glmMultiply = time([&]()
+	{
+		for (size_t i = 0; i < count; i++)
+			productsReference[i] = viewProjection * models[i];
+	});
+	double glmPoints = time([&]()
+	{
+		for (size_t i = 0; i < count; i++)
+			pointsReference[i] = glm::vec3(viewProjection * glm::vec4(points[i], 1.0f));
+	});
+	std::cout << "  glm    \t TRS " << glmTRS << " ms \t viewProj*model " << glmMultiply << " ms \t points " << glmPoints << " ms" << std::endl;
+
+	Level previous = getLevel();
+	for (int level = MATH_SCALAR; level <= supportedLevel(); level++)
+	{
+		setLevel((Level)level);
+		double trs = time([&]() { composeTRS(positions.data(), rotations.data(), scales.data(), products.data(), count); });
+		float trsError = maxError(products, reference);
+		double shared = time([&]() { multiply(viewProjection, models.data(), products.data(), count); });
+		float sharedError = maxError(products, productsReference);
+		std::vector<glm::mat4> lefts(count, viewProjection);
+		double pairwise = time([&]() { multiply(lefts.data(), models.data(), products.data(), count); });
+		double pointsTime = time([&]() { transformPoints(viewProjection, points.data(), pointsOut.data(), count); });
+		float pointsError = 0.0f;
+		for (size_t i = 0; i < count; i++)
+			pointsError = std::max(pointsError, glm::length(pointsOut[i] - pointsReference[i]));
+
+		std::cout << "  " << levelName((Level)level) << "    \t TRS " << trs << " ms (x" << glmTRS / trs << ") \t viewProj*model " << shared
+			<< " ms (x" << glmMultiply / shared << "), pairwise " << pairwise << " ms \t points " << pointsTime << " ms (x" << glmPoints / pointsTime
+			<< ") \t max error " << std::max(std::max(trsError, sharedError), pointsError) << std::endl;
+	}
+	setLevel(previous);
+}
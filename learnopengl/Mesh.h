@@ -1,10 +1,63 @@
 #pragma once
 #include <glad/glad.h>
+#include <vector>
+#include <algorithm>
+
+#include <glm/vec3.hpp>
+
+// Attribute locations shared by every vertex shader
+enum VertexAttributeLocation
+{
+	ATTRIB_POSITION = 0,
+	ATTRIB_COLOR = 1,
+	ATTRIB_UV = 2,
+	ATTRIB_NORMAL = 3,
+	ATTRIB_INSTANCE_TEXTURE = 4,     // per instance, never in a mesh's vertices (see TextureArrayPool)
+	ATTRIB_INSTANCE_UV_TRANSFORM = 5 // per instance as well
+};
+
+// Where to find one attribute inside the vertex buffer (what glVertexAttribPointer needs)
+struct VertexAttribute
+{
+	unsigned int location; // one of VertexAttributeLocation
+	int components;        // 1 to 4
+	GLenum type;           // GL_FLOAT, GL_UNSIGNED_BYTE, ...
+	bool normalized;       // integer types mapped to [0,1] / [-1,1]
+	unsigned int stride;   // bytes between two vertices, 0 if tightly packed
+	unsigned int offset;   // bytes from the start of the buffer
+};
+
+// One level of detail: a range of the index buffer, all LODs share the same vertices
+struct MeshLod
+{
+	unsigned int firstIndex;
+	unsigned int indexCount;
+	float error; // how far (object space) this LOD strays from the full mesh
+};
+
+// CPU copy of a mesh, interleaved as position(3) normal(3) uv(2), the layout CreateVNT expects
+struct MeshData
+{
+	std::vector<float> vertices;
+	std::vector<unsigned int> indices;
+	std::vector<MeshLod> lods; // empty means a single LOD using every index
+
+	unsigned int vertexCount() const { return (unsigned int)(vertices.size() / 8); }
+
+	// axis aligned box around the positions
+	void computeBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const;
+};
+
 class Mesh {
 public:
 	Mesh();
 	~Mesh();
 	void draw();
+	// draw one level of detail, 0 being the full mesh
+	void draw(int lod);
+	// same, reading only the positions (depth prepass, shadow maps): a VAO with the position
+	// attribute alone over the same vertex buffer, made by the first call
+	void drawDepth(int lod = 0);
 
 	// Create a Mesh with Vertices, Color, and Texture coordinates provided
 	void CreateVCT(const float* vertices, const unsigned int* indices, unsigned int numVertices, unsigned int numIndices);
@@ -12,21 +65,71 @@ public:
 	// Create a Mesh with only Vertices provided
 	void CreateV(const float* vertices, const unsigned int* indices, unsigned int numVertices, unsigned int numIndices);
 
+	// Create a Mesh with Vertices, Normals, and Texture coordinates provided
+	void CreateVNT(const float* vertices, const unsigned int* indices, unsigned int numVertices, unsigned int numIndices);
+
+	// Create a Mesh from raw buffers described attribute by attribute,
+	// the data is uploaded as it is (used to send glTF binary buffers without repacking them).
+	void CreateFromAttributes(const void* vertexData, size_t vertexBytes, const VertexAttribute* attributes, unsigned int numAttributes,
+		const void* indices, unsigned int numIndices, GLenum indexType);
+
+	// object space bounding box, filled by the importers
+	void setBounds(glm::vec3 boundsMin, glm::vec3 boundsMax) { this->boundsMin = boundsMin; this->boundsMax = boundsMax; }
+	glm::vec3 getBoundsMin() const { return boundsMin; }
+	glm::vec3 getBoundsMax() const { return boundsMax; }
+
+	// LODs stored as ranges of the index buffer, by default a single one covering it all
+	void setLods(const std::vector<MeshLod>& lods) { if (!lods.empty()) this->lods = lods; }
+	int getLodCount() const { return (int)lods.size(); }
+
+	// Pick the LOD to draw from the screen space error: the coarsest one whose error,
+	// projected at 'distance', stays under maxPixelError pixels. pixelsPerUnit is
+	// viewportHeight / (2 * tan(fov / 2)). The current LOD is kept inside a hysteresis band
+	// so an object sitting at a switching distance does not pop back and forth.
+	int selectLod(float distance, float pixelsPerUnit, int currentLod, float maxPixelError = 1.0f, float hysteresis = 0.25f) const;
 
 private:
+	void drawElements(unsigned int vertexArray, int lod);
+	void createDepthArray();
+
 	unsigned int VBO;
 	unsigned int VAO;
+	unsigned int depthVAO; // the position attribute alone, 0 until drawDepth() needs it
+	VertexAttribute depthPosition; // what depthVAO reads, components 0 to draw the depth with VAO
 	unsigned int EBO;
 	unsigned int indicesCount;
+	GLenum indicesType; // GL_UNSIGNED_INT for our own meshes, imported ones may use smaller indices
+
+	glm::vec3 boundsMin;
+	glm::vec3 boundsMax;
+
+	std::vector<MeshLod> lods;
 };
 
+void MeshData::computeBounds(glm::vec3& boundsMin, glm::vec3& boundsMax) const
+{
+	boundsMin = boundsMax = glm::vec3(0.0f);
+	for (size_t i = 0; i < vertices.size(); i += 8)
+	{
+		glm::vec3 position(vertices[i], vertices[i + 1], vertices[i + 2]);
+		boundsMin = (i == 0) ? position : glm::min(boundsMin, position);
+		boundsMax = (i == 0) ? position : glm::max(boundsMax, position);
+	}
+}
+
+
 
 Mesh::Mesh( )
 {
 	VBO = 0;
 	VAO = 0;
 	EBO = 0;
+	depthVAO = 0;
+	depthPosition = { ATTRIB_POSITION, 0, GL_FLOAT, false, 0, 0 };
 	indicesCount = -1;
+	indicesType = GL_UNSIGNED_INT;
+	boundsMin = glm::vec3(-0.5f); // until an importer tells us better
+	boundsMax = glm::vec3(0.5f);
 }
 
 void Mesh::CreateVCT(const float* vertices, const unsigned int* indices, unsigned int numVertices, unsigned int numIndices)
@@ -100,11 +203,129 @@ void Mesh::CreateV(const float* vertices, const unsigned int* indices, unsigned
 	glBindVertexArray(0);
 
 }
+void Mesh::CreateVNT(const float* vertices, const unsigned int* indices, unsigned int numVertices, unsigned int numIndices)
+{
+	// same interleaving as CreateVCT, the normal takes the place of the color
+	const VertexAttribute attributes[] = {
+		{ ATTRIB_POSITION, 3, GL_FLOAT, false, 8 * sizeof(float), 0 },
+		{ ATTRIB_NORMAL,   3, GL_FLOAT, false, 8 * sizeof(float), 3 * sizeof(float) },
+		{ ATTRIB_UV,       2, GL_FLOAT, false, 8 * sizeof(float), 6 * sizeof(float) },
+	};
+	CreateFromAttributes(vertices, sizeof(vertices[0]) * numVertices, attributes, 3, indices, numIndices, GL_UNSIGNED_INT);
+}
+
+void Mesh::CreateFromAttributes(const void* vertexData, size_t vertexBytes, const VertexAttribute* attributes, unsigned int numAttributes,
+	const void* indices, unsigned int numIndices, GLenum indexType)
+{
+	indicesCount = numIndices;
+	indicesType = indexType;
+	lods.assign(1, MeshLod{ 0, numIndices, 0.0f });
+
+	unsigned int indexSize = (indexType == GL_UNSIGNED_BYTE) ? 1 : (indexType == GL_UNSIGNED_SHORT) ? 2 : 4;
+
+	glGenVertexArrays(1, &VAO);
+	glBindVertexArray(VAO);
+
+	glGenBuffers(1, &EBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)indexSize * numIndices, indices, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &VBO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)vertexBytes, vertexData, GL_STATIC_DRAW);
+
+	for (unsigned int i = 0; i < numAttributes; i++)
+	{
+		const VertexAttribute& attribute = attributes[i];
+		glVertexAttribPointer(attribute.location, attribute.components, attribute.type, attribute.normalized ? GL_TRUE : GL_FALSE,
+			attribute.stride, (void*)(size_t)attribute.offset);
+		glEnableVertexAttribArray(attribute.location);
+	}
+
+	// the depth passes read the positions only, their VAO is made when one draws the mesh
+	for (unsigned int i = 0; i < numAttributes; i++)
+		if (attributes[i].location == ATTRIB_POSITION && numAttributes > 1)
+			depthPosition = attributes[i];
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
 Mesh::~Mesh()
 {
 	glDeleteBuffers(1, &VBO);
 	glDeleteBuffers(1, &EBO);
 	glDeleteVertexArrays(1, &VAO);
+	glDeleteVertexArrays(1, &depthVAO);
+}
+
+void Mesh::draw(int lod)
+{
+	drawElements(VAO, lod);
+}
+
+void Mesh::drawDepth(int lod)
+{
+	if (!depthVAO && depthPosition.components)
+		createDepthArray();
+	drawElements(depthVAO ? depthVAO : VAO, lod);
+}
+
+void Mesh::createDepthArray()
+{
+	// the interleaved buffer itself, with every attribute but the position left disabled:
+	// no copy of the positions and no memory for meshes no depth pass draws
+	glGenVertexArrays(1, &depthVAO);
+	glBindVertexArray(depthVAO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);
+	glVertexAttribPointer(ATTRIB_POSITION, depthPosition.components, depthPosition.type, depthPosition.normalized ? GL_TRUE : GL_FALSE,
+		depthPosition.stride, (void*)(size_t)depthPosition.offset);
+	glEnableVertexAttribArray(ATTRIB_POSITION);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+void Mesh::drawElements(unsigned int vertexArray, int lod)
+{
+	glBindVertexArray(vertexArray);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	if (lods.empty())
+	{
+		glDrawElements(GL_TRIANGLES, indicesCount, indicesType, 0);
+		return;
+	}
+	const MeshLod& level = lods[std::min(std::max(lod, 0), (int)lods.size() - 1)];
+	unsigned int indexSize = (indicesType == GL_UNSIGNED_BYTE) ? 1 : (indicesType == GL_UNSIGNED_SHORT) ? 2 : 4;
+	glDrawElements(GL_TRIANGLES, level.indexCount, indicesType, (void*)((size_t)level.firstIndex * indexSize));
+}
+
+int Mesh::selectLod(float distance, float pixelsPerUnit, int currentLod, float maxPixelError, float hysteresis) const
+{
+	if (lods.size() <= 1)
+		return 0;
+	distance = std::max(distance, 1e-4f);
+	currentLod = std::min(std::max(currentLod, 0), (int)lods.size() - 1);
+
+	// the coarsest LOD which is precise enough
+	int wanted = 0;
+	for (int i = (int)lods.size() - 1; i > 0; i--)
+	{
+		if (lods[i].error * pixelsPerUnit / distance <= maxPixelError)
+		{
+			wanted = i;
+			break;
+		}
+	}
+
+	// going coarser needs the error under the threshold by the hysteresis margin,
+	// going finer happens only once the current LOD is clearly over the threshold
+	float margin = maxPixelError * (1.0f - hysteresis);
+	while (wanted > currentLod && lods[wanted].error * pixelsPerUnit / distance > margin)
+		wanted--;
+	if (wanted < currentLod && lods[currentLod].error * pixelsPerUnit / distance <= maxPixelError * (1.0f + hysteresis))
+		wanted = currentLod;
+	return wanted;
 }
 
 void Mesh::draw()
@@ -112,6 +333,6 @@ void Mesh::draw()
 	glBindVertexArray(VAO);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
 	//glDrawArrays(GL_TRIANGLES, 0, 3); // the starting index of the vertex array we'd like to draw, and how many vertices  
-	glDrawElements(GL_TRIANGLES, indicesCount, GL_UNSIGNED_INT, 0);
+	glDrawElements(GL_TRIANGLES, indicesCount, indicesType, 0);
 	//glBindVertexArray(0); // no need to unbind it every time
 }
\ No newline at end of file
@@ -0,0 +1,950 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <cctype>
+#include <cstdlib>
+#include <algorithm>
+
+#include "IOFile.h"
+#include "Mesh.h"
+#include "CookedMesh.h"
+#include "MeshSimplifier.h"
+
+// Minimal JSON document, only what the glTF loader needs
+struct JsonValue
+{
+	enum Type { JSON_NULL, JSON_BOOL, JSON_NUMBER, JSON_STRING, JSON_ARRAY, JSON_OBJECT };
+
+	Type type = JSON_NULL;
+	double number = 0.0;
+	std::string string;
+	std::vector<JsonValue> items;          // array elements
+	std::vector<std::string> keys;         // object member names, parallel to items
+
+	// object member lookup, returns a null value if missing
+	const JsonValue& operator[](const char* key) const;
+	// array element lookup, returns a null value if out of range
+	const JsonValue& operator[](size_t index) const;
+
+	bool isNull() const { return type == JSON_NULL; }
+	int asInt(int fallback = 0) const { return type == JSON_NUMBER ? (int)number : fallback; }
+	size_t size() const { return items.size(); }
+
+	// parse a whole document, returns false on syntax errors
+	static bool parse(const char* text, size_t length, JsonValue& out);
+
+private:
+	static bool parseValue(const char*& p, const char* end, JsonValue& out, int depth);
+	static bool parseString(const char*& p, const char* end, std::string& out);
+	static void skipSpaces(const char*& p, const char* end);
+};
+
+class MeshImporter
+{
+public:
+	// Load a Wavefront OBJ file (v, vt, vn, f) into an interleaved MeshData.
+	// numThreads = 0 uses every core, small files are always parsed on one thread
+	static bool loadOBJ(const char* path, MeshData& meshData, unsigned int numThreads = 0);
+
+	// Same as loadOBJ, for OBJ text already in memory
+	static bool parseOBJ(const char* text, size_t size, MeshData& meshData, unsigned int numThreads = 0);
+
+	// Load one primitive of a glTF 2.0 file (.gltf + .bin or .glb) into a Mesh.
+	// The binary buffer is memory mapped and handed to glBufferData as it is
+	static bool loadGLTF(const char* path, Mesh& mesh, int meshIndex = 0, int primitiveIndex = 0);
+
+	// Load any supported model file (.obj, .gltf, .glb or a cooked .mesh) into a Mesh, picking the importer from the extension
+	static bool loadModel(const char* path, Mesh& mesh);
+
+	// Parse an OBJ file several times and print the throughput, single-threaded vs all cores
+	static void benchmarkOBJ(const char* path, int iterations = 5);
+
+	// throughput of the last OBJ parse in MB/s
+	static double lastParseMBps;
+
+private:
+	struct ObjChunk
+	{
+		const char* begin;
+		const char* end;
+		// counts from the first pass, then offsets into the shared arrays after the prefix sum
+		size_t positions, uvs, normals, triangles;
+	};
+
+	static void countOBJChunk(ObjChunk& chunk);
+	static bool parseOBJChunk(const ObjChunk& chunk, float* positions, float* uvs, float* normals, int* corners);
+	static bool buildOBJVertices(const std::vector<float>& positions, const std::vector<float>& uvs, const std::vector<float>& normals,
+		const std::vector<int>& corners, MeshData& meshData);
+
+	static float parseFloat(const char*& p, const char* end);
+	static int parseInt(const char*& p, const char* end);
+	static bool endsWith(const char* path, const char* extension);
+};
+
+double MeshImporter::lastParseMBps = 0.0;
+
+
+//
+// JSON
+//
+
+const JsonValue& JsonValue::operator[](const char* key) const
+{
+	static const JsonValue nullValue;
+	if (type != JSON_OBJECT)
+		return nullValue;
+	for (size_t i = 0; i < keys.size(); i++)
+		if (keys[i] == key)
+			return items[i];
+	return nullValue;
+}
+
+const JsonValue& JsonValue::operator[](size_t index) const
+{
+	static const JsonValue nullValue;
+	if (type != JSON_ARRAY || index >= items.size())
+		return nullValue;
+	return items[index];
+}
+
+bool JsonValue::parse(const char* text, size_t length, JsonValue& out)
+{
+	const char* p = text;
+	const char* end = text + length;
+	if (!parseValue(p, end, out, 0))
+	{
+		std::cout << "ERROR::JSON::PARSE_FAILED at byte " << (p - text) << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void JsonValue::skipSpaces(const char*& p, const char* end)
+{
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r'))
+		p++;
+}
+
+bool JsonValue::parseString(const char*& p, const char* end, std::string& out)
+{
+	p++; // opening quote
+	out.clear();
+	while (p < end && *p != '"')
+	{
+		if (*p == '\\' && p + 1 < end)
+		{
+			p++;
+			switch (*p)
+			{
+			case 'n': out += '\n'; break;
+			case 't': out += '\t'; break;
+			case 'r': out += '\r'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'u': // glTF names are the only place this shows up, keep ASCII and drop the rest
+				if (p + 4 >= end)
+					return false;
+				{
+					unsigned int code = (unsigned int)strtoul(std::string(p + 1, 4).c_str(), NULL, 16);
+					out += (code < 128) ? (char)code : '?';
+				}
+				p += 4;
+				break;
+			default: out += *p; break; // \" \\ \/
+			}
+			p++;
+		}
+		else
+			out += *p++;
+	}
+	if (p >= end)
+		return false;
+	p++; // closing quote
+	return true;
+}
+
+bool JsonValue::parseValue(const char*& p, const char* end, JsonValue& out, int depth)
+{
+	if (depth > 64) // malformed or hostile file
+		return false;
+
+	skipSpaces(p, end);
+	if (p >= end)
+		return false;
+
+	if (*p == '{')
+	{
+		out.type = JSON_OBJECT;
+		p++;
+		skipSpaces(p, end);
+		if (p < end && *p == '}') { p++; return true; }
+		while (p < end)
+		{
+			skipSpaces(p, end);
+			if (p >= end || *p != '"')
+				return false;
+			out.keys.emplace_back();
+			if (!parseString(p, end, out.keys.back()))
+				return false;
+			skipSpaces(p, end);
+			if (p >= end || *p != ':')
+				return false;
+			p++;
+			out.items.emplace_back();
+			if (!parseValue(p, end, out.items.back(), depth + 1))
+				return false;
+			skipSpaces(p, end);
+			if (p < end && *p == ',') { p++; continue; }
+			if (p < end && *p == '}') { p++; return true; }
+			return false;
+		}
+		return false;
+	}
+	if (*p == '[')
+	{
+		out.type = JSON_ARRAY;
+		p++;
+		skipSpaces(p, end);
+		if (p < end && *p == ']') { p++; return true; }
+		while (p < end)
+		{
+			out.items.emplace_back();
+			if (!parseValue(p, end, out.items.back(), depth + 1))
+				return false;
+			skipSpaces(p, end);
+			if (p < end && *p == ',') { p++; continue; }
+			if (p < end && *p == ']') { p++; return true; }
+			return false;
+		}
+		return false;
+	}
+	if (*p == '"')
+	{
+		out.type = JSON_STRING;
+		return parseString(p, end, out.string);
+	}
+	if (end - p >= 4 && strncmp(p, "true", 4) == 0) { out.type = JSON_BOOL; out.number = 1.0; p += 4; return true; }
+	if (end - p >= 5 && strncmp(p, "false", 5) == 0) { out.type = JSON_BOOL; out.number = 0.0; p += 5; return true; }
+	if (end - p >= 4 && strncmp(p, "null", 4) == 0) { out.type = JSON_NULL; p += 4; return true; }
+
+	// number, strtod needs a terminated string so copy the (short) token first
+	const char* start = p;
+	while (p < end && (isdigit((unsigned char)*p) || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E'))
+		p++;
+	if (p == start)
+		return false;
+	out.type = JSON_NUMBER;
+	out.number = strtod(std::string(start, p).c_str(), NULL);
+	return true;
+}
+
+
+//
+// OBJ
+//
+
+// SWAR helpers: test and convert 8 ASCII digits at once with 64-bit integer arithmetic
+static inline bool objIsEightDigits(const char* p)
+{
+	uint64_t value;
+	memcpy(&value, p, 8);
+	return (((value & 0xF0F0F0F0F0F0F0F0ull) | (((value + 0x0606060606060606ull) & 0xF0F0F0F0F0F0F0F0ull) >> 4)) == 0x3333333333333333ull);
+}
+
+static inline uint32_t objParseEightDigits(const char* p)
+{
+	uint64_t value;
+	memcpy(&value, p, 8);
+	value = (value & 0x0F0F0F0F0F0F0F0Full) * 2561 >> 8;
+	value = (value & 0x00FF00FF00FF00FFull) * 6553601 >> 16;
+	return (uint32_t)((value & 0x0000FFFF0000FFFFull) * 42949672960001ull >> 32);
+}
+
+static inline bool objIsDigit(char c) { return c >= '0' && c <= '9'; }
+static inline bool objIsSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+float MeshImporter::parseFloat(const char*& p, const char* end)
+{
+	static const double powersOfTen[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		p++;
+	}
+
+	// up to 19 significant digits fit in 64 bits, the rest only moves the exponent
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int exponent = 0;
+
+	while (end - p >= 8 && digits <= 11 && objIsEightDigits(p))
+	{
+		mantissa = mantissa * 100000000ull + objParseEightDigits(p);
+		digits += 8;
+		p += 8;
+	}
+	while (p < end && objIsDigit(*p))
+	{
+		if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); digits++; }
+		else exponent++;
+		p++;
+	}
+
+	if (p < end && *p == '.')
+	{
+		p++;
+		while (end - p >= 8 && digits <= 11 && objIsEightDigits(p))
+		{
+			mantissa = mantissa * 100000000ull + objParseEightDigits(p);
+			digits += 8;
+			exponent -= 8;
+			p += 8;
+		}
+		while (p < end && objIsDigit(*p))
+		{
+			if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); digits++; exponent--; }
+			p++;
+		}
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		p++;
+		bool negativeExponent = false;
+		if (p < end && (*p == '-' || *p == '+'))
+		{
+			negativeExponent = (*p == '-');
+			p++;
+		}
+		int value = 0;
+		while (p < end && objIsDigit(*p))
+		{
+			if (value < 10000)
+				value = value * 10 + (*p - '0');
+			p++;
+		}
+		exponent += negativeExponent ? -value : value;
+	}
+
+	double result = (double)mantissa;
+	if (exponent < 0)
+		result = (exponent >= -22) ? result / powersOfTen[-exponent] : result * std::pow(10.0, exponent);
+	else if (exponent > 0)
+		result = (exponent <= 22) ? result * powersOfTen[exponent] : result * std::pow(10.0, exponent);
+
+	return (float)(negative ? -result : result);
+}
+
+int MeshImporter::parseInt(const char*& p, const char* end)
+{
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = (*p == '-');
+		p++;
+	}
+	int value = 0;
+	while (p < end && objIsDigit(*p))
+		value = value * 10 + (*p++ - '0');
+	return negative ? -value : value;
+}
+
+// First pass: only look at the first characters of each line to size every array up front,
+// so the real parse writes straight into its final place without any reallocation
+void MeshImporter::countOBJChunk(ObjChunk& chunk)
+{
+	chunk.positions = chunk.uvs = chunk.normals = chunk.triangles = 0;
+
+	const char* p = chunk.begin;
+	const char* end = chunk.end;
+	while (p < end)
+	{
+		const char* lineEnd = (const char*)memchr(p, '\n', end - p); // memchr is vectorized by the C library
+		if (!lineEnd)
+			lineEnd = end;
+
+		if (lineEnd - p >= 2)
+		{
+			if (p[0] == 'v')
+			{
+				if (objIsSpace(p[1])) chunk.positions++;
+				else if (p[1] == 't') chunk.uvs++;
+				else if (p[1] == 'n') chunk.normals++;
+			}
+			else if (p[0] == 'f' && objIsSpace(p[1]))
+			{
+				// a polygon with n corners gives n - 2 triangles in a fan
+				int corners = 0;
+				bool inToken = false;
+				for (const char* c = p + 1; c < lineEnd; c++)
+				{
+					bool space = objIsSpace(*c);
+					if (!space && !inToken)
+						corners++;
+					inToken = !space;
+				}
+				if (corners >= 3)
+					chunk.triangles += corners - 2;
+			}
+		}
+		p = lineEnd + 1;
+	}
+}
+
+// Second pass: parse the chunk, the offsets computed by the first pass tell where this chunk writes
+// and let negative (relative) OBJ indices resolve to global ones without a fix-up pass
+bool MeshImporter::parseOBJChunk(const ObjChunk& chunk, float* positions, float* uvs, float* normals, int* corners)
+{
+	size_t positionCount = chunk.positions;
+	size_t uvCount = chunk.uvs;
+	size_t normalCount = chunk.normals;
+
+	float* positionOut = positions + 3 * chunk.positions;
+	float* uvOut = uvs + 2 * chunk.uvs;
+	float* normalOut = normals + 3 * chunk.normals;
+	int* cornerOut = corners + 9 * chunk.triangles;
+
+	const char* p = chunk.begin;
+	const char* end = chunk.end;
+	while (p < end)
+	{
+		const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+		if (!lineEnd)
+			lineEnd = end;
+
+		if (lineEnd - p >= 2 && p[0] == 'v')
+		{
+			if (objIsSpace(p[1]))
+			{
+				p += 2;
+				for (int i = 0; i < 3; i++)
+				{
+					while (p < lineEnd && objIsSpace(*p)) p++;
+					*positionOut++ = parseFloat(p, lineEnd);
+				}
+				positionCount++;
+			}
+			else if (p[1] == 't')
+			{
+				p += 2;
+				for (int i = 0; i < 2; i++)
+				{
+					while (p < lineEnd && objIsSpace(*p)) p++;
+					*uvOut++ = parseFloat(p, lineEnd);
+				}
+				uvCount++;
+			}
+			else if (p[1] == 'n')
+			{
+				p += 2;
+				for (int i = 0; i < 3; i++)
+				{
+					while (p < lineEnd && objIsSpace(*p)) p++;
+					*normalOut++ = parseFloat(p, lineEnd);
+				}
+				normalCount++;
+			}
+		}
+		else if (lineEnd - p >= 2 && p[0] == 'f' && objIsSpace(p[1]))
+		{
+			p += 2;
+			int first[3], previous[3];
+			int cornerIndex = 0;
+			while (true)
+			{
+				while (p < lineEnd && objIsSpace(*p)) p++;
+				if (p >= lineEnd)
+					break;
+
+				// v, v/vt, v//vn or v/vt/vn; OBJ is 1-based and negative values count back from the last element
+				int corner[3] = { -1, -1, -1 };
+				size_t counts[3] = { positionCount, uvCount, normalCount };
+				for (int k = 0; k < 3; k++)
+				{
+					if (k > 0)
+					{
+						if (p >= lineEnd || *p != '/')
+							break;
+						p++;
+						if (p < lineEnd && *p == '/')
+							continue;
+					}
+					// 0, or a relative index before the first element, is invalid in every chunk: -2 fails the
+					// range check, whereas counting from this chunk's offset could land on a valid element
+					int value = parseInt(p, lineEnd);
+					if (value > 0)
+						corner[k] = value - 1;
+					else if (value < 0 && (int)counts[k] + value >= 0)
+						corner[k] = (int)counts[k] + value;
+					else
+						corner[k] = -2;
+				}
+				while (p < lineEnd && !objIsSpace(*p)) p++; // skip anything we did not understand
+
+				if (cornerIndex == 0)
+					memcpy(first, corner, sizeof(corner));
+				else if (cornerIndex >= 2)
+				{
+					memcpy(cornerOut, first, sizeof(first));
+					memcpy(cornerOut + 3, previous, sizeof(previous));
+					memcpy(cornerOut + 6, corner, sizeof(corner));
+					cornerOut += 9;
+				}
+				memcpy(previous, corner, sizeof(corner));
+				cornerIndex++;
+			}
+		}
+		p = lineEnd + 1;
+	}
+	return true;
+}
+
+// Turn v/vt/vn corners into unique interleaved vertices with an open addressing hash table
+bool MeshImporter::buildOBJVertices(const std::vector<float>& positions, const std::vector<float>& uvs, const std::vector<float>& normals,
+	const std::vector<int>& corners, MeshData& meshData)
+{
+	size_t cornerCount = corners.size() / 3;
+	int positionCount = (int)(positions.size() / 3);
+	int uvCount = (int)(uvs.size() / 2);
+	int normalCount = (int)(normals.size() / 3);
+
+	size_t tableSize = 1;
+	while (tableSize < cornerCount * 2)
+		tableSize <<= 1;
+	std::vector<unsigned int> table(tableSize, 0xFFFFFFFFu);
+	std::vector<int> uniqueCorners;
+	uniqueCorners.reserve(cornerCount * 3);
+
+	meshData.indices.resize(cornerCount);
+	for (size_t i = 0; i < cornerCount; i++)
+	{
+		const int* corner = &corners[i * 3];
+		if (corner[0] < 0 || corner[0] >= positionCount || corner[1] < -1 || corner[1] >= uvCount || corner[2] < -1 || corner[2] >= normalCount)
+		{
+			std::cout << "ERROR::MeshImporter::OBJ:: face index out of range" << std::endl;
+			return false;
+		}
+
+		uint64_t hash = ((uint64_t)(uint32_t)corner[0] * 73856093ull) ^ ((uint64_t)(uint32_t)corner[1] * 19349663ull) ^ ((uint64_t)(uint32_t)corner[2] * 83492791ull);
+		size_t slot = (size_t)(hash * 0x9E3779B97F4A7C15ull >> 20) & (tableSize - 1);
+		while (true)
+		{
+			unsigned int entry = table[slot];
+			if (entry == 0xFFFFFFFFu)
+			{
+				entry = (unsigned int)(uniqueCorners.size() / 3);
+				uniqueCorners.insert(uniqueCorners.end(), corner, corner + 3);
+				table[slot] = entry;
+				meshData.indices[i] = entry;
+				break;
+			}
+			const int* other = &uniqueCorners[entry * 3];
+			if (other[0] == corner[0] && other[1] == corner[1] && other[2] == corner[2])
+			{
+				meshData.indices[i] = entry;
+				break;
+			}
+			slot = (slot + 1) & (tableSize - 1);
+		}
+	}
+
+	size_t vertexCount = uniqueCorners.size() / 3;
+	meshData.vertices.assign(vertexCount * 8, 0.0f);
+	bool missingNormals = false;
+	for (size_t i = 0; i < vertexCount; i++)
+	{
+		const int* corner = &uniqueCorners[i * 3];
+		float* vertex = &meshData.vertices[i * 8];
+		memcpy(vertex, &positions[corner[0] * 3], 3 * sizeof(float));
+		if (corner[2] >= 0)
+			memcpy(vertex + 3, &normals[corner[2] * 3], 3 * sizeof(float));
+		else
+			missingNormals = true;
+		if (corner[1] >= 0)
+			memcpy(vertex + 6, &uvs[corner[1] * 2], 2 * sizeof(float));
+	}
+
+	// lighting needs normals, build smooth ones from the faces for the vertices that have none
+	if (missingNormals)
+	{
+		for (size_t t = 0; t + 2 < meshData.indices.size(); t += 3)
+		{
+			float* v[3];
+			for (int k = 0; k < 3; k++)
+				v[k] = &meshData.vertices[meshData.indices[t + k] * 8];
+			float e1[3] = { v[1][0] - v[0][0], v[1][1] - v[0][1], v[1][2] - v[0][2] };
+			float e2[3] = { v[2][0] - v[0][0], v[2][1] - v[0][1], v[2][2] - v[0][2] };
+			float n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+			for (int k = 0; k < 3; k++)
+				if (uniqueCorners[meshData.indices[t + k] * 3 + 2] < 0)
+					for (int c = 0; c < 3; c++)
+						v[k][3 + c] += n[c];
+		}
+		for (size_t i = 0; i < vertexCount; i++)
+		{
+			if (uniqueCorners[i * 3 + 2] >= 0)
+				continue;
+			float* n = &meshData.vertices[i * 8 + 3];
+			float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+			if (length > 0.0f)
+				for (int k = 0; k < 3; k++)
+					n[k] /= length;
+		}
+	}
+	return true;
+}
+
+bool MeshImporter::parseOBJ(const char* text, size_t size, MeshData& meshData, unsigned int numThreads)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	if (numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	if (size < (1u << 20)) // not worth starting threads for small files
+		numThreads = 1;
+
+	// split the text in chunks ending on a line break
+	std::vector<ObjChunk> chunks(numThreads);
+	const char* end = text + size;
+	const char* chunkBegin = text;
+	for (unsigned int i = 0; i < numThreads; i++)
+	{
+		const char* chunkEnd = (i + 1 == numThreads) ? end : text + size / numThreads * (i + 1);
+		if (chunkEnd < chunkBegin)
+			chunkEnd = chunkBegin;
+		if (chunkEnd < end)
+		{
+			const char* lineEnd = (const char*)memchr(chunkEnd, '\n', end - chunkEnd);
+			chunkEnd = lineEnd ? lineEnd + 1 : end;
+		}
+		chunks[i].begin = chunkBegin;
+		chunks[i].end = chunkEnd;
+		chunkBegin = chunkEnd;
+	}
+
+	std::vector<std::thread> workers;
+	for (unsigned int i = 1; i < numThreads; i++)
+		workers.emplace_back(countOBJChunk, std::ref(chunks[i]));
+	countOBJChunk(chunks[0]);
+	for (std::thread& worker : workers)
+		worker.join();
+	workers.clear();
+
+	// prefix sum, every chunk now knows where its data starts
+	size_t totals[4] = { 0, 0, 0, 0 };
+	for (ObjChunk& chunk : chunks)
+	{
+		size_t counts[4] = { chunk.positions, chunk.uvs, chunk.normals, chunk.triangles };
+		chunk.positions = totals[0];
+		chunk.uvs = totals[1];
+		chunk.normals = totals[2];
+		chunk.triangles = totals[3];
+		for (int k = 0; k < 4; k++)
+			totals[k] += counts[k];
+	}
+
+	std::vector<float> positions(totals[0] * 3);
+	std::vector<float> uvs(totals[1] * 2);
+	std::vector<float> normals(totals[2] * 3);
+	std::vector<int> corners(totals[3] * 9);
+
+	for (unsigned int i = 1; i < numThreads; i++)
+		workers.emplace_back(parseOBJChunk, std::cref(chunks[i]), positions.data(), uvs.data(), normals.data(), corners.data());
+	parseOBJChunk(chunks[0], positions.data(), uvs.data(), normals.data(), corners.data());
+	for (std::thread& worker : workers)
+		worker.join();
+
+	if (totals[3] == 0)
+	{
+		std::cout << "ERROR::MeshImporter::OBJ:: no faces found" << std::endl;
+		return false;
+	}
+
+	bool success = buildOBJVertices(positions, uvs, normals, corners, meshData);
+
+	double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+	lastParseMBps = (seconds > 0.0) ? (size / (1024.0 * 1024.0)) / seconds : 0.0;
+	return success;
+}
+
+bool MeshImporter::loadOBJ(const char* path, MeshData& meshData, unsigned int numThreads)
+{
+	MappedFile file;
+	if (!file.open(path))
+		return false;
+	if (!parseOBJ(file.data(), file.size(), meshData, numThreads))
+	{
+		std::cout << "ERROR::MeshImporter::loadOBJ::" << path << std::endl;
+		return false;
+	}
+	std::cout << "MeshImporter::loadOBJ::" << path << " \t" << meshData.vertexCount() << " vertices, "
+		<< meshData.indices.size() / 3 << " triangles (" << lastParseMBps << " MB/s)" << std::endl;
+	return true;
+}
+
+void MeshImporter::benchmarkOBJ(const char* path, int iterations)
+{
+	MappedFile file;
+	if (!file.open(path))
+		return;
+
+	unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+	std::vector<unsigned int> threadCounts(1, 1);
+	if (cores > 1)
+		threadCounts.push_back(cores);
+	for (unsigned int threads : threadCounts)
+	{
+		double best = 0.0;
+		for (int i = 0; i < iterations; i++)
+		{
+			MeshData meshData;
+			if (!parseOBJ(file.data(), file.size(), meshData, threads))
+				return;
+			best = std::max(best, lastParseMBps);
+		}
+		std::cout << "MeshImporter::benchmarkOBJ::" << path << " \t" << (file.size() / (1024.0 * 1024.0)) << " MB, "
+			<< threads << " thread(s): " << best << " MB/s" << std::endl;
+	}
+}
+
+
+//
+// glTF 2.0
+//
+
+bool MeshImporter::loadGLTF(const char* path, Mesh& mesh, int meshIndex, int primitiveIndex)
+{
+	MappedFile file;
+	if (!file.open(path))
+		return false;
+
+	const char* jsonText = file.data();
+	size_t jsonLength = file.size();
+	const char* binChunk = nullptr;
+	size_t binLength = 0;
+
+	// .glb: 12 bytes header then a JSON chunk and an optional BIN chunk
+	uint32_t header[5] = {};
+	if (file.size() >= 20)
+		memcpy(header, file.data(), sizeof(header));
+	bool isBinary = (header[0] == 0x46546C67u); // "glTF"
+	if (isBinary)
+	{
+		if (header[1] != 2 || header[4] != 0x4E4F534Au) // version 2 and "JSON"
+		{
+			std::cout << "ERROR::MeshImporter::GLTF:: unsupported binary container " << path << std::endl;
+			return false;
+		}
+		jsonText = file.data() + 20;
+		jsonLength = header[3];
+		size_t binHeader = 20 + ((jsonLength + 3) & ~(size_t)3);
+		if (binHeader + 8 <= file.size())
+		{
+			uint32_t chunk[2];
+			memcpy(chunk, file.data() + binHeader, sizeof(chunk));
+			if (chunk[1] == 0x004E4942u && binHeader + 8 + chunk[0] <= file.size()) // "BIN"
+			{
+				binChunk = file.data() + binHeader + 8;
+				binLength = chunk[0];
+			}
+		}
+		if (20 + jsonLength > file.size())
+			return false;
+	}
+
+	JsonValue document;
+	if (!JsonValue::parse(jsonText, jsonLength, document))
+		return false;
+
+	const JsonValue& primitive = document["meshes"][(size_t)meshIndex]["primitives"][(size_t)primitiveIndex];
+	if (primitive.isNull())
+	{
+		std::cout << "ERROR::MeshImporter::GLTF:: no primitive " << meshIndex << "/" << primitiveIndex << " in " << path << std::endl;
+		return false;
+	}
+	if (primitive["mode"].asInt(4) != 4)
+	{
+		std::cout << "ERROR::MeshImporter::GLTF:: only triangle lists are supported" << std::endl;
+		return false;
+	}
+
+	// map every buffer: the GLB chunk, or external .bin files next to the .gltf
+	std::string directory(path);
+	size_t slash = directory.find_last_of("/\\");
+	directory = (slash == std::string::npos) ? "" : directory.substr(0, slash + 1);
+
+	const JsonValue& buffers = document["buffers"];
+	std::vector<MappedFile> bufferFiles(buffers.size());
+	std::vector<const char*> bufferData(buffers.size(), nullptr);
+	std::vector<size_t> bufferSize(buffers.size(), 0);
+	for (size_t i = 0; i < buffers.size(); i++)
+	{
+		const JsonValue& uri = buffers[i]["uri"];
+		if (uri.isNull() && isBinary && i == 0)
+		{
+			bufferData[i] = binChunk;
+			bufferSize[i] = binLength;
+		}
+		else if (uri.type == JsonValue::JSON_STRING && uri.string.compare(0, 5, "data:") != 0)
+		{
+			if (bufferFiles[i].open((directory + uri.string).c_str()))
+			{
+				bufferData[i] = bufferFiles[i].data();
+				bufferSize[i] = bufferFiles[i].size();
+			}
+		}
+		else
+			std::cout << "ERROR::MeshImporter::GLTF:: embedded data URIs are not supported" << std::endl;
+	}
+
+	// resolve an accessor into (buffer, byte offset, stride); the glTF componentType values are the GL enums
+	struct Accessor { int buffer; size_t offset; unsigned int stride; GLenum type; int components; bool normalized; unsigned int count; size_t size; };
+	auto resolveAccessor = [&](int index, Accessor& out) -> bool
+	{
+		const JsonValue& accessor = document["accessors"][(size_t)index];
+		const JsonValue& view = document["bufferViews"][(size_t)accessor["bufferView"].asInt(-1)];
+		if (accessor.isNull() || view.isNull())
+			return false;
+
+		static const char* typeNames[] = { "SCALAR", "VEC2", "VEC3", "VEC4" };
+		out.components = 0;
+		for (int k = 0; k < 4; k++)
+			if (accessor["type"].string == typeNames[k])
+				out.components = k + 1;
+		out.buffer = view["buffer"].asInt(-1);
+		out.offset = (size_t)view["byteOffset"].asInt(0) + (size_t)accessor["byteOffset"].asInt(0);
+		out.stride = (unsigned int)view["byteStride"].asInt(0);
+		out.type = (GLenum)accessor["componentType"].asInt(0);
+		out.normalized = accessor["normalized"].number != 0.0;
+		out.count = (unsigned int)accessor["count"].asInt(0);
+
+		unsigned int componentSize = (out.type == GL_BYTE || out.type == GL_UNSIGNED_BYTE) ? 1 : (out.type == GL_SHORT || out.type == GL_UNSIGNED_SHORT) ? 2 : 4;
+		unsigned int elementSize = componentSize * out.components;
+		out.size = (out.count == 0) ? 0 : (size_t)(out.stride ? out.stride : elementSize) * (out.count - 1) + elementSize;
+
+		return out.components != 0 && out.buffer >= 0 && out.buffer < (int)bufferData.size() && bufferData[out.buffer]
+			&& out.offset + out.size <= bufferSize[out.buffer];
+	};
+
+	static const char* attributeNames[] = { "POSITION", "COLOR_0", "TEXCOORD_0", "NORMAL" };
+	static const unsigned int attributeLocations[] = { ATTRIB_POSITION, ATTRIB_COLOR, ATTRIB_UV, ATTRIB_NORMAL };
+
+	Accessor accessors[4];
+	int numAccessors = 0;
+	VertexAttribute attributes[4];
+	for (int k = 0; k < 4; k++)
+	{
+		const JsonValue& index = primitive["attributes"][attributeNames[k]];
+		if (index.isNull())
+			continue;
+		if (!resolveAccessor(index.asInt(), accessors[numAccessors]))
+		{
+			std::cout << "ERROR::MeshImporter::GLTF:: invalid accessor for " << attributeNames[k] << std::endl;
+			return false;
+		}
+		const Accessor& accessor = accessors[numAccessors];
+		attributes[numAccessors] = { attributeLocations[k], accessor.components, accessor.type, accessor.normalized, accessor.stride, 0 };
+		numAccessors++;
+	}
+	if (numAccessors == 0 || primitive["attributes"]["POSITION"].isNull())
+	{
+		std::cout << "ERROR::MeshImporter::GLTF:: primitive has no POSITION" << std::endl;
+		return false;
+	}
+
+	// upload the smallest range of the buffer covering all the attributes, as one VBO
+	size_t rangeBegin = accessors[0].offset, rangeEnd = accessors[0].offset + accessors[0].size;
+	for (int k = 0; k < numAccessors; k++)
+	{
+		if (accessors[k].buffer != accessors[0].buffer)
+		{
+			std::cout << "ERROR::MeshImporter::GLTF:: attributes spread over several buffers are not supported" << std::endl;
+			return false;
+		}
+		rangeBegin = std::min(rangeBegin, accessors[k].offset);
+		rangeEnd = std::max(rangeEnd, accessors[k].offset + accessors[k].size);
+	}
+	for (int k = 0; k < numAccessors; k++)
+		attributes[k].offset = (unsigned int)(accessors[k].offset - rangeBegin);
+
+	const char* vertexData = bufferData[accessors[0].buffer] + rangeBegin;
+
+	if (!primitive["indices"].isNull())
+	{
+		Accessor indices;
+		if (!resolveAccessor(primitive["indices"].asInt(), indices) || indices.components != 1 || indices.stride != 0)
+		{
+			std::cout << "ERROR::MeshImporter::GLTF:: invalid index accessor" << std::endl;
+			return false;
+		}
+		mesh.CreateFromAttributes(vertexData, rangeEnd - rangeBegin, attributes, numAccessors,
+			bufferData[indices.buffer] + indices.offset, indices.count, indices.type);
+	}
+	else
+	{
+		// non indexed primitive, draw the vertices in order
+		std::vector<unsigned int> sequence(accessors[0].count);
+		for (unsigned int i = 0; i < accessors[0].count; i++)
+			sequence[i] = i;
+		mesh.CreateFromAttributes(vertexData, rangeEnd - rangeBegin, attributes, numAccessors,
+			sequence.data(), (unsigned int)sequence.size(), GL_UNSIGNED_INT);
+	}
+
+	// glTF requires min/max on POSITION accessors
+	const JsonValue& positionAccessor = document["accessors"][(size_t)primitive["attributes"]["POSITION"].asInt()];
+	if (positionAccessor["min"].size() == 3 && positionAccessor["max"].size() == 3)
+	{
+		const JsonValue& low = positionAccessor["min"];
+		const JsonValue& high = positionAccessor["max"];
+		mesh.setBounds(glm::vec3((float)low[(size_t)0].number, (float)low[(size_t)1].number, (float)low[(size_t)2].number),
+			glm::vec3((float)high[(size_t)0].number, (float)high[(size_t)1].number, (float)high[(size_t)2].number));
+	}
+
+	std::cout << "MeshImporter::loadGLTF::" << path << " \t" << accessors[0].count << " vertices" << std::endl;
+	return true;
+}
+
+
+bool MeshImporter::endsWith(const char* path, const char* extension)
+{
+	size_t pathLength = strlen(path), extensionLength = strlen(extension);
+	if (pathLength < extensionLength)
+		return false;
+	for (size_t i = 0; i < extensionLength; i++)
+		if (tolower((unsigned char)path[pathLength - extensionLength + i]) != extension[i])
+			return false;
+	return true;
+}
+
+bool MeshImporter::loadModel(const char* path, Mesh& mesh)
+{
+	if (endsWith(path, ".gltf") || endsWith(path, ".glb"))
+		return loadGLTF(path, mesh);
+	if (endsWith(path, ".mesh"))
+		return CookedMesh::load(path, mesh);
+
+	MeshData meshData;
+	if (!loadOBJ(path, meshData))
+		return false;
+	MeshSimplifier::buildLods(meshData);
+	mesh.CreateVNT(meshData.vertices.data(), meshData.indices.data(), (unsigned int)meshData.vertices.size(), (unsigned int)meshData.indices.size());
+	mesh.setLods(meshData.lods);
+
+	glm::vec3 boundsMin, boundsMax;
+	meshData.computeBounds(boundsMin, boundsMax);
+	mesh.setBounds(boundsMin, boundsMax);
+	return true;
+}
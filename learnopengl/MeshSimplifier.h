@@ -0,0 +1,322 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+#include "Mesh.h"
+
+//
+// Quadric error metric simplification (Garland & Heckbert) with half-edge collapses:
+// a vertex is always moved onto one of its neighbours, so no vertex is ever created
+// and every LOD is just another index range over the same vertex buffer.
+//
+class MeshSimplifier
+{
+public:
+	// Simplify a triangle list down to about targetIndexCount indices.
+	// vertices are interleaved with 'stride' floats per vertex, position first.
+	// Returns the geometric error (object space distance) of the result
+	static float simplify(const float* vertices, unsigned int vertexCount, unsigned int stride,
+		const std::vector<unsigned int>& indices, size_t targetIndexCount, std::vector<unsigned int>& result);
+
+	// Append a chain of LODs to meshData.indices, each about 'ratio' the size of the previous one,
+	// and describe them in meshData.lods (LOD 0 is the original mesh)
+	static void buildLods(MeshData& meshData, int maxLods = 4, float ratio = 0.5f);
+
+private:
+	struct Quadric
+	{
+		// symmetric 4x4 matrix, upper triangle
+		double a00, a01, a02, a03, a11, a12, a13, a22, a23, a33;
+		double weight; // total area of the planes, turns the error into a mean squared distance
+	};
+
+	// quadrics: one per vertex, built from indices when empty. Passing the same vector to the
+	// next step measures its collapses against the planes of the mesh the chain started from
+	static float simplify(const float* vertices, unsigned int vertexCount, unsigned int stride,
+		const std::vector<unsigned int>& indices, size_t targetIndexCount, std::vector<unsigned int>& result,
+		std::vector<Quadric>& quadrics);
+	static void addPlane(Quadric& q, double a, double b, double c, double d, double weight);
+	static void addQuadric(Quadric& q, const Quadric& other);
+	static double evaluate(const Quadric& q, const float* p);
+};
+
+
+void MeshSimplifier::addPlane(Quadric& q, double a, double b, double c, double d, double weight)
+{
+	q.a00 += weight * a * a; q.a01 += weight * a * b; q.a02 += weight * a * c; q.a03 += weight * a * d;
+	q.a11 += weight * b * b; q.a12 += weight * b * c; q.a13 += weight * b * d;
+	q.a22 += weight * c * c; q.a23 += weight * c * d;
+	q.a33 += weight * d * d;
+	q.weight += weight;
+}
+
+void MeshSimplifier::addQuadric(Quadric& q, const Quadric& o)
+{
+	q.a00 += o.a00; q.a01 += o.a01; q.a02 += o.a02; q.a03 += o.a03;
+	q.a11 += o.a11; q.a12 += o.a12; q.a13 += o.a13;
+	q.a22 += o.a22; q.a23 += o.a23;
+	q.a33 += o.a33;
+	q.weight += o.weight;
+}
+
+double MeshSimplifier::evaluate(const Quadric& q, const float* p)
+{
+	double x = p[0], y = p[1], z = p[2];
+	return q.a00 * x * x + 2 * q.a01 * x * y + 2 * q.a02 * x * z + 2 * q.a03 * x
+		+ q.a11 * y * y + 2 * q.a12 * y * z + 2 * q.a13 * y
+		+ q.a22 * z * z + 2 * q.a23 * z
+		+ q.a33;
+}
+
+float MeshSimplifier::simplify(const float* vertices, unsigned int vertexCount, unsigned int stride,
+	const std::vector<unsigned int>& indices, size_t targetIndexCount, std::vector<unsigned int>& result)
+{
+	std::vector<Quadric> quadrics;
+	return simplify(vertices, vertexCount, stride, indices, targetIndexCount, result, quadrics);
+}
+
+float MeshSimplifier::simplify(const float* vertices, unsigned int vertexCount, unsigned int stride,
+	const std::vector<unsigned int>& indices, size_t targetIndexCount, std::vector<unsigned int>& result,
+	std::vector<Quadric>& quadrics)
+{
+	result = indices;
+	if (indices.size() <= targetIndexCount || vertexCount == 0)
+		return 0.0f;
+
+	auto position = [&](unsigned int v) { return vertices + (size_t)v * stride; };
+
+	// vertices split by an attribute seam (same position, different normal/uv) share one "position vertex"
+	std::vector<unsigned int> positionOf(vertexCount);
+	std::vector<unsigned int> wedgeCount(vertexCount, 0);
+	{
+		size_t tableSize = 1;
+		while (tableSize < (size_t)vertexCount * 2)
+			tableSize <<= 1;
+		std::vector<unsigned int> table(tableSize, 0xFFFFFFFFu);
+		for (unsigned int v = 0; v < vertexCount; v++)
+		{
+			uint32_t bits[3];
+			memcpy(bits, position(v), sizeof(bits));
+			size_t slot = (size_t)((bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u)) & (tableSize - 1);
+			while (table[slot] != 0xFFFFFFFFu && memcmp(position(table[slot]), position(v), 3 * sizeof(float)) != 0)
+				slot = (slot + 1) & (tableSize - 1);
+			if (table[slot] == 0xFFFFFFFFu)
+				table[slot] = v;
+			positionOf[v] = table[slot];
+			wedgeCount[table[slot]]++;
+		}
+	}
+
+	// accumulate the plane of every triangle into the quadric of its corners (area weighted),
+	// unless a previous step left the quadrics of the mesh it started from
+	bool buildQuadrics = quadrics.size() != vertexCount;
+	if (buildQuadrics)
+	{
+		quadrics.resize(vertexCount);
+		memset(quadrics.data(), 0, quadrics.size() * sizeof(Quadric));
+	}
+	for (size_t t = 0; buildQuadrics && t + 2 < result.size(); t += 3)
+	{
+		const float* p0 = position(result[t]);
+		const float* p1 = position(result[t + 1]);
+		const float* p2 = position(result[t + 2]);
+		double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+		double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+		double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+		double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+		if (length == 0.0)
+			continue;
+		for (int k = 0; k < 3; k++)
+			n[k] /= length;
+		double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+		for (int k = 0; k < 3; k++)
+			addPlane(quadrics[positionOf[result[t + k]]], n[0], n[1], n[2], d, length * 0.5);
+	}
+
+	// open borders and attribute seams stay where they are, moving them tears the surface or the UVs
+	std::vector<char> locked(vertexCount, 0);
+	{
+		std::vector<uint64_t> edges;
+		edges.reserve(result.size());
+		for (size_t t = 0; t + 2 < result.size(); t += 3)
+			for (int k = 0; k < 3; k++)
+			{
+				uint64_t a = positionOf[result[t + k]], b = positionOf[result[t + (k + 1) % 3]];
+				edges.push_back(a < b ? (a << 32 | b) : (b << 32 | a));
+			}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i = 0; i < edges.size();)
+		{
+			size_t j = i;
+			while (j < edges.size() && edges[j] == edges[i])
+				j++;
+			if (j - i == 1)
+			{
+				locked[edges[i] >> 32] = 1;
+				locked[edges[i] & 0xFFFFFFFFu] = 1;
+			}
+			i = j;
+		}
+		for (unsigned int v = 0; v < vertexCount; v++)
+			if (wedgeCount[positionOf[v]] > 1)
+				locked[positionOf[v]] = 1;
+	}
+
+	struct Collapse
+	{
+		unsigned int from, to; // vertex indices
+		double cost;
+		bool operator<(const Collapse& other) const { return cost < other.cost; }
+	};
+	std::vector<Collapse> collapses;
+	std::vector<unsigned int> remap(vertexCount);
+	std::vector<char> touched(vertexCount);
+	std::vector<unsigned int> triangleStart(vertexCount + 1), triangleList;
+	double maxCost = 0.0;
+
+	// every pass collapses the cheapest independent edges, then the index list is rebuilt
+	while (result.size() > targetIndexCount)
+	{
+		collapses.clear();
+		for (size_t t = 0; t + 2 < result.size(); t += 3)
+			for (int k = 0; k < 3; k++)
+			{
+				unsigned int from = result[t + k], to = result[t + (k + 1) % 3];
+				unsigned int fromPosition = positionOf[from], toPosition = positionOf[to];
+				if (locked[fromPosition] || fromPosition == toPosition)
+					continue;
+				Quadric q = quadrics[fromPosition];
+				addQuadric(q, quadrics[toPosition]);
+				double cost = (q.weight > 0.0) ? evaluate(q, position(to)) / q.weight : 0.0;
+				collapses.push_back({ from, to, std::max(0.0, cost) });
+			}
+		if (collapses.empty())
+			break;
+		std::sort(collapses.begin(), collapses.end());
+
+		// triangles around each position vertex, to reject collapses that would flip one
+		std::fill(triangleStart.begin(), triangleStart.end(), 0);
+		for (size_t i = 0; i < result.size(); i++)
+			triangleStart[positionOf[result[i]] + 1]++;
+		for (unsigned int v = 0; v < vertexCount; v++)
+			triangleStart[v + 1] += triangleStart[v];
+		triangleList.resize(result.size());
+		{
+			std::vector<unsigned int> fill(triangleStart.begin(), triangleStart.end() - 1);
+			for (size_t i = 0; i < result.size(); i++)
+				triangleList[fill[positionOf[result[i]]]++] = (unsigned int)(i / 3);
+		}
+
+		for (unsigned int v = 0; v < vertexCount; v++)
+			remap[v] = v;
+		std::fill(touched.begin(), touched.end(), 0);
+
+		size_t trianglesLeft = result.size() / 3;
+		size_t targetTriangles = targetIndexCount / 3;
+		size_t applied = 0;
+		for (const Collapse& collapse : collapses)
+		{
+			if (trianglesLeft <= targetTriangles)
+				break;
+			unsigned int fromPosition = positionOf[collapse.from], toPosition = positionOf[collapse.to];
+			if (touched[fromPosition] || touched[toPosition])
+				continue;
+
+			bool flips = false;
+			const float* target = position(collapse.to);
+			for (unsigned int i = triangleStart[fromPosition]; i < triangleStart[fromPosition + 1] && !flips; i++)
+			{
+				const unsigned int* triangle = &result[triangleList[i] * 3];
+				int corner = 0;
+				bool hasTarget = false;
+				for (int k = 0; k < 3; k++)
+				{
+					if (positionOf[triangle[k]] == fromPosition) corner = k;
+					if (positionOf[triangle[k]] == toPosition) hasTarget = true;
+				}
+				if (hasTarget)
+					continue; // this triangle disappears
+				const float* p0 = position(triangle[corner]);
+				const float* p1 = position(triangle[(corner + 1) % 3]);
+				const float* p2 = position(triangle[(corner + 2) % 3]);
+				float before[3], after[3];
+				float e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] }, e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+				float f1[3] = { p1[0] - target[0], p1[1] - target[1], p1[2] - target[2] }, f2[3] = { p2[0] - target[0], p2[1] - target[1], p2[2] - target[2] };
+				before[0] = e1[1] * e2[2] - e1[2] * e2[1]; before[1] = e1[2] * e2[0] - e1[0] * e2[2]; before[2] = e1[0] * e2[1] - e1[1] * e2[0];
+				after[0] = f1[1] * f2[2] - f1[2] * f2[1]; after[1] = f1[2] * f2[0] - f1[0] * f2[2]; after[2] = f1[0] * f2[1] - f1[1] * f2[0];
+				if (before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.0f)
+					flips = true;
+			}
+			if (flips)
+				continue;
+
+			remap[collapse.from] = collapse.to;
+			addQuadric(quadrics[toPosition], quadrics[fromPosition]);
+			touched[fromPosition] = touched[toPosition] = 1;
+			// neighbours are frozen too, their triangles changed shape
+			for (unsigned int i = triangleStart[fromPosition]; i < triangleStart[fromPosition + 1]; i++)
+				for (int k = 0; k < 3; k++)
+					touched[positionOf[result[triangleList[i] * 3 + k]]] = 1;
+
+			maxCost = std::max(maxCost, collapse.cost);
+			trianglesLeft -= 2; // an interior edge collapse removes two triangles
+			applied++;
+		}
+		if (applied == 0)
+			break;
+
+		// rebuild the index list without the triangles that collapsed
+		size_t write = 0;
+		for (size_t t = 0; t + 2 < result.size(); t += 3)
+		{
+			unsigned int a = remap[result[t]], b = remap[result[t + 1]], c = remap[result[t + 2]];
+			if (positionOf[a] == positionOf[b] || positionOf[b] == positionOf[c] || positionOf[a] == positionOf[c])
+				continue;
+			result[write++] = a;
+			result[write++] = b;
+			result[write++] = c;
+		}
+		result.resize(write);
+	}
+
+	return (float)std::sqrt(maxCost);
+}
+
+void MeshSimplifier::buildLods(MeshData& meshData, int maxLods, float ratio)
+{
+	meshData.lods.clear();
+	meshData.lods.push_back({ 0, (unsigned int)meshData.indices.size(), 0.0f });
+
+	std::vector<unsigned int> previous = meshData.indices;
+	std::vector<unsigned int> lod;
+	std::vector<Quadric> quadrics;
+	float error = 0.0f;
+	for (int i = 1; i < maxLods; i++)
+	{
+		size_t target = (size_t)(previous.size() / 3 * ratio) * 3;
+		if (target < 12)
+			break;
+		// the quadrics carry over from step to step, so every collapse is measured against the planes of
+		// the full mesh it has absorbed. The error is the largest RMS plane distance of the chain so far,
+		// an estimate of the distance from the full mesh rather than a bound on it
+		error = std::max(error, simplify(meshData.vertices.data(), meshData.vertexCount(), 8, previous, target, lod, quadrics));
+
+		// stop when the simplifier can't make progress anymore (everything left is locked)
+		if (lod.size() > previous.size() * 0.9)
+			break;
+
+		meshData.lods.push_back({ (unsigned int)meshData.indices.size(), (unsigned int)lod.size(), error });
+		meshData.indices.insert(meshData.indices.end(), lod.begin(), lod.end());
+		previous.swap(lod);
+	}
+
+	std::cout << "MeshSimplifier::buildLods::";
+	for (const MeshLod& level : meshData.lods)
+		std::cout << " " << level.indexCount / 3 << " tris (error " << level.error << ")";
+	std::cout << std::endl;
+}
@@ -0,0 +1,715 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#include "MathKernels.h" // SIMD level and target macros
+
+enum MipFilter
+{
+	MIP_FILTER_BOX,    // 2x2 average, what glGenerateMipmap does
+	MIP_FILTER_KAISER  // Kaiser windowed sinc, 8 taps per axis: sharper distant textures, slower
+};
+
+struct MipSettings
+{
+	MipFilter filter = MIP_FILTER_BOX;
+	bool srgb = true;             // color channels are sRGB encoded and get filtered in linear space, alpha is always linear
+	float alphaCoverage = 0.0f;   // alpha test reference: every level keeps the fraction of texels passing it that the source has, 0 is off
+	int maxLevels = 0;            // levels of the chain counting the source, 0 goes down to 1x1
+	unsigned int numThreads = 0;  // 0 uses every core
+};
+
+struct MipLevel
+{
+	int width;
+	int height;
+	std::vector<unsigned char> pixels; // tightly packed rows, bottom to top
+};
+
+//
+// CPU mip chain builder for 8 bit RGB and RGBA images, used by the texture uploads and the cooker.
+// Each level is filtered from the previous one kept in linear float RGBA, so rounding does not pile
+// up along the chain, and quantized back to 8 bits with lookup tables (exact sRGB rounding).
+// The filters come in scalar, SSE and AVX2 + FMA versions and follow MathKernels' level, so
+// MathKernels::setLevel switches them as well. Rows are spread over threads.
+// Sizes are halved and rounded down: the box filter drops the last column / row of an odd level.
+//
+class MipBuilder
+{
+public:
+	// Number of levels of a width x height chain, at most maxLevels when it is not 0
+	static int levelCount(int width, int height, int maxLevels = 0);
+
+	// levels[0] is the source image, the rest of the chain is appended after it
+	static void build(std::vector<MipLevel>& levels, int channels, const MipSettings& settings = MipSettings());
+	// Same into memory the caller owns (a mapped pixel unpack buffer...): level i, i from 1 to
+	// levelCount(width, height, settings.maxLevels) - 1, is written to levels[i]. levels[0] is unused.
+	static void build(const unsigned char* source, int width, int height, int channels, unsigned char* const* levels, const MipSettings& settings = MipSettings());
+
+	// Time both filters on every SIMD level in megapixels per second, check them against the
+	// scalar version, and show what the gamma correct filtering and alpha coverage change
+	static void benchmark();
+
+private:
+	static const int kaiserTaps = 8;
+
+	struct Tables
+	{
+		float toLinear[256];        // sRGB byte to linear
+		float unorm[256];           // byte / 255
+		float threshold[256];       // linear value from which sRGB byte i + 1 is the closest
+		unsigned char encode[4096]; // sRGB byte of linear i / 4095, the threshold fixes the rest
+		float kaiser[kaiserTaps];   // weights of the input texels 2x-3 .. 2x+4 for output texel x
+	};
+	static const Tables& tables();
+
+	// Output rows [rowBegin, rowEnd) of a filter pass, every image is RGBA float
+	typedef void (*BoxKernel)(const float* source, int sourceWidth, int sourceHeight, float* dest, int width, int rowBegin, int rowEnd);
+	typedef void (*HorizontalKernel)(const float* source, int sourceWidth, float* dest, int width, int rowBegin, int rowEnd, const float* weights);
+	typedef void (*VerticalKernel)(const float* source, int sourceHeight, float* dest, int width, int rowBegin, int rowEnd, const float* weights);
+
+	static void boxScalar(const float* source, int sourceWidth, int sourceHeight, float* dest, int width, int rowBegin, int rowEnd);
+	static void horizontalScalar(const float* source, int sourceWidth, float* dest, int width, int rowBegin, int rowEnd, const float* weights);
+	static void verticalScalar(const float* source, int sourceHeight, float* dest, int width, int rowBegin, int rowEnd, const float* weights);
+#ifdef MATH_KERNELS_X86
+	static void boxSSE(const float* source, int sourceWidth, int sourceHeight, float* dest, int width, int rowBegin, int rowEnd);
+	static void horizontalSSE(const float* source, int sourceWidth, float* dest, int width, int rowBegin, int rowEnd, const float* weights);
+	static void verticalSSE(const float* source, int sourceHeight, float* dest, int width, int rowBegin, int rowEnd, const float* weights);
+
+	MATH_TARGET_AVX2 static void boxAVX2(const float* source, int sourceWidth, int sourceHeight, float* dest, int width, int rowBegin, int rowEnd);
+	MATH_TARGET_AVX2 static void horizontalAVX2(const float* source, int sourceWidth, float* dest, int width, int rowBegin, int rowEnd, const float* weights);
+	MATH_TARGET_AVX2 static void verticalAVX2(const float* source, int sourceHeight, float* dest, int width, int rowBegin, int rowEnd, const float* weights);
+#endif
+
+	static void toFloat(const unsigned char* pixels, int channels, bool srgb, float* out, size_t begin, size_t end);
+	static void toBytes(const float* pixels, int channels, bool srgb, float alphaScale, unsigned char* out, size_t begin, size_t end);
+	// Alpha scale that makes the same fraction of the level's texels pass reference as 'coverage'
+	static float coverageScale(const float* pixels, size_t count, float reference, float coverage);
+
+	template<typename Function> static void parallelFor(size_t count, unsigned int numThreads, Function function);
+};
+
+
+int MipBuilder::levelCount(int width, int height, int maxLevels)
+{
+	int count = 1;
+	while (width > 1 || height > 1)
+	{
+		width = std::max(1, width / 2);
+		height = std::max(1, height / 2);
+		count++;
+	}
+	return maxLevels > 0 ? std::min(count, maxLevels) : count;
+}
+
+const MipBuilder::Tables& MipBuilder::tables()
+{
+	static Tables result = []()
+	{
+		Tables t;
+		auto decode = [](double v) { return v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4); };
+		for (int i = 0; i < 256; i++)
+		{
+			t.toLinear[i] = (float)decode(i / 255.0);
+			t.unorm[i] = i / 255.0f;
+			t.threshold[i] = (float)decode((i + 0.5) / 255.0);
+		}
+		int byte = 0;
+		for (int i = 0; i < 4096; i++)
+		{
+			while (byte < 255 && i / 4095.0f >= t.threshold[byte])
+				byte++;
+			t.encode[i] = (unsigned char)byte;
+		}
+
+		// sinc cut at the output's Nyquist frequency, under a Kaiser window 2 output texels wide
+		auto bessel0 = [](double x)
+		{
+			double sum = 1.0, term = 1.0;
+			for (int k = 1; k < 32; k++)
+			{
+				term *= (x / (2.0 * k)) * (x / (2.0 * k));
+				sum += term;
+			}
+			return sum;
+		};
+		const double pi = 3.14159265358979323846, alpha = 4.0, halfWidth = 2.0;
+		double sum = 0.0;
+		double weights[kaiserTaps];
+		for (int k = 0; k < kaiserTaps; k++)
+		{
+			double d = (k - 3.5) / 2.0; // texel center to output center, in output texels
+			double sinc = std::sin(pi * d) / (pi * d);
+			double window = bessel0(alpha * std::sqrt(1.0 - (d / halfWidth) * (d / halfWidth))) / bessel0(alpha);
+			weights[k] = sinc * window;
+			sum += weights[k];
+		}
+		for (int k = 0; k < kaiserTaps; k++)
+			t.kaiser[k] = (float)(weights[k] / sum);
+		return t;
+	}();
+	return result;
+}
+
+template<typename Function>
+void MipBuilder::parallelFor(size_t count, unsigned int numThreads, Function function)
+{
+	if (numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	numThreads = (unsigned int)std::min<size_t>(numThreads, count);
+	if (numThreads <= 1)
+	{
+		function((size_t)0, count);
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	size_t perThread = (count + numThreads - 1) / numThreads;
+	for (unsigned int i = 1; i < numThreads; i++)
+	{
+		size_t begin = std::min(count, i * perThread), end = std::min(count, begin + perThread);
+		workers.emplace_back([=]() { function(begin, end); });
+	}
+	function((size_t)0, std::min(count, perThread));
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+void MipBuilder::build(std::vector<MipLevel>& levels, int channels, const MipSettings& settings)
+{
+	if (levels.empty() || (channels != 3 && channels != 4))
+	{
+		std::cout << "ERROR::MipBuilder::build:: needs a source level with 3 or 4 channels" << std::endl;
+		return;
+	}
+	levels.resize(levelCount(levels[0].width, levels[0].height, settings.maxLevels));
+	std::vector<unsigned char*> pixels(levels.size(), NULL);
+	for (size_t level = 1; level < levels.size(); level++)
+	{
+		levels[level].width = std::max(1, levels[level - 1].width / 2);
+		levels[level].height = std::max(1, levels[level - 1].height / 2);
+		levels[level].pixels.resize((size_t)levels[level].width * levels[level].height * channels);
+		pixels[level] = levels[level].pixels.data();
+	}
+	build(levels[0].pixels.data(), levels[0].width, levels[0].height, channels, pixels.data(), settings);
+}
+
+void MipBuilder::build(const unsigned char* source, int width, int height, int channels, unsigned char* const* levels, const MipSettings& settings)
+{
+	int count = levelCount(width, height, settings.maxLevels);
+	if (count == 1)
+		return;
+
+	const Tables& t = tables();
+	BoxKernel box = boxScalar;
+	HorizontalKernel horizontal = horizontalScalar;
+	VerticalKernel vertical = verticalScalar;
+#ifdef MATH_KERNELS_X86
+	if (MathKernels::getLevel() == MathKernels::MATH_SSE)
+	{
+		box = boxSSE;
+		horizontal = horizontalSSE;
+		vertical = verticalSSE;
+	}
+	else if (MathKernels::getLevel() == MathKernels::MATH_AVX2)
+	{
+		box = boxAVX2;
+		horizontal = horizontalAVX2;
+		vertical = verticalAVX2;
+	}
+#endif
+	// a thread per 16K texels at least, the small levels are not worth starting threads for
+	auto threadsFor = [&](size_t texels) { return texels < 16384 ? 1u : settings.numThreads; };
+
+	std::vector<float> current, next, scratch;
+
+	float coverage = 0.0f;
+	if (settings.alphaCoverage > 0.0f && channels == 4)
+	{
+		size_t passing = 0;
+		for (size_t i = 3; i < (size_t)width * height * 4; i += 4)
+			passing += source[i] > settings.alphaCoverage * 255.0f;
+		coverage = (float)passing / ((size_t)width * height);
+	}
+
+	for (int level = 1; level < count; level++)
+	{
+		int nextWidth = std::max(1, width / 2), nextHeight = std::max(1, height / 2);
+		next.resize((size_t)nextWidth * nextHeight * 4);
+		unsigned int threads = threadsFor((size_t)width * height);
+		// level 1 reads the bytes, converted to float a row at a time: a float copy of the
+		// whole source would be the largest buffer by far
+		bool fromBytes = level == 1;
+		if (settings.filter == MIP_FILTER_BOX)
+		{
+			parallelFor((size_t)nextHeight, threads, [&](size_t begin, size_t end)
+			{
+				if (!fromBytes)
+				{
+					box(current.data(), width, height, next.data(), nextWidth, (int)begin, (int)end);
+					return;
+				}
+				std::vector<float> rows((size_t)width * 8);
+				for (size_t y = begin; y < end; y++)
+				{
+					toFloat(source + 2 * y * width * channels, channels, settings.srgb, rows.data(), 0, width);
+					toFloat(source + std::min(2 * y + 1, (size_t)height - 1) * width * channels, channels, settings.srgb, rows.data() + width * 4, 0, width);
+					box(rows.data(), width, 2, next.data() + y * nextWidth * 4, nextWidth, 0, 1);
+				}
+			});
+		}
+		else
+		{
+			// separable: halve the rows, then the columns
+			scratch.resize((size_t)nextWidth * height * 4);
+			parallelFor((size_t)height, threads, [&](size_t begin, size_t end)
+			{
+				if (!fromBytes)
+				{
+					horizontal(current.data(), width, scratch.data(), nextWidth, (int)begin, (int)end, t.kaiser);
+					return;
+				}
+				std::vector<float> row((size_t)width * 4);
+				for (size_t y = begin; y < end; y++)
+				{
+					toFloat(source + y * width * channels, channels, settings.srgb, row.data(), 0, width);
+					horizontal(row.data(), width, scratch.data() + y * nextWidth * 4, nextWidth, 0, 1, t.kaiser);
+				}
+			});
+			parallelFor((size_t)nextHeight, threads, [&](size_t begin, size_t end)
+			{
+				vertical(scratch.data(), height, next.data(), nextWidth, (int)begin, (int)end, t.kaiser);
+			});
+		}
+
+		// the scale only goes into the bytes, the next level is filtered from the unscaled alpha
+		size_t texels = (size_t)nextWidth * nextHeight;
+		float alphaScale = coverage > 0.0f ? coverageScale(next.data(), texels, settings.alphaCoverage, coverage) : 1.0f;
+		unsigned char* out = levels[level];
+		parallelFor((size_t)nextHeight, threadsFor(texels), [&](size_t begin, size_t end)
+		{
+			toBytes(next.data(), channels, settings.srgb, alphaScale, out, begin * nextWidth, end * nextWidth);
+		});
+
+		current.swap(next);
+		width = nextWidth;
+		height = nextHeight;
+	}
+}
+
+void MipBuilder::toFloat(const unsigned char* pixels, int channels, bool srgb, float* out, size_t begin, size_t end)
+{
+	const Tables& t = tables();
+	const float* color = srgb ? t.toLinear : t.unorm;
+	for (size_t i = begin; i < end; i++)
+	{
+		const unsigned char* pixel = pixels + i * channels;
+		out[i * 4] = color[pixel[0]];
+		out[i * 4 + 1] = color[pixel[1]];
+		out[i * 4 + 2] = color[pixel[2]];
+		out[i * 4 + 3] = channels == 4 ? t.unorm[pixel[3]] : 1.0f;
+	}
+}
+
+void MipBuilder::toBytes(const float* pixels, int channels, bool srgb, float alphaScale, unsigned char* out, size_t begin, size_t end)
+{
+	const Tables& t = tables();
+	for (size_t i = begin; i < end; i++)
+	{
+		unsigned char* pixel = out + i * channels;
+		for (int c = 0; c < 3; c++)
+		{
+			float value = std::min(std::max(pixels[i * 4 + c], 0.0f), 1.0f);
+			if (srgb)
+			{
+				int byte = t.encode[(int)(value * 4095.0f)];
+				while (byte < 255 && value >= t.threshold[byte])
+					byte++;
+				pixel[c] = (unsigned char)byte;
+			}
+			else
+				pixel[c] = (unsigned char)(value * 255.0f + 0.5f);
+		}
+		if (channels == 4)
+			pixel[3] = (unsigned char)(std::min(std::max(pixels[i * 4 + 3] * alphaScale, 0.0f), 1.0f) * 255.0f + 0.5f);
+	}
+}
+
+float MipBuilder::coverageScale(const float* pixels, size_t count, float reference, float coverage)
+{
+	// lowest alpha of the texels to keep, from a histogram: the bin edge whose count of texels
+	// above it is closest to the coverage (ties make an exact match impossible), mapped on the reference
+	const int bins = 1024;
+	std::vector<size_t> histogram(bins, 0);
+	for (size_t i = 0; i < count; i++)
+		histogram[std::min(std::max((int)(pixels[i * 4 + 3] * (bins - 1)), 0), bins - 1)]++;
+	double target = (double)coverage * count;
+	size_t above = 0;
+	int best = bins - 1;
+	double bestError = target;
+	for (int bin = bins - 1; bin >= 0; bin--)
+	{
+		above += histogram[bin];
+		double error = std::fabs((double)above - target);
+		if (error < bestError)
+		{
+			bestError = error;
+			best = bin;
+		}
+	}
+	if (bestError == target)
+		return 1.0f;
+	return reference / std::max((float)best / (bins - 1), 1e-4f);
+}
+
+// --------------------------------------------------------------------------------------
+// Scalar reference
+// --------------------------------------------------------------------------------------
+
+static inline void mipBoxTexel(const float* row0, const float* row1, int sourceWidth, int x, float* out)
+{
+	int x0 = std::min(2 * x, sourceWidth - 1) * 4, x1 = std::min(2 * x + 1, sourceWidth - 1) * 4;
+	for (int c = 0; c < 4; c++)
+		out[c] = 0.25f * (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c]);
+}
+
+static inline void mipKaiserTexel(const float* row, int sourceWidth, int x, const float* weights, float* out)
+{
+	float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (int k = 0; k < 8; k++)
+	{
+		const float* texel = row + std::min(std::max(2 * x - 3 + k, 0), sourceWidth - 1) * 4;
+		for (int c = 0; c < 4; c++)
+			sum[c] += weights[k] * texel[c];
+	}
+	for (int c = 0; c < 4; c++)
+		out[c] = sum[c];
+}
+
+// output texels whose 8 taps are all inside the row: x in [2, end)
+static inline int mipKaiserInteriorEnd(int sourceWidth, int width)
+{
+	return std::max(2, std::min(width, sourceWidth >= 5 ? (sourceWidth - 5) / 2 + 1 : 0));
+}
+
+void MipBuilder::boxScalar(const float* source, int sourceWidth, int sourceHeight, float* dest, int width, int rowBegin, int rowEnd)
+{
+	for (int y = rowBegin; y < rowEnd; y++)
+	{
+		const float* row0 = source + (size_t)std::min(2 * y, sourceHeight - 1) * sourceWidth * 4;
+		const float* row1 = source + (size_t)std::min(2 * y + 1, sourceHeight - 1) * sourceWidth * 4;
+		float* out = dest + (size_t)y * width * 4;
+		for (int x = 0; x < width; x++)
+			mipBoxTexel(row0, row1, sourceWidth, x, out + x * 4);
+	}
+}
+
+void MipBuilder::horizontalScalar(const float* source, int sourceWidth, float* dest, int width, int rowBegin, int rowEnd, const float* weights)
+{
+	for (int y = rowBegin; y < rowEnd; y++)
+	{
+		const float* row = source + (size_t)y * sourceWidth * 4;
+		float* out = dest + (size_t)y * width * 4;
+		for (int x = 0; x < width; x++)
+			mipKaiserTexel(row, sourceWidth, x, weights, out + x * 4);
+	}
+}
+
+void MipBuilder::verticalScalar(const float* source, int sourceHeight, float* dest, int width, int rowBegin, int rowEnd, const float* weights)
+{
+	size_t rowFloats = (size_t)width * 4;
+	for (int y = rowBegin; y < rowEnd; y++)
+	{
+		const float* rows[8];
+		for (int k = 0; k < 8; k++)
+			rows[k] = source + std::min(std::max(2 * y - 3 + k, 0), sourceHeight - 1) * rowFloats;
+		float* out = dest + (size_t)y * rowFloats;
+		for (size_t i = 0; i < rowFloats; i++)
+		{
+			float sum = 0.0f;
+			for (int k = 0; k < 8; k++)
+				sum += weights[k] * rows[k][i];
+			out[i] = sum;
+		}
+	}
+}
+
+#ifdef MATH_KERNELS_X86
+
+// --------------------------------------------------------------------------------------
+// SSE: one RGBA texel per register
+// --------------------------------------------------------------------------------------
+
+void MipBuilder::boxSSE(const float* source, int sourceWidth, int sourceHeight, float* dest, int width, int rowBegin, int rowEnd)
+{
+	const __m128 quarter = _mm_set1_ps(0.25f);
+	int pairs = std::min(width, sourceWidth / 2); // texels with both sources in the row
+	for (int y = rowBegin; y < rowEnd; y++)
+	{
+		const float* row0 = source + (size_t)std::min(2 * y, sourceHeight - 1) * sourceWidth * 4;
+		const float* row1 = source + (size_t)std::min(2 * y + 1, sourceHeight - 1) * sourceWidth * 4;
+		float* out = dest + (size_t)y * width * 4;
+		for (int x = 0; x < pairs; x++)
+		{
+			__m128 top = _mm_add_ps(_mm_loadu_ps(row0 + x * 8), _mm_loadu_ps(row0 + x * 8 + 4));
+			__m128 bottom = _mm_add_ps(_mm_loadu_ps(row1 + x * 8), _mm_loadu_ps(row1 + x * 8 + 4));
+			_mm_storeu_ps(out + x * 4, _mm_mul_ps(_mm_add_ps(top, bottom), quarter));
+		}
+		for (int x = pairs; x < width; x++)
+			mipBoxTexel(row0, row1, sourceWidth, x, out + x * 4);
+	}
+}
+
+void MipBuilder::horizontalSSE(const float* source, int sourceWidth, float* dest, int width, int rowBegin, int rowEnd, const float* weights)
+{
+	__m128 w[8];
+	for (int k = 0; k < 8; k++)
+		w[k] = _mm_set1_ps(weights[k]);
+	int interiorEnd = mipKaiserInteriorEnd(sourceWidth, width);
+	for (int y = rowBegin; y < rowEnd; y++)
+	{
+		const float* row = source + (size_t)y * sourceWidth * 4;
+		float* out = dest + (size_t)y * width * 4;
+		for (int x = 0; x < std::min(2, width); x++)
+			mipKaiserTexel(row, sourceWidth, x, weights, out + x * 4);
+		for (int x = 2; x < interiorEnd; x++)
+		{
+			const float* taps = row + (2 * x - 3) * 4;
+			__m128 sum = _mm_mul_ps(w[0], _mm_loadu_ps(taps));
+			for (int k = 1; k < 8; k++)
+				sum = _mm_add_ps(sum, _mm_mul_ps(w[k], _mm_loadu_ps(taps + k * 4)));
+			_mm_storeu_ps(out + x * 4, sum);
+		}
+		for (int x = interiorEnd; x < width; x++)
+			mipKaiserTexel(row, sourceWidth, x, weights, out + x * 4);
+	}
+}
+
+void MipBuilder::verticalSSE(const float* source, int sourceHeight, float* dest, int width, int rowBegin, int rowEnd, const float* weights)
+{
+	__m128 w[8];
+	for (int k = 0; k < 8; k++)
+		w[k] = _mm_set1_ps(weights[k]);
+	size_t rowFloats = (size_t)width * 4;
+	for (int y = rowBegin; y < rowEnd; y++)
+	{
+		const float* rows[8];
+		for (int k = 0; k < 8; k++)
+			rows[k] = source + std::min(std::max(2 * y - 3 + k, 0), sourceHeight - 1) * rowFloats;
+		float* out = dest + (size_t)y * rowFloats;
+		for (size_t i = 0; i < rowFloats; i += 4)
+		{
+			__m128 sum = _mm_mul_ps(w[0], _mm_loadu_ps(rows[0] + i));
+			for (int k = 1; k < 8; k++)
+				sum = _mm_add_ps(sum, _mm_mul_ps(w[k], _mm_loadu_ps(rows[k] + i)));
+			_mm_storeu_ps(out + i, sum);
+		}
+	}
+}
+
+// --------------------------------------------------------------------------------------
+// AVX2 + FMA: two RGBA texels per register
+// --------------------------------------------------------------------------------------
+
+void MipBuilder::boxAVX2(const float* source, int sourceWidth, int sourceHeight, float* dest, int width, int rowBegin, int rowEnd)
+{
+	const __m256 quarter = _mm256_set1_ps(0.25f);
+	int pairs = std::min(width, sourceWidth / 2);
+	for (int y = rowBegin; y < rowEnd; y++)
+	{
+		const float* row0 = source + (size_t)std::min(2 * y, sourceHeight - 1) * sourceWidth * 4;
+		const float* row1 = source + (size_t)std::min(2 * y + 1, sourceHeight - 1) * sourceWidth * 4;
+		float* out = dest + (size_t)y * width * 4;
+		int x = 0;
+		for (; x + 1 < pairs; x += 2)
+		{
+			// texels 2x, 2x+1 and 2x+2, 2x+3 summed over the two rows, then the halves regrouped per output
+			__m256 first = _mm256_add_ps(_mm256_loadu_ps(row0 + x * 8), _mm256_loadu_ps(row1 + x * 8));
+			__m256 second = _mm256_add_ps(_mm256_loadu_ps(row0 + x * 8 + 8), _mm256_loadu_ps(row1 + x * 8 + 8));
+			__m256 even = _mm256_permute2f128_ps(first, second, 0x20);
+			__m256 odd = _mm256_permute2f128_ps(first, second, 0x31);
+			_mm256_storeu_ps(out + x * 4, _mm256_mul_ps(_mm256_add_ps(even, odd), quarter));
+		}
+		for (; x < width; x++)
+			mipBoxTexel(row0, row1, sourceWidth, x, out + x * 4);
+	}
+}
+
+void MipBuilder::horizontalAVX2(const float* source, int sourceWidth, float* dest, int width, int rowBegin, int rowEnd, const float* weights)
+{
+	// a load of texels (i, i + 1) fills both halves, so the taps are taken in pairs: weights
+	// (w[2j], w[2j+1]) per half, and the halves are added at the end. Output x + 1 uses the
+	// same weights on the loads one pair further.
+	__m256 w[4];
+	for (int j = 0; j < 4; j++)
+		w[j] = _mm256_insertf128_ps(_mm256_set1_ps(weights[2 * j]), _mm_set1_ps(weights[2 * j + 1]), 1);
+	int interiorEnd = mipKaiserInteriorEnd(sourceWidth, width);
+	for (int y = rowBegin; y < rowEnd; y++)
+	{
+		const float* row = source + (size_t)y * sourceWidth * 4;
+		float* out = dest + (size_t)y * width * 4;
+		for (int x = 0; x < std::min(2, width); x++)
+			mipKaiserTexel(row, sourceWidth, x, weights, out + x * 4);
+		int x = 2;
+		for (; x + 1 < interiorEnd; x += 2)
+		{
+			const float* taps = row + (2 * x - 3) * 4;
+			__m256 pair = _mm256_loadu_ps(taps);
+			__m256 first = _mm256_mul_ps(w[0], pair);
+			pair = _mm256_loadu_ps(taps + 8);
+			__m256 second = _mm256_mul_ps(w[0], pair);
+			first = _mm256_fmadd_ps(w[1], pair, first);
+			for (int j = 2; j < 5; j++)
+			{
+				pair = _mm256_loadu_ps(taps + j * 8);
+				second = _mm256_fmadd_ps(w[j - 1], pair, second);
+				if (j < 4)
+					first = _mm256_fmadd_ps(w[j], pair, first);
+			}
+			__m256 low = _mm256_permute2f128_ps(first, second, 0x20), high = _mm256_permute2f128_ps(first, second, 0x31);
+			_mm256_storeu_ps(out + x * 4, _mm256_add_ps(low, high));
+		}
+		for (; x < width; x++)
+			mipKaiserTexel(row, sourceWidth, x, weights, out + x * 4);
+	}
+}
+
+void MipBuilder::verticalAVX2(const float* source, int sourceHeight, float* dest, int width, int rowBegin, int rowEnd, const float* weights)
+{
+	__m256 w[8];
+	for (int k = 0; k < 8; k++)
+		w[k] = _mm256_set1_ps(weights[k]);
+	size_t rowFloats = (size_t)width * 4;
+	for (int y = rowBegin; y < rowEnd; y++)
+	{
+		const float* rows[8];
+		for (int k = 0; k < 8; k++)
+			rows[k] = source + std::min(std::max(2 * y - 3 + k, 0), sourceHeight - 1) * rowFloats;
+		float* out = dest + (size_t)y * rowFloats;
+		size_t i = 0;
+		for (; i + 8 <= rowFloats; i += 8)
+		{
+			__m256 sum = _mm256_mul_ps(w[0], _mm256_loadu_ps(rows[0] + i));
+			for (int k = 1; k < 8; k++)
+				sum = _mm256_fmadd_ps(w[k], _mm256_loadu_ps(rows[k] + i), sum);
+			_mm256_storeu_ps(out + i, sum);
+		}
+		for (; i < rowFloats; i++)
+		{
+			float sum = 0.0f;
+			for (int k = 0; k < 8; k++)
+				sum += weights[k] * rows[k][i];
+			out[i] = sum;
+		}
+	}
+}
+
+#endif
+
+// --------------------------------------------------------------------------------------
+// Benchmark
+// --------------------------------------------------------------------------------------
+
+void MipBuilder::benchmark()
+{
+	// 2048x2048 RGBA: gradients, noise and alpha tested discs
+	const int size = 2048;
+	std::mt19937 random(99);
+	std::vector<MipLevel> source(1);
+	source[0] = { size, size, std::vector<unsigned char>((size_t)size * size * 4) };
+	for (int y = 0; y < size; y++)
+		for (int x = 0; x < size; x++)
+		{
+			unsigned char* pixel = &source[0].pixels[((size_t)y * size + x) * 4];
+			pixel[0] = (unsigned char)(x * 255 / size);
+			pixel[1] = (unsigned char)(y * 255 / size);
+			pixel[2] = (unsigned char)random();
+			float dx = (x % 64) - 31.5f, dy = (y % 64) - 31.5f, radius = 10.0f + (x / 64 * 7 + y / 64 * 13) % 20;
+			pixel[3] = (unsigned char)std::min(255.0f, std::max(0.0f, (radius - std::sqrt(dx * dx + dy * dy)) * 64.0f + 128.0f));
+		}
+	double megapixels = (double)size * size / 1e6;
+	unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+	std::cout << "MipBuilder::benchmark:: " << size << "x" << size << " RGBA8 sRGB full chains, best of 3 runs, CPU supports "
+		<< MathKernels::levelName(MathKernels::supportedLevel()) << ", " << cores << " cores" << std::endl;
+
+	auto time = [&](const MipSettings& settings, std::vector<MipLevel>& levels)
+	{
+		double best = 1e30;
+		for (int iteration = 0; iteration < 3; iteration++)
+		{
+			levels.resize(1);
+			auto start = std::chrono::high_resolution_clock::now();
+			build(levels, 4, settings);
+			best = std::min(best, std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count());
+		}
+		return best;
+	};
+
+	MathKernels::Level previous = MathKernels::getLevel();
+	const char* filterNames[] = { "box   ", "Kaiser" };
+	for (int filter = MIP_FILTER_BOX; filter <= MIP_FILTER_KAISER; filter++)
+	{
+		MipSettings settings;
+		settings.filter = (MipFilter)filter;
+		settings.numThreads = 1;
+		MathKernels::setLevel(MathKernels::MATH_SCALAR);
+		std::vector<MipLevel> reference = source;
+		double scalarSeconds = time(settings, reference);
+
+		for (int level = MathKernels::MATH_SCALAR; level <= MathKernels::supportedLevel(); level++)
+		{
+			MathKernels::setLevel((MathKernels::Level)level);
+			std::vector<MipLevel> levels = source;
+			settings.numThreads = 1;
+			double single = time(settings, levels);
+			settings.numThreads = 0;
+			double threaded = time(settings, levels);
+
+			int difference = 0;
+			for (size_t i = 1; i < levels.size(); i++)
+				for (size_t j = 0; j < levels[i].pixels.size(); j++)
+					difference = std::max(difference, std::abs(levels[i].pixels[j] - reference[i].pixels[j]));
+
+			std::cout << "  " << filterNames[filter] << " " << MathKernels::levelName((MathKernels::Level)level) << "    \t 1 thread "
+				<< megapixels / single << " MP/s (x" << scalarSeconds / single << ") \t " << cores << " threads " << megapixels / threaded
+				<< " MP/s (x" << scalarSeconds / threaded << ") \t max difference " << difference << std::endl;
+		}
+	}
+	MathKernels::setLevel(previous);
+
+	// a black and white checkerboard is 50% grey: sRGB 188 when averaged in linear space, 128 (too dark) when not
+	std::vector<MipLevel> checker(1);
+	checker[0] = { 2, 2, { 0, 0, 0, 255, 255, 255, 255, 255, 255, 255, 255, 255, 0, 0, 0, 255 } };
+	MipSettings settings;
+	build(checker, 4, settings);
+	int linear = checker[1].pixels[0];
+	settings.srgb = false;
+	build(checker, 4, settings);
+	std::cout << "  checkerboard mip: sRGB " << linear << " filtered in linear space, " << (int)checker[1].pixels[0] << " on the encoded values" << std::endl;
+
+	// fraction of the texels an alpha test at 0.5 keeps, per level
+	for (int preserve = 0; preserve < 2; preserve++)
+	{
+		settings = MipSettings();
+		settings.alphaCoverage = preserve ? 0.5f : 0.0f;
+		settings.maxLevels = 7;
+		std::vector<MipLevel> levels = source;
+		build(levels, 4, settings);
+		std::cout << (preserve ? "  alpha test coverage, preserved:" : "  alpha test coverage per level:");
+		for (const MipLevel& level : levels)
+		{
+			size_t passing = 0;
+			for (size_t i = 3; i < level.pixels.size(); i += 4)
+				passing += level.pixels[i] > 127;
+			std::cout << " " << (int)(100.0 * passing / ((size_t)level.width * level.height) + 0.5) << "%";
+		}
+		std::cout << std::endl;
+	}
+}
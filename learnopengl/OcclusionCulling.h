@@ -0,0 +1,728 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Camera.h"
+#include "Shader.h"
+#include "Mesh.h"
+#include "Framebuffer.h" // DepthConfig
+#include "RenderThread.h"
+#include "GeometryGenerator.h"
+
+enum OcclusionMode
+{
+	OCCLUSION_OFF,
+	OCCLUSION_HIZ,     // boxes tested on the CPU against the depth pyramid of a previous frame
+	OCCLUSION_QUERIES  // draws conditional on last frame's query of their box, the GPU skips the hidden ones
+};
+
+//
+// Occlusion culling: objects hidden behind others are not drawn.
+// Hi-Z: after the opaque draws the depth buffer is reduced into a pyramid (each texel keeps the
+// farthest depth of the four under it) and its level of at most 128 texels across is read back
+// through a pixel pack buffer, the CPU building the coarser levels. The next frames test each
+// object's box against it: the box is projected with the view of that depth, and is hidden when
+// its nearest depth is behind every texel of the level where it covers at most 4x4 texels.
+// The depth is a frame or two old: an object coming out from behind an occluder as the camera
+// moves shows up that much late, objects crossing the camera plane are always drawn.
+// Queries: the fallback without readback. The boxes of the objects in view are drawn against the
+// depth with an occlusion query each (color and depth writes off), the next frame draws each
+// object inside glBeginConditionalRender on its query, GL_QUERY_NO_WAIT: the draws are still
+// recorded and submitted, the GPU drops those whose box was hidden, or draws them if it does not
+// know yet. The results are read back two frames later for the statistics only.
+//
+class OcclusionCulling
+{
+public:
+	OcclusionCulling();
+	// Deletes the GL objects, needs the context
+	~OcclusionCulling();
+
+	OcclusionCulling(const OcclusionCulling&) = delete;
+	OcclusionCulling& operator=(const OcclusionCulling&) = delete;
+
+	// Queries for objectCount objects and the box mesh, needs the context
+	bool create(const DepthConfig& depthConfig, unsigned int objectCount);
+
+	void setMode(OcclusionMode mode);
+	OcclusionMode getMode() const { return mode; }
+	static const char* getModeName(OcclusionMode mode);
+
+	// Start recording a frame: take the newest pyramid the GL read back
+	void beginFrame(Camera& camera);
+	// Is the object worth drawing, its world box being in the view (object is below objectCount).
+	// Hi-Z: false when the box is behind the pyramid. Queries: true, the box is queried at endFrame().
+	bool isVisible(unsigned int object, glm::vec3 boxMin, glm::vec3 boxMax);
+	// Around every draw of a visible object: with queries, conditional on last frame's query
+	void beginDraw(CommandList& commands, unsigned int object);
+	void endDraw(CommandList& commands, unsigned int object);
+	// After the opaque draws, their target still bound. Hi-Z: reduce the texture depthTexture returns
+	// (width x height, empty if the depth is not a texture) and read the pyramid back; it is called on
+	// the render thread, which recreates the targets on resize. Queries: draw the boxes with boxShader
+	// (projection, view and model, depth only) against the depth.
+	void endFrame(CommandList& commands, Shader* pyramidShader, Shader* boxShader, std::function<GLuint()> depthTexture, int width, int height,
+		const glm::mat4& projection, const glm::mat4& view);
+
+	// objects culled among those in view, per frame on average since the last reset
+	double getCulledRatio() const;
+	double getTestedPerFrame() const;
+	void resetStatistics();
+	void report() const;
+
+private:
+	static const int maxReadbackSize = 128;
+	static const int maxLevels = 16;
+	static const int readbackCount = 3;
+
+	// CPU copy of the coarse levels of a pyramid (GPU level numbering: level 0 is half the screen)
+	struct Pyramid
+	{
+		std::vector<float> texels;
+		int firstLevel; // the level read back, the finer ones stay on the GPU
+		int levelCount;
+		int offsets[maxLevels];
+		int widths[maxLevels];
+		int heights[maxLevels];
+		glm::mat4 viewProjection; // what the depth was drawn with
+		int screenWidth;
+		int screenHeight;
+		unsigned int frame;
+		bool valid;
+	};
+	struct Readback
+	{
+		GLuint buffer;
+		size_t capacity;
+		GLsync fence;  // pending while not NULL
+		glm::mat4 viewProjection;
+		int screenWidth;
+		int screenHeight;
+		unsigned int frame;
+		int level;      // of the pyramid as it was when read, a resize may have changed it since
+		int levelWidth;
+		int levelHeight;
+	};
+	struct BoxQuery
+	{
+		glm::vec3 boxMin;
+		glm::vec3 boxMax;
+		unsigned int object;
+	};
+
+	bool isHidden(const Pyramid& pyramid, glm::vec3 boxMin, glm::vec3 boxMax) const;
+	// render thread
+	void buildPyramid(Shader* pyramidShader, GLuint depthTexture, int width, int height);
+	void startReadback(const glm::mat4& viewProjection, int width, int height, unsigned int frame);
+	void finishReadbacks();
+	void queryBoxes(Shader* boxShader, const BoxQuery* boxes, unsigned int count, int set);
+	void collectQueries(int set);
+
+	OcclusionMode mode;
+	bool reverseZ;
+	GLenum compareFunc;
+	GLenum compareFuncOrEqual;
+	unsigned int objectCount;
+	unsigned int frame;     // frames recorded, main thread
+	unsigned int modeFrame; // older pyramids and queries are from another mode
+
+	// Hi-Z, the GPU side (render thread)
+	GLuint pyramidTexture;
+	GLuint pyramidFBO;
+	GLuint emptyVAO;
+	int pyramidWidth;       // level 0
+	int pyramidHeight;
+	int readbackLevel;
+	Readback readbacks[readbackCount];
+	int nextReadback;
+	// the render thread fills 'writing' and publishes it as 'ready', the main thread takes 'ready' as 'reading'
+	Pyramid pyramids[3];
+	int writing;
+	int ready;
+	int reading;
+	bool readyIsNew;
+	std::mutex handoff;
+
+	// queries: two sets, one issued this frame while the draws use last frame's
+	std::vector<GLuint> queries[2];
+	std::vector<unsigned char> queried[2]; // main thread: the object's box is in that set
+	std::vector<unsigned int> issued[2];   // render thread: what to read back before reusing the set
+	std::vector<BoxQuery> boxes;           // this frame's
+	Mesh* box;                             // unit cube, drawn scaled to each object's box
+	glm::vec3 cameraPosition;
+	float nearPlane;
+
+	// statistics
+	unsigned int frameTested;                // objects in view this frame (main thread)
+	unsigned int frameCulled;
+	unsigned long long testedTotal;          // main thread, culled by Hi-Z
+	unsigned long long culledTotal;
+	unsigned int statisticFrames;
+	unsigned long long pyramidTests;         // boxes tested against a pyramid
+	double pyramidAge;                       // frames between the depth and its test, summed
+	std::atomic<unsigned long long> queryTested; // queries, render thread
+	std::atomic<unsigned long long> queryCulled;
+	std::atomic<unsigned int> queryFrames;
+	unsigned int pyramidsBuilt;              // render thread
+	unsigned int readbacksSkipped;           // every buffer was still in flight
+	unsigned int queriesNotReady;            // results not there two frames later, left out of the statistics
+};
+
+
+OcclusionCulling::OcclusionCulling() : queryTested(0), queryCulled(0), queryFrames(0)
+{
+	mode = OCCLUSION_OFF;
+	reverseZ = false;
+	compareFunc = GL_LESS;
+	compareFuncOrEqual = GL_LEQUAL;
+	objectCount = 0;
+	frame = 0;
+	modeFrame = 0;
+	pyramidTexture = 0;
+	pyramidFBO = 0;
+	emptyVAO = 0;
+	pyramidWidth = pyramidHeight = 0;
+	readbackLevel = 0;
+	for (Readback& readback : readbacks)
+		readback = Readback{ 0, 0, NULL, glm::mat4(1.0f), 0, 0, 0, 0, 0, 0 };
+	nextReadback = 0;
+	for (Pyramid& pyramid : pyramids)
+	{
+		pyramid.firstLevel = 0;
+		pyramid.levelCount = 0;
+		pyramid.frame = 0;
+		pyramid.valid = false;
+	}
+	writing = 0;
+	ready = 1;
+	reading = 2;
+	readyIsNew = false;
+	box = NULL;
+	cameraPosition = glm::vec3(0.0f);
+	nearPlane = 0.1f;
+	frameTested = frameCulled = 0;
+	testedTotal = culledTotal = 0;
+	statisticFrames = 0;
+	pyramidTests = 0;
+	pyramidAge = 0.0;
+	pyramidsBuilt = 0;
+	readbacksSkipped = 0;
+	queriesNotReady = 0;
+}
+
+OcclusionCulling::~OcclusionCulling()
+{
+	for (Readback& readback : readbacks)
+	{
+		if (readback.fence)
+			glDeleteSync(readback.fence);
+		if (readback.buffer != 0)
+			glDeleteBuffers(1, &readback.buffer);
+	}
+	if (pyramidTexture != 0)
+		glDeleteTextures(1, &pyramidTexture);
+	if (pyramidFBO != 0)
+		glDeleteFramebuffers(1, &pyramidFBO);
+	if (emptyVAO != 0)
+		glDeleteVertexArrays(1, &emptyVAO);
+	for (int set = 0; set < 2; set++)
+		if (!queries[set].empty())
+			glDeleteQueries((GLsizei)queries[set].size(), queries[set].data());
+	delete box;
+}
+
+bool OcclusionCulling::create(const DepthConfig& depthConfig, unsigned int objectCount)
+{
+	reverseZ = depthConfig.reverseZ;
+	compareFunc = depthConfig.compareFunc();
+	compareFuncOrEqual = depthConfig.compareFuncOrEqual();
+	this->objectCount = objectCount;
+	for (int set = 0; set < 2; set++)
+	{
+		queries[set].resize(objectCount);
+		if (objectCount > 0)
+			glGenQueries((GLsizei)objectCount, queries[set].data());
+		queried[set].assign(objectCount, 0);
+		issued[set].reserve(objectCount);
+	}
+	boxes.reserve(objectCount);
+
+	glGenVertexArrays(1, &emptyVAO);
+	glGenFramebuffers(1, &pyramidFBO);
+
+	ShapeDesc cube;
+	cube.type = SHAPE_CUBE;
+	cube.segments = 1;
+	cube.size = 1.0f;
+	box = new Mesh();
+	GeometryGenerator::createMesh(cube, GeneratorLayout::V(), *box);
+	return true;
+}
+
+const char* OcclusionCulling::getModeName(OcclusionMode mode)
+{
+	const char* names[] = { "off", "hi-z", "conditional render" };
+	return names[mode];
+}
+
+void OcclusionCulling::setMode(OcclusionMode mode)
+{
+	if (mode == this->mode)
+		return;
+	this->mode = mode;
+	// pyramids and queries from before are not trusted
+	modeFrame = frame + 1;
+	queried[0].assign(objectCount, 0);
+	queried[1].assign(objectCount, 0);
+}
+
+void OcclusionCulling::beginFrame(Camera& camera)
+{
+	frame++;
+	cameraPosition = camera.getPosition();
+	nearPlane = camera.getNearPlane();
+	boxes.clear();
+	std::fill(queried[frame & 1].begin(), queried[frame & 1].end(), 0);
+	frameTested = frameCulled = 0;
+
+	if (mode == OCCLUSION_HIZ)
+	{
+		std::lock_guard<std::mutex> lock(handoff);
+		if (readyIsNew)
+		{
+			std::swap(ready, reading);
+			readyIsNew = false;
+		}
+	}
+}
+
+bool OcclusionCulling::isVisible(unsigned int object, glm::vec3 boxMin, glm::vec3 boxMax)
+{
+	frameTested++;
+	testedTotal++;
+	if (mode == OCCLUSION_HIZ)
+	{
+		const Pyramid& pyramid = pyramids[reading];
+		if (!pyramid.valid || pyramid.frame < modeFrame)
+			return true;
+		pyramidTests++;
+		pyramidAge += frame - pyramid.frame;
+		if (isHidden(pyramid, boxMin, boxMax))
+		{
+			frameCulled++;
+			culledTotal++;
+			return false;
+		}
+	}
+	else if (mode == OCCLUSION_QUERIES)
+	{
+		// a box around the camera would be clipped by the near plane and seen as hidden: no query,
+		// the object is drawn unconditionally next frame. The box grows a little so that an object
+		// filling its box exactly does not hide it.
+		glm::vec3 margin = glm::max(glm::vec3(0.01f), (boxMax - boxMin) * 0.01f);
+		boxMin -= margin;
+		boxMax += margin;
+		glm::vec3 nearMargin(nearPlane * 2.0f);
+		glm::vec3 nearMin = boxMin - nearMargin, nearMax = boxMax + nearMargin;
+		if (cameraPosition.x > nearMin.x && cameraPosition.y > nearMin.y && cameraPosition.z > nearMin.z
+			&& cameraPosition.x < nearMax.x && cameraPosition.y < nearMax.y && cameraPosition.z < nearMax.z)
+			return true;
+		boxes.push_back(BoxQuery{ boxMin, boxMax, object });
+		queried[frame & 1][object] = 1;
+	}
+	return true;
+}
+
+bool OcclusionCulling::isHidden(const Pyramid& pyramid, glm::vec3 boxMin, glm::vec3 boxMax) const
+{
+	// screen rectangle and nearest depth of the box, as it was in the pyramid's frame
+	glm::vec2 ndcMin(1.0f), ndcMax(-1.0f);
+	float nearest = reverseZ ? 0.0f : 1.0f;
+	for (int i = 0; i < 8; i++)
+	{
+		glm::vec3 corner((i & 1) ? boxMax.x : boxMin.x, (i & 2) ? boxMax.y : boxMin.y, (i & 4) ? boxMax.z : boxMin.z);
+		glm::vec4 clip = pyramid.viewProjection * glm::vec4(corner, 1.0f);
+		if (clip.w <= 1e-4f)
+			return false; // crosses the camera plane
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		glm::vec2 ndcXY(ndc.x, ndc.y);
+		ndcMin = i ? glm::min(ndcMin, ndcXY) : ndcXY;
+		ndcMax = i ? glm::max(ndcMax, ndcXY) : ndcXY;
+		// window depth: [0, 1] clip range with reverse-Z, [-1, 1] otherwise
+		float depth = reverseZ ? ndc.z : ndc.z * 0.5f + 0.5f;
+		nearest = reverseZ ? std::max(nearest, depth) : std::min(nearest, depth);
+	}
+	if (ndcMax.x < -1.0f || ndcMax.y < -1.0f || ndcMin.x > 1.0f || ndcMin.y > 1.0f)
+		return false; // out of that frame's view, nothing known about it
+
+	int x0 = (int)((std::max(ndcMin.x, -1.0f) * 0.5f + 0.5f) * pyramid.screenWidth);
+	int y0 = (int)((std::max(ndcMin.y, -1.0f) * 0.5f + 0.5f) * pyramid.screenHeight);
+	int x1 = std::min((int)((std::min(ndcMax.x, 1.0f) * 0.5f + 0.5f) * pyramid.screenWidth), pyramid.screenWidth - 1);
+	int y1 = std::min((int)((std::min(ndcMax.y, 1.0f) * 0.5f + 0.5f) * pyramid.screenHeight), pyramid.screenHeight - 1);
+
+	// the level where the rectangle covers at most 4x4 texels. A level L texel covers 2^(L+1)
+	// pixels, the last row and column also take what the halving of an odd size left over.
+	int k = 0;
+	int tx0, ty0, tx1, ty1;
+	while (true)
+	{
+		int shift = pyramid.firstLevel + k + 1;
+		tx0 = std::min(x0 >> shift, pyramid.widths[k] - 1);
+		ty0 = std::min(y0 >> shift, pyramid.heights[k] - 1);
+		tx1 = std::min(x1 >> shift, pyramid.widths[k] - 1);
+		ty1 = std::min(y1 >> shift, pyramid.heights[k] - 1);
+		if ((tx1 - tx0 < 4 && ty1 - ty0 < 4) || k == pyramid.levelCount - 1)
+			break;
+		k++;
+	}
+	const float* texels = &pyramid.texels[pyramid.offsets[k]];
+	for (int y = ty0; y <= ty1; y++)
+	{
+		for (int x = tx0; x <= tx1; x++)
+		{
+			float farthest = texels[y * pyramid.widths[k] + x];
+			if (reverseZ ? nearest >= farthest : nearest <= farthest)
+				return false;
+		}
+	}
+	return true;
+}
+
+void OcclusionCulling::beginDraw(CommandList& commands, unsigned int object)
+{
+	int set = (frame + 1) & 1;
+	if (mode != OCCLUSION_QUERIES || !queried[set][object])
+		return;
+	GLuint query = queries[set][object];
+	commands.call([query]()
+	{
+		glBeginConditionalRender(query, GL_QUERY_NO_WAIT);
+	});
+}
+
+void OcclusionCulling::endDraw(CommandList& commands, unsigned int object)
+{
+	if (mode != OCCLUSION_QUERIES || !queried[(frame + 1) & 1][object])
+		return;
+	commands.call([]()
+	{
+		glEndConditionalRender();
+	});
+}
+
+void OcclusionCulling::endFrame(CommandList& commands, Shader* pyramidShader, Shader* boxShader, std::function<GLuint()> depthTexture, int width, int height,
+	const glm::mat4& projection, const glm::mat4& view)
+{
+	statisticFrames++;
+
+	if (mode == OCCLUSION_HIZ && depthTexture)
+	{
+		glm::mat4 viewProjection = projection * view;
+		unsigned int frame = this->frame;
+		commands.call([this, pyramidShader, depthTexture, width, height, viewProjection, frame]()
+		{
+			finishReadbacks();
+			buildPyramid(pyramidShader, depthTexture(), width, height);
+			startReadback(viewProjection, width, height, frame);
+		});
+	}
+	else if (mode == OCCLUSION_QUERIES)
+	{
+		unsigned int count = (unsigned int)boxes.size();
+		BoxQuery* staged = commands.stage<BoxQuery>(count);
+		if (count > 0)
+			memcpy(staged, boxes.data(), sizeof(BoxQuery) * count);
+		commands.useShader(boxShader);
+		commands.setMat4(boxShader, "projection", projection);
+		commands.setMat4(boxShader, "view", view);
+		int set = frame & 1;
+		commands.call([this, boxShader, staged, count, set]()
+		{
+			queryBoxes(boxShader, staged, count, set);
+		});
+	}
+}
+
+void OcclusionCulling::buildPyramid(Shader* pyramidShader, GLuint depthTexture, int width, int height)
+{
+	// (re)allocate the levels the GPU reduces, down to the one read back
+	int levelWidth = std::max(1, width / 2), levelHeight = std::max(1, height / 2);
+	if (levelWidth != pyramidWidth || levelHeight != pyramidHeight)
+	{
+		pyramidWidth = levelWidth;
+		pyramidHeight = levelHeight;
+		if (pyramidTexture == 0)
+			glGenTextures(1, &pyramidTexture);
+		glActiveTexture(GL_TEXTURE14);
+		glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+		readbackLevel = 0;
+		for (int w = levelWidth, h = levelHeight; ; w = std::max(1, w / 2), h = std::max(1, h / 2), readbackLevel++)
+		{
+			glTexImage2D(GL_TEXTURE_2D, readbackLevel, GL_R32F, w, h, 0, GL_RED, GL_FLOAT, NULL);
+			if ((w <= maxReadbackSize && h <= maxReadbackSize) || readbackLevel == maxLevels - 1)
+				break;
+		}
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, readbackLevel);
+	}
+
+	GLint previousFramebuffer, viewport[4];
+	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	pyramidShader->use();
+	glUniform1i(pyramidShader->getUniformLocation("source"), 14);
+	glUniform1i(pyramidShader->getUniformLocation("reverseZ"), reverseZ ? 1 : 0);
+	GLint sourceSizeLocation = pyramidShader->getUniformLocation("sourceSize");
+	glDisable(GL_DEPTH_TEST);
+	glBindFramebuffer(GL_FRAMEBUFFER, pyramidFBO);
+	glBindVertexArray(emptyVAO);
+	glActiveTexture(GL_TEXTURE14);
+
+	int sourceWidth = width, sourceHeight = height;
+	for (int level = 0; level <= readbackLevel; level++)
+	{
+		int w = std::max(1, sourceWidth / 2), h = std::max(1, sourceHeight / 2);
+		// the source is the only level the shader sees, the one written is not sampled
+		if (level == 0)
+			glBindTexture(GL_TEXTURE_2D, depthTexture);
+		else
+		{
+			glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+		}
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, pyramidTexture, level);
+		glUniform2i(sourceSizeLocation, sourceWidth, sourceHeight);
+		glViewport(0, 0, w, h);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+		sourceWidth = w;
+		sourceHeight = h;
+	}
+
+	glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, readbackLevel);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glEnable(GL_DEPTH_TEST);
+	glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+	pyramidsBuilt++;
+}
+
+void OcclusionCulling::startReadback(const glm::mat4& viewProjection, int width, int height, unsigned int frame)
+{
+	Readback& readback = readbacks[nextReadback];
+	if (readback.fence)
+	{
+		readbacksSkipped++; // the GL is more than readbackCount frames behind
+		return;
+	}
+	int w = std::max(1, pyramidWidth >> readbackLevel), h = std::max(1, pyramidHeight >> readbackLevel);
+	size_t size = (size_t)w * h * sizeof(float);
+	if (readback.buffer == 0)
+		glGenBuffers(1, &readback.buffer);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+	if (readback.capacity < size)
+	{
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		readback.capacity = size;
+	}
+	// into the buffer, the copy happens when the GL gets there
+	glActiveTexture(GL_TEXTURE14);
+	glBindTexture(GL_TEXTURE_2D, pyramidTexture);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glGetTexImage(GL_TEXTURE_2D, readbackLevel, GL_RED, GL_FLOAT, (void*)0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	readback.viewProjection = viewProjection;
+	readback.screenWidth = width;
+	readback.screenHeight = height;
+	readback.frame = frame;
+	readback.level = readbackLevel;
+	readback.levelWidth = w;
+	readback.levelHeight = h;
+	nextReadback = (nextReadback + 1) % readbackCount;
+}
+
+void OcclusionCulling::finishReadbacks()
+{
+	// oldest first, the newer ones cannot be done before it
+	for (int i = 0; i < readbackCount; i++)
+	{
+		Readback& readback = readbacks[(nextReadback + i) % readbackCount];
+		if (!readback.fence)
+			continue;
+		if (glClientWaitSync(readback.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			break;
+		glDeleteSync(readback.fence);
+		readback.fence = NULL;
+
+		// the level read back, then the coarser ones built from it the way the shader does
+		Pyramid& pyramid = pyramids[writing];
+		pyramid.firstLevel = readback.level;
+		pyramid.levelCount = 0;
+		size_t total = 0;
+		for (int w = readback.levelWidth, h = readback.levelHeight; ; w = std::max(1, w / 2), h = std::max(1, h / 2))
+		{
+			pyramid.offsets[pyramid.levelCount] = (int)total;
+			pyramid.widths[pyramid.levelCount] = w;
+			pyramid.heights[pyramid.levelCount] = h;
+			pyramid.levelCount++;
+			total += (size_t)w * h;
+			if ((w == 1 && h == 1) || pyramid.levelCount == maxLevels)
+				break;
+		}
+		pyramid.texels.resize(total);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		size_t size = (size_t)pyramid.widths[0] * pyramid.heights[0] * sizeof(float);
+		const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+		bool mapped = data != NULL;
+		if (mapped)
+		{
+			memcpy(pyramid.texels.data(), data, size);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		if (!mapped)
+		{
+			std::cout << "ERROR::OcclusionCulling::finishReadbacks:: cannot map the depth pyramid" << std::endl;
+			continue;
+		}
+
+		for (int k = 1; k < pyramid.levelCount; k++)
+		{
+			const float* source = &pyramid.texels[pyramid.offsets[k - 1]];
+			float* destination = &pyramid.texels[pyramid.offsets[k]];
+			int sourceWidth = pyramid.widths[k - 1], sourceHeight = pyramid.heights[k - 1];
+			for (int y = 0; y < pyramid.heights[k]; y++)
+			{
+				for (int x = 0; x < pyramid.widths[k]; x++)
+				{
+					int xEnd = std::min((2 * x + 3 == sourceWidth) ? 2 * x + 2 : 2 * x + 1, sourceWidth - 1);
+					int yEnd = std::min((2 * y + 3 == sourceHeight) ? 2 * y + 2 : 2 * y + 1, sourceHeight - 1);
+					float farthest = source[std::min(2 * y, sourceHeight - 1) * sourceWidth + std::min(2 * x, sourceWidth - 1)];
+					for (int sy = 2 * y; sy <= yEnd; sy++)
+						for (int sx = 2 * x; sx <= xEnd; sx++)
+							farthest = reverseZ ? std::min(farthest, source[sy * sourceWidth + sx]) : std::max(farthest, source[sy * sourceWidth + sx]);
+					destination[y * pyramid.widths[k] + x] = farthest;
+				}
+			}
+		}
+		pyramid.viewProjection = readback.viewProjection;
+		pyramid.screenWidth = readback.screenWidth;
+		pyramid.screenHeight = readback.screenHeight;
+		pyramid.frame = readback.frame;
+		pyramid.valid = true;
+
+		std::lock_guard<std::mutex> lock(handoff);
+		std::swap(writing, ready);
+		readyIsNew = true;
+	}
+}
+
+void OcclusionCulling::queryBoxes(Shader* boxShader, const BoxQuery* boxes, unsigned int count, int set)
+{
+	// the results of this set were for the draws of the frame before, before it is reused
+	collectQueries(set);
+
+	// the boxes touch the faces of what they hold: equal depths pass
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	glDepthFunc(compareFuncOrEqual);
+	GLint modelLocation = boxShader->getUniformLocation("model");
+	for (unsigned int i = 0; i < count; i++)
+	{
+		const BoxQuery& query = boxes[i];
+		glm::mat4 model = glm::scale(glm::translate(glm::mat4(1.0f), (query.boxMin + query.boxMax) * 0.5f), query.boxMax - query.boxMin);
+		glUniformMatrix4fv(modelLocation, 1, GL_FALSE, glm::value_ptr(model));
+		glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[set][query.object]);
+		box->drawDepth();
+		glEndQuery(GL_ANY_SAMPLES_PASSED);
+		issued[set].push_back(query.object);
+	}
+	glDepthFunc(compareFunc);
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+
+void OcclusionCulling::collectQueries(int set)
+{
+	unsigned int tested = 0, culled = 0;
+	for (unsigned int object : issued[set])
+	{
+		GLuint available = GL_FALSE, samples = 0;
+		glGetQueryObjectuiv(queries[set][object], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+		{
+			queriesNotReady++;
+			continue;
+		}
+		glGetQueryObjectuiv(queries[set][object], GL_QUERY_RESULT, &samples);
+		tested++;
+		if (samples == 0)
+			culled++;
+	}
+	if (!issued[set].empty())
+	{
+		queryTested += tested;
+		queryCulled += culled;
+		queryFrames++;
+	}
+	issued[set].clear();
+}
+
+double OcclusionCulling::getCulledRatio() const
+{
+	if (mode == OCCLUSION_QUERIES)
+		return queryTested ? (double)queryCulled / queryTested : 0.0;
+	return testedTotal ? (double)culledTotal / testedTotal : 0.0;
+}
+
+double OcclusionCulling::getTestedPerFrame() const
+{
+	if (mode == OCCLUSION_QUERIES)
+		return queryFrames ? (double)queryTested / queryFrames : 0.0;
+	return statisticFrames ? (double)testedTotal / statisticFrames : 0.0;
+}
+
+void OcclusionCulling::resetStatistics()
+{
+	testedTotal = culledTotal = 0;
+	statisticFrames = 0;
+	pyramidTests = 0;
+	pyramidAge = 0.0;
+	queryTested = 0;
+	queryCulled = 0;
+	queryFrames = 0;
+}
+
+void OcclusionCulling::report() const
+{
+	std::cout << "OcclusionCulling:: " << getModeName(mode) << ", " << objectCount << " objects, " << getTestedPerFrame() << " in view a frame, "
+		<< getCulledRatio() * 100.0 << "% of them culled on average";
+	if (mode == OCCLUSION_HIZ)
+		std::cout << " (last frame " << frameCulled << " of " << frameTested << ")";
+	if (pyramidsBuilt > 0)
+		std::cout << ", " << pyramidsBuilt << " pyramids from " << pyramidWidth << "x" << pyramidHeight << ", level " << readbackLevel
+		<< " read back, tested " << (pyramidTests ? pyramidAge / pyramidTests : 0.0) << " frames later, " << readbacksSkipped << " readbacks skipped";
+	if (queriesNotReady > 0)
+		std::cout << ", " << queriesNotReady << " query results late";
+	std::cout << std::endl;
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+
+#include "Shader.h"
+#include "Framebuffer.h"
+#include "RenderGraph.h"
+#include "RenderThread.h"
+
+struct PostSettings
+{
+	bool bloom = true;
+	bool fxaa = true;
+	float exposure = 1.0f;
+	float bloomThreshold = 1.0f; // HDR values above this glow
+	float bloomKnee = 0.5f;      // the glow fades in over that much below the threshold
+	float bloomStrength = 0.6f;
+};
+
+// The full screen shaders of the passes, all of them with fullscreen.vs
+struct PostShaders
+{
+	Shader* threshold;
+	Shader* downsample;
+	Shader* blur;
+	Shader* upsample;
+	Shader* tonemap;
+	Shader* fxaa;
+};
+
+//
+// Post-processing of the HDR scene into the window, as a render graph.
+// Bloom: the bright parts at half size, down to 1/8, blurred there and on the way up at 1/4 and
+// added back at each size. Then the ACES tonemapping of the scene and its bloom, then FXAA from
+// the luma the tonemapping leaves in alpha. Without FXAA the tonemapping writes the window.
+// The bloom passes are always declared: without bloom the tonemapping does not read them and the
+// graph culls them, the blur and upsampling textures of the chain share their memory.
+//
+class PostProcess
+{
+public:
+	PostProcess(const PostSettings& settings = PostSettings());
+
+	// Build and compile the graph reading the scene's color texture. The shaders and the scene
+	// must outlive it.
+	bool create(Framebuffer* scene, const PostShaders& shaders);
+	// Record the passes, the window's framebuffer is bound after them
+	void execute(CommandList& commands, int width, int height);
+
+	// the resolved graph and its texture memory at that frame size
+	void report(int width, int height) const;
+
+private:
+	void addBlur(const char* name, Shader* shader, RenderResource input, RenderResource output, float directionX, float directionY);
+
+	PostSettings settings;
+	RenderGraph graph;
+};
+
+
+PostProcess::PostProcess(const PostSettings& settings)
+{
+	this->settings = settings;
+}
+
+void PostProcess::addBlur(const char* name, Shader* shader, RenderResource input, RenderResource output, float directionX, float directionY)
+{
+	graph.addPass(name, { input }, output, [shader, directionX, directionY](const RenderPassContext& context)
+	{
+		shader->use();
+		glUniform2f(shader->getUniformLocation("outputTexelSize"), 1.0f / context.width, 1.0f / context.height);
+		glUniform2f(shader->getUniformLocation("direction"), directionX, directionY);
+	});
+}
+
+bool PostProcess::create(Framebuffer* scene, const PostShaders& shaders)
+{
+	// bloom stays in HDR, the small float format is enough for a blurred glow
+	const GLenum bloomFormat = GL_R11F_G11F_B10F;
+	RenderResource sceneColor = graph.importTexture("scene", [scene]() { return (GLuint)scene->getColorTexture(); });
+	RenderResource window = graph.importWindow("window");
+	RenderResource bright = graph.createTexture("bloom bright 1/2", 0.5f, bloomFormat);
+	RenderResource down4 = graph.createTexture("bloom down 1/4", 0.25f, bloomFormat);
+	RenderResource down8 = graph.createTexture("bloom down 1/8", 0.125f, bloomFormat);
+	RenderResource blurH8 = graph.createTexture("bloom blur x 1/8", 0.125f, bloomFormat);
+	RenderResource blurV8 = graph.createTexture("bloom blur y 1/8", 0.125f, bloomFormat);
+	RenderResource up4 = graph.createTexture("bloom up 1/4", 0.25f, bloomFormat);
+	RenderResource blurH4 = graph.createTexture("bloom blur x 1/4", 0.25f, bloomFormat);
+	RenderResource blurV4 = graph.createTexture("bloom blur y 1/4", 0.25f, bloomFormat);
+	RenderResource bloom = graph.createTexture("bloom", 0.5f, bloomFormat);
+	RenderResource tonemapped = settings.fxaa ? graph.createTexture("tonemapped", 1.0f, GL_RGBA8) : window;
+
+	Shader* threshold = shaders.threshold;
+	float thresholdValue = settings.bloomThreshold, knee = settings.bloomKnee;
+	graph.addPass("bloom threshold", { sceneColor }, bright, [threshold, thresholdValue, knee](const RenderPassContext& context)
+	{
+		threshold->use();
+		glUniform2f(threshold->getUniformLocation("outputTexelSize"), 1.0f / context.width, 1.0f / context.height);
+		glUniform1f(threshold->getUniformLocation("threshold"), thresholdValue);
+		glUniform1f(threshold->getUniformLocation("knee"), knee);
+	});
+	Shader* downsample = shaders.downsample;
+	auto downsamplePass = [downsample](const RenderPassContext& context)
+	{
+		downsample->use();
+		glUniform2f(downsample->getUniformLocation("outputTexelSize"), 1.0f / context.width, 1.0f / context.height);
+	};
+	graph.addPass("bloom downsample 1/4", { bright }, down4, downsamplePass);
+	graph.addPass("bloom downsample 1/8", { down4 }, down8, downsamplePass);
+	addBlur("bloom blur x 1/8", shaders.blur, down8, blurH8, 1.0f, 0.0f);
+	addBlur("bloom blur y 1/8", shaders.blur, blurH8, blurV8, 0.0f, 1.0f);
+	Shader* upsample = shaders.upsample;
+	auto upsamplePass = [upsample](const RenderPassContext& context)
+	{
+		upsample->use();
+		glUniform1i(upsample->getUniformLocation("source"), 0);
+		glUniform1i(upsample->getUniformLocation("base"), 1);
+		glUniform2f(upsample->getUniformLocation("outputTexelSize"), 1.0f / context.width, 1.0f / context.height);
+	};
+	graph.addPass("bloom upsample 1/4", { blurV8, down4 }, up4, upsamplePass);
+	addBlur("bloom blur x 1/4", shaders.blur, up4, blurH4, 1.0f, 0.0f);
+	addBlur("bloom blur y 1/4", shaders.blur, blurH4, blurV4, 0.0f, 1.0f);
+	graph.addPass("bloom upsample 1/2", { blurV4, bright }, bloom, upsamplePass);
+
+	Shader* tonemap = shaders.tonemap;
+	float exposure = settings.exposure, bloomStrength = settings.bloom ? settings.bloomStrength : 0.0f;
+	auto tonemapPass = [tonemap, exposure, bloomStrength](const RenderPassContext& context)
+	{
+		tonemap->use();
+		glUniform1i(tonemap->getUniformLocation("scene"), 0);
+		glUniform1i(tonemap->getUniformLocation("bloom"), 1);
+		glUniform2f(tonemap->getUniformLocation("outputTexelSize"), 1.0f / context.width, 1.0f / context.height);
+		glUniform1f(tonemap->getUniformLocation("exposure"), exposure);
+		glUniform1f(tonemap->getUniformLocation("bloomStrength"), bloomStrength);
+	};
+	if (settings.bloom)
+		graph.addPass("tonemap", { sceneColor, bloom }, tonemapped, tonemapPass);
+	else
+		graph.addPass("tonemap", { sceneColor }, tonemapped, tonemapPass);
+
+	if (settings.fxaa)
+	{
+		Shader* fxaa = shaders.fxaa;
+		graph.addPass("fxaa", { tonemapped }, window, [fxaa](const RenderPassContext& context)
+		{
+			fxaa->use();
+			glUniform2f(fxaa->getUniformLocation("outputTexelSize"), 1.0f / context.width, 1.0f / context.height);
+		});
+	}
+	graph.markOutput(window);
+	return graph.compile();
+}
+
+void PostProcess::execute(CommandList& commands, int width, int height)
+{
+	graph.execute(commands, width, height);
+}
+
+void PostProcess::report(int width, int height) const
+{
+	std::cout << "PostProcess:: " << (settings.bloom ? "bloom, " : "") << "ACES tonemapping at exposure " << settings.exposure
+		<< (settings.fxaa ? ", FXAA" : "") << std::endl;
+	graph.dump(width, height);
+}
@@ -0,0 +1,455 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+#include <vector>
+#include <functional>
+#include <initializer_list>
+#include <algorithm>
+
+#include "RenderThread.h"
+
+// A texture of the graph, by index
+typedef int RenderResource;
+
+// What a pass function gets: its inputs are bound to units 0 and up, in the order they were declared
+struct RenderPassContext
+{
+	int width;  // of the output
+	int height;
+	int inputCount;
+	int inputWidths[4];
+	int inputHeights[4];
+};
+
+//
+// Render graph of full screen passes.
+// Passes declare the textures they read and the one they write, then compile() works out the
+// frame: the passes whose output does not lead to a marked output are culled, the others are
+// ordered so that every texture is written before it is read, and the transient textures (made
+// by the graph, sized as a fraction of the frame) get their GL texture. Two transients of the
+// same size and format share one when the first is last read before the second is written, so
+// the memory is the peak of what is alive at once rather than the sum.
+// The description and compile() belong to the main thread before the render thread starts;
+// execute() records the passes, the GL textures are (re)made on the render thread on resize.
+//
+class RenderGraph
+{
+public:
+	static const int maxInputs = 4;
+	// sets the pass's shader up and its uniforms, the graph then draws one triangle over the output (render thread)
+	typedef std::function<void(const RenderPassContext&)> PassFunction;
+
+	RenderGraph();
+	// Deletes the textures, needs the context
+	~RenderGraph();
+
+	RenderGraph(const RenderGraph&) = delete;
+	RenderGraph& operator=(const RenderGraph&) = delete;
+
+	// A frame sized texture made elsewhere. texture() is asked on the render thread every frame,
+	// its owner may recreate it. Names must be string literals (they are not copied).
+	RenderResource importTexture(const char* name, std::function<GLuint()> texture);
+	// The window's framebuffer, as a pass output
+	RenderResource importWindow(const char* name);
+	// A texture owned by the graph, scale times the frame size
+	RenderResource createTexture(const char* name, float scale, GLenum internalFormat);
+	void addPass(const char* name, std::initializer_list<RenderResource> inputs, RenderResource output, PassFunction function);
+	// What the frame is for, the passes not leading to one of these are culled
+	void markOutput(RenderResource resource);
+
+	// Cull, order and share the transient textures. False (and an error printed) when a texture
+	// is written by two passes, read without being written or the passes depend on each other.
+	bool compile();
+	// Record the passes for a width x height frame, the window's framebuffer is bound after them
+	void execute(CommandList& commands, int width, int height);
+
+	// the order, the culled passes and the texture of each transient, with the memory it saves
+	void dump(int width, int height) const;
+
+private:
+	struct Resource
+	{
+		const char* name;
+		float scale;
+		GLenum format;
+		bool imported;
+		bool window;
+		std::function<GLuint()> texture; // imported ones
+		int producer;                    // pass writing it, -1 for none
+		int firstUse;                    // positions in the order
+		int lastUse;
+		int physical;                    // transient: index in textures
+	};
+	struct Pass
+	{
+		const char* name;
+		int inputs[maxInputs];
+		int inputCount;
+		int output;
+		PassFunction function;
+		bool culled;
+	};
+	// a GL texture and its framebuffer, shared by the transients it was given to
+	struct Physical
+	{
+		float scale;
+		GLenum format;
+		int lastUse;  // while compiling: the last pass reading its current transient
+		GLuint texture;
+		GLuint fbo;
+	};
+
+	bool visit(int pass, std::vector<int>& state);
+	// the GL textures for a frame size (render thread once it started)
+	void allocate(int width, int height);
+	void release();
+	void run(int width, int height);
+
+	static int scaled(int size, float scale) { return std::max(1, (int)(size * scale)); }
+	static int bytesPerPixel(GLenum format);
+	static const char* formatName(GLenum format);
+
+	std::vector<Resource> resources;
+	std::vector<Pass> passes;
+	std::vector<int> outputs;
+	std::vector<int> order;      // live passes, in execution order
+	std::vector<Physical> textures;
+	bool compiled;
+	int allocatedWidth;
+	int allocatedHeight;
+	GLuint emptyVAO;             // the full screen triangle comes from gl_VertexID
+};
+
+
+RenderGraph::RenderGraph()
+{
+	compiled = false;
+	allocatedWidth = allocatedHeight = 0;
+	emptyVAO = 0;
+}
+
+RenderGraph::~RenderGraph()
+{
+	release();
+	if (emptyVAO != 0)
+		glDeleteVertexArrays(1, &emptyVAO);
+}
+
+RenderResource RenderGraph::importTexture(const char* name, std::function<GLuint()> texture)
+{
+	resources.push_back(Resource{ name, 1.0f, 0, true, false, texture, -1, -1, -1, -1 });
+	return (RenderResource)resources.size() - 1;
+}
+
+RenderResource RenderGraph::importWindow(const char* name)
+{
+	resources.push_back(Resource{ name, 1.0f, 0, true, true, nullptr, -1, -1, -1, -1 });
+	return (RenderResource)resources.size() - 1;
+}
+
+RenderResource RenderGraph::createTexture(const char* name, float scale, GLenum internalFormat)
+{
+	resources.push_back(Resource{ name, scale, internalFormat, false, false, nullptr, -1, -1, -1, -1 });
+	return (RenderResource)resources.size() - 1;
+}
+
+void RenderGraph::addPass(const char* name, std::initializer_list<RenderResource> inputs, RenderResource output, PassFunction function)
+{
+	Pass pass;
+	pass.name = name;
+	pass.inputCount = 0;
+	for (RenderResource input : inputs)
+	{
+		if (pass.inputCount == maxInputs)
+		{
+			std::cout << "ERROR::RenderGraph::addPass:: " << name << " reads more than " << maxInputs << " textures" << std::endl;
+			break;
+		}
+		pass.inputs[pass.inputCount++] = input;
+	}
+	pass.output = output;
+	pass.function = function;
+	pass.culled = false;
+	passes.push_back(pass);
+	compiled = false;
+}
+
+void RenderGraph::markOutput(RenderResource resource)
+{
+	outputs.push_back(resource);
+	compiled = false;
+}
+
+bool RenderGraph::visit(int pass, std::vector<int>& state)
+{
+	// 0 not visited, 1 on the current path, 2 ordered
+	if (state[pass] == 2)
+		return true;
+	if (state[pass] == 1)
+	{
+		std::cout << "ERROR::RenderGraph::compile:: " << passes[pass].name << " depends on itself" << std::endl;
+		return false;
+	}
+	state[pass] = 1;
+	for (int i = 0; i < passes[pass].inputCount; i++)
+	{
+		int producer = resources[passes[pass].inputs[i]].producer;
+		if (producer >= 0 && !visit(producer, state))
+			return false;
+	}
+	state[pass] = 2;
+	order.push_back(pass);
+	return true;
+}
+
+bool RenderGraph::compile()
+{
+	compiled = false;
+	order.clear();
+	for (Resource& resource : resources)
+	{
+		resource.producer = -1;
+		resource.firstUse = resource.lastUse = -1;
+		resource.physical = -1;
+	}
+	for (int i = 0; i < (int)passes.size(); i++)
+	{
+		Resource& output = resources[passes[i].output];
+		if (output.producer >= 0 || (output.imported && !output.window))
+		{
+			std::cout << "ERROR::RenderGraph::compile:: " << output.name << " is written by " << passes[i].name << " and "
+				<< (output.producer >= 0 ? passes[output.producer].name : "outside the graph") << std::endl;
+			return false;
+		}
+		output.producer = i;
+	}
+
+	// culling and ordering: what the outputs need, depth first, inputs before their readers
+	std::vector<int> state(passes.size(), 0);
+	for (int output : outputs)
+	{
+		int producer = resources[output].producer;
+		if (producer < 0)
+		{
+			std::cout << "ERROR::RenderGraph::compile:: no pass writes the output " << resources[output].name << std::endl;
+			return false;
+		}
+		if (!visit(producer, state))
+			return false;
+	}
+	for (int i = 0; i < (int)passes.size(); i++)
+		passes[i].culled = state[i] != 2;
+	for (int pass : order)
+		for (int i = 0; i < passes[pass].inputCount; i++)
+		{
+			const Resource& input = resources[passes[pass].inputs[i]];
+			if (input.producer < 0 && !input.imported)
+			{
+				std::cout << "ERROR::RenderGraph::compile:: " << passes[pass].name << " reads " << input.name << " which no pass writes" << std::endl;
+				return false;
+			}
+		}
+
+	// lifetimes, from the pass writing a texture to the last one reading it
+	for (int position = 0; position < (int)order.size(); position++)
+	{
+		const Pass& pass = passes[order[position]];
+		Resource& output = resources[pass.output];
+		output.firstUse = output.lastUse = position;
+		for (int i = 0; i < pass.inputCount; i++)
+			resources[pass.inputs[i]].lastUse = position;
+	}
+	// a texture the frame is for stays until the end
+	for (int output : outputs)
+		resources[output].lastUse = (int)order.size();
+
+	// sharing: in order of writing, each transient takes a texture of its size and format whose
+	// last reader came before, or a new one. Reading and writing the same texture in one pass is
+	// not allowed, so the last read has to be strictly before.
+	release();
+	textures.clear();
+	for (int pass : order)
+	{
+		Resource& resource = resources[passes[pass].output];
+		if (resource.imported)
+			continue;
+		int chosen = -1;
+		for (int i = 0; i < (int)textures.size() && chosen < 0; i++)
+			if (textures[i].scale == resource.scale && textures[i].format == resource.format && textures[i].lastUse < resource.firstUse)
+				chosen = i;
+		if (chosen < 0)
+		{
+			textures.push_back(Physical{ resource.scale, resource.format, -1, 0, 0 });
+			chosen = (int)textures.size() - 1;
+		}
+		textures[chosen].lastUse = resource.lastUse;
+		resource.physical = chosen;
+	}
+	compiled = true;
+	return true;
+}
+
+void RenderGraph::release()
+{
+	for (Physical& physical : textures)
+	{
+		if (physical.texture != 0)
+			glDeleteTextures(1, &physical.texture);
+		if (physical.fbo != 0)
+			glDeleteFramebuffers(1, &physical.fbo);
+		physical.texture = physical.fbo = 0;
+	}
+	allocatedWidth = allocatedHeight = 0;
+}
+
+void RenderGraph::allocate(int width, int height)
+{
+	release();
+	for (Physical& physical : textures)
+	{
+		glGenTextures(1, &physical.texture);
+		glBindTexture(GL_TEXTURE_2D, physical.texture);
+		// the pixel type does not matter without data
+		glTexImage2D(GL_TEXTURE_2D, 0, physical.format, scaled(width, physical.scale), scaled(height, physical.scale), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		glGenFramebuffers(1, &physical.fbo);
+		glBindFramebuffer(GL_FRAMEBUFFER, physical.fbo);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, physical.texture, 0);
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+			std::cout << "ERROR::RenderGraph::allocate:: incomplete framebuffer for a " << formatName(physical.format) << " texture, status 0x"
+				<< std::hex << status << std::dec << std::endl;
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	allocatedWidth = width;
+	allocatedHeight = height;
+}
+
+void RenderGraph::execute(CommandList& commands, int width, int height)
+{
+	if (!compiled)
+		return;
+	commands.call([this, width, height]()
+	{
+		run(width, height);
+	});
+}
+
+void RenderGraph::run(int width, int height)
+{
+	if (width <= 0 || height <= 0)
+		return;
+	if (width != allocatedWidth || height != allocatedHeight)
+		allocate(width, height);
+	if (emptyVAO == 0)
+		glGenVertexArrays(1, &emptyVAO);
+
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_BLEND);
+	glBindVertexArray(emptyVAO);
+	for (int index : order)
+	{
+		const Pass& pass = passes[index];
+		const Resource& output = resources[pass.output];
+		RenderPassContext context;
+		context.width = scaled(width, output.scale);
+		context.height = scaled(height, output.scale);
+		context.inputCount = pass.inputCount;
+		for (int i = 0; i < pass.inputCount; i++)
+		{
+			const Resource& input = resources[pass.inputs[i]];
+			context.inputWidths[i] = scaled(width, input.scale);
+			context.inputHeights[i] = scaled(height, input.scale);
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(GL_TEXTURE_2D, input.imported ? input.texture() : textures[input.physical].texture);
+		}
+		glActiveTexture(GL_TEXTURE0);
+		glBindFramebuffer(GL_FRAMEBUFFER, output.window ? 0 : textures[output.physical].fbo);
+		glViewport(0, 0, context.width, context.height);
+
+		pass.function(context);
+		glDrawArrays(GL_TRIANGLES, 0, 3);
+	}
+	glEnable(GL_DEPTH_TEST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, width, height);
+}
+
+int RenderGraph::bytesPerPixel(GLenum format)
+{
+	switch (format)
+	{
+	case GL_R8: return 1;
+	case GL_R16F: return 2;
+	case GL_RGBA16F: return 8;
+	case GL_RGBA32F: return 16;
+	default: return 4; // GL_RGBA8, GL_R11F_G11F_B10F, GL_RGB10_A2, GL_RG16F, GL_R32F
+	}
+}
+
+const char* RenderGraph::formatName(GLenum format)
+{
+	switch (format)
+	{
+	case GL_R8: return "R8";
+	case GL_R16F: return "R16F";
+	case GL_R32F: return "R32F";
+	case GL_RG16F: return "RG16F";
+	case GL_RGBA8: return "RGBA8";
+	case GL_RGB10_A2: return "RGB10_A2";
+	case GL_R11F_G11F_B10F: return "R11F_G11F_B10F";
+	case GL_RGBA16F: return "RGBA16F";
+	case GL_RGBA32F: return "RGBA32F";
+	default: return "?";
+	}
+}
+
+void RenderGraph::dump(int width, int height) const
+{
+	if (!compiled)
+	{
+		std::cout << "RenderGraph:: not compiled" << std::endl;
+		return;
+	}
+	size_t transientBytes = 0, textureBytes = 0;
+	int transients = 0;
+	for (const Resource& resource : resources)
+		if (!resource.imported && resource.physical >= 0)
+		{
+			transientBytes += (size_t)scaled(width, resource.scale) * scaled(height, resource.scale) * bytesPerPixel(resource.format);
+			transients++;
+		}
+	for (const Physical& physical : textures)
+		textureBytes += (size_t)scaled(width, physical.scale) * scaled(height, physical.scale) * bytesPerPixel(physical.format);
+	std::cout << "RenderGraph:: " << order.size() << " passes, " << passes.size() - order.size() << " culled, " << transients
+		<< " transient targets in " << textures.size() << " textures at " << width << "x" << height << ", " << textureBytes / 1024 << " KB instead of "
+		<< transientBytes / 1024 << " KB";
+	if (transientBytes > 0)
+		std::cout << " (" << (1.0 - (double)textureBytes / transientBytes) * 100.0 << "% saved)";
+	std::cout << std::endl;
+
+	for (int position = 0; position < (int)order.size(); position++)
+	{
+		const Pass& pass = passes[order[position]];
+		const Resource& output = resources[pass.output];
+		std::cout << "  " << position << " " << pass.name << ":";
+		for (int i = 0; i < pass.inputCount; i++)
+			std::cout << (i ? ", " : " ") << resources[pass.inputs[i]].name;
+		std::cout << " -> " << output.name;
+		if (output.window)
+			std::cout << " (window)";
+		else
+			std::cout << " (" << scaled(width, output.scale) << "x" << scaled(height, output.scale) << " " << formatName(output.format)
+				<< ", texture " << output.physical << ", read until pass " << output.lastUse << ")";
+		std::cout << std::endl;
+	}
+	for (const Pass& pass : passes)
+		if (pass.culled)
+			std::cout << "  culled " << pass.name << ": no output needs " << resources[pass.output].name << std::endl;
+}
@@ -0,0 +1,524 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <new>
+#include <cstddef>
+#include <cstring>
+
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "Shader.h"
+#include "Mesh.h"
+#include "Texture.h"
+#include "Framebuffer.h"
+#include "FrameArena.h"
+#include "TextureArray.h"
+
+enum RenderCommandType
+{
+	RCMD_BIND_TARGET,
+	RCMD_CLEAR,
+	RCMD_USE_SHADER,
+	RCMD_UNIFORM_FLOAT,
+	RCMD_UNIFORM_FLOAT3,
+	RCMD_UNIFORM_MAT3,
+	RCMD_UNIFORM_MAT4,
+	RCMD_BIND_TEXTURE,
+	RCMD_BIND_TEXTURE_ARRAYS,
+	RCMD_INSTANCE_TEXTURE,
+	RCMD_DRAW,
+	RCMD_DRAW_DEPTH,
+	RCMD_BLIT,
+	RCMD_CALL
+};
+
+//
+// GL work of one frame, recorded by the main thread and replayed by the render thread.
+// Commands (header + payload) are bump allocated from the list's own FrameArena and chained,
+// the arena is rewound once the list ran, so recording a frame does not touch the heap.
+// Everything a command needs is copied in: matrices and uniform values, never pointers to
+// the caller's locals. Shaders, meshes and textures are referenced and must outlive the frame.
+//
+class CommandList
+{
+public:
+	CommandList();
+	~CommandList();
+
+	// Render into target (NULL for the window), resizing it first if needed, and set the viewport
+	void bindTarget(Framebuffer* target, int width, int height);
+	void clear(glm::vec4 color, GLbitfield mask);
+	void useShader(Shader* shader);
+	// uniform names must be string literals (they are not copied)
+	void setFloat(Shader* shader, const char* name, float value);
+	void setFloat3(Shader* shader, const char* name, glm::vec3 value);
+	void setMat3(Shader* shader, const char* name, const glm::mat3& value);
+	void setMat4(Shader* shader, const char* name, const glm::mat4& value);
+	// uniform mat4 array, the values are staged in the frame arena
+	void setMat4(Shader* shader, const char* name, const glm::mat4* values, unsigned int count);
+	void bindTexture(Texture* texture);
+	// Bind every array of the pool once for the pass, then pick each draw's texture by slice
+	void bindTextureArrays(TextureArrayPool* pool, unsigned int firstUnit);
+	void setInstanceTexture(Shader* shader, TextureArrayPool* pool, TextureSlice slice, glm::vec4 uvTransform = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f));
+	void draw(Mesh* mesh, int lod = 0);
+	// Draw reading the positions only, for the depth passes
+	void drawDepth(Mesh* mesh, int lod = 0);
+	// Copy target's color to the window
+	void blit(Framebuffer* target, int screenWidth, int screenHeight);
+	// Run any function on the render thread, for resource creation, uploads and deletion
+	template<typename Function> void call(Function function);
+	// Room in the frame arena for data a call() reads (buffer contents...), valid until the list ran
+	template<typename T> T* stage(size_t count) { return arena.allocate<T>(count); }
+
+	// Replay every command with the GL, then forget them (render thread)
+	void execute();
+	// Drop the recorded commands without running them
+	void reset();
+
+	unsigned int getCommandCount() const { return commandCount; }
+	size_t getBytesUsed() const { return arena.getUsed(); }
+	const FrameArena& getArena() const { return arena; }
+
+private:
+	struct Header
+	{
+		RenderCommandType type;
+		Header* next;
+	};
+
+	template<typename Payload> Payload* allocate(RenderCommandType type);
+	void* allocate(RenderCommandType type, size_t payloadSize);
+	void rewind();
+
+	static const size_t commandAlignment = 16; // enough for the mat4s and for any captured object
+	static const size_t headerSize = (sizeof(Header) + commandAlignment - 1) & ~(commandAlignment - 1);
+
+	FrameArena arena;
+	Header* first;
+	Header* last;
+	unsigned int commandCount;
+
+	// payloads
+	struct BindTarget { Framebuffer* target; int width; int height; };
+	struct Clear { glm::vec4 color; GLbitfield mask; };
+	struct UseShader { Shader* shader; };
+	struct UniformFloat { Shader* shader; const char* name; float value; };
+	struct UniformFloat3 { Shader* shader; const char* name; glm::vec3 value; };
+	struct UniformMat3 { Shader* shader; const char* name; glm::mat3 value; };
+	struct UniformMat4 { Shader* shader; const char* name; const glm::mat4* values; unsigned int count; };
+	struct BindTexture { Texture* texture; };
+	struct BindTextureArrays { TextureArrayPool* pool; unsigned int firstUnit; };
+	struct InstanceTexture { glm::vec4 uvTransform; Shader* shader; TextureArrayPool* pool; TextureSlice slice; };
+	struct Draw { Mesh* mesh; int lod; };
+	struct Blit { Framebuffer* target; int screenWidth; int screenHeight; };
+	struct Call { void (*invoke)(void* function); void (*destroy)(void* function); };
+	static const size_t callSize = (sizeof(Call) + commandAlignment - 1) & ~(commandAlignment - 1);
+};
+
+//
+// Owner of the GL context once the setup is done. The main thread records frame N+1 into one
+// command list while the render thread replays frame N from the other one.
+// With threaded = false the lists are replayed right away on the calling thread, same code path.
+//
+class RenderThread
+{
+public:
+	RenderThread(GLFWwindow* window, bool threaded);
+	~RenderThread();
+
+	// Hand the GL context over to the render thread (the calling thread must have it current)
+	void start();
+	// Finish the last frame and give the GL context back to the calling thread
+	void stop();
+
+	// List to record the next frame into
+	CommandList& getCommandList() { return lists[writeIndex]; }
+	// Send the recorded frame; waits only if the render thread is still busy with the previous one
+	void submitFrame();
+
+	bool isThreaded() const { return threaded; }
+
+	// Frames handed to submitFrame() so far, which is also the index of the frame being recorded
+	unsigned int getSubmittedFrames() const { return submitCount; }
+	// Frames the GL has fully executed, as far as the main thread knows: submitFrame() only
+	// returns once the render thread finished the frame before the one it submits
+	unsigned int getCompletedFrames() const { return (threaded && running && submitCount > 0) ? submitCount - 1 : submitCount; }
+
+	// Statistics since start(), in milliseconds per frame
+	unsigned int getFrameCount() const { return frameCount; }
+	double getAverageRenderMs() const { return frameCount ? renderSeconds * 1000.0 / frameCount : 0.0; }
+	double getAverageWaitMs() const { return submitCount ? waitSeconds * 1000.0 / submitCount : 0.0; }
+
+private:
+	void run();
+	void renderFrame(CommandList& list);
+
+	GLFWwindow* window;
+	bool threaded;
+	bool running;
+
+	CommandList lists[2];
+	int writeIndex;       // list the main thread records into
+
+	std::thread thread;
+	std::mutex mutex;
+	std::condition_variable condition;
+	int pendingIndex;     // list submitted and not picked up yet, -1 if none
+	bool busy;            // the render thread is replaying a list
+	bool quit;
+
+	// written by the render thread only, read after stop() or between frames
+	unsigned int frameCount;
+	double renderSeconds;
+	// written by the main thread only
+	unsigned int submitCount;
+	double waitSeconds;
+};
+
+
+CommandList::CommandList() : arena(64 * 1024)
+{
+	first = NULL;
+	last = NULL;
+	commandCount = 0;
+}
+
+CommandList::~CommandList()
+{
+	reset();
+}
+
+void* CommandList::allocate(RenderCommandType type, size_t payloadSize)
+{
+	Header* header = (Header*)arena.allocate(headerSize + payloadSize, commandAlignment);
+	header->type = type;
+	header->next = NULL;
+	if (last)
+		last->next = header;
+	else
+		first = header;
+	last = header;
+	commandCount++;
+	return (unsigned char*)header + headerSize;
+}
+
+template<typename Payload>
+Payload* CommandList::allocate(RenderCommandType type)
+{
+	static_assert(alignof(Payload) <= commandAlignment, "render command payload is over-aligned");
+	return (Payload*)allocate(type, sizeof(Payload));
+}
+
+void CommandList::bindTarget(Framebuffer* target, int width, int height)
+{
+	*allocate<BindTarget>(RCMD_BIND_TARGET) = { target, width, height };
+}
+
+void CommandList::clear(glm::vec4 color, GLbitfield mask)
+{
+	*allocate<Clear>(RCMD_CLEAR) = { color, mask };
+}
+
+void CommandList::useShader(Shader* shader)
+{
+	allocate<UseShader>(RCMD_USE_SHADER)->shader = shader;
+}
+
+void CommandList::setFloat(Shader* shader, const char* name, float value)
+{
+	*allocate<UniformFloat>(RCMD_UNIFORM_FLOAT) = { shader, name, value };
+}
+
+void CommandList::setFloat3(Shader* shader, const char* name, glm::vec3 value)
+{
+	*allocate<UniformFloat3>(RCMD_UNIFORM_FLOAT3) = { shader, name, value };
+}
+
+void CommandList::setMat3(Shader* shader, const char* name, const glm::mat3& value)
+{
+	*allocate<UniformMat3>(RCMD_UNIFORM_MAT3) = { shader, name, value };
+}
+
+void CommandList::setMat4(Shader* shader, const char* name, const glm::mat4& value)
+{
+	setMat4(shader, name, &value, 1);
+}
+
+void CommandList::setMat4(Shader* shader, const char* name, const glm::mat4* values, unsigned int count)
+{
+	glm::mat4* staged = arena.allocate<glm::mat4>(count);
+	memcpy(staged, values, sizeof(glm::mat4) * count);
+	*allocate<UniformMat4>(RCMD_UNIFORM_MAT4) = { shader, name, staged, count };
+}
+
+void CommandList::bindTexture(Texture* texture)
+{
+	allocate<BindTexture>(RCMD_BIND_TEXTURE)->texture = texture;
+}
+
+void CommandList::bindTextureArrays(TextureArrayPool* pool, unsigned int firstUnit)
+{
+	*allocate<BindTextureArrays>(RCMD_BIND_TEXTURE_ARRAYS) = { pool, firstUnit };
+}
+
+void CommandList::setInstanceTexture(Shader* shader, TextureArrayPool* pool, TextureSlice slice, glm::vec4 uvTransform)
+{
+	*allocate<InstanceTexture>(RCMD_INSTANCE_TEXTURE) = { uvTransform, shader, pool, slice };
+}
+
+void CommandList::draw(Mesh* mesh, int lod)
+{
+	*allocate<Draw>(RCMD_DRAW) = { mesh, lod };
+}
+
+void CommandList::drawDepth(Mesh* mesh, int lod)
+{
+	*allocate<Draw>(RCMD_DRAW_DEPTH) = { mesh, lod };
+}
+
+void CommandList::blit(Framebuffer* target, int screenWidth, int screenHeight)
+{
+	*allocate<Blit>(RCMD_BLIT) = { target, screenWidth, screenHeight };
+}
+
+template<typename Function>
+void CommandList::call(Function function)
+{
+	static_assert(alignof(Function) <= commandAlignment, "captured state is over-aligned");
+	unsigned char* payload = (unsigned char*)allocate(RCMD_CALL, callSize + sizeof(Function));
+	Call* call = (Call*)payload;
+	call->invoke = [](void* stored) { (*(Function*)stored)(); };
+	call->destroy = [](void* stored) { ((Function*)stored)->~Function(); };
+	new (payload + callSize) Function(std::move(function));
+}
+
+void CommandList::execute()
+{
+	for (Header* header = first; header; header = header->next)
+	{
+		void* payload = (unsigned char*)header + headerSize;
+		switch (header->type)
+		{
+		case RCMD_BIND_TARGET:
+		{
+			BindTarget* bind = (BindTarget*)payload;
+			if (bind->target)
+			{
+				bind->target->resize(bind->width, bind->height);
+				bind->target->bind();
+			}
+			else
+			{
+				glBindFramebuffer(GL_FRAMEBUFFER, 0);
+				glViewport(0, 0, bind->width, bind->height);
+			}
+			break;
+		}
+		case RCMD_CLEAR:
+		{
+			Clear* clear = (Clear*)payload;
+			glClearColor(clear->color.x, clear->color.y, clear->color.z, clear->color.w);
+			glClear(clear->mask);
+			break;
+		}
+		case RCMD_USE_SHADER:
+			((UseShader*)payload)->shader->use();
+			break;
+		case RCMD_UNIFORM_FLOAT:
+		{
+			UniformFloat* uniform = (UniformFloat*)payload;
+			glUniform1f(uniform->shader->getUniformLocation(uniform->name), uniform->value);
+			break;
+		}
+		case RCMD_UNIFORM_FLOAT3:
+		{
+			UniformFloat3* uniform = (UniformFloat3*)payload;
+			glUniform3fv(uniform->shader->getUniformLocation(uniform->name), 1, glm::value_ptr(uniform->value));
+			break;
+		}
+		case RCMD_UNIFORM_MAT3:
+		{
+			UniformMat3* uniform = (UniformMat3*)payload;
+			glUniformMatrix3fv(uniform->shader->getUniformLocation(uniform->name), 1, GL_FALSE, glm::value_ptr(uniform->value));
+			break;
+		}
+		case RCMD_UNIFORM_MAT4:
+		{
+			UniformMat4* uniform = (UniformMat4*)payload;
+			glUniformMatrix4fv(uniform->shader->getUniformLocation(uniform->name), uniform->count, GL_FALSE, glm::value_ptr(uniform->values[0]));
+			break;
+		}
+		case RCMD_BIND_TEXTURE:
+			((BindTexture*)payload)->texture->bind();
+			break;
+		case RCMD_BIND_TEXTURE_ARRAYS:
+			((BindTextureArrays*)payload)->pool->bind(((BindTextureArrays*)payload)->firstUnit);
+			break;
+		case RCMD_INSTANCE_TEXTURE:
+		{
+			InstanceTexture* instance = (InstanceTexture*)payload;
+			instance->pool->applyInstanceTexture(instance->shader, instance->slice, instance->uvTransform);
+			break;
+		}
+		case RCMD_DRAW:
+			((Draw*)payload)->mesh->draw(((Draw*)payload)->lod);
+			break;
+		case RCMD_DRAW_DEPTH:
+			((Draw*)payload)->mesh->drawDepth(((Draw*)payload)->lod);
+			break;
+		case RCMD_BLIT:
+		{
+			Blit* blit = (Blit*)payload;
+			blit->target->blitToScreen(blit->screenWidth, blit->screenHeight);
+			break;
+		}
+		case RCMD_CALL:
+		{
+			Call* call = (Call*)payload;
+			void* function = (unsigned char*)payload + callSize;
+			call->invoke(function);
+			call->destroy(function);
+			break;
+		}
+		}
+	}
+	// the calls destroyed their state as they ran, everything else is plain data
+	rewind();
+}
+
+void CommandList::reset()
+{
+	// destroy the captured state of calls that never ran
+	for (Header* header = first; header; header = header->next)
+	{
+		if (header->type == RCMD_CALL)
+		{
+			Call* call = (Call*)((unsigned char*)header + headerSize);
+			call->destroy((unsigned char*)call + callSize);
+		}
+	}
+	rewind();
+}
+
+void CommandList::rewind()
+{
+	first = NULL;
+	last = NULL;
+	commandCount = 0;
+	arena.reset();
+}
+
+
+RenderThread::RenderThread(GLFWwindow* window, bool threaded)
+{
+	this->window = window;
+	this->threaded = threaded;
+	running = false;
+	writeIndex = 0;
+	pendingIndex = -1;
+	busy = false;
+	quit = false;
+	frameCount = 0;
+	renderSeconds = 0.0;
+	submitCount = 0;
+	waitSeconds = 0.0;
+}
+
+RenderThread::~RenderThread()
+{
+	stop();
+}
+
+void RenderThread::start()
+{
+	if (running)
+		return;
+	running = true;
+	if (!threaded)
+		return;
+
+	// a context can only be current on one thread at a time
+	glfwMakeContextCurrent(NULL);
+	quit = false;
+	thread = std::thread(&RenderThread::run, this);
+}
+
+void RenderThread::stop()
+{
+	if (!running)
+		return;
+	running = false;
+	if (!threaded)
+		return;
+
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		quit = true;
+	}
+	condition.notify_all();
+	thread.join();
+	glfwMakeContextCurrent(window);
+}
+
+void RenderThread::submitFrame()
+{
+	submitCount++;
+	if (!threaded)
+	{
+		renderFrame(lists[writeIndex]);
+		return;
+	}
+
+	auto waitStart = std::chrono::high_resolution_clock::now();
+	{
+		// the other list is free once the render thread picked up the previous frame and finished it
+		std::unique_lock<std::mutex> lock(mutex);
+		condition.wait(lock, [this]() { return pendingIndex < 0 && !busy; });
+		pendingIndex = writeIndex;
+	}
+	condition.notify_all();
+	waitSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - waitStart).count();
+	writeIndex = 1 - writeIndex;
+}
+
+void RenderThread::renderFrame(CommandList& list)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+	list.execute();
+	glfwSwapBuffers(window);
+	renderSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count();
+	frameCount++;
+}
+
+void RenderThread::run()
+{
+	glfwMakeContextCurrent(window);
+	while (true)
+	{
+		int index;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [this]() { return pendingIndex >= 0 || quit; });
+			if (pendingIndex < 0)
+				break; // quit, and nothing left to draw
+			index = pendingIndex;
+			pendingIndex = -1;
+			busy = true;
+		}
+		renderFrame(lists[index]);
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			busy = false;
+		}
+		condition.notify_all();
+	}
+	glfwMakeContextCurrent(NULL);
+}
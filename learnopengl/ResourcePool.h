@@ -0,0 +1,289 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "Mesh.h"
+#include "Shader.h"
+#include "RenderThread.h"
+
+//
+// 32 bit reference to a pooled resource: slot index in the low 20 bits, generation in the high 12.
+// The generation of a slot changes every time its resource is released, so a handle kept after
+// that is detected as stale instead of reaching whatever lives in the slot next.
+// 0 is never a valid handle.
+//
+template<typename T>
+struct ResourceHandle
+{
+	uint32_t value = 0;
+
+	static const unsigned int indexBits = 20;
+	static const uint32_t indexMask = (1u << indexBits) - 1;
+	static const uint32_t generationMask = (1u << (32 - indexBits)) - 1;
+
+	unsigned int getIndex() const { return value & indexMask; }
+	unsigned int getGeneration() const { return value >> indexBits; }
+	bool isNull() const { return value == 0; }
+
+	bool operator==(const ResourceHandle& other) const { return value == other.value; }
+	bool operator!=(const ResourceHandle& other) const { return value != other.value; }
+};
+
+typedef ResourceHandle<Mesh> MeshHandle;
+typedef ResourceHandle<Shader> ShaderHandle;
+
+//
+// Owner of every resource of one type (meshes and shaders, the textures are layers of TextureArrayPool).
+// Objects are constructed in place in pages of pageSize slots: they never move (the GL classes
+// are not movable, and the pointers recorded in the command lists stay valid). The pages are not
+// compacted, a released slot stays a hole until the free list hands it out again; next to them
+// the pool only keeps per slot state, the free list and the indices of the live slots, for forEach().
+// Releasing only invalidates the handle. The destructor (which deletes the GL objects) is
+// recorded by collect() at the end of the frame's command list, so it runs on the render thread
+// after the draws of the frames in flight, and the slot is reused once that frame completed.
+// Used from the main thread only.
+//
+template<typename T>
+class ResourcePool
+{
+public:
+	typedef ResourceHandle<T> Handle;
+
+	// name is used in the leak report, it must be a string literal
+	ResourcePool(const char* name);
+	~ResourcePool();
+
+	ResourcePool(const ResourcePool&) = delete;
+	ResourcePool& operator=(const ResourcePool&) = delete;
+
+	// Construct a resource in the pool, with the GL context current (the constructors call the GL)
+	template<typename... Args> Handle create(Args&&... args);
+	// The resource, NULL if the handle is null or stale
+	T* get(Handle handle) const;
+	bool isAlive(Handle handle) const { return get(handle) != NULL; }
+	// Invalidate the handle now, the resource is destroyed later by collect()
+	void release(Handle handle);
+
+	// Once per frame while recording it: queue the destruction of the released resources
+	// and recycle the slots of the ones the render thread already destroyed
+	void collect(RenderThread& renderThread);
+	// Shutdown, after RenderThread::stop(): report the resources never released, then destroy
+	// everything left with the calling thread's GL context. Returns the number of leaks.
+	unsigned int destroyAll();
+
+	// Visit the live resources, function(Handle, T&)
+	template<typename Function> void forEach(Function function);
+
+	unsigned int size() const { return (unsigned int)dense.size(); }
+	const char* getName() const { return name; }
+
+private:
+	enum SlotState
+	{
+		SLOT_FREE,
+		SLOT_ALIVE,
+		SLOT_RELEASED, // handle invalidated, destructor not recorded yet
+		SLOT_RETIRING  // destructor recorded in the list of frame retireFrame
+	};
+	struct Slot
+	{
+		uint32_t generation;
+		SlotState state;
+		unsigned int denseIndex;  // position in dense while alive
+		unsigned int retireFrame;
+	};
+
+	static const unsigned int pageSize = 256;
+	static_assert(alignof(T) <= alignof(std::max_align_t), "pooled type is over-aligned");
+
+	T* slotObject(unsigned int index) const { return (T*)(pages[index / pageSize] + (size_t)(index % pageSize) * sizeof(T)); }
+	Handle makeHandle(unsigned int index) const;
+	unsigned int allocateSlot();
+
+	const char* name;
+	std::vector<unsigned char*> pages;
+	std::vector<Slot> slots;
+	std::vector<unsigned int> dense;     // live slots
+	std::vector<unsigned int> freeSlots;
+	std::vector<unsigned int> released;  // SLOT_RELEASED slots
+	std::vector<unsigned int> retiring;  // SLOT_RETIRING slots
+};
+
+
+template<typename T>
+ResourcePool<T>::ResourcePool(const char* name)
+{
+	this->name = name;
+}
+
+template<typename T>
+ResourcePool<T>::~ResourcePool()
+{
+	// the GL context may be gone by now, so destructors are not run here
+	if (!dense.empty() || !released.empty())
+		std::cout << "ERROR::ResourcePool::~ResourcePool:: " << name << " pool destroyed with "
+			<< dense.size() + released.size() << " resources left, destroyAll() was not called" << std::endl;
+	for (unsigned char* page : pages)
+		delete[] page;
+}
+
+template<typename T>
+ResourceHandle<T> ResourcePool<T>::makeHandle(unsigned int index) const
+{
+	Handle handle;
+	handle.value = (slots[index].generation << Handle::indexBits) | index;
+	return handle;
+}
+
+template<typename T>
+unsigned int ResourcePool<T>::allocateSlot()
+{
+	if (!freeSlots.empty())
+	{
+		unsigned int index = freeSlots.back();
+		freeSlots.pop_back();
+		return index;
+	}
+
+	unsigned int index = (unsigned int)slots.size();
+	if (index > Handle::indexMask)
+	{
+		std::cout << "ERROR::ResourcePool::create:: " << name << " pool is full" << std::endl;
+		throw "Resource pool full";
+	}
+	if (index % pageSize == 0)
+		pages.push_back(new unsigned char[pageSize * sizeof(T)]);
+	slots.push_back({ 1, SLOT_FREE, 0, 0 });
+	return index;
+}
+
+template<typename T>
+template<typename... Args>
+ResourceHandle<T> ResourcePool<T>::create(Args&&... args)
+{
+	unsigned int index = allocateSlot();
+	try
+	{
+		new (slotObject(index)) T(std::forward<Args>(args)...);
+	}
+	catch (...)
+	{
+		freeSlots.push_back(index);
+		throw;
+	}
+	Slot& slot = slots[index];
+	slot.state = SLOT_ALIVE;
+	slot.denseIndex = (unsigned int)dense.size();
+	dense.push_back(index);
+	return makeHandle(index);
+}
+
+template<typename T>
+T* ResourcePool<T>::get(Handle handle) const
+{
+	unsigned int index = handle.getIndex();
+	if (handle.isNull() || index >= slots.size())
+		return NULL;
+	const Slot& slot = slots[index];
+	if (slot.state != SLOT_ALIVE || slot.generation != handle.getGeneration())
+		return NULL;
+	return slotObject(index);
+}
+
+template<typename T>
+void ResourcePool<T>::release(Handle handle)
+{
+	if (!get(handle))
+	{
+		std::cout << "ERROR::ResourcePool::release:: stale or null " << name << " handle 0x" << std::hex << handle.value << std::dec << std::endl;
+		return;
+	}
+	unsigned int index = handle.getIndex();
+	Slot& slot = slots[index];
+
+	// swap the last live slot into the hole
+	unsigned int moved = dense.back();
+	dense[slot.denseIndex] = moved;
+	slots[moved].denseIndex = slot.denseIndex;
+	dense.pop_back();
+
+	// skip 0 so that no handle is ever null
+	slot.generation = (slot.generation + 1) & Handle::generationMask;
+	if (slot.generation == 0)
+		slot.generation = 1;
+	slot.state = SLOT_RELEASED;
+	released.push_back(index);
+}
+
+template<typename T>
+void ResourcePool<T>::collect(RenderThread& renderThread)
+{
+	// slots whose destructor ran in a frame the render thread finished are free again
+	unsigned int completedFrames = renderThread.getCompletedFrames();
+	for (size_t i = 0; i < retiring.size();)
+	{
+		if (slots[retiring[i]].retireFrame < completedFrames)
+		{
+			slots[retiring[i]].state = SLOT_FREE;
+			freeSlots.push_back(retiring[i]);
+			retiring[i] = retiring.back();
+			retiring.pop_back();
+		}
+		else
+			i++;
+	}
+
+	// the frame being recorded may still draw the released resources: destroy them after it
+	CommandList& commands = renderThread.getCommandList();
+	unsigned int frame = renderThread.getSubmittedFrames();
+	for (unsigned int index : released)
+	{
+		T* object = slotObject(index);
+		commands.call([object]() { object->~T(); });
+		slots[index].state = SLOT_RETIRING;
+		slots[index].retireFrame = frame;
+		retiring.push_back(index);
+	}
+	released.clear();
+}
+
+template<typename T>
+unsigned int ResourcePool<T>::destroyAll()
+{
+	unsigned int leaks = (unsigned int)dense.size();
+	if (leaks > 0)
+	{
+		std::cout << "ERROR::ResourcePool::destroyAll:: " << leaks << " " << name << " resources were never released:";
+		for (size_t i = 0; i < dense.size() && i < 16; i++)
+			std::cout << " 0x" << std::hex << makeHandle(dense[i]).value << std::dec;
+		std::cout << (dense.size() > 16 ? " ..." : "") << std::endl;
+	}
+
+	for (unsigned int index : dense)
+		slotObject(index)->~T();
+	for (unsigned int index : released)
+		slotObject(index)->~T();
+	// the retiring ones were destroyed by the frames RenderThread::stop() finished
+	for (Slot& slot : slots)
+		slot.state = SLOT_FREE;
+	dense.clear();
+	released.clear();
+	retiring.clear();
+	freeSlots.clear();
+	for (unsigned int i = (unsigned int)slots.size(); i > 0; i--)
+		freeSlots.push_back(i - 1);
+	return leaks;
+}
+
+template<typename T>
+template<typename Function>
+void ResourcePool<T>::forEach(Function function)
+{
+	for (unsigned int index : dense)
+		function(makeHandle(index), *slotObject(index));
+}
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <iostream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#include <glm/vec3.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "MathKernels.h"
+
+// Handle to a node, it stays valid when the graph reorders its storage
+typedef unsigned int SceneNode;
+const SceneNode SCENE_NO_PARENT = 0xFFFFFFFFu;
+
+//
+// Transform hierarchy stored as structure of arrays.
+// Nodes are kept sorted so a parent always comes before its children: updating every
+// world matrix is one linear pass, and nodes whose transform did not change (and whose
+// parent did not move) are skipped. The matrix math itself lives in MathKernels.h.
+//
+class SceneGraph
+{
+public:
+	SceneGraph();
+
+	SceneNode createNode(SceneNode parent = SCENE_NO_PARENT);
+	void setParent(SceneNode node, SceneNode parent);
+
+	void setPosition(SceneNode node, glm::vec3 position);
+	void setRotation(SceneNode node, glm::quat rotation);
+	void setScale(SceneNode node, glm::vec3 scale);
+
+	glm::vec3 getPosition(SceneNode node) const { return positions[nodeToSlot[node]]; }
+	const glm::mat4& getWorldMatrix(SceneNode node) const { return worldMatrices[nodeToSlot[node]]; }
+
+	// Recompute the local and world matrices of everything that moved since the last update
+	void update();
+
+	size_t size() const { return parents.size(); }
+
+	// Build a random hierarchy and print how many world matrices per second update() produces
+	static void benchmark(size_t nodeCount = 1000000);
+
+private:
+	void markDirty(SceneNode node) { localDirty[nodeToSlot[node]] = 1; }
+	void sortByDepth();
+
+	// per slot, sorted parents first
+	std::vector<unsigned int> parents;        // slot of the parent, SCENE_NO_PARENT for roots
+	std::vector<glm::vec3> positions;
+	std::vector<glm::quat> rotations;
+	std::vector<glm::vec3> scales;
+	std::vector<glm::mat4> localMatrices;
+	std::vector<glm::mat4> worldMatrices;
+	std::vector<unsigned char> localDirty;    // the node's own transform changed
+	std::vector<unsigned char> worldDirty;    // scratch for update(), the world matrix has to be rebuilt
+
+	// handle <-> slot
+	std::vector<unsigned int> nodeToSlot;
+	std::vector<SceneNode> slotToNode;
+
+	bool needsSort;
+};
+
+
+SceneGraph::SceneGraph()
+{
+	needsSort = false;
+}
+
+SceneNode SceneGraph::createNode(SceneNode parent)
+{
+	// a new node is appended after its parent, so the order stays valid without sorting
+	SceneNode node = (SceneNode)nodeToSlot.size();
+	unsigned int slot = (unsigned int)parents.size();
+	nodeToSlot.push_back(slot);
+	slotToNode.push_back(node);
+
+	parents.push_back(parent == SCENE_NO_PARENT ? SCENE_NO_PARENT : nodeToSlot[parent]);
+	positions.push_back(glm::vec3(0.0f));
+	rotations.push_back(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+	scales.push_back(glm::vec3(1.0f));
+	localMatrices.push_back(glm::mat4(1.0f));
+	worldMatrices.push_back(glm::mat4(1.0f));
+	localDirty.push_back(1);
+	worldDirty.push_back(1);
+	return node;
+}
+
+void SceneGraph::setParent(SceneNode node, SceneNode parent)
+{
+	unsigned int slot = nodeToSlot[node];
+	parents[slot] = (parent == SCENE_NO_PARENT) ? SCENE_NO_PARENT : nodeToSlot[parent];
+	localDirty[slot] = 1;
+	if (parent != SCENE_NO_PARENT && nodeToSlot[parent] > slot)
+		needsSort = true; // the parent now comes after its child
+}
+
+void SceneGraph::setPosition(SceneNode node, glm::vec3 position)
+{
+	positions[nodeToSlot[node]] = position;
+	markDirty(node);
+}
+
+void SceneGraph::setRotation(SceneNode node, glm::quat rotation)
+{
+	rotations[nodeToSlot[node]] = rotation;
+	markDirty(node);
+}
+
+void SceneGraph::setScale(SceneNode node, glm::vec3 scale)
+{
+	scales[nodeToSlot[node]] = scale;
+	markDirty(node);
+}
+
+// Reorder every array by depth in the hierarchy (roots first), which puts parents before children
+void SceneGraph::sortByDepth()
+{
+	size_t count = parents.size();
+	std::vector<unsigned int> depth(count, 0);
+	for (size_t slot = 0; slot < count; slot++)
+	{
+		// walk up, the chain is short in practice and only runs after a reparenting
+		unsigned int d = 0;
+		for (unsigned int p = parents[slot]; p != SCENE_NO_PARENT && d <= count; p = parents[p])
+			d++;
+		depth[slot] = d;
+	}
+	std::vector<unsigned int> order(count);
+	for (size_t i = 0; i < count; i++)
+		order[i] = (unsigned int)i;
+	std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return depth[a] < depth[b]; });
+
+	std::vector<unsigned int> newSlot(count);
+	for (size_t i = 0; i < count; i++)
+		newSlot[order[i]] = (unsigned int)i;
+
+	auto permute = [&](auto& array)
+	{
+		auto sorted = array;
+		for (size_t i = 0; i < count; i++)
+			sorted[i] = array[order[i]];
+		array.swap(sorted);
+	};
+	permute(parents);
+	permute(positions);
+	permute(rotations);
+	permute(scales);
+	permute(localMatrices);
+	permute(worldMatrices);
+	permute(localDirty);
+	permute(slotToNode);
+	for (size_t i = 0; i < count; i++)
+	{
+		if (parents[i] != SCENE_NO_PARENT)
+			parents[i] = newSlot[parents[i]];
+		nodeToSlot[slotToNode[i]] = (unsigned int)i;
+		localDirty[i] = 1; // cheap enough after a reparenting, and it keeps the bookkeeping simple
+	}
+	needsSort = false;
+}
+
+void SceneGraph::update()
+{
+	if (needsSort)
+		sortByDepth();
+
+	size_t count = parents.size();
+
+	// local matrices first, in runs of consecutive dirty nodes so the batched kernel gets long arrays
+	for (size_t slot = 0; slot < count;)
+	{
+		if (!localDirty[slot])
+		{
+			slot++;
+			continue;
+		}
+		size_t end = slot + 1;
+		while (end < count && localDirty[end])
+			end++;
+		MathKernels::composeTRS(&positions[slot], &rotations[slot], &scales[slot], &localMatrices[slot], end - slot);
+		slot = end;
+	}
+
+	// then world = parent world * local, parents are always done before their children
+	for (size_t slot = 0; slot < count; slot++)
+	{
+		unsigned int parent = parents[slot];
+		bool moved = localDirty[slot] || (parent != SCENE_NO_PARENT && worldDirty[parent]);
+		worldDirty[slot] = moved;
+		localDirty[slot] = 0;
+		if (!moved)
+			continue; // static node under a static parent, its matrices are still right
+
+		if (parent == SCENE_NO_PARENT)
+			worldMatrices[slot] = localMatrices[slot];
+		else
+			MathKernels::multiply(worldMatrices[parent], localMatrices[slot], worldMatrices[slot]);
+	}
+}
+
+void SceneGraph::benchmark(size_t nodeCount)
+{
+	SceneGraph graph;
+	std::mt19937 random(42);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+	// a forest of shallow trees, like a level made of many objects with a few attached parts
+	for (size_t i = 0; i < nodeCount; i++)
+	{
+		SceneNode parent = (i % 16 == 0) ? SCENE_NO_PARENT : (SceneNode)(i - 1 - random() % std::min<size_t>(i % 16, 4));
+		SceneNode node = graph.createNode(parent);
+		graph.setPosition(node, glm::vec3(unit(random), unit(random), unit(random)));
+		graph.setRotation(node, glm::angleAxis(unit(random) * 3.14f, glm::normalize(glm::vec3(unit(random), unit(random), 1.0f))));
+	}
+	graph.update();
+
+	const int frames = 10;
+	auto startTime = std::chrono::high_resolution_clock::now();
+	for (int frame = 0; frame < frames; frame++)
+	{
+		for (size_t slot = 0; slot < graph.size(); slot++)
+			graph.localDirty[slot] = 1;
+		graph.update();
+	}
+	double allSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count() / frames;
+
+	// only the roots move, children follow
+	startTime = std::chrono::high_resolution_clock::now();
+	for (int frame = 0; frame < frames; frame++)
+	{
+		for (size_t slot = 0; slot < graph.size(); slot += 160)
+			graph.localDirty[slot] = 1;
+		graph.update();
+	}
+	double sparseSeconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - startTime).count() / frames;
+
+	std::cout << "SceneGraph::benchmark:: " << nodeCount << " nodes, everything moving: " << allSeconds * 1000.0 << " ms/update ("
+		<< nodeCount / allSeconds / 1e6 << " M matrices/s), 1 tree in 10 moving: " << sparseSeconds * 1000.0 << " ms/update" << std::endl;
+}
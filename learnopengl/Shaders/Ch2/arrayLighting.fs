@@ -0,0 +1,15 @@
+#version 330 core
+
+out vec4 FragColor;
+in vec2 vertexUV;
+flat in uvec4 vertexTexture;
+
+uniform vec3 lightColor;
+uniform vec3 objectColor;
+
+uniform sampler2DArray mainTextures; // set to the unit of the array holding the draw's texture
+
+void main(){
+	vec4 texColor = texture(mainTextures, vec3(vertexUV, float(vertexTexture.z))); // z is the layer
+	FragColor = vec4(objectColor * lightColor, 1.0) * texColor;
+}
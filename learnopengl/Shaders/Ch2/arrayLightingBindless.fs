@@ -0,0 +1,15 @@
+#version 400 core
+#extension GL_ARB_bindless_texture : require
+
+out vec4 FragColor;
+in vec2 vertexUV;
+flat in uvec4 vertexTexture;
+
+uniform vec3 lightColor;
+uniform vec3 objectColor;
+
+void main(){
+	sampler2DArray mainTextures = sampler2DArray(vertexTexture.xy); // the sampler comes from the handle, nothing is bound
+	vec4 texColor = texture(mainTextures, vec3(vertexUV, float(vertexTexture.z))); // z is the layer
+	FragColor = vec4(objectColor * lightColor, 1.0) * texColor;
+}
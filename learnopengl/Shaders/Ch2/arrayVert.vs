@@ -0,0 +1,23 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;   // the position variable has attribute position 0
+layout (location = 2) in vec2 aUV; // the texture variable has attribute position 2
+layout (location = 4) in uvec4 aInstanceTexture; // per instance: bindless handle (x, y), layer, array
+layout (location = 5) in vec4 aInstanceUVTransform; // per instance: scale (xy) and offset (zw) into an atlas region
+
+out vec2 vertexUV; // output the UVs to the fragment shader
+flat out uvec4 vertexTexture; // which texture to sample, the same for the whole draw
+
+uniform mat4 projection;
+uniform mat4 model;
+uniform mat4 view;
+
+invariant gl_Position; // same depth as depthOnly.vs, for the GL_EQUAL test after the depth prepass
+
+void main()
+{
+    vec4 position = view * model * vec4(aPos, 1.0);
+    gl_Position = projection * position;
+    vertexUV = aUV * aInstanceUVTransform.xy + aInstanceUVTransform.zw;
+    vertexTexture = aInstanceTexture;
+}
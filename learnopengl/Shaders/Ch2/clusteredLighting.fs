@@ -0,0 +1,83 @@
+#version 330 core
+
+out vec4 FragColor;
+in vec2 vertexUV;
+in vec3 viewPosition;
+in vec3 viewNormal;
+flat in uvec4 vertexTexture;
+
+uniform vec3 objectColor;
+
+uniform sampler2DArray mainTextures; // set to the unit of the array holding the draw's texture
+
+// set by ClusteredLighting::apply
+uniform samplerBuffer lights;        // 2 texels a light: view position and radius, color
+uniform usamplerBuffer froxels;      // first light index and light count of each froxel
+uniform usamplerBuffer lightIndices;
+uniform vec2 froxelTileScale;        // gl_FragCoord to tile
+uniform vec2 froxelSliceScale;       // slice = log(depth) * x + y
+uniform ivec3 froxelCounts;          // tiles across, down, slices
+uniform int allLightCount;           // not 0: go through every light, not the froxel's
+
+// set by CascadedShadows::apply, cascadeCount is 0 without the directional light
+uniform sampler2DShadow shadowAtlas;
+uniform mat4 shadowMatrices[4];      // view space to the cascade's tile of the atlas and its depth
+uniform vec4 cascadeEnds;            // view distance where each cascade ends
+uniform vec4 shadowNormalOffsets;    // per cascade, how far along the normal the lookup is pushed
+uniform float shadowTexelSize;       // of the atlas
+uniform int cascadeCount;
+uniform vec3 sunDirection;           // view space, toward the light
+uniform vec3 sunColor;
+
+vec3 pointLight(int light, vec3 normal){
+	vec4 positionRadius = texelFetch(lights, 2 * light);
+	vec3 toLight = positionRadius.xyz - viewPosition;
+	float distance2 = dot(toLight, toLight);
+	// fades to 0 at the radius, where the CPU stopped assigning the light
+	float falloff = clamp(1.0 - distance2 / (positionRadius.w * positionRadius.w), 0.0, 1.0);
+	float diffuse = max(dot(normal, toLight * inversesqrt(max(distance2, 1e-6))), 0.0);
+	return texelFetch(lights, 2 * light + 1).rgb * (falloff * falloff * diffuse);
+}
+
+// 1 lit to 0 shadowed, 4 bilinear comparisons over 3x3 texels
+float sunShadow(vec3 position, vec3 normal){
+	float viewDistance = -position.z;
+	if (viewDistance > cascadeEnds[cascadeCount - 1])
+		return 1.0;
+	int cascade = 0;
+	while (viewDistance > cascadeEnds[cascade])
+		cascade++;
+	vec3 coord = (shadowMatrices[cascade] * vec4(position + normal * shadowNormalOffsets[cascade], 1.0)).xyz;
+	float lit = texture(shadowAtlas, coord + vec3(-shadowTexelSize, -shadowTexelSize, 0.0));
+	lit += texture(shadowAtlas, coord + vec3(shadowTexelSize, -shadowTexelSize, 0.0));
+	lit += texture(shadowAtlas, coord + vec3(-shadowTexelSize, shadowTexelSize, 0.0));
+	lit += texture(shadowAtlas, coord + vec3(shadowTexelSize, shadowTexelSize, 0.0));
+	return lit * 0.25;
+}
+
+vec3 sunLight(vec3 position, vec3 normal){
+	float diffuse = max(dot(normal, sunDirection), 0.0);
+	return diffuse > 0.0 ? sunColor * (diffuse * sunShadow(position, normal)) : vec3(0.0);
+}
+
+void main(){
+	vec3 normal = normalize(viewNormal);
+	vec3 lighting = vec3(0.1); // ambient
+	if (cascadeCount > 0)
+		lighting += sunLight(viewPosition, normal);
+	if (allLightCount > 0)
+	{
+		for (int i = 0; i < allLightCount; i++)
+			lighting += pointLight(i, normal);
+	}
+	else
+	{
+		ivec2 tile = min(ivec2(gl_FragCoord.xy * froxelTileScale), froxelCounts.xy - 1);
+		int slice = clamp(int(log(-viewPosition.z) * froxelSliceScale.x + froxelSliceScale.y), 0, froxelCounts.z - 1);
+		uvec2 froxel = texelFetch(froxels, (slice * froxelCounts.y + tile.y) * froxelCounts.x + tile.x).xy;
+		for (uint i = 0u; i < froxel.y; i++)
+			lighting += pointLight(int(texelFetch(lightIndices, int(froxel.x + i)).x), normal);
+	}
+	vec4 texColor = texture(mainTextures, vec3(vertexUV, float(vertexTexture.z))); // z is the layer
+	FragColor = vec4(objectColor * lighting, 1.0) * texColor;
+}
@@ -0,0 +1,65 @@
+#version 330 core
+
+out vec4 FragColor;
+
+uniform sampler2D albedoBuffer;
+uniform sampler2D normalBuffer;
+uniform sampler2D depthBuffer;
+uniform mat4 inverseProjection;
+uniform vec2 depthToNDC; // scale and offset from the depth buffer to clip space z
+uniform float ambient;
+
+// set by CascadedShadows::apply, cascadeCount is 0 without the directional light
+uniform sampler2DShadow shadowAtlas;
+uniform mat4 shadowMatrices[4];      // view space to the cascade's tile of the atlas and its depth
+uniform vec4 cascadeEnds;            // view distance where each cascade ends
+uniform vec4 shadowNormalOffsets;    // per cascade, how far along the normal the lookup is pushed
+uniform float shadowTexelSize;       // of the atlas
+uniform int cascadeCount;
+uniform vec3 sunDirection;           // view space, toward the light
+uniform vec3 sunColor;
+
+vec3 decodeNormal(vec2 e){
+	e = e * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float fold = clamp(-n.z, 0.0, 1.0);
+	n.xy += vec2(n.x >= 0.0 ? -fold : fold, n.y >= 0.0 ? -fold : fold);
+	return normalize(n);
+}
+
+// 1 lit to 0 shadowed, 4 bilinear comparisons over 3x3 texels
+float sunShadow(vec3 position, vec3 normal){
+	float viewDistance = -position.z;
+	if (viewDistance > cascadeEnds[cascadeCount - 1])
+		return 1.0;
+	int cascade = 0;
+	while (viewDistance > cascadeEnds[cascade])
+		cascade++;
+	vec3 coord = (shadowMatrices[cascade] * vec4(position + normal * shadowNormalOffsets[cascade], 1.0)).xyz;
+	float lit = texture(shadowAtlas, coord + vec3(-shadowTexelSize, -shadowTexelSize, 0.0));
+	lit += texture(shadowAtlas, coord + vec3(shadowTexelSize, -shadowTexelSize, 0.0));
+	lit += texture(shadowAtlas, coord + vec3(-shadowTexelSize, shadowTexelSize, 0.0));
+	lit += texture(shadowAtlas, coord + vec3(shadowTexelSize, shadowTexelSize, 0.0));
+	return lit * 0.25;
+}
+
+vec3 sunLight(vec3 position, vec3 normal){
+	float diffuse = max(dot(normal, sunDirection), 0.0);
+	return diffuse > 0.0 ? sunColor * (diffuse * sunShadow(position, normal)) : vec3(0.0);
+}
+
+void main(){
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec3 albedo = texelFetch(albedoBuffer, pixel, 0).rgb;
+	vec3 lighting = vec3(ambient);
+	// nothing to light where nothing was drawn, and no position either past the far plane
+	if (cascadeCount > 0 && albedo != vec3(0.0))
+	{
+		// the forward shaders' directional light, at the position rebuilt from the depth
+		vec2 ndc = (gl_FragCoord.xy / vec2(textureSize(depthBuffer, 0))) * 2.0 - 1.0;
+		float depth = texelFetch(depthBuffer, pixel, 0).r * depthToNDC.x + depthToNDC.y;
+		vec4 position = inverseProjection * vec4(ndc, depth, 1.0);
+		lighting += sunLight(position.xyz / position.w, decodeNormal(texelFetch(normalBuffer, pixel, 0).xy));
+	}
+	FragColor = vec4(albedo * lighting, 1.0);
+}
@@ -0,0 +1,36 @@
+#version 330 core
+
+out vec4 FragColor;
+
+uniform sampler2D albedoBuffer;
+uniform sampler2D normalBuffer;
+uniform sampler2D depthBuffer;
+uniform mat4 inverseProjection;
+uniform vec2 depthToNDC; // scale and offset from the depth buffer to clip space z
+
+uniform vec4 lightPositionRadius; // view space
+uniform vec4 lightColor;
+
+vec3 decodeNormal(vec2 e){
+	e = e * 2.0 - 1.0;
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float fold = clamp(-n.z, 0.0, 1.0);
+	n.xy += vec2(n.x >= 0.0 ? -fold : fold, n.y >= 0.0 ? -fold : fold);
+	return normalize(n);
+}
+
+void main(){
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	vec2 ndc = (gl_FragCoord.xy / vec2(textureSize(depthBuffer, 0))) * 2.0 - 1.0;
+	float depth = texelFetch(depthBuffer, pixel, 0).r * depthToNDC.x + depthToNDC.y;
+	vec4 position = inverseProjection * vec4(ndc, depth, 1.0);
+	vec3 viewPosition = position.xyz / position.w;
+	vec3 normal = decodeNormal(texelFetch(normalBuffer, pixel, 0).xy);
+
+	// the forward shaders' point light
+	vec3 toLight = lightPositionRadius.xyz - viewPosition;
+	float distance2 = dot(toLight, toLight);
+	float falloff = clamp(1.0 - distance2 / (lightPositionRadius.w * lightPositionRadius.w), 0.0, 1.0);
+	float diffuse = max(dot(normal, toLight * inversesqrt(max(distance2, 1e-6))), 0.0);
+	FragColor = vec4(texelFetch(albedoBuffer, pixel, 0).rgb * lightColor.rgb * (falloff * falloff * diffuse), 1.0);
+}
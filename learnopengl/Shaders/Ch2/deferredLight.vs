@@ -0,0 +1,10 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos; // the light volume, around the unit sphere
+
+uniform mat4 PVM; // scaled by the light's radius
+
+void main()
+{
+    gl_Position = PVM * vec4(aPos, 1.0);
+}
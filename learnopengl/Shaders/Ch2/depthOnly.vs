@@ -0,0 +1,17 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;   // the position variable has attribute position 0, the only one read
+
+uniform mat4 projection;
+uniform mat4 model;
+uniform mat4 view;
+
+// the shading pass tests GL_EQUAL against this depth: same expression and same inputs as
+// clusteredVert.vs and arrayVert.vs, and invariant so the compiler cannot compute it differently
+invariant gl_Position;
+
+void main()
+{
+    vec4 position = view * model * vec4(aPos, 1.0);
+    gl_Position = projection * position;
+}
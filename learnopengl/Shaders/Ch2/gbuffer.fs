@@ -0,0 +1,28 @@
+#version 330 core
+
+layout (location = 0) out vec4 albedo;
+layout (location = 1) out vec2 normal;
+layout (location = 2) out vec3 emissive;
+in vec2 vertexUV;
+in vec3 viewPosition;
+in vec3 viewNormal;
+flat in uvec4 vertexTexture;
+
+uniform vec3 objectColor;
+uniform vec3 emissiveColor;
+
+uniform sampler2DArray mainTextures; // set to the unit of the array holding the draw's texture
+
+// unit vector to the octahedron folded onto the [0, 1] square
+vec2 encodeNormal(vec3 n){
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 folded = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return (n.z >= 0.0 ? n.xy : folded) * 0.5 + 0.5;
+}
+
+void main(){
+	vec4 texColor = texture(mainTextures, vec3(vertexUV, float(vertexTexture.z))); // z is the layer
+	albedo = vec4(objectColor * texColor.rgb, 1.0);
+	normal = encodeNormal(normalize(viewNormal));
+	emissive = emissiveColor;
+}
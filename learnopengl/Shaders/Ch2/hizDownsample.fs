@@ -0,0 +1,26 @@
+#version 330 core
+
+// One level of the depth pyramid: each texel keeps the farthest depth of the 2x2 texels under it,
+// so a box nearer than a texel is never hidden by it
+uniform sampler2D source; // the depth buffer, then the previous level bound as the only level
+uniform ivec2 sourceSize;
+uniform bool reverseZ;    // the farthest depth is the smallest one
+
+out float farthest;
+
+void main()
+{
+    ivec2 base = ivec2(gl_FragCoord.xy) * 2;
+    // an odd source size leaves a last row or column over, the last texel takes it too
+    ivec2 extra = ivec2(equal(base + 3, sourceSize));
+    float result = reverseZ ? 1.0 : 0.0;
+    for (int y = 0; y <= 1 + extra.y; y++)
+    {
+        for (int x = 0; x <= 1 + extra.x; x++)
+        {
+            float depth = texelFetch(source, min(base + ivec2(x, y), sourceSize - 1), 0).r;
+            result = reverseZ ? min(result, depth) : max(result, depth);
+        }
+    }
+    farthest = result;
+}
@@ -0,0 +1,24 @@
+#version 330 core
+
+// One direction of a 9 texel gaussian, in 5 taps: the bilinear filter weighs each pair of
+// neighbouring texels when sampling between them
+uniform sampler2D source;   // same size as the output
+uniform vec2 outputTexelSize;
+uniform vec2 direction;     // (1, 0) or (0, 1)
+
+out vec3 color;
+
+const float offsets[3] = float[](0.0, 1.3846153846, 3.2307692308);
+const float weights[3] = float[](0.2270270270, 0.3162162162, 0.0702702703);
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy * outputTexelSize;
+    vec2 texelStep = direction * outputTexelSize;
+    color = texture(source, uv).rgb * weights[0];
+    for (int i = 1; i < 3; i++)
+    {
+        color += texture(source, uv + texelStep * offsets[i]).rgb * weights[i];
+        color += texture(source, uv - texelStep * offsets[i]).rgb * weights[i];
+    }
+}
@@ -0,0 +1,18 @@
+#version 330 core
+
+// Half the size: the 4x4 source texels under each texel, in 4 bilinear taps
+uniform sampler2D source;
+uniform vec2 outputTexelSize;
+
+out vec3 color;
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy * outputTexelSize;
+    vec2 sourceTexel = 1.0 / vec2(textureSize(source, 0));
+    color = texture(source, uv + vec2(-sourceTexel.x, -sourceTexel.y)).rgb;
+    color += texture(source, uv + vec2(sourceTexel.x, -sourceTexel.y)).rgb;
+    color += texture(source, uv + vec2(-sourceTexel.x, sourceTexel.y)).rgb;
+    color += texture(source, uv + vec2(sourceTexel.x, sourceTexel.y)).rgb;
+    color *= 0.25;
+}
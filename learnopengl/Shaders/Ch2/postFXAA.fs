@@ -0,0 +1,125 @@
+#version 330 core
+
+// Fast approximate anti-aliasing (after FXAA 3.11's PC quality preset, shortened): find the
+// edges from the luma contrast, follow each one along its direction to its ends, and blend
+// across it by where the pixel lies along it
+uniform sampler2D source;   // tonemapped, luma in alpha
+uniform vec2 outputTexelSize;
+
+out vec4 FragColor;
+
+const float edgeThreshold = 0.125;    // of the local luma range
+const float edgeThresholdMin = 0.0312; // darker than this is not worth it
+const float subpixelQuality = 0.75;
+const int searchSteps = 6;
+const float searchStepSizes[6] = float[](1.0, 1.5, 2.0, 2.0, 4.0, 8.0);
+
+float luma(vec2 uv){
+    return textureLod(source, uv, 0.0).a;
+}
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy * outputTexelSize;
+    vec4 center = textureLod(source, uv, 0.0);
+    float lumaCenter = center.a;
+    float lumaDown = textureLodOffset(source, uv, 0.0, ivec2(0, -1)).a;
+    float lumaUp = textureLodOffset(source, uv, 0.0, ivec2(0, 1)).a;
+    float lumaLeft = textureLodOffset(source, uv, 0.0, ivec2(-1, 0)).a;
+    float lumaRight = textureLodOffset(source, uv, 0.0, ivec2(1, 0)).a;
+
+    float lumaMin = min(lumaCenter, min(min(lumaDown, lumaUp), min(lumaLeft, lumaRight)));
+    float lumaMax = max(lumaCenter, max(max(lumaDown, lumaUp), max(lumaLeft, lumaRight)));
+    float lumaRange = lumaMax - lumaMin;
+    if (lumaRange < max(edgeThresholdMin, lumaMax * edgeThreshold))
+    {
+        FragColor = vec4(center.rgb, 1.0);
+        return;
+    }
+
+    float lumaDownLeft = textureLodOffset(source, uv, 0.0, ivec2(-1, -1)).a;
+    float lumaUpRight = textureLodOffset(source, uv, 0.0, ivec2(1, 1)).a;
+    float lumaUpLeft = textureLodOffset(source, uv, 0.0, ivec2(-1, 1)).a;
+    float lumaDownRight = textureLodOffset(source, uv, 0.0, ivec2(1, -1)).a;
+
+    // horizontal or vertical edge, from the second derivatives across each direction
+    float lumaDownUp = lumaDown + lumaUp;
+    float lumaLeftRight = lumaLeft + lumaRight;
+    float lumaLeftCorners = lumaDownLeft + lumaUpLeft;
+    float lumaDownCorners = lumaDownLeft + lumaDownRight;
+    float lumaRightCorners = lumaDownRight + lumaUpRight;
+    float lumaUpCorners = lumaUpRight + lumaUpLeft;
+    float edgeHorizontal = abs(-2.0 * lumaLeft + lumaLeftCorners) + abs(-2.0 * lumaCenter + lumaDownUp) * 2.0 + abs(-2.0 * lumaRight + lumaRightCorners);
+    float edgeVertical = abs(-2.0 * lumaUp + lumaUpCorners) + abs(-2.0 * lumaCenter + lumaLeftRight) * 2.0 + abs(-2.0 * lumaDown + lumaDownCorners);
+    bool horizontal = edgeHorizontal >= edgeVertical;
+
+    // which side of the pixel the edge is on
+    float luma1 = horizontal ? lumaDown : lumaLeft;
+    float luma2 = horizontal ? lumaUp : lumaRight;
+    float gradient1 = luma1 - lumaCenter;
+    float gradient2 = luma2 - lumaCenter;
+    bool steepest1 = abs(gradient1) >= abs(gradient2);
+    float gradientScaled = 0.25 * max(abs(gradient1), abs(gradient2));
+
+    float stepLength = horizontal ? outputTexelSize.y : outputTexelSize.x;
+    float lumaLocalAverage;
+    if (steepest1)
+    {
+        stepLength = -stepLength;
+        lumaLocalAverage = 0.5 * (luma1 + lumaCenter);
+    }
+    else
+        lumaLocalAverage = 0.5 * (luma2 + lumaCenter);
+
+    // walk both ways along the edge, half a texel across it, until the luma leaves the edge's
+    vec2 edgeUV = uv;
+    if (horizontal)
+        edgeUV.y += stepLength * 0.5;
+    else
+        edgeUV.x += stepLength * 0.5;
+    vec2 offset = horizontal ? vec2(outputTexelSize.x, 0.0) : vec2(0.0, outputTexelSize.y);
+    vec2 uv1 = edgeUV - offset;
+    vec2 uv2 = edgeUV + offset;
+    float lumaEnd1 = luma(uv1) - lumaLocalAverage;
+    float lumaEnd2 = luma(uv2) - lumaLocalAverage;
+    bool reached1 = abs(lumaEnd1) >= gradientScaled;
+    bool reached2 = abs(lumaEnd2) >= gradientScaled;
+    for (int i = 1; i < searchSteps && !(reached1 && reached2); i++)
+    {
+        if (!reached1)
+        {
+            uv1 -= offset * searchStepSizes[i];
+            lumaEnd1 = luma(uv1) - lumaLocalAverage;
+            reached1 = abs(lumaEnd1) >= gradientScaled;
+        }
+        if (!reached2)
+        {
+            uv2 += offset * searchStepSizes[i];
+            lumaEnd2 = luma(uv2) - lumaLocalAverage;
+            reached2 = abs(lumaEnd2) >= gradientScaled;
+        }
+    }
+
+    // the nearer end decides, when its luma change goes the other way than the center's
+    float distance1 = horizontal ? uv.x - uv1.x : uv.y - uv1.y;
+    float distance2 = horizontal ? uv2.x - uv.x : uv2.y - uv.y;
+    bool nearer1 = distance1 < distance2;
+    float distanceFinal = min(distance1, distance2);
+    float edgeLength = distance1 + distance2;
+    bool centerSmaller = lumaCenter < lumaLocalAverage;
+    bool variationCorrect = ((nearer1 ? lumaEnd1 : lumaEnd2) < 0.0) != centerSmaller;
+    float pixelOffset = variationCorrect ? -distanceFinal / edgeLength + 0.5 : 0.0;
+
+    // thin lines and single texels the ends miss, from the 3x3 average
+    float lumaAverage = (1.0 / 12.0) * (2.0 * (lumaDownUp + lumaLeftRight) + lumaLeftCorners + lumaRightCorners);
+    float subpixel = clamp(abs(lumaAverage - lumaCenter) / lumaRange, 0.0, 1.0);
+    subpixel = (-2.0 * subpixel + 3.0) * subpixel * subpixel;
+    pixelOffset = max(pixelOffset, subpixel * subpixel * subpixelQuality);
+
+    vec2 finalUV = uv;
+    if (horizontal)
+        finalUV.y += pixelOffset * stepLength;
+    else
+        finalUV.x += pixelOffset * stepLength;
+    FragColor = vec4(textureLod(source, finalUV, 0.0).rgb, 1.0);
+}
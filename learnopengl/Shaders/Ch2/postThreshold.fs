@@ -0,0 +1,28 @@
+#version 330 core
+
+// Bloom's first pass: the parts of the scene brighter than the threshold, at half size.
+// The knee fades the bright part in instead of cutting it, so bloom does not flicker on edges
+// crossing the threshold.
+uniform sampler2D source;      // the HDR scene
+uniform vec2 outputTexelSize;
+uniform float threshold;
+uniform float knee;
+
+out vec3 bright;
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy * outputTexelSize;
+    vec2 sourceTexel = 1.0 / vec2(textureSize(source, 0));
+    // the 4x4 source texels under this one, in 4 bilinear taps
+    vec3 color = texture(source, uv + vec2(-sourceTexel.x, -sourceTexel.y)).rgb;
+    color += texture(source, uv + vec2(sourceTexel.x, -sourceTexel.y)).rgb;
+    color += texture(source, uv + vec2(-sourceTexel.x, sourceTexel.y)).rgb;
+    color += texture(source, uv + vec2(sourceTexel.x, sourceTexel.y)).rgb;
+    color *= 0.25;
+
+    float brightness = max(color.r, max(color.g, color.b));
+    float soft = clamp(brightness - threshold + knee, 0.0, 2.0 * knee);
+    soft = soft * soft / (4.0 * knee + 0.0001);
+    bright = color * (max(soft, brightness - threshold) / max(brightness, 0.0001));
+}
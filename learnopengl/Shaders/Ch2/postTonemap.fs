@@ -0,0 +1,27 @@
+#version 330 core
+
+// HDR to the display: the exposed scene and its bloom through the ACES filmic curve
+// (Narkowicz's fit). The scene's colors are display values already, as without post, so there
+// is no gamma curve after it.
+uniform sampler2D scene;
+uniform sampler2D bloom;
+uniform vec2 outputTexelSize;
+uniform float exposure;
+uniform float bloomStrength;  // 0 without bloom, nothing is bound then
+
+out vec4 FragColor;
+
+vec3 aces(vec3 x){
+    return clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+}
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy * outputTexelSize;
+    vec3 color = texelFetch(scene, ivec2(gl_FragCoord.xy), 0).rgb;
+    if (bloomStrength > 0.0)
+        color += texture(bloom, uv).rgb * bloomStrength;
+    color = aces(color * exposure);
+    // FXAA finds the edges in the luma, kept in alpha so it is not computed for every tap
+    FragColor = vec4(color, dot(color, vec3(0.299, 0.587, 0.114)));
+}
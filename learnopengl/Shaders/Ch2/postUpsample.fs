@@ -0,0 +1,15 @@
+#version 330 core
+
+// Twice the size: the blurred smaller level, filtered up, over the level of this size so each
+// size adds a wider halo
+uniform sampler2D source;   // the smaller level
+uniform sampler2D base;     // the level of the output's size
+uniform vec2 outputTexelSize;
+
+out vec3 color;
+
+void main()
+{
+    vec2 uv = gl_FragCoord.xy * outputTexelSize;
+    color = texture(base, uv).rgb + texture(source, uv).rgb;
+}
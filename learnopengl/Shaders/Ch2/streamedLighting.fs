@@ -0,0 +1,14 @@
+#version 330 core
+
+out vec4 FragColor;
+in vec2 vertexUV;
+
+uniform vec3 lightColor;
+uniform vec3 objectColor;
+
+uniform sampler2D mainTexture; // a streamed texture, its base level is the finest mip resident
+
+void main(){
+	vec4 texColor = texture(mainTexture, vertexUV);
+	FragColor = vec4(objectColor * lightColor, 1.0) * texColor;
+}
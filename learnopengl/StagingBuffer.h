@@ -0,0 +1,158 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+#include <vector>
+#include <cstdint>
+
+//
+// Ring of pixel unpack buffers the texture uploads are written into.
+// The image is decoded straight into a mapped buffer, then glTexImage2D reads it from there
+// (the pixel pointer is an offset into the bound GL_PIXEL_UNPACK_BUFFER): no copy of the image
+// in client memory, and the driver can copy it to the texture later (DMA) instead of during
+// the call. Each buffer gets a fence after its uploads; it is only written again once the GL is
+// done reading it, so a few textures can be in flight while the next one decodes.
+// The buffers grow to the largest image seen and are kept, the memory is reused.
+// Needs the GL context, map() / unmap() / finish() go in that order for each upload.
+//
+class StagingBuffer
+{
+public:
+	StagingBuffer(int count = 3);
+	~StagingBuffer();
+
+	StagingBuffer(const StagingBuffer&) = delete;
+	StagingBuffer& operator=(const StagingBuffer&) = delete;
+
+	// Map size bytes of the next buffer, waiting for the GL to be done with it.
+	// readable: the caller reads the bytes back too (the mips are filtered from the image), the
+	// driver keeps the mapping in cached memory instead of write combined.
+	unsigned char* map(size_t size, bool readable = false);
+	// Unmap the buffer and leave it bound to GL_PIXEL_UNPACK_BUFFER for the uploads.
+	// False when the contents were lost while mapped (the buffer is still bound, finish() it).
+	bool unmap();
+	// After the uploads reading the buffer: fence it and unbind it
+	void finish();
+
+	void report() const;
+
+private:
+	struct Slot
+	{
+		GLuint buffer;
+		size_t capacity;
+		GLsync fence; // the GL reads the buffer until it signals, NULL when free
+	};
+
+	std::vector<Slot> slots;
+	int current;     // slot of the map() in progress, -1 between uploads
+	int next;
+
+	// statistics for report()
+	unsigned int uploadCount;
+	size_t uploadedBytes;
+	unsigned int stallCount; // map() waited for a fence
+	unsigned int growCount;  // a buffer was (re)allocated to fit an image
+};
+
+
+StagingBuffer::StagingBuffer(int count)
+{
+	// the GL buffers are made on the first map(): the object can be built before the context
+	slots.resize(count > 0 ? count : 1, Slot{ 0, 0, NULL });
+	current = -1;
+	next = 0;
+	uploadCount = 0;
+	uploadedBytes = 0;
+	stallCount = 0;
+	growCount = 0;
+}
+
+StagingBuffer::~StagingBuffer()
+{
+	for (Slot& slot : slots)
+	{
+		if (slot.fence)
+			glDeleteSync(slot.fence);
+		if (slot.buffer != 0)
+			glDeleteBuffers(1, &slot.buffer);
+	}
+}
+
+unsigned char* StagingBuffer::map(size_t size, bool readable)
+{
+	if (current >= 0)
+	{
+		std::cout << "ERROR::StagingBuffer::map:: the previous upload was not finished" << std::endl;
+		return NULL;
+	}
+	Slot& slot = slots[next];
+	if (slot.fence)
+	{
+		if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+		{
+			stallCount++;
+			while (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+				;
+		}
+		glDeleteSync(slot.fence);
+		slot.fence = NULL;
+	}
+
+	if (slot.buffer == 0)
+		glGenBuffers(1, &slot.buffer);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+	if (slot.capacity < size)
+	{
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+		slot.capacity = size;
+		growCount++;
+	}
+
+	// the fence says the GL is done with the old contents: no need for the driver to check again
+	GLbitfield access = readable ? GL_MAP_READ_BIT | GL_MAP_WRITE_BIT
+		: GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+	unsigned char* pointer = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, access);
+	if (!pointer)
+	{
+		std::cout << "ERROR::StagingBuffer::map:: cannot map " << size << " bytes" << std::endl;
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return NULL;
+	}
+	current = next;
+	next = (next + 1) % (int)slots.size();
+	uploadCount++;
+	uploadedBytes += size;
+	return pointer;
+}
+
+bool StagingBuffer::unmap()
+{
+	if (current < 0)
+		return false;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slots[current].buffer);
+	if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_FALSE)
+	{
+		std::cout << "ERROR::StagingBuffer::unmap:: the buffer contents were lost" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void StagingBuffer::finish()
+{
+	if (current < 0)
+		return;
+	slots[current].fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	current = -1;
+}
+
+void StagingBuffer::report() const
+{
+	size_t capacity = 0;
+	for (const Slot& slot : slots)
+		capacity += slot.capacity;
+	std::cout << "StagingBuffer:: " << slots.size() << " buffers, " << capacity / 1024 << " KB, " << uploadCount << " uploads ("
+		<< uploadedBytes / 1024 << " KB), " << stallCount << " waits for the GL, " << growCount << " buffer allocations" << std::endl;
+}
@@ -2,8 +2,14 @@
 #define TEXTURE_FILE
 
 #include<iostream>
+#include<chrono>
+#include<algorithm>
 #include<glad/glad.h>
 
+#include "CookedTexture.h" // before the implementation below: they include stb_image.h too
+#include "ImageLoader.h"
+#include "StagingBuffer.h"
+
 // By defining STB_IMAGE_IMPLEMENTATION the preprocessor modifies the header file
 // such that it only contains the relevant definition source code, 
 // effectively turning the header file into a .cpp file
@@ -15,34 +21,96 @@
 class Texture
 {
 public:
-	Texture(const char* imagePath, int index, bool hasAlpha = true);
+	// imagePath can be a cooked .tex, uploaded block compressed with its mips (hasAlpha is then ignored).
+	// srgb: the image is color and sampling decodes it to linear (GL_SRGB8 / GL_SRGB8_ALPHA8),
+	// for shaders that light in linear space and write to an sRGB framebuffer.
+	// staging: the image and its mips are decoded straight into one of its pixel unpack buffers
+	// instead of client memory, the upload is then asynchronous
+	Texture(const char* imagePath, int index, bool hasAlpha = true, bool srgb = false, StagingBuffer* staging = NULL);
 	~Texture();
 
 	// bind the texture
 	void bind();
 
+	// Time loading an image into a texture through client memory and through a staging buffer,
+	// needs the GL context
+	static void benchmark(const char* imagePath);
+
 private:
 	unsigned int texture;
 	int index;
 };
 
-#endif // !TEXTURE_FILE
-
-Texture::Texture(const char* imagePath, int index=0, bool hasAlpha)
+Texture::Texture(const char* imagePath, int index=0, bool hasAlpha, bool srgb, StagingBuffer* staging)
 {	
 	texture = 0; // init
 	this->index = index;
 	
 	float borderColor[] = { 0.0f, 0.0f, 0.0f, 1.0f };
 
-	// load the texture data
-	int width, height, nChannels;
-	stbi_set_flip_vertically_on_load(true); // flip to be comform with OpenGL standard
-	unsigned char* data = stbi_load(imagePath, &width, &height, &nChannels, 0);
-	if (!data)
+	// a cooked texture already has its compressed mips, everything else goes through ImageLoader
+	CookedTexture cooked;
+	std::vector<MipLevel> levels(1);
+	int channels = hasAlpha ? 4 : 3;
+	size_t offsets[32]; // of the levels in the staging buffer
+	if (CookedTexture::isCooked(imagePath))
+	{
+		if (!cooked.load(imagePath))
+		{
+			std::cout << "ERROR::TEXTURE:: Failed to load texture" << std::endl;
+			throw "Image loading error";
+		}
+	}
+	else if (staging)
 	{
-		std::cout << "ERROR::TEXTURE:: Failed to load texture" << std::endl;
-		throw "Image loading error";
+		// the size is known from the header: the mapping takes the whole chain, level 0 first
+		unsigned char* mapped = NULL;
+		bool loaded = ImageLoader::loadInto(imagePath, channels, [&](int width, int height) -> unsigned char*
+		{
+			levels.resize(MipBuilder::levelCount(width, height));
+			size_t size = 0;
+			for (size_t level = 0; level < levels.size(); level++)
+			{
+				levels[level].width = std::max(1, width >> level);
+				levels[level].height = std::max(1, height >> level);
+				offsets[level] = size;
+				size += (size_t)levels[level].width * levels[level].height * channels;
+			}
+			// the mips are filtered from the image in the mapping
+			mapped = staging->map(size, true);
+			return mapped;
+		});
+		if (mapped)
+		{
+			if (loaded)
+			{
+				unsigned char* pixels[32];
+				for (size_t level = 0; level < levels.size(); level++)
+					pixels[level] = mapped + offsets[level];
+				MipBuilder::build(mapped, levels[0].width, levels[0].height, channels, pixels);
+			}
+			loaded = staging->unmap() && loaded;
+			if (!loaded)
+				staging->finish();
+		}
+		if (!loaded)
+		{
+			std::cout << "ERROR::TEXTURE:: Failed to load texture" << std::endl;
+			throw "Image loading error";
+		}
+	}
+	else
+	{
+		// load the texture data, bottom row first like OpenGL
+		if (!ImageLoader::load(imagePath, channels, levels[0]))
+		{
+			std::cout << "ERROR::TEXTURE:: Failed to load texture" << std::endl;
+			throw "Image loading error";
+		}
+
+		// build the mipmaps on the CPU: glGenerateMipmap averages the sRGB values as they are
+		// (the small levels get too dark) and is slow on software GL
+		MipBuilder::build(levels, channels);
 	}
 
 	// generate texture object ID
@@ -62,17 +130,26 @@ Texture::Texture(const char* imagePath, int index=0, bool hasAlpha)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-	// send the data to the GPU
-	if(hasAlpha)
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-	else
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data);
-
-	// generate mipmaps automatically
-	glGenerateMipmap(GL_TEXTURE_2D);
-
-	stbi_image_free(data); // never forget to free the memory
+	if (cooked.getLevelCount() > 0)
+	{
+		cooked.upload(srgb);
+		return;
+	}
 
+	// send the data to the GPU, every level
+	GLenum format = hasAlpha ? GL_RGBA : GL_RGB;
+	GLint internalFormat = hasAlpha ? (srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8) : (srgb ? GL_SRGB8 : GL_RGB8);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows of RGB levels are not 4 byte aligned
+	for (size_t level = 0; level < levels.size(); level++)
+	{
+		// with the staging buffer bound, the pointer is an offset into it
+		const void* pixels = staging ? (const void*)offsets[level] : (const void*)levels[level].pixels.data();
+		glTexImage2D(GL_TEXTURE_2D, (GLint)level, internalFormat, levels[level].width, levels[level].height, 0, format, GL_UNSIGNED_BYTE, pixels);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	if (staging)
+		staging->finish();
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
 }
 
 Texture::~Texture()
@@ -87,4 +164,35 @@ void Texture::bind()
 { 
 	glActiveTexture(GL_TEXTURE0 + this->index);
 	glBindTexture(GL_TEXTURE_2D, texture); 
-}
\ No newline at end of file
+}
+
+void Texture::benchmark(const char* imagePath)
+{
+	const int runs = 8;
+	StagingBuffer staging;
+	std::cout << "Texture::benchmark:: " << imagePath << " RGBA8 with its mips, " << runs << " loads, until the GL is done with each" << std::endl;
+	for (int mode = 0; mode < 2; mode++)
+	{
+		double total = 0.0, best = 1e9;
+		for (int run = 0; run < runs; run++)
+		{
+			auto start = std::chrono::high_resolution_clock::now();
+			try
+			{
+				Texture texture(imagePath, 0, true, false, mode == 1 ? &staging : NULL);
+				glFinish();
+			}
+			catch (const char*)
+			{
+				return;
+			}
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+			total += ms;
+			best = std::min(best, ms);
+		}
+		std::cout << (mode == 1 ? "  staging buffer \t " : "  client memory  \t ") << total / runs << " ms per texture, best " << best << " ms" << std::endl;
+	}
+	staging.report();
+}
+
+#endif // !TEXTURE_FILE
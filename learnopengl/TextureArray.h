@@ -0,0 +1,244 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <glm/vec4.hpp>
+
+#include "Texture.h" // stb_image
+#include "ImageLoader.h"
+#include "MipBuilder.h"
+#include "Shader.h"
+#include "Mesh.h"
+
+// A texture of a TextureArrayPool: which of its arrays, and the layer inside it
+struct TextureSlice
+{
+	unsigned short array;
+	unsigned short layer;
+};
+
+//
+// Textures stored as layers of GL_TEXTURE_2D_ARRAYs, one array per size and format.
+// A pass binds every array once, then each draw only says which (array, layer) it samples
+// through the per-instance attribute ATTRIB_INSTANCE_TEXTURE, so there is no rebind per material.
+// With ARB_bindless_texture the arrays are never bound at all: the attribute carries the
+// 64 bit texture handle and the shader builds its sampler from it.
+//
+// The per-instance attributes are ATTRIB_INSTANCE_TEXTURE, a uvec4 (handle low, handle high,
+// layer, array), and ATTRIB_INSTANCE_UV_TRANSFORM. No mesh enables them, so they come from the
+// current generic attribute values set by applyInstanceTexture(); an instanced draw can feed
+// them from a buffer with a divisor of 1 instead.
+//
+// Mips are built by MipBuilder (filtered in linear space) unless they come with the image.
+//
+class TextureArrayPool
+{
+public:
+	TextureArrayPool();
+	~TextureArrayPool();
+
+	TextureArrayPool(const TextureArrayPool&) = delete;
+	TextureArrayPool& operator=(const TextureArrayPool&) = delete;
+
+	// Load an image and give it a layer in the array of its size and format, throws when the
+	// image cannot be loaded. The slice can be used once build() ran.
+	TextureSlice add(const char* imagePath, bool hasAlpha = true);
+	// Same with pixels already in memory (copied), rows bottom to top. mipLevels limits the
+	// mip chain of the array (atlas pages), 0 builds all of it.
+	TextureSlice add(const unsigned char* pixels, int width, int height, int channels, int mipLevels = 0);
+	// A mip chain built beforehand (cooked), copied. The array keeps levels.size() levels.
+	TextureSlice add(const std::vector<MipLevel>& levels, int channels);
+	// Build the missing mips, create the GL arrays of the images added since the last build and free their pixels
+	void build();
+
+	static bool bindlessSupported() { return GLAD_GL_ARB_bindless_texture != 0; }
+	bool isBindless() const { return bindless; }
+
+	// Non bindless path: bind array i to unit firstUnit + i, once per pass
+	void bind(unsigned int firstUnit);
+	// Select the texture of the next draws: the instance attributes, and without bindless the
+	// unit of shader's "mainTextures" sampler (a uniform update, not a texture bind).
+	// uvTransform maps the mesh UVs into a sub-rectangle of the layer (atlas regions).
+	void applyInstanceTexture(Shader* shader, TextureSlice slice, glm::vec4 uvTransform = glm::vec4(1.0f, 1.0f, 0.0f, 0.0f)) const;
+
+	unsigned int getArrayCount() const { return (unsigned int)arrays.size(); }
+	unsigned int getTextureCount() const;
+	// one line per array: size, format and layers
+	void report() const;
+
+private:
+	TextureSlice addLayer(std::vector<MipLevel>&& levels, int channels, int mipLevels);
+
+	struct Array
+	{
+		int width;
+		int height;
+		int channels;       // 3 or 4
+		int mipLevels;      // 0 for the full chain
+		unsigned int texture;
+		GLuint64 handle;    // bindless handle, 0 without bindless
+		std::vector<std::vector<MipLevel>> pending; // mip chains added and not uploaded yet, one per layer (maybe only level 0)
+		unsigned int layers; // uploaded
+	};
+
+	bool bindless;
+	unsigned int firstUnit; // of the last bind()
+	std::vector<Array> arrays;
+};
+
+
+TextureArrayPool::TextureArrayPool()
+{
+	bindless = bindlessSupported();
+	firstUnit = 0;
+}
+
+TextureArrayPool::~TextureArrayPool()
+{
+	for (Array& array : arrays)
+	{
+		if (array.handle != 0)
+			glMakeTextureHandleNonResidentARB(array.handle);
+		if (array.texture != 0)
+			glDeleteTextures(1, &array.texture);
+	}
+}
+
+TextureSlice TextureArrayPool::add(const char* imagePath, bool hasAlpha)
+{
+	int channels = hasAlpha ? 4 : 3;
+	std::vector<MipLevel> levels(1);
+	if (!ImageLoader::load(imagePath, channels, levels[0]))
+	{
+		std::cout << "ERROR::TextureArrayPool::add:: Failed to load texture " << imagePath << std::endl;
+		throw "Image loading error";
+	}
+	return addLayer(std::move(levels), channels, 0);
+}
+
+TextureSlice TextureArrayPool::add(const unsigned char* pixels, int width, int height, int channels, int mipLevels)
+{
+	std::vector<MipLevel> levels(1);
+	levels[0].width = width;
+	levels[0].height = height;
+	levels[0].pixels.assign(pixels, pixels + (size_t)width * height * channels);
+	return addLayer(std::move(levels), channels, mipLevels);
+}
+
+TextureSlice TextureArrayPool::add(const std::vector<MipLevel>& levels, int channels)
+{
+	return addLayer(std::vector<MipLevel>(levels), channels, (int)levels.size());
+}
+
+TextureSlice TextureArrayPool::addLayer(std::vector<MipLevel>&& levels, int channels, int mipLevels)
+{
+	int width = levels[0].width, height = levels[0].height;
+	// an array is closed once built, a texture of the same size added later starts a new one
+	GLint maxLayers = 256;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+	unsigned int index = 0;
+	while (index < arrays.size() && !(arrays[index].texture == 0 && arrays[index].width == width && arrays[index].height == height
+		&& arrays[index].channels == channels && arrays[index].mipLevels == mipLevels && arrays[index].pending.size() < (size_t)maxLayers))
+		index++;
+	if (index == arrays.size())
+		arrays.push_back({ width, height, channels, mipLevels, 0, 0, {}, 0 });
+
+	arrays[index].pending.push_back(std::move(levels));
+	TextureSlice slice;
+	slice.array = (unsigned short)index;
+	slice.layer = (unsigned short)(arrays[index].pending.size() - 1);
+	return slice;
+}
+
+void TextureArrayPool::build()
+{
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1); // rows of RGB images are not 4 byte aligned
+	for (Array& array : arrays)
+	{
+		if (array.texture != 0 || array.pending.empty())
+			continue;
+
+		int levelCount = MipBuilder::levelCount(array.width, array.height, array.mipLevels);
+		MipSettings settings;
+		settings.maxLevels = levelCount;
+		for (std::vector<MipLevel>& levels : array.pending)
+			if ((int)levels.size() < levelCount)
+				MipBuilder::build(levels, array.channels, settings);
+
+		GLenum format = array.channels == 4 ? GL_RGBA : GL_RGB;
+		glGenTextures(1, &array.texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture);
+		for (int level = 0; level < levelCount; level++)
+		{
+			const MipLevel& size = array.pending[0][level];
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, array.channels == 4 ? GL_RGBA8 : GL_RGB8, size.width, size.height, (GLsizei)array.pending.size(),
+				0, format, GL_UNSIGNED_BYTE, NULL);
+			for (size_t layer = 0; layer < array.pending.size(); layer++)
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, (GLint)layer, size.width, size.height, 1, format, GL_UNSIGNED_BYTE, array.pending[layer][level].pixels.data());
+		}
+		array.layers = (unsigned int)array.pending.size();
+		array.pending.clear();
+
+		// same sampling as Texture
+		float borderColor[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+		glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		// the texture can not be modified once its handle exists, so this comes last
+		if (bindless)
+		{
+			array.handle = glGetTextureHandleARB(array.texture);
+			glMakeTextureHandleResidentARB(array.handle);
+		}
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void TextureArrayPool::bind(unsigned int firstUnit)
+{
+	this->firstUnit = firstUnit;
+	if (bindless)
+		return;
+	for (size_t i = 0; i < arrays.size(); i++)
+	{
+		glActiveTexture(GL_TEXTURE0 + firstUnit + (GLenum)i);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[i].texture);
+	}
+}
+
+void TextureArrayPool::applyInstanceTexture(Shader* shader, TextureSlice slice, glm::vec4 uvTransform) const
+{
+	GLuint64 handle = arrays[slice.array].handle;
+	glVertexAttribI4ui(ATTRIB_INSTANCE_TEXTURE, (GLuint)(handle & 0xFFFFFFFFu), (GLuint)(handle >> 32), slice.layer, slice.array);
+	glVertexAttrib4f(ATTRIB_INSTANCE_UV_TRANSFORM, uvTransform.x, uvTransform.y, uvTransform.z, uvTransform.w);
+	if (!bindless)
+		glUniform1i(shader->getUniformLocation("mainTextures"), firstUnit + slice.array);
+}
+
+unsigned int TextureArrayPool::getTextureCount() const
+{
+	unsigned int count = 0;
+	for (const Array& array : arrays)
+		count += array.layers + (unsigned int)array.pending.size();
+	return count;
+}
+
+void TextureArrayPool::report() const
+{
+	std::cout << "Textures:: " << getTextureCount() << " textures in " << arrays.size() << " arrays, "
+		<< (bindless ? "bindless" : "bound once per pass (no ARB_bindless_texture)") << std::endl;
+	for (size_t i = 0; i < arrays.size(); i++)
+		std::cout << "  array " << i << ": " << arrays[i].width << "x" << arrays[i].height << (arrays[i].channels == 4 ? " RGBA8, " : " RGB8, ")
+			<< arrays[i].layers << " layers" << (arrays[i].mipLevels > 0 ? ", " + std::to_string(arrays[i].mipLevels) + " mip levels" : "") << std::endl;
+}
@@ -0,0 +1,545 @@
+#pragma once
+
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include <glm/vec4.hpp>
+
+#include "IOFile.h"
+#include "Mesh.h"
+#include "CookedMesh.h" // crc32
+#include "TextureArray.h"
+#include "ImageLoader.h"
+#include "MipBuilder.h"
+
+//
+// Skyline bin packer: the top edge of everything placed so far is kept as a list of horizontal
+// segments, a rectangle goes where its top ends lowest (then leftmost).
+// Fast and close to MaxRects on the mostly similar sized images of an atlas.
+//
+class SkylinePacker
+{
+public:
+	SkylinePacker(int width, int height);
+
+	// Find room for a width x height rectangle, false when the page is full
+	bool insert(int width, int height, int& x, int& y);
+	// area covered by the inserted rectangles
+	long long getUsedArea() const { return usedArea; }
+
+private:
+	struct Segment
+	{
+		int x;
+		int y;
+		int width;
+	};
+
+	// y where a rectangle starting at segment index would sit, -1 if it does not fit there
+	int fit(size_t index, int width, int height) const;
+
+	std::vector<Segment> skyline;
+	int width;
+	int height;
+	long long usedArea;
+};
+
+// Where an image ended up: the atlas page (a layer of the atlas' texture array), its texels,
+// and the transform from the image's own UVs to the page's: atlasUV = uv * uvTransform.xy + uvTransform.zw
+struct AtlasRegion
+{
+	TextureSlice slice;
+	unsigned int page;
+	int x, y, width, height;
+	glm::vec4 uvTransform;
+};
+
+//
+// Cooked atlas, written by --cook-atlas (little endian):
+//   CookedAtlasHeader
+//   CookedAtlasRegion[imageCount]
+//   pages, RGBA8, starting at pixelOffset (16 bytes aligned): for each page its mip levels, pageSize x pageSize
+//   first and halved every time, as many as MipBuilder::levelCount(pageSize, pageSize, mipLevels)
+//
+struct CookedAtlasHeader
+{
+	uint32_t magic;          // COOKED_ATLAS_MAGIC
+	uint32_t version;        // COOKED_ATLAS_VERSION
+	uint32_t checksum;       // CRC32 of everything after the header
+	uint32_t pageSize;
+	uint32_t pageCount;
+	uint32_t imageCount;
+	uint32_t mipLevels;
+	uint32_t padding;
+	uint64_t pixelOffset;
+};
+
+struct CookedAtlasRegion
+{
+	uint32_t page;
+	uint32_t x, y, width, height;
+};
+
+const uint32_t COOKED_ATLAS_MAGIC = 0x544C4C4Cu; // "LLLT"
+const uint32_t COOKED_ATLAS_VERSION = 2;
+
+//
+// Packs small images into shared RGBA8 pages, so a pass samples a handful of pages instead of
+// binding one texture per image. Works on the CPU only until upload(), so it runs offline
+// (--cook-atlas) as well as at load time.
+//
+// Mip safe gutters: every image is surrounded by padding texels repeating its edge, and its
+// rectangle is aligned on 2^(mipLevels-1) texels. Each of the first mipLevels levels then
+// averages texels of one image only, and keeps at least one gutter texel for the bilinear filter.
+// The atlas texture stops at mipLevels levels for that reason. The pages' mips are built by pack()
+// (so a cooked atlas carries them) with the box filter, the only one that stays inside the gutters.
+// UVs outside [0, 1] would sample the neighbours: repeating textures do not belong in an atlas.
+//
+class TextureAtlas
+{
+public:
+	// padding is rounded up to the mip alignment
+	TextureAtlas(int pageSize = 2048, int padding = 4, int mipLevels = 3);
+
+	// Load an image, throws when it cannot be loaded. Returns its index for getRegion()
+	unsigned int add(const char* imagePath);
+	// Copy RGBA8 pixels, rows bottom to top like the GL
+	unsigned int add(const unsigned char* pixels, int width, int height);
+
+	// Place every image, compose the pages and build their mips, false if an image does not fit in a page
+	bool pack();
+	// Hand the pages to pool as layers of a single array (and build it), fills the regions' slices
+	void upload(TextureArrayPool& pool);
+
+	unsigned int getImageCount() const { return (unsigned int)regions.size(); }
+	const AtlasRegion& getRegion(unsigned int image) const { return regions[image]; }
+	unsigned int getPageCount() const { return (unsigned int)pages.size(); }
+	int getPageSize() const { return pageSize; }
+	const unsigned char* getPagePixels(unsigned int page, unsigned int level = 0) const { return pages[page][level].pixels.data(); }
+
+	// Bake the UV transform of an image into a mesh (interleaved position/normal/uv), for meshes
+	// that only ever use this image so the shader can keep the identity transform
+	void remapUVs(MeshData& meshData, unsigned int image) const;
+
+	// Cooked atlas file, packed pages and regions
+	bool write(const char* path) const;
+	bool load(const char* path);
+
+	// Page usage and the number of texture binds saved
+	void report() const;
+
+	// Pack a set of random small images and print the efficiency and timings
+	static void benchmark(unsigned int imageCount = 1000);
+
+private:
+	struct Image
+	{
+		int width;
+		int height;
+		std::vector<unsigned char> pixels;
+	};
+
+	int alignUp(int value) const { return (value + alignment - 1) / alignment * alignment; }
+	// bytes of a page with its mips
+	static size_t chainBytes(int pageSize, int mipLevels);
+	void computeUVTransform(AtlasRegion& region) const;
+
+	int pageSize;
+	int padding;
+	int mipLevels;
+	int alignment;
+	std::vector<Image> images;       // dropped once packed
+	std::vector<AtlasRegion> regions;
+	std::vector<std::vector<MipLevel>> pages; // mip chain of every page
+};
+
+
+SkylinePacker::SkylinePacker(int width, int height)
+{
+	this->width = width;
+	this->height = height;
+	usedArea = 0;
+	skyline.push_back({ 0, 0, width });
+}
+
+int SkylinePacker::fit(size_t index, int width, int height) const
+{
+	int x = skyline[index].x;
+	if (x + width > this->width)
+		return -1;
+	int y = 0;
+	int remaining = width;
+	for (size_t i = index; remaining > 0; i++)
+	{
+		y = std::max(y, skyline[i].y);
+		if (y + height > this->height)
+			return -1;
+		remaining -= skyline[i].width;
+	}
+	return y;
+}
+
+bool SkylinePacker::insert(int width, int height, int& x, int& y)
+{
+	size_t bestIndex = 0;
+	int bestTop = -1;
+	for (size_t i = 0; i < skyline.size(); i++)
+	{
+		int fitY = fit(i, width, height);
+		if (fitY >= 0 && (bestTop < 0 || fitY + height < bestTop || (fitY + height == bestTop && skyline[i].x < x)))
+		{
+			bestIndex = i;
+			bestTop = fitY + height;
+			x = skyline[i].x;
+			y = fitY;
+		}
+	}
+	if (bestTop < 0)
+		return false;
+
+	// the new segment covers the rectangle's top, the ones under it are cut or removed
+	skyline.insert(skyline.begin() + bestIndex, { x, bestTop, width });
+	for (size_t i = bestIndex + 1; i < skyline.size();)
+	{
+		int overlap = x + width - skyline[i].x;
+		if (overlap <= 0)
+			break;
+		if (overlap < skyline[i].width)
+		{
+			skyline[i].x += overlap;
+			skyline[i].width -= overlap;
+			break;
+		}
+		skyline.erase(skyline.begin() + i);
+	}
+	// neighbours at the same height become one segment
+	for (size_t i = 0; i + 1 < skyline.size();)
+	{
+		if (skyline[i].y == skyline[i + 1].y)
+		{
+			skyline[i].width += skyline[i + 1].width;
+			skyline.erase(skyline.begin() + i + 1);
+		}
+		else
+			i++;
+	}
+	usedArea += (long long)width * height;
+	return true;
+}
+
+
+TextureAtlas::TextureAtlas(int pageSize, int padding, int mipLevels)
+{
+	this->pageSize = pageSize;
+	this->mipLevels = std::max(1, mipLevels);
+	alignment = 1 << (this->mipLevels - 1);
+	this->padding = alignUp(std::max(padding, 1));
+}
+
+unsigned int TextureAtlas::add(const char* imagePath)
+{
+	MipLevel image;
+	if (!ImageLoader::load(imagePath, 4, image))
+	{
+		std::cout << "ERROR::TextureAtlas::add:: Failed to load texture " << imagePath << std::endl;
+		throw "Image loading error";
+	}
+	return add(image.pixels.data(), image.width, image.height);
+}
+
+unsigned int TextureAtlas::add(const unsigned char* pixels, int width, int height)
+{
+	Image image;
+	image.width = width;
+	image.height = height;
+	image.pixels.assign(pixels, pixels + (size_t)width * height * 4);
+	images.push_back(std::move(image));
+
+	AtlasRegion region = {};
+	region.width = width;
+	region.height = height;
+	regions.push_back(region);
+	return (unsigned int)regions.size() - 1;
+}
+
+void TextureAtlas::computeUVTransform(AtlasRegion& region) const
+{
+	region.uvTransform = glm::vec4((float)region.width / pageSize, (float)region.height / pageSize,
+		(float)region.x / pageSize, (float)region.y / pageSize);
+}
+
+bool TextureAtlas::pack()
+{
+	// tallest first keeps the skyline flat
+	std::vector<unsigned int> order(images.size());
+	for (unsigned int i = 0; i < order.size(); i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b) {
+		return images[a].height != images[b].height ? images[a].height > images[b].height : images[a].width > images[b].width;
+	});
+
+	std::vector<SkylinePacker> packers;
+	pages.clear();
+	for (unsigned int index : order)
+	{
+		const Image& image = images[index];
+		int rectWidth = alignUp(image.width + 2 * padding);
+		int rectHeight = alignUp(image.height + 2 * padding);
+		if (rectWidth > pageSize || rectHeight > pageSize)
+		{
+			std::cout << "ERROR::TextureAtlas::pack:: image " << index << " (" << image.width << "x" << image.height
+				<< ") does not fit in a " << pageSize << " page" << std::endl;
+			return false;
+		}
+
+		// first page with room, or a new one
+		int rectX = 0, rectY = 0;
+		size_t page = 0;
+		while (page < packers.size() && !packers[page].insert(rectWidth, rectHeight, rectX, rectY))
+			page++;
+		if (page == packers.size())
+		{
+			packers.push_back(SkylinePacker(pageSize, pageSize));
+			pages.push_back(std::vector<MipLevel>(1));
+			pages.back()[0] = { pageSize, pageSize, std::vector<unsigned char>((size_t)pageSize * pageSize * 4, 0) };
+			packers.back().insert(rectWidth, rectHeight, rectX, rectY);
+		}
+
+		AtlasRegion& region = regions[index];
+		region.page = (unsigned int)page;
+		region.x = rectX + padding;
+		region.y = rectY + padding;
+		computeUVTransform(region);
+
+		// copy the image and extrude its edges over the whole rectangle
+		unsigned char* pagePixels = pages[page][0].pixels.data();
+		for (int py = rectY; py < rectY + rectHeight; py++)
+		{
+			int sy = std::min(std::max(py - region.y, 0), image.height - 1);
+			for (int px = rectX; px < rectX + rectWidth; px++)
+			{
+				int sx = std::min(std::max(px - region.x, 0), image.width - 1);
+				memcpy(pagePixels + ((size_t)py * pageSize + px) * 4, image.pixels.data() + ((size_t)sy * image.width + sx) * 4, 4);
+			}
+		}
+	}
+	images.clear();
+	images.shrink_to_fit();
+
+	MipSettings settings;
+	settings.maxLevels = mipLevels;
+	for (std::vector<MipLevel>& levels : pages)
+		MipBuilder::build(levels, 4, settings);
+	return true;
+}
+
+void TextureAtlas::upload(TextureArrayPool& pool)
+{
+	for (size_t page = 0; page < pages.size(); page++)
+	{
+		TextureSlice slice = pool.add(pages[page], 4);
+		for (AtlasRegion& region : regions)
+			if (region.page == page)
+				region.slice = slice;
+	}
+	pool.build();
+}
+
+size_t TextureAtlas::chainBytes(int pageSize, int mipLevels)
+{
+	size_t bytes = 0;
+	int size = pageSize;
+	for (int level = 0; level < MipBuilder::levelCount(pageSize, pageSize, mipLevels); level++, size = std::max(1, size / 2))
+		bytes += (size_t)size * size * 4;
+	return bytes;
+}
+
+void TextureAtlas::remapUVs(MeshData& meshData, unsigned int image) const
+{
+	const glm::vec4& transform = regions[image].uvTransform;
+	for (size_t i = 0; i < meshData.vertices.size(); i += 8)
+	{
+		meshData.vertices[i + 6] = meshData.vertices[i + 6] * transform.x + transform.z;
+		meshData.vertices[i + 7] = meshData.vertices[i + 7] * transform.y + transform.w;
+	}
+}
+
+bool TextureAtlas::write(const char* path) const
+{
+	CookedAtlasHeader header;
+	memset(&header, 0, sizeof(header));
+	header.magic = COOKED_ATLAS_MAGIC;
+	header.version = COOKED_ATLAS_VERSION;
+	header.pageSize = pageSize;
+	header.pageCount = (uint32_t)pages.size();
+	header.imageCount = (uint32_t)regions.size();
+	header.mipLevels = mipLevels;
+	header.padding = (uint32_t)padding;
+	header.pixelOffset = (sizeof(header) + regions.size() * sizeof(CookedAtlasRegion) + 15) & ~(uint64_t)15;
+
+	size_t pageBytes = chainBytes(pageSize, mipLevels);
+	std::vector<char> body((size_t)header.pixelOffset - sizeof(header) + pages.size() * pageBytes, 0);
+	for (size_t i = 0; i < regions.size(); i++)
+	{
+		CookedAtlasRegion cooked = { regions[i].page, (uint32_t)regions[i].x, (uint32_t)regions[i].y, (uint32_t)regions[i].width, (uint32_t)regions[i].height };
+		memcpy(body.data() + i * sizeof(cooked), &cooked, sizeof(cooked));
+	}
+	char* pixels = body.data() + (size_t)header.pixelOffset - sizeof(header);
+	for (const std::vector<MipLevel>& levels : pages)
+		for (const MipLevel& level : levels)
+		{
+			memcpy(pixels, level.pixels.data(), level.pixels.size());
+			pixels += level.pixels.size();
+		}
+	header.checksum = CookedMesh::crc32(body.data(), body.size());
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		std::cout << "ERROR::TextureAtlas::write::" << path << " \t cannot open file" << std::endl;
+		return false;
+	}
+	file.write((const char*)&header, sizeof(header));
+	file.write(body.data(), body.size());
+	if (!file)
+	{
+		std::cout << "ERROR::TextureAtlas::write::" << path << " \t write failed" << std::endl;
+		return false;
+	}
+	std::cout << "TextureAtlas::write::" << path << " \t" << regions.size() << " images, " << pages.size() << " pages, "
+		<< (sizeof(header) + body.size()) / 1024 << " KB" << std::endl;
+	return true;
+}
+
+bool TextureAtlas::load(const char* path)
+{
+	MappedFile file;
+	if (!file.open(path))
+		return false;
+
+	CookedAtlasHeader header;
+	if (file.size() < sizeof(header))
+	{
+		std::cout << "ERROR::TextureAtlas::load::" << path << " \t file too small" << std::endl;
+		return false;
+	}
+	memcpy(&header, file.data(), sizeof(header));
+	if (header.magic != COOKED_ATLAS_MAGIC || header.version != COOKED_ATLAS_VERSION)
+	{
+		std::cout << "ERROR::TextureAtlas::load::" << path << " \t not a cooked atlas, or an older version" << std::endl;
+		return false;
+	}
+	if (header.pageSize == 0 || header.pageSize > 16384 || header.mipLevels == 0 || header.mipLevels > 16)
+	{
+		std::cout << "ERROR::TextureAtlas::load::" << path << " \t corrupted header" << std::endl;
+		return false;
+	}
+	size_t pageBytes = chainBytes((int)header.pageSize, (int)header.mipLevels);
+	if (sizeof(header) + (uint64_t)header.imageCount * sizeof(CookedAtlasRegion) > header.pixelOffset
+		|| header.pixelOffset + (uint64_t)header.pageCount * pageBytes > file.size())
+	{
+		std::cout << "ERROR::TextureAtlas::load::" << path << " \t corrupted header" << std::endl;
+		return false;
+	}
+	if (CookedMesh::crc32(file.data() + sizeof(header), file.size() - sizeof(header)) != header.checksum)
+	{
+		std::cout << "ERROR::TextureAtlas::load::" << path << " \t checksum mismatch" << std::endl;
+		return false;
+	}
+
+	pageSize = (int)header.pageSize;
+	mipLevels = (int)header.mipLevels;
+	alignment = 1 << (mipLevels - 1);
+	padding = (int)header.padding;
+	images.clear();
+	regions.assign(header.imageCount, AtlasRegion());
+	for (uint32_t i = 0; i < header.imageCount; i++)
+	{
+		CookedAtlasRegion cooked;
+		memcpy(&cooked, file.data() + sizeof(header) + i * sizeof(cooked), sizeof(cooked));
+		if (cooked.page >= header.pageCount || cooked.x + cooked.width > header.pageSize || cooked.y + cooked.height > header.pageSize)
+		{
+			std::cout << "ERROR::TextureAtlas::load::" << path << " \t region outside of the pages" << std::endl;
+			return false;
+		}
+		AtlasRegion& region = regions[i];
+		region.page = cooked.page;
+		region.x = (int)cooked.x;
+		region.y = (int)cooked.y;
+		region.width = (int)cooked.width;
+		region.height = (int)cooked.height;
+		computeUVTransform(region);
+	}
+	pages.assign(header.pageCount, std::vector<MipLevel>());
+	const unsigned char* pixels = (const unsigned char*)file.data() + header.pixelOffset;
+	for (std::vector<MipLevel>& levels : pages)
+	{
+		int size = pageSize;
+		for (int level = 0; level < MipBuilder::levelCount(pageSize, pageSize, mipLevels); level++, size = std::max(1, size / 2))
+		{
+			size_t bytes = (size_t)size * size * 4;
+			levels.push_back({ size, size, std::vector<unsigned char>(pixels, pixels + bytes) });
+			pixels += bytes;
+		}
+	}
+	return true;
+}
+
+void TextureAtlas::report() const
+{
+	// content: the images themselves, fill: their rectangles with the gutters and alignment
+	long long imageArea = 0;
+	std::vector<long long> rectArea(pages.size(), 0);
+	for (const AtlasRegion& region : regions)
+	{
+		imageArea += (long long)region.width * region.height;
+		rectArea[region.page] += (long long)alignUp(region.width + 2 * padding) * alignUp(region.height + 2 * padding);
+	}
+	double pageArea = (double)pageSize * pageSize;
+	std::cout << "Atlas:: " << regions.size() << " images on " << pages.size() << " pages of " << pageSize << "x" << pageSize
+		<< ", " << 100.0 * imageArea / (pageArea * std::max<size_t>(pages.size(), 1)) << "% image content, page fill";
+	for (size_t page = 0; page < pages.size(); page++)
+		std::cout << " " << (int)(100.0 * rectArea[page] / pageArea) << "%";
+	std::cout << " (gutters of " << padding << ", mips aligned on " << alignment << "), " << regions.size()
+		<< " texture binds become " << pages.size() << " layers of one array" << std::endl;
+}
+
+void TextureAtlas::benchmark(unsigned int imageCount)
+{
+	// UI icons and decals: mostly 16 to 128 texels, some odd sizes
+	std::mt19937 random(1234);
+	std::uniform_int_distribution<int> sizes(16, 128);
+	std::vector<unsigned char> pixels(128 * 128 * 4);
+	for (size_t i = 0; i < pixels.size(); i++)
+		pixels[i] = (unsigned char)random();
+
+	int paddings[] = { 1, 4 };
+	int mipCounts[] = { 1, 3 };
+	for (int configuration = 0; configuration < 2; configuration++)
+	{
+		TextureAtlas atlas(2048, paddings[configuration], mipCounts[configuration]);
+		long long imageArea = 0;
+		for (unsigned int i = 0; i < imageCount; i++)
+		{
+			int width = sizes(random), height = sizes(random);
+			atlas.add(pixels.data(), width, height);
+			imageArea += (long long)width * height;
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		if (!atlas.pack())
+			return;
+		double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+		std::cout << "TextureAtlas::benchmark:: padding " << paddings[configuration] << ", " << mipCounts[configuration] << " mip levels, "
+			<< imageCount << " images packed, composed and mipmapped in " << seconds * 1000.0 << " ms, ideal pages "
+			<< (double)imageArea / (2048.0 * 2048.0) << std::endl;
+		atlas.report();
+	}
+}
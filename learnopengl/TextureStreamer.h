@@ -0,0 +1,290 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm>
+
+#include "CookedTexture.h"
+#include "RenderThread.h"
+
+//
+// Partial mip residency for cooked textures (.tex).
+// A texture is created with its coarse mips only (the tail, up to tailSize pixels) and
+// GL_TEXTURE_BASE_LEVEL clamped to the finest level in GL, so it is usable right away and
+// the sampler never touches a level that is not there. Every frame the draws say how big the
+// texture is on screen (request()), update() then sends the next finer level of the textures
+// that are the most blurry for their size, a few MB per frame, straight from the file mapping.
+//
+// Under the memory budget, a level is only evicted when nothing asked for it this frame: the
+// least recently used textures give back their finest levels first. What is on screen keeps
+// its levels and a request that does not fit stays coarser, so two visible textures never
+// evict each other back and forth.
+//
+// The GL work is recorded into the frame's command list, update() runs on the main thread.
+//
+class TextureStreamer
+{
+public:
+	// budgetBytes: GL memory for every level of every texture, the tails always fit in it.
+	// uploadBytesPerFrame: how much goes to the GL per frame, at least one level.
+	TextureStreamer(size_t budgetBytes = 64 << 20, size_t uploadBytesPerFrame = 4 << 20, int tailSize = 64);
+	~TextureStreamer();
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	// Map a cooked texture and create it with its tail, needs the GL context.
+	// Returns the texture's index or -1 when the file cannot be loaded.
+	int add(const char* path, bool srgb = false);
+
+	// The texture is drawn this frame covering projectedSize pixels across (Camera::projectedSize()
+	// of the world size the texture spans). The finest request of the frame wins.
+	void request(int texture, float projectedSize);
+	// Turn this frame's requests into uploads and evictions, before the draws using the textures
+	void update(CommandList& commands);
+	// Bind a texture to a unit for the next draws
+	void bind(CommandList& commands, int texture, unsigned int unit);
+
+	GLuint getTexture(int texture) const { return textures[texture].texture; }
+	int getResidentLevel(int texture) const { return textures[texture].residentLevel; }
+	int getWantedLevel(int texture) const { return textures[texture].wantedLevel; }
+	size_t getResidentBytes() const { return residentBytes; }
+	void report() const;
+
+private:
+	struct StreamedTexture
+	{
+		std::string name;
+		CookedTexture* cooked; // the mapping stays open, levels are uploaded from it
+		GLuint texture;
+		bool srgb;
+		int tailLevel;        // this level and the coarser ones are always resident
+		int residentLevel;    // finest level in GL, the texture's base level
+		int wantedLevel;      // finest level needed by the last update()
+		int requestedLevel;   // finest level asked for since the last update()
+		unsigned int lastUsed; // frame of the last request
+	};
+
+	// Evict unneeded levels until 'bytes' more fit, false if they don't. 'keep' is not touched.
+	bool makeRoom(size_t bytes, int keep, CommandList& commands);
+	void uploadLevel(int index, CommandList& commands);
+	void evictLevel(int index, CommandList& commands);
+
+	std::vector<StreamedTexture> textures;
+	std::vector<int> candidates; // reused by update()
+	size_t budgetBytes;
+	size_t uploadBytesPerFrame;
+	int tailSize;
+	size_t residentBytes;
+	unsigned int frameIndex;
+
+	// statistics for report()
+	unsigned int uploadCount;
+	size_t uploadedBytes;
+	unsigned int evictionCount;
+	unsigned int overBudgetFrames; // frames that left a request unfulfilled for lack of memory
+};
+
+
+TextureStreamer::TextureStreamer(size_t budgetBytes, size_t uploadBytesPerFrame, int tailSize)
+{
+	this->budgetBytes = budgetBytes;
+	this->uploadBytesPerFrame = uploadBytesPerFrame;
+	this->tailSize = tailSize;
+	residentBytes = 0;
+	frameIndex = 0;
+	uploadCount = 0;
+	uploadedBytes = 0;
+	evictionCount = 0;
+	overBudgetFrames = 0;
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	for (StreamedTexture& streamed : textures)
+	{
+		glDeleteTextures(1, &streamed.texture);
+		delete streamed.cooked;
+	}
+}
+
+int TextureStreamer::add(const char* path, bool srgb)
+{
+	CookedTexture* cooked = new CookedTexture();
+	if (!cooked->load(path))
+	{
+		delete cooked;
+		return -1;
+	}
+	if (!cooked->isNative(srgb))
+		std::cout << "TextureStreamer::add:: " << BlockCompressor::formatName(cooked->getFormat()) << " is not supported by the driver, "
+			<< path << " is decoded on the CPU as it streams" << std::endl;
+
+	StreamedTexture streamed;
+	streamed.name = path;
+	streamed.cooked = cooked;
+	streamed.srgb = srgb;
+	streamed.tailLevel = cooked->getLevelCount() - 1;
+	while (streamed.tailLevel > 0 && std::max(cooked->getLevelWidth(streamed.tailLevel - 1), cooked->getLevelHeight(streamed.tailLevel - 1)) <= tailSize)
+		streamed.tailLevel--;
+	streamed.residentLevel = streamed.tailLevel;
+	streamed.wantedLevel = streamed.tailLevel;
+	streamed.requestedLevel = streamed.tailLevel;
+	streamed.lastUsed = frameIndex;
+
+	// every level exists in the texture object, the ones under the base level are just empty
+	glGenTextures(1, &streamed.texture);
+	glBindTexture(GL_TEXTURE_2D, streamed.texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	for (int level = cooked->getLevelCount() - 1; level >= streamed.tailLevel; level--)
+	{
+		cooked->uploadLevel(level, srgb);
+		residentBytes += cooked->getLevelMemory(level, srgb);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, streamed.tailLevel);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, cooked->getLevelCount() - 1);
+
+	textures.push_back(streamed);
+	candidates.reserve(textures.size());
+	return (int)textures.size() - 1;
+}
+
+void TextureStreamer::request(int texture, float projectedSize)
+{
+	StreamedTexture& streamed = textures[texture];
+	streamed.lastUsed = frameIndex;
+
+	// one texel per pixel: the level as wide as the texture is on screen, rounded to the finer one
+	float size = (float)std::max(streamed.cooked->getWidth(), streamed.cooked->getHeight());
+	int level = projectedSize > 0.0f ? (int)floor(log2(size / projectedSize)) : streamed.tailLevel;
+	level = std::min(std::max(level, 0), streamed.tailLevel);
+	streamed.requestedLevel = std::min(streamed.requestedLevel, level);
+}
+
+void TextureStreamer::update(CommandList& commands)
+{
+	// what this frame needs, the textures not drawn only need their tail
+	candidates.clear();
+	for (int i = 0; i < (int)textures.size(); i++)
+	{
+		StreamedTexture& streamed = textures[i];
+		streamed.wantedLevel = streamed.requestedLevel;
+		streamed.requestedLevel = streamed.tailLevel;
+		if (streamed.wantedLevel < streamed.residentLevel)
+			candidates.push_back(i);
+	}
+	makeRoom(0, -1, commands); // in case the budget shrank
+
+	// the textures the most levels away from their size on screen first, one level at a time
+	std::sort(candidates.begin(), candidates.end(), [this](int a, int b) {
+		return textures[a].residentLevel - textures[a].wantedLevel > textures[b].residentLevel - textures[b].wantedLevel; });
+	size_t uploaded = 0;
+	bool overBudget = false;
+	for (int index : candidates)
+	{
+		StreamedTexture& streamed = textures[index];
+		while (streamed.residentLevel > streamed.wantedLevel)
+		{
+			size_t bytes = streamed.cooked->getLevelMemory(streamed.residentLevel - 1, streamed.srgb);
+			if (uploaded > 0 && uploaded + bytes > uploadBytesPerFrame)
+				break;
+			if (!makeRoom(bytes, index, commands))
+			{
+				overBudget = true;
+				break;
+			}
+			uploadLevel(index, commands);
+			uploaded += bytes;
+		}
+	}
+	if (overBudget)
+		overBudgetFrames++;
+	frameIndex++;
+}
+
+bool TextureStreamer::makeRoom(size_t bytes, int keep, CommandList& commands)
+{
+	while (residentBytes + bytes > budgetBytes)
+	{
+		// the least recently used texture with a level nobody asked for, the largest level on a tie
+		int victim = -1;
+		for (int i = 0; i < (int)textures.size(); i++)
+		{
+			const StreamedTexture& streamed = textures[i];
+			if (i == keep || streamed.residentLevel >= streamed.wantedLevel)
+				continue;
+			if (victim < 0 || streamed.lastUsed < textures[victim].lastUsed
+				|| (streamed.lastUsed == textures[victim].lastUsed && streamed.residentLevel < textures[victim].residentLevel))
+				victim = i;
+		}
+		if (victim < 0)
+			return false;
+		evictLevel(victim, commands);
+	}
+	return true;
+}
+
+void TextureStreamer::uploadLevel(int index, CommandList& commands)
+{
+	StreamedTexture& streamed = textures[index];
+	int level = streamed.residentLevel - 1;
+	size_t bytes = streamed.cooked->getLevelMemory(level, streamed.srgb);
+	streamed.residentLevel = level;
+	residentBytes += bytes;
+	uploadCount++;
+	uploadedBytes += bytes;
+
+	// the level is complete before the base level lets the sampler reach it
+	const CookedTexture* cooked = streamed.cooked;
+	GLuint texture = streamed.texture;
+	bool srgb = streamed.srgb;
+	commands.call([cooked, texture, level, srgb]() {
+		glBindTexture(GL_TEXTURE_2D, texture);
+		cooked->uploadLevel(level, srgb);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level);
+	});
+}
+
+void TextureStreamer::evictLevel(int index, CommandList& commands)
+{
+	StreamedTexture& streamed = textures[index];
+	int level = streamed.residentLevel;
+	residentBytes -= streamed.cooked->getLevelMemory(level, streamed.srgb);
+	streamed.residentLevel = level + 1;
+	evictionCount++;
+
+	// raise the base level first, then give the level's memory back with an empty image
+	GLuint texture = streamed.texture;
+	commands.call([texture, level]() {
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level + 1);
+		glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	});
+}
+
+void TextureStreamer::bind(CommandList& commands, int texture, unsigned int unit)
+{
+	GLuint id = textures[texture].texture;
+	commands.call([id, unit]() {
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_2D, id);
+	});
+}
+
+void TextureStreamer::report() const
+{
+	std::cout << "TextureStreamer:: " << textures.size() << " textures, " << residentBytes / 1024 << " KB resident of a "
+		<< budgetBytes / 1024 << " KB budget, " << uploadCount << " level uploads (" << uploadedBytes / 1024 << " KB), "
+		<< evictionCount << " evictions, " << overBudgetFrames << " frames over budget" << std::endl;
+	for (const StreamedTexture& streamed : textures)
+		std::cout << "  " << streamed.name << ": " << BlockCompressor::formatName(streamed.cooked->getFormat()) << " "
+			<< streamed.cooked->getLevelWidth(streamed.residentLevel) << "x" << streamed.cooked->getLevelHeight(streamed.residentLevel)
+			<< " resident (level " << streamed.residentLevel << "), level " << streamed.wantedLevel << " wanted, tail from level "
+			<< streamed.tailLevel << std::endl;
+}
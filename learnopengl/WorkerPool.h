@@ -0,0 +1,134 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+
+//
+// Threads kept for the work done every frame. run() cuts [0, count) into batches that the
+// workers and the calling thread take in turn, and returns once all of them are done.
+// Nothing is allocated by a run: the function stays on the caller's stack and the workers
+// sleep between runs (the parallelFor helpers of the loaders start threads every time).
+// run() is called from one thread at a time.
+//
+class WorkerPool
+{
+public:
+	// numThreads counts the calling thread, 0 uses every core
+	WorkerPool(unsigned int numThreads = 0);
+	~WorkerPool();
+
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	unsigned int getThreadCount() const { return (unsigned int)workers.size() + 1; }
+
+	// function(begin, end, threadIndex) for batches of at most batchSize items, threadIndex is
+	// below getThreadCount() (0 for the calling thread) so it can pick per thread scratch memory
+	template<typename Function> void run(size_t count, size_t batchSize, Function function);
+
+private:
+	void work(unsigned int threadIndex);
+	void runBatches(unsigned int threadIndex);
+
+	std::vector<std::thread> workers;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	unsigned int generation; // bumped by every run, the workers wait for a new one
+	unsigned int busyWorkers;
+	bool quit;
+
+	// the run in progress
+	void (*invoke)(void* function, size_t begin, size_t end, unsigned int threadIndex);
+	void* function;
+	size_t count;
+	size_t batchSize;
+	std::atomic<size_t> next;
+};
+
+
+WorkerPool::WorkerPool(unsigned int numThreads)
+{
+	if (numThreads == 0)
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	generation = 0;
+	busyWorkers = 0;
+	quit = false;
+	invoke = NULL;
+	function = NULL;
+	count = 0;
+	batchSize = 1;
+	next = 0;
+	for (unsigned int i = 1; i < numThreads; i++)
+		workers.emplace_back(&WorkerPool::work, this, i);
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (std::thread& worker : workers)
+		worker.join();
+}
+
+template<typename Function>
+void WorkerPool::run(size_t count, size_t batchSize, Function function)
+{
+	batchSize = std::max<size_t>(1, batchSize);
+	if (workers.empty() || count <= batchSize)
+	{
+		if (count > 0)
+			function((size_t)0, count, 0u);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		invoke = [](void* stored, size_t begin, size_t end, unsigned int threadIndex) { (*(Function*)stored)(begin, end, threadIndex); };
+		this->function = &function;
+		this->count = count;
+		this->batchSize = batchSize;
+		next = 0;
+		busyWorkers = (unsigned int)workers.size();
+		generation++;
+	}
+	wake.notify_all();
+	runBatches(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this]() { return busyWorkers == 0; });
+}
+
+void WorkerPool::work(unsigned int threadIndex)
+{
+	unsigned int seen = 0;
+	while (true)
+	{
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&]() { return quit || generation != seen; });
+			if (quit)
+				return;
+			seen = generation;
+		}
+		runBatches(threadIndex);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--busyWorkers == 0)
+				done.notify_one();
+		}
+	}
+}
+
+void WorkerPool::runBatches(unsigned int threadIndex)
+{
+	for (size_t begin = next.fetch_add(batchSize); begin < count; begin = next.fetch_add(batchSize))
+		invoke(function, begin, std::min(count, begin + batchSize), threadIndex);
+}
@@ -1,5 +1,9 @@
 
 #include<iostream>
+#include<cstring>
+#include<cstdlib>
+#include<atomic>
+#include<new>
 
 #include<glad/glad.h>
 #include<GLFW/glfw3.h>
@@ -15,17 +19,37 @@
 #include"Mesh.h"
 #include"Texture.h"
 #include"Camera.h"
-
-#include"ToyMeshData.h"
+#include"MeshImporter.h"
+#include"GeometryGenerator.h"
+#include"SceneGraph.h"
+#include"MathKernels.h"
+#include"Framebuffer.h"
+#include"Input.h"
+#include"FrameArena.h"
+#include"RenderThread.h"
+#include"ResourcePool.h"
+#include"TextureArray.h"
+#include"TextureAtlas.h"
+#include"MipBuilder.h"
+#include"CookedTexture.h"
+#include"ImageLoader.h"
+#include"TextureStreamer.h"
+#include"ClusteredLighting.h"
+#include"DeferredShading.h"
+#include"DepthPrepass.h"
+#include"OcclusionCulling.h"
+#include"CascadedShadows.h"
+#include"PostProcess.h"
 
 //
 // Callback functions definition
 //
 
-int main();
+int main(int argc, char** argv);
 
 void framebufferSizeCallback(GLFWwindow* window, int width, int height);
-void processInput(GLFWwindow* window);
+void simulate(GLFWwindow* window, double time, float step);
+void keyInput(GLFWwindow* window, int key, int scancode, int action, int mods);
 void mouseInput(GLFWwindow* window, double mouseXPos, double mouseYPos);
 void scrollInput(GLFWwindow* window, double xOffset, double yOffset);
 
@@ -35,22 +59,273 @@ void scrollInput(GLFWwindow* window, double xOffset, double yOffset);
 
 int windowHeight = 600, windowWidth = 800; // screen resolution
 
-// Mouse events
-float lastMouseY = windowHeight / 2.0f, lastMouseX = windowWidth / 2.0f; // last recorded mouse position
-float firstMouse = true; // to avoid mouse jumping in the initial frame
+// Input events, queued by the callbacks and consumed by the simulation
+Input* input = new Input();
 
 // Timing
-float deltaTime = 0.0f; // Time between current frame and last frame
-float lastFrameTime = 0.0f; // Time of last frame
+const double simulationStep = 1.0 / 120.0; // the simulation always advances by this much, whatever the frame rate
+const double maxFrameTime = 0.25; // longer frames are clamped so a hitch does not trigger a burst of steps
 
-// Camera model
+// Camera model: the simulation moves simulatedCamera, camera is what is rendered,
+// interpolated between the last two simulation steps
+Camera* simulatedCamera = new Camera();
 Camera* camera = new Camera();
 
+// With the point lights: shade them through the G-buffer instead of the clustered forward pass, Tab switches
+bool deferredShading = false;
+// Write the depth of the opaque draws first, then shade them with an equal depth test, P switches
+bool depthPrepass = false;
+// With the rooms: how the objects hidden behind the walls are culled, O cycles through the modes
+OcclusionMode occlusionMode = OCCLUSION_OFF;
+
+// Every operator new of the program, plain or array, goes through here so the frame loop can count
+// its heap allocations (the library's nothrow forms call these ones)
+std::atomic<unsigned long long> heapAllocations(0);
+
+void* operator new(size_t size)
+{
+	heapAllocations.fetch_add(1, std::memory_order_relaxed);
+	void* memory = malloc(size ? size : 1);
+	if (!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+// GCC pairs the library's calls to operator new with the free() of the deletes inlined next to them
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+void operator delete(void* memory, size_t) noexcept
+{
+	operator delete(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	operator delete(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+	operator delete(memory);
+}
+
 //
 // Main function
 //
-int main()
+// learnopengl [model.obj|.gltf|.glb|.mesh]        display a model instead of the toy cube
+// learnopengl --standard-depth [model]           keep the [-1, 1] depth range instead of reverse-Z
+// learnopengl --single-thread [model]            record and submit the GL commands on the main thread
+// learnopengl --sim-load ms [model]              add ms of busy work to every frame, to see the render thread overlap
+// learnopengl --check-allocations [model]       fail if a frame after the warm-up allocates from the heap
+// learnopengl --stream-texture file.tex [model]  texture the cube with a cooked texture whose mips stream in by screen size
+// learnopengl --texture-budget MB [model]         GL memory for the streamed textures, 64 MB by default
+// learnopengl --lights N [model]                 light the scene with N point lights assigned to clusters, on a floor
+// learnopengl --deferred [model]                with --lights, start with deferred shading (Tab switches forward / deferred)
+// learnopengl --depth-prepass [model]           draw the depth first so each pixel is shaded once (P switches it on and off)
+// learnopengl --occlusion off|hiz|queries [model]  add rooms of walls and crates, culled by the depth pyramid or conditional render (O cycles)
+// learnopengl --shadows [model]                 add a sun casting cascaded shadow maps, on the floor and the rooms
+// learnopengl --post [model]                    draw in HDR, then bloom, tonemapping and FXAA through the render graph (its passes are printed)
+// learnopengl --no-bloom / --no-fxaa [model]    with --post, leave that pass out
+// learnopengl --bench-lights [model]             frame time with 1 to 10000 lights, clustered forward, deferred and every light per fragment, then exit
+// learnopengl --bench-prepass [model]            frame time and shaded samples at 1000 lights with and without the depth prepass, then exit
+// learnopengl --bench-occlusion [model]          frame time and culled objects in the rooms for every occlusion culling mode, then exit
+// learnopengl --bench-shadows [model]            frame time and caster draws in the rooms without shadows, with every cascade drawn every frame and cached, then exit
+// learnopengl --bench-obj model.obj              measure the OBJ parser throughput and exit
+// learnopengl --cook model.obj model.mesh        convert a model into the binary cooked format and exit
+// learnopengl --cook-atlas out.atlas images...    pack small images into a cooked texture atlas and exit
+// learnopengl --bench-atlas                      measure the atlas packer on random small images and exit
+// learnopengl --bench-mips                       measure the CPU mip chain builder, SIMD against scalar, and exit
+// learnopengl --cook-texture image out.tex [bc1|bc3|bc5|bc7]  compress an image and its mips (bc7 by default) and exit
+// learnopengl --bench-bc [image]                 measure the block compressors and their quality and exit
+// learnopengl --cook-png image out.png [rows]    rewrite an image as a PNG that decodes in parallel, in bands of rows (64), and exit
+// learnopengl --check-png images...              compare the PNG decoder with stb_image byte for byte and exit
+// learnopengl --bench-png [image]                measure the PNG decoder against stb_image and exit
+// learnopengl --bench-upload image               measure texture loads through client memory and through a staging buffer and exit
+// learnopengl --bench-clusters                   measure the light to cluster assignment, SIMD and threads against scalar, and exit
+// learnopengl --bench-geometry                   measure the procedural geometry generators and exit
+// learnopengl --bench-scene                      measure the scene graph transform update at 1M nodes and exit
+// learnopengl --bench-math                       compare the SIMD matrix kernels against glm and exit
+int main(int argc, char** argv)
 {
+	if (argc >= 2 && strcmp(argv[1], "--bench-math") == 0)
+	{
+		MathKernels::benchmark();
+		return 0;
+	}
+	if (argc >= 2 && strcmp(argv[1], "--bench-scene") == 0)
+	{
+		SceneGraph::benchmark();
+		return 0;
+	}
+	if (argc >= 2 && strcmp(argv[1], "--bench-geometry") == 0)
+	{
+		GeometryGenerator::benchmark();
+		return 0;
+	}
+	if (argc >= 3 && strcmp(argv[1], "--bench-obj") == 0)
+	{
+		MeshImporter::benchmarkOBJ(argv[2]);
+		return 0;
+	}
+	if (argc >= 4 && strcmp(argv[1], "--cook") == 0)
+	{
+		MeshData meshData;
+		if (!MeshImporter::loadOBJ(argv[2], meshData))
+			return -1;
+		MeshSimplifier::buildLods(meshData);
+		return CookedMesh::write(argv[3], meshData) ? 0 : -1;
+	}
+	if (argc >= 2 && strcmp(argv[1], "--bench-atlas") == 0)
+	{
+		TextureAtlas::benchmark();
+		return 0;
+	}
+	if (argc >= 2 && strcmp(argv[1], "--bench-clusters") == 0)
+	{
+		ClusteredLighting::benchmark();
+		return 0;
+	}
+	if (argc >= 2 && strcmp(argv[1], "--bench-mips") == 0)
+	{
+		MipBuilder::benchmark();
+		return 0;
+	}
+	if (argc >= 2 && strcmp(argv[1], "--bench-bc") == 0)
+	{
+		CookedTexture::benchmark(argc >= 3 ? argv[2] : "Resources/cartoon.png");
+		return 0;
+	}
+	if (argc >= 4 && strcmp(argv[1], "--cook-png") == 0)
+	{
+		MipLevel image;
+		int channels = 4;
+		if (!ImageLoader::load(argv[2], channels, image))
+			return -1;
+		// keep the alpha channel only if something uses it
+		bool opaque = true;
+		for (size_t i = 3; i < image.pixels.size() && opaque; i += 4)
+			opaque = image.pixels[i] == 255;
+		if (opaque)
+		{
+			channels = 3;
+			for (size_t i = 0, j = 0; i < image.pixels.size(); i += 4, j += 3)
+				memmove(&image.pixels[j], &image.pixels[i], 3);
+		}
+		return ImageLoader::writePNG(argv[3], image.pixels.data(), image.width, image.height, channels, argc >= 5 ? atoi(argv[4]) : 64) ? 0 : -1;
+	}
+	if (argc >= 3 && strcmp(argv[1], "--check-png") == 0)
+	{
+		bool ok = true;
+		for (int i = 2; i < argc; i++)
+			ok = ImageLoader::check(argv[i]) && ok;
+		return ok ? 0 : 1;
+	}
+	if (argc >= 2 && strcmp(argv[1], "--bench-png") == 0)
+	{
+		ImageLoader::benchmark(argc >= 3 ? argv[2] : "Resources/cartoon.png");
+		return 0;
+	}
+	if (argc >= 4 && strcmp(argv[1], "--cook-texture") == 0)
+	{
+		BlockFormat format = BLOCK_BC7;
+		if (argc >= 5 && strcmp(argv[4], "bc1") == 0)
+			format = BLOCK_BC1;
+		else if (argc >= 5 && strcmp(argv[4], "bc3") == 0)
+			format = BLOCK_BC3;
+		else if (argc >= 5 && strcmp(argv[4], "bc5") == 0)
+			format = BLOCK_BC5;
+		return CookedTexture::cook(argv[2], argv[3], format) ? 0 : -1;
+	}
+	if (argc >= 4 && strcmp(argv[1], "--cook-atlas") == 0)
+	{
+		TextureAtlas atlas;
+		for (int i = 3; i < argc; i++)
+			atlas.add(argv[i]);
+		if (!atlas.pack())
+			return -1;
+		atlas.report();
+		return atlas.write(argv[2]) ? 0 : -1;
+	}
+	const char* modelPath = NULL;
+	bool standardDepth = false;
+	bool singleThread = false;
+	double simulationLoadMs = 0.0;
+	bool checkAllocations = false;
+	const char* streamedTexturePath = NULL;
+	size_t textureBudgetMB = 64;
+	const char* benchUploadPath = NULL;
+	int lightCount = 0;
+	bool benchLights = false;
+	bool benchPrepass = false;
+	bool rooms = false;
+	bool benchOcclusion = false;
+	bool shadows = false;
+	bool benchShadows = false;
+	bool post = false;
+	PostSettings postSettings;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "--standard-depth") == 0)
+			standardDepth = true;
+		else if (strcmp(argv[i], "--single-thread") == 0)
+			singleThread = true;
+		else if (strcmp(argv[i], "--sim-load") == 0 && i + 1 < argc)
+			simulationLoadMs = atof(argv[++i]);
+		else if (strcmp(argv[i], "--check-allocations") == 0)
+			checkAllocations = true;
+		else if (strcmp(argv[i], "--stream-texture") == 0 && i + 1 < argc)
+			streamedTexturePath = argv[++i];
+		else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+			textureBudgetMB = (size_t)atoi(argv[++i]);
+		else if (strcmp(argv[i], "--bench-upload") == 0 && i + 1 < argc)
+			benchUploadPath = argv[++i];
+		else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+			lightCount = std::min(std::max(atoi(argv[++i]), 0), ClusteredLighting::maxLights);
+		else if (strcmp(argv[i], "--deferred") == 0)
+			deferredShading = true;
+		else if (strcmp(argv[i], "--bench-lights") == 0)
+			benchLights = true;
+		else if (strcmp(argv[i], "--depth-prepass") == 0)
+			depthPrepass = true;
+		else if (strcmp(argv[i], "--bench-prepass") == 0)
+			benchPrepass = true;
+		else if (strcmp(argv[i], "--occlusion") == 0 && i + 1 < argc)
+		{
+			rooms = true;
+			i++;
+			occlusionMode = strcmp(argv[i], "hiz") == 0 ? OCCLUSION_HIZ : strcmp(argv[i], "queries") == 0 ? OCCLUSION_QUERIES : OCCLUSION_OFF;
+		}
+		else if (strcmp(argv[i], "--bench-occlusion") == 0)
+			benchOcclusion = rooms = true;
+		else if (strcmp(argv[i], "--shadows") == 0)
+			shadows = true;
+		else if (strcmp(argv[i], "--bench-shadows") == 0)
+			benchShadows = rooms = true;
+		else if (strcmp(argv[i], "--post") == 0)
+			post = true;
+		else if (strcmp(argv[i], "--no-bloom") == 0)
+			postSettings.bloom = false;
+		else if (strcmp(argv[i], "--no-fxaa") == 0)
+			postSettings.fxaa = false;
+		else
+			modelPath = argv[i];
+	}
+
 	// we first initialize GLFW, after which we can configure GLFW using glfwWindowHint
 	glfwInit();
 
@@ -89,38 +364,108 @@ int main()
 		glfwTerminate();
 		return -1;
 	}
+	DepthConfig::loadClipControl((GLADloadproc)glfwGetProcAddress); // core in 4.5, not loaded by this glad without the extension
 
 	// We have to tell OpenGL the size of the rendering window 
 	// so OpenGL knows how we want to display the data and coordinates with respect to the window. 
 	glViewport(0, 0, windowWidth, windowHeight); // The first two parameters of glViewport set the location of the lower left corner of the window.
+
+	// the upload benchmark needs the context, nothing else
+	if (benchUploadPath)
+	{
+		Texture::benchmark(benchUploadPath);
+		glfwTerminate();
+		return 0;
+	}
+	camera->setAspect((float)windowWidth / (float)windowHeight);
 	
 	//
 	// CallBacks
 	// ---------
 	glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);// Setting up a callback for window resizing 
+	glfwSetKeyCallback(window, keyInput); // callback for key presses and releases
 	glfwSetCursorPosCallback(window, mouseInput); // callback for mouse movements
 	glfwSetScrollCallback(window, scrollInput); // callback for mouse movements
 
 	// INIT MODEL And Shaders
 	// ----------------------
-	Mesh* cubeMesh = new  Mesh();
-	cubeMesh->CreateVCT(
-		toyData::cubeVertexColorUVs, 
-		toyData::cubeIndices, 
-		sizeof(toyData::cubeVertexColorUVs) / sizeof(toyData::cubeVertexColorUVs[0]), 
-		sizeof(toyData::cubeIndices) / sizeof(toyData::cubeIndices[0])
-	);
-	Mesh* lightCube = new  Mesh();
-	lightCube->CreateV(
-		toyData::cubeVerticesOnly,
-		toyData::cubeIndices,
-		sizeof(toyData::cubeVerticesOnly) / sizeof(toyData::cubeVerticesOnly[0]),
-		sizeof(toyData::cubeIndices) / sizeof(toyData::cubeIndices[0])
-	);
-	Shader* cubeShader = new Shader("Shaders/Ch1/cameraVert.vs", "Shaders/Ch2/baseLighting.fs");
-	Shader* lightShader = new Shader("Shaders/Ch2/lightVert.vs", "Shaders/Ch2/lightFrag.fs");
-	Texture* cartoonTex = new Texture("Resources/cartoon.png", 0, false);
-	Texture* checkerBoardTex = new Texture("Resources/diffuse_puzzle.png", 1, false);
+	ShapeDesc cubeShape;
+	cubeShape.type = SHAPE_CUBE;
+	cubeShape.segments = 1;
+	cubeShape.size = 0.5f;
+
+	// meshes and shaders live in pools and are referred to by handle
+	ResourcePool<Mesh> meshes("Mesh");
+	ResourcePool<Shader> shaders("Shader");
+
+	MeshHandle cubeMeshHandle = meshes.create();
+	if (!modelPath || !MeshImporter::loadModel(modelPath, *meshes.get(cubeMeshHandle)))
+		GeometryGenerator::createMesh(cubeShape, GeneratorLayout::VNT(), *meshes.get(cubeMeshHandle)); // with per-face normals for the lighting
+	MeshHandle lightCubeHandle = meshes.create();
+	GeometryGenerator::createMesh(cubeShape, GeneratorLayout::V(), *meshes.get(lightCubeHandle));
+	// the point lights need something to fall on
+	bool benchPhases = benchLights || benchPrepass || benchOcclusion || benchShadows;
+	bool clustered = lightCount > 0 || benchPhases || shadows;
+	ShapeDesc floorShape;
+	floorShape.type = SHAPE_PLANE;
+	floorShape.segments = 1;
+	floorShape.size = 60.0f;
+	MeshHandle floorHandle = meshes.create();
+	if (clustered)
+		GeometryGenerator::createMesh(floorShape, GeneratorLayout::VNT(), *meshes.get(floorHandle));
+	// the walls and crates of the rooms are scaled unit cubes
+	ShapeDesc boxShape = cubeShape;
+	boxShape.size = 1.0f;
+	MeshHandle boxHandle = meshes.create();
+	if (rooms)
+		GeometryGenerator::createMesh(boxShape, GeneratorLayout::VNT(), *meshes.get(boxHandle));
+
+	// a cooked texture given on the command line streams its mips in as the cube gets bigger on screen
+	TextureStreamer* textureStreamer = new TextureStreamer(textureBudgetMB << 20);
+	int streamedTex = streamedTexturePath ? textureStreamer->add(streamedTexturePath) : -1;
+
+	ShaderHandle cubeShaderHandle;
+	if (streamedTex >= 0)
+		cubeShaderHandle = shaders.create("Shaders/Ch2/arrayVert.vs", "Shaders/Ch2/streamedLighting.fs");
+	else if (clustered)
+		cubeShaderHandle = shaders.create("Shaders/Ch2/clusteredVert.vs",
+			TextureArrayPool::bindlessSupported() ? "Shaders/Ch2/clusteredLightingBindless.fs" : "Shaders/Ch2/clusteredLighting.fs");
+	else
+		cubeShaderHandle = shaders.create("Shaders/Ch2/arrayVert.vs",
+			TextureArrayPool::bindlessSupported() ? "Shaders/Ch2/arrayLightingBindless.fs" : "Shaders/Ch2/arrayLighting.fs");
+	clustered = clustered && streamedTex < 0;
+	ShaderHandle lightShaderHandle = shaders.create("Shaders/Ch2/lightVert.vs", "Shaders/Ch2/lightFrag.fs");
+	ShaderHandle depthShaderHandle = shaders.create("Shaders/Ch2/depthOnly.vs", "Shaders/Ch2/depthOnly.fs");
+	ShaderHandle pyramidShaderHandle;
+	if (rooms)
+		pyramidShaderHandle = shaders.create("Shaders/Ch2/fullscreen.vs", "Shaders/Ch2/hizDownsample.fs");
+	// the deferred path: the scene into the G-buffer, then ambient and light volumes
+	ShaderHandle gbufferShaderHandle, deferredAmbientHandle, deferredLightHandle;
+	if (clustered)
+	{
+		gbufferShaderHandle = shaders.create("Shaders/Ch2/clusteredVert.vs",
+			TextureArrayPool::bindlessSupported() ? "Shaders/Ch2/gbufferBindless.fs" : "Shaders/Ch2/gbuffer.fs");
+		deferredAmbientHandle = shaders.create("Shaders/Ch2/fullscreen.vs", "Shaders/Ch2/deferredAmbient.fs");
+		deferredLightHandle = shaders.create("Shaders/Ch2/deferredLight.vs", "Shaders/Ch2/deferredLight.fs");
+	}
+	// post-processing, the passes of the render graph
+	ShaderHandle postThresholdHandle, postDownsampleHandle, postBlurHandle, postUpsampleHandle, postTonemapHandle, postFXAAHandle;
+	if (post)
+	{
+		postThresholdHandle = shaders.create("Shaders/Ch2/fullscreen.vs", "Shaders/Ch2/postThreshold.fs");
+		postDownsampleHandle = shaders.create("Shaders/Ch2/fullscreen.vs", "Shaders/Ch2/postDownsample.fs");
+		postBlurHandle = shaders.create("Shaders/Ch2/fullscreen.vs", "Shaders/Ch2/postBlur.fs");
+		postUpsampleHandle = shaders.create("Shaders/Ch2/fullscreen.vs", "Shaders/Ch2/postUpsample.fs");
+		postTonemapHandle = shaders.create("Shaders/Ch2/fullscreen.vs", "Shaders/Ch2/postTonemap.fs");
+		postFXAAHandle = shaders.create("Shaders/Ch2/fullscreen.vs", "Shaders/Ch2/postFXAA.fs");
+	}
+
+	// textures are layers of arrays grouped by size, a pass binds them all once
+	TextureArrayPool* textureArrays = new TextureArrayPool();
+	TextureSlice cartoonTex = textureArrays->add("Resources/cartoon.png", false);
+	textureArrays->add("Resources/diffuse_puzzle.png", false); // 512x512, gets an array of its own
+	textureArrays->build();
+	textureArrays->report();
 	 
 
 	// tell GLFW that it should hide the cursor and capture it
@@ -132,139 +477,622 @@ int main()
 	
 	// Enable depth testing to avoid drawing hidden objects in the back
 	glEnable(GL_DEPTH_TEST);
+
+	// Depth: reverse-Z with an infinite far plane into a float depth buffer whenever the GL can do it.
+	// The window's depth buffer is 24 bit fixed point, so the scene is drawn offscreen and blitted.
+	// With post-processing the scene is always drawn offscreen, into a half float HDR color.
+	DepthConfig depthConfig;
+	depthConfig.reverseZ = !standardDepth && DepthConfig::reverseZSupported();
+	Framebuffer* sceneTarget = NULL;
+	if (depthConfig.reverseZ || post)
+	{
+		sceneTarget = new Framebuffer();
+		if (!sceneTarget->create(windowWidth, windowHeight, depthConfig.reverseZ, post ? GL_RGBA16F : GL_RGBA8))
+		{
+			delete sceneTarget;
+			sceneTarget = NULL;
+			depthConfig.reverseZ = false;
+		}
+	}
+	depthConfig.apply();
+	camera->setReverseZ(depthConfig.reverseZ);
+	camera->setInfiniteFar(depthConfig.reverseZ);
+	std::cout << "Depth:: " << (depthConfig.reverseZ ? "reverse-Z, infinite far plane, 32 bit float" : "standard, 24 bit")
+		<< (DepthConfig::reverseZSupported() ? "" : " (no glClipControl)") << std::endl;
+
+	// counts the shaded samples, and draws the depth first when asked to
+	DepthPrepass* prepass = new DepthPrepass(depthConfig);
+
+	// the G-buffer has a depth buffer of its own, in the same convention
+	DeferredShading* deferred = NULL;
+	if (clustered)
+	{
+		deferred = new DeferredShading();
+		if (!deferred->create(windowWidth, windowHeight, depthConfig.reverseZ))
+		{
+			delete deferred;
+			deferred = NULL;
+		}
+	}
+
+	// Rooms for the occlusion culling: rows of walls across the view with a doorway each, and crates
+	// between them. From the start position most of it is behind the first wall.
+	struct RoomObject { glm::mat4 model; glm::vec3 boundsMin; glm::vec3 boundsMax; glm::vec3 color; };
+	std::vector<RoomObject> roomObjects;
+	std::vector<unsigned int> visibleObjects; // this frame's, the memory is kept
+	OcclusionCulling* occlusion = NULL;
+	if (rooms)
+	{
+		auto addBox = [&](glm::vec3 center, glm::vec3 size, glm::vec3 color)
+		{
+			roomObjects.push_back({ glm::scale(glm::translate(glm::mat4(1.0f), center), size), center - size * 0.5f, center + size * 0.5f, color });
+		};
+		for (int row = 0; row < 8; row++)
+		{
+			float z = -4.0f - row * 6.0f;
+			float door = (float)((row * 7) % 5 - 2) * 6.0f; // 2 wide, centered there
+			addBox(glm::vec3((door - 21.0f) * 0.5f, 1.0f, z), glm::vec3(door + 19.0f, 4.0f, 0.4f), glm::vec3(0.7f, 0.6f, 0.5f));
+			addBox(glm::vec3((door + 21.0f) * 0.5f, 1.0f, z), glm::vec3(19.0f - door, 4.0f, 0.4f), glm::vec3(0.7f, 0.6f, 0.5f));
+			for (int column = 0; column < 19; column++)
+				for (int depth = 0; depth < 2; depth++)
+					addBox(glm::vec3(-18.0f + column * 2.0f, -0.6f, z - 1.5f - depth * 2.0f), glm::vec3(0.8f), glm::vec3(0.8f, 0.5f, 0.2f));
+		}
+		visibleObjects.reserve(roomObjects.size());
+		occlusion = new OcclusionCulling();
+		occlusion->create(depthConfig, (unsigned int)roomObjects.size());
+	}
+
+	// The sun and its shadows. The clustered shaders read the sun's uniforms either way: without
+	// the atlas apply() turns it off.
+	CascadedShadows* shadowMaps = NULL;
+	std::vector<ShadowCaster> casters; // this frame's, the memory is kept
+	if (clustered)
+	{
+		shadowMaps = new CascadedShadows(depthConfig);
+		if ((shadows || benchShadows) && shadowMaps->create())
+		{
+			shadowMaps->setLight(glm::vec3(-0.4f, -1.0f, -0.3f), glm::vec3(0.8f, 0.75f, 0.6f));
+			shadowMaps->setEnabled(shadows);
+		}
+		casters.reserve(roomObjects.size() + 1);
+	}
+
+	// Bloom, tonemapping and FXAA from the scene's target into the window
+	PostProcess* postProcess = NULL;
+	if (post && sceneTarget)
+	{
+		postProcess = new PostProcess(postSettings);
+		PostShaders postShaders = { shaders.get(postThresholdHandle), shaders.get(postDownsampleHandle), shaders.get(postBlurHandle),
+			shaders.get(postUpsampleHandle), shaders.get(postTonemapHandle), shaders.get(postFXAAHandle) };
+		if (postProcess->create(sceneTarget, postShaders))
+			postProcess->report(windowWidth, windowHeight);
+		else
+		{
+			delete postProcess;
+			postProcess = NULL;
+		}
+	}
+
+	// Scene: the lit cube and the light cube
+	SceneGraph scene;
+	SceneNode cubeNode = scene.createNode();
+	scene.setRotation(cubeNode, glm::angleAxis(glm::radians(20.0f), glm::normalize(glm::vec3(1.0f, 0.3f, 0.5f))));
+	SceneNode lightNode = scene.createNode();
+	scene.setPosition(lightNode, glm::vec3(1.0f, 1.0f, 0.0f));
+	scene.setRotation(lightNode, glm::angleAxis(glm::radians(45.0f), glm::normalize(glm::vec3(1.0f, 0.3f, 0.5f))));
+	scene.setScale(lightNode, glm::vec3(0.3f));
+
+	// Point lights: the first one is the light cube, the others are scattered over the floor.
+	// Each frame assigns them to the froxels of the view on the worker pool, before the draws.
+	ClusteredLighting* lighting = NULL;
+	WorkerPool* lightingPool = NULL;
+	// --bench-lights and --bench-prepass time each of these for phaseFrames after a warm-up, then close the window
+	enum LightPath { LIGHTS_CLUSTERED, LIGHTS_DEFERRED, LIGHTS_EVERY };
+	enum ShadowPath { SHADOWS_OFF, SHADOWS_EVERY_FRAME, SHADOWS_CACHED };
+	struct LightPhase { int lights; LightPath path; bool prepass; OcclusionMode occlusion; ShadowPath shadows; };
+	const LightPhase benchLightPhases[] = {
+		{ 1, LIGHTS_CLUSTERED, false, OCCLUSION_OFF, SHADOWS_OFF }, { 100, LIGHTS_CLUSTERED, false, OCCLUSION_OFF, SHADOWS_OFF },
+		{ 1000, LIGHTS_CLUSTERED, false, OCCLUSION_OFF, SHADOWS_OFF }, { 10000, LIGHTS_CLUSTERED, false, OCCLUSION_OFF, SHADOWS_OFF },
+		{ 1, LIGHTS_DEFERRED, false, OCCLUSION_OFF, SHADOWS_OFF }, { 100, LIGHTS_DEFERRED, false, OCCLUSION_OFF, SHADOWS_OFF },
+		{ 1000, LIGHTS_DEFERRED, false, OCCLUSION_OFF, SHADOWS_OFF }, { 10000, LIGHTS_DEFERRED, false, OCCLUSION_OFF, SHADOWS_OFF },
+		{ 1, LIGHTS_EVERY, false, OCCLUSION_OFF, SHADOWS_OFF }, { 100, LIGHTS_EVERY, false, OCCLUSION_OFF, SHADOWS_OFF } };
+	const LightPhase benchPrepassPhases[] = {
+		{ 1000, LIGHTS_CLUSTERED, false, OCCLUSION_OFF, SHADOWS_OFF }, { 1000, LIGHTS_CLUSTERED, true, OCCLUSION_OFF, SHADOWS_OFF },
+		{ 1000, LIGHTS_DEFERRED, false, OCCLUSION_OFF, SHADOWS_OFF }, { 1000, LIGHTS_DEFERRED, true, OCCLUSION_OFF, SHADOWS_OFF } };
+	const LightPhase benchOcclusionPhases[] = {
+		{ 100, LIGHTS_CLUSTERED, false, OCCLUSION_OFF, SHADOWS_OFF }, { 100, LIGHTS_CLUSTERED, false, OCCLUSION_HIZ, SHADOWS_OFF },
+		{ 100, LIGHTS_CLUSTERED, false, OCCLUSION_QUERIES, SHADOWS_OFF } };
+	const LightPhase benchShadowPhases[] = {
+		{ 100, LIGHTS_CLUSTERED, false, OCCLUSION_OFF, SHADOWS_OFF }, { 100, LIGHTS_CLUSTERED, false, OCCLUSION_OFF, SHADOWS_EVERY_FRAME },
+		{ 100, LIGHTS_CLUSTERED, false, OCCLUSION_OFF, SHADOWS_CACHED }, { 100, LIGHTS_DEFERRED, false, OCCLUSION_OFF, SHADOWS_CACHED } };
+	const LightPhase* lightPhases = benchShadows ? benchShadowPhases : benchOcclusion ? benchOcclusionPhases : benchPrepass ? benchPrepassPhases : benchLightPhases;
+	const char* lightPathNames[] = { "clustered forward", "deferred", "every light per fragment" };
+	const char* shadowPathNames[] = { "off", "every cascade every frame", "far cascades cached" };
+	const int lightPhaseCount = benchShadows ? 4 : benchOcclusion ? 3 : benchPrepass ? 4 : benchLights ? 10 : 1;
+	const unsigned int phaseWarmupFrames = 10, phaseFrames = 50;
+	int lightPhase = 0;
+	unsigned int phaseFrame = 0;
+	double phaseStartTime = 0.0, phaseAssignMs = 0.0;
+	auto scatterLights = [&](int count)
+	{
+		lighting->clearLights();
+		lighting->addLight({ glm::vec3(1.0f, 1.0f, 0.0f), 8.0f, glm::vec3(1.0f) });
+		std::mt19937 random(count);
+		std::uniform_real_distribution<float> across(-30.0f, 30.0f), height(-0.8f, 2.0f), radius(1.0f, 3.0f), hue(0.0f, 1.0f);
+		for (int i = 1; i < count; i++)
+		{
+			float h = hue(random) * 6.2831853f;
+			glm::vec3 color = glm::vec3(0.5f) + 0.5f * glm::vec3(cos(h), cos(h - 2.0943951f), cos(h + 2.0943951f)); // a color wheel
+			lighting->addLight({ glm::vec3(across(random), height(random), across(random)), radius(random), color });
+		}
+	};
+	if (clustered)
+	{
+		lighting = new ClusteredLighting();
+		lightingPool = new WorkerPool();
+		scatterLights(benchPhases ? lightPhases[0].lights : lightCount);
+	}
+	glm::mat4 floorModel = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
+
+	int cubeLod = 0; // LOD drawn last frame, the selection keeps it unless the change is clear
+	double lastFrameTime = glfwGetTime();
+	double simulationLag = 0.0; // real time not simulated yet, always less than one step after the loop below
+	CameraState previousCameraState = simulatedCamera->getState();
+
+	// From here on the GL context belongs to the render thread, this thread only records commands
+	RenderThread renderThread(window, !singleThread);
+	renderThread.start();
+	double loopStartTime = glfwGetTime();
+	double mainThreadSeconds = 0.0;
+	// the command lists and the GL driver grow during the first frames, after that a frame must not allocate
+	const unsigned int warmupFrames = 60;
+	unsigned int frameIndex = 0;
+	unsigned long long warmupAllocations = 0;
+
 	// Rendering loop
 	while (!glfwWindowShouldClose(window))
 	{
 
+		if (frameIndex++ == warmupFrames)
+			warmupAllocations = heapAllocations.load();
+
 		// per-frame time logic
-		float curTime = glfwGetTime();
-		deltaTime = curTime - lastFrameTime;
-		lastFrameTime = curTime;
+		double frameStartTime = glfwGetTime();
+		simulationLag += std::min(frameStartTime - lastFrameTime, maxFrameTime);
+		lastFrameTime = frameStartTime;
+		float curTime = (float)frameStartTime;
+
+		// fixed-timestep simulation, each step consumes the input that happened before its end
+		while (simulationLag >= simulationStep)
+		{
+			simulationLag -= simulationStep;
+			previousCameraState = simulatedCamera->getState();
+			simulate(window, frameStartTime - simulationLag, (float)simulationStep);
+		}
+		// stand-in for an expensive simulation
+		while (simulationLoadMs > 0.0 && (glfwGetTime() - frameStartTime) * 1000.0 < simulationLoadMs)
+			;
+
+		// render in between the last two simulated states, so motion stays smooth at any frame rate
+		camera->setState(Camera::interpolate(previousCameraState, simulatedCamera->getState(), (float)(simulationLag / simulationStep)));
 
-		// input
-		processInput(window); 
+		// world matrices of whatever moved since the last frame
+		scene.update();
 
-		// rendering commands here
-		glClearColor(0.0f, 0.2f, 0.3f, 0.1f); // We want to clear the screen with a color of our choice. 
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // The possible bits we can set are GL_COLOR_BUFFER_BIT, GL_DEPTH_BUFFER_BIT and GL_STENCIL_BUFFER_BIT. 
+		// rendering commands here, recorded for the render thread
+		CommandList& commands = renderThread.getCommandList();
+		// the benchmarks pick the path per phase, otherwise Tab does
+		LightPath lightPath = benchPhases ? lightPhases[lightPhase].path : deferredShading ? LIGHTS_DEFERRED : LIGHTS_CLUSTERED;
+		bool drawDeferred = deferred && lightPath == LIGHTS_DEFERRED;
+		bool drawPrepass = benchPhases ? lightPhases[lightPhase].prepass : depthPrepass;
 
+		// the camera only rebuilds the matrices that changed since the last frame
+		const glm::mat4& projectionMat = camera->getProjectionMatrix();
+		const glm::mat4& viewMat = camera->getViewMatrix();
+		const glm::mat4& viewProjectionMat = camera->getViewProjectionMatrix();
 
-		glm::mat4 projectionMat = glm::perspective(glm::radians(camera->getFOV()), (float)windowWidth / (float)windowHeight, 0.1f, 100.f);
+		// resolve the handles once per frame, the resources outlive the frames that draw them
+		Mesh* cubeMesh = meshes.get(cubeMeshHandle);
+		Mesh* lightCube = meshes.get(lightCubeHandle);
+		Mesh* floorMesh = meshes.get(floorHandle);
+		Shader* cubeShader = shaders.get(drawDeferred ? gbufferShaderHandle : cubeShaderHandle); // the G-buffer takes the same uniforms
+		Shader* lightShader = shaders.get(lightShaderHandle);
+		Shader* depthShader = shaders.get(depthShaderHandle);
+		Mesh* boxMesh = meshes.get(boxHandle);
+
+		const glm::mat4& model = scene.getWorldMatrix(cubeNode);
+
+		// pick the level of detail from its error projected on screen
+		float pixelsPerUnit = windowHeight / (2.0f * tan(glm::radians(camera->getFOV()) / 2.0f));
+		float cubeDistance = glm::length(camera->getPosition() - glm::vec3(model[3]));
+		cubeLod = cubeMesh->selectLod(cubeDistance, pixelsPerUnit, cubeLod);
+
+		// Draw the model, unless its bounding sphere is outside of the view
+		glm::vec3 boundsCenter = glm::vec3(model * glm::vec4((cubeMesh->getBoundsMin() + cubeMesh->getBoundsMax()) * 0.5f, 1.0f));
+		float boundsScale = std::max(glm::length(glm::vec3(model[0])), std::max(glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))));
+		float boundsRadius = glm::length(cubeMesh->getBoundsMax() - cubeMesh->getBoundsMin()) * 0.5f * boundsScale;
+		bool cubeVisible = camera->getFrustum().intersectsSphere(boundsCenter, boundsRadius);
+
+		// the room objects in view which the occlusion culling does not find hidden
+		if (occlusion)
+		{
+			// Hi-Z reads the scene's depth as a texture, the forward path with the standard depth draws into the window's
+			OcclusionMode mode = benchPhases ? lightPhases[lightPhase].occlusion : occlusionMode;
+			if (mode == OCCLUSION_HIZ && !drawDeferred && !sceneTarget)
+				mode = OCCLUSION_QUERIES;
+			occlusion->setMode(mode);
+			occlusion->beginFrame(*camera);
+			visibleObjects.clear();
+			const Frustum& frustum = camera->getFrustum();
+			for (unsigned int i = 0; i < (unsigned int)roomObjects.size(); i++)
+			{
+				const RoomObject& object = roomObjects[i];
+				if (frustum.intersectsBox(object.boundsMin, object.boundsMax) && occlusion->isVisible(i, object.boundsMin, object.boundsMax))
+					visibleObjects.push_back(i);
+			}
+		}
+
+		// the sun's shadow maps, every caster around the view and not only those in it, before the
+		// scene's target is bound
+		if (shadowMaps)
+		{
+			if (benchShadows)
+			{
+				shadowMaps->setEnabled(lightPhases[lightPhase].shadows != SHADOWS_OFF);
+				shadowMaps->setCaching(lightPhases[lightPhase].shadows == SHADOWS_CACHED);
+			}
+			casters.clear();
+			for (const RoomObject& object : roomObjects)
+				casters.push_back({ boxMesh, object.model, object.boundsMin, object.boundsMax, 0, true });
+			casters.push_back({ cubeMesh, model, boundsCenter - glm::vec3(boundsRadius), boundsCenter + glm::vec3(boundsRadius), cubeLod, false });
+			shadowMaps->render(commands, depthShader, *camera, casters);
+		}
+
+		if (drawDeferred)
+			deferred->beginGeometry(commands, windowWidth, windowHeight, glm::vec3(0.0f, 0.2f, 0.3f));
+		else
+		{
+			commands.bindTarget(sceneTarget, windowWidth, windowHeight); // NULL draws straight into the window
+			commands.clear(glm::vec4(0.0f, 0.2f, 0.3f, 0.1f), GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); // We want to clear the screen with a color of our choice. 
+		}
+
+		// depth prepass: the same draws as the shading pass below, positions only
+		if (drawPrepass)
+		{
+			prepass->beginDepth(commands, depthShader, projectionMat, viewMat);
+			if (lighting)
+				prepass->drawDepth(commands, depthShader, floorMesh, floorModel);
+			for (unsigned int i : visibleObjects)
+			{
+				occlusion->beginDraw(commands, i);
+				prepass->drawDepth(commands, depthShader, boxMesh, roomObjects[i].model);
+				occlusion->endDraw(commands, i);
+			}
+			if (cubeVisible)
+				prepass->drawDepth(commands, depthShader, cubeMesh, model, cubeLod);
+		}
+		prepass->beginShading(commands, drawPrepass);
 		
 		/// First Mesh 
 		// --------------------------------------------------------------------------------------
 
 		// Bind the shader
-		cubeShader->use();
-		cubeShader->setMat4("projection", projectionMat);
+		commands.useShader(cubeShader);
+		commands.setMat4(cubeShader, "projection", projectionMat);
 
-		cartoonTex->bind(); // use a texture
-		checkerBoardTex->bind(); // use a texture 
+		commands.bindTextureArrays(textureArrays, 0); // every texture of the pass, no bind per draw after this
+		commands.setInstanceTexture(cubeShader, textureArrays, cartoonTex); // and the cube samples this layer
 		  
-		cubeShader->setFloat("time", curTime);
+		commands.setFloat(cubeShader, "time", curTime);
+
+		commands.setFloat3(cubeShader, "objectColor", glm::vec3(0.2f, 0.8f, 0.3f));
+		commands.setFloat3(cubeShader, "lightColor", glm::vec3(1.0f));
 
-		cubeShader->setFloat3("objectColor", glm::vec3(0.2f, 0.8f, 0.3f));
-		cubeShader->setFloat3("lightColor", glm::vec3(1.0f));
+		commands.setMat4(cubeShader, "view", viewMat);
+		// clusteredVert.vs takes the normal matrix with the model, rather than inverting it for every vertex
+		auto setModel = [&](const glm::mat4& objectModel)
+		{
+			commands.setMat4(cubeShader, "model", objectModel);
+			if (clustered)
+				commands.setMat3(cubeShader, "normalMatrix", glm::transpose(glm::inverse(glm::mat3(viewMat * objectModel))));
+		};
 
-		cubeShader->setMat4("view", camera->getViewMatrix());
+		// assign the lights to the froxels of this frame's view, the light cube carries the first one
+		if (lighting)
+		{
+			lighting->getLight(0).position = glm::vec3(scene.getWorldMatrix(lightNode)[3]);
+			if (!drawDeferred)
+			{
+				lighting->update(commands, *camera, windowWidth, windowHeight, lightingPool);
+				lighting->apply(commands, cubeShader, 8, lightPath == LIGHTS_EVERY);
+				shadowMaps->apply(commands, cubeShader, *camera);
+			}
+
+			commands.setFloat3(cubeShader, "objectColor", glm::vec3(0.8f));
+			setModel(floorModel);
+			commands.draw(floorMesh);
+			commands.setFloat3(cubeShader, "objectColor", glm::vec3(0.2f, 0.8f, 0.3f));
+		}
+
+		for (unsigned int i : visibleObjects)
+		{
+			occlusion->beginDraw(commands, i);
+			commands.setFloat3(cubeShader, "objectColor", roomObjects[i].color);
+			setModel(roomObjects[i].model);
+			commands.draw(boxMesh);
+			occlusion->endDraw(commands, i);
+		}
+		if (!visibleObjects.empty())
+			commands.setFloat3(cubeShader, "objectColor", glm::vec3(0.2f, 0.8f, 0.3f));
 		
-		glm::mat4 model = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
-		model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
-		float angle = 20.0f ;
-		model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-		cubeShader->setMat4("model", model); 
-		// Draw the model
-		cubeMesh->draw();
+		setModel(model);
+
+		// the streamed texture spans the cube, its mips follow the cube's size on screen
+		if (streamedTex >= 0)
+		{
+			if (cubeVisible)
+				textureStreamer->request(streamedTex, camera->projectedSize(boundsCenter, boundsRadius * 2.0f, (float)windowHeight));
+			textureStreamer->update(commands);
+			textureStreamer->bind(commands, streamedTex, 0);
+		}
+		if (cubeVisible)
+			commands.draw(cubeMesh, cubeLod);
+		prepass->endShading(commands);
+
+		// the depth of this frame, for the culling of the next ones
+		if (occlusion)
+		{
+			// read on the render thread, a resize recreates the textures there
+			std::function<GLuint()> depthTexture;
+			if (drawDeferred)
+				depthTexture = [deferred]() { return deferred->getDepthTexture(); };
+			else if (sceneTarget)
+				depthTexture = [sceneTarget]() { return sceneTarget->getDepthTexture(); };
+			occlusion->endFrame(commands, shaders.get(pyramidShaderHandle), depthShader, depthTexture, windowWidth, windowHeight, projectionMat, viewMat);
+		}
+
+		// deferred: light what the G-buffer holds, the light cube is then drawn forward over it
+		if (drawDeferred)
+		{
+			Shader* ambientShader = shaders.get(deferredAmbientHandle);
+			commands.useShader(ambientShader);
+			shadowMaps->apply(commands, ambientShader, *camera);
+			deferred->lightScene(commands, ambientShader, shaders.get(deferredLightHandle), lighting->getLights(), *camera, 0.1f);
+		}
 
 		/// Second Mesh 
 		// --------------------------------------------------------------------------------------
-		lightShader->use();
+		commands.useShader(lightShader);
 
-		model = glm::mat4(1.0f); // make sure to initialize matrix to identity matrix first
-		model = glm::translate(model, glm::vec3(1.0f, 1.0f, 0.0f));
-		model = glm::rotate(model, glm::radians(45.0f), glm::vec3(1.0f, 0.3f, 0.5f));
-		model = glm::scale(model,  glm::vec3(0.3f));
-
-		lightShader->setMat4("PVM", projectionMat * camera->getViewMatrix() * model); 
+		glm::mat4 lightPVM;
+		MathKernels::multiply(viewProjectionMat, scene.getWorldMatrix(lightNode), lightPVM);
+		commands.setMat4(lightShader, "PVM", lightPVM); 
 		
 		// Draw the model2
-		lightCube->draw();
+		commands.draw(lightCube);
 
 		// --------------------------------------------------------------------------------------
-		// check and call events and swap the buffers
-		glfwSwapBuffers(window);
+		if (drawDeferred)
+			deferred->resolve(commands, windowWidth, windowHeight, postProcess ? sceneTarget : NULL);
+		if (postProcess)
+			postProcess->execute(commands, windowWidth, windowHeight);
+		else if (sceneTarget && !drawDeferred)
+			commands.blit(sceneTarget, windowWidth, windowHeight);
+
+		// destroy what was released once the frames using it are done
+		meshes.collect(renderThread);
+		shaders.collect(renderThread);
+
+		// hand the frame over (the render thread swaps the buffers) and check and call events
+		mainThreadSeconds += glfwGetTime() - frameStartTime;
+		renderThread.submitFrame();
 		glfwPollEvents();
+
+		// light benchmark: time the phase once it warmed up, then move on to the next light count
+		if (benchPhases)
+		{
+			if (phaseFrame == phaseWarmupFrames)
+			{
+				phaseStartTime = glfwGetTime();
+				phaseAssignMs = 0.0;
+				if (occlusion)
+					occlusion->resetStatistics();
+				if (shadowMaps)
+					shadowMaps->resetStatistics();
+			}
+			if (phaseFrame >= phaseWarmupFrames)
+				phaseAssignMs += lighting->getAssignMs();
+			if (++phaseFrame == phaseWarmupFrames + phaseFrames)
+			{
+				const LightPhase& phase = lightPhases[lightPhase];
+				std::cout << "Lights:: " << phase.lights << " lights, " << lightPathNames[phase.path] << (phase.prepass ? " after a depth prepass, " : ", ")
+					<< (glfwGetTime() - phaseStartTime) * 1000.0 / phaseFrames << " ms/frame, ";
+				if (phase.path == LIGHTS_DEFERRED)
+					std::cout << deferred->getDrawnLightCount() << " light volumes drawn";
+				else
+					std::cout << lighting->getVisibleLightCount() << " in view, assignment " << phaseAssignMs / phaseFrames << " ms";
+				if (benchOcclusion)
+					std::cout << ", occlusion culling " << OcclusionCulling::getModeName(phase.occlusion) << ": " << occlusion->getCulledRatio() * 100.0
+						<< "% of " << occlusion->getTestedPerFrame() << " objects in view culled";
+				if (benchShadows)
+					std::cout << ", shadows " << shadowPathNames[phase.shadows] << ": " << shadowMaps->getCascadesPerFrame() << " cascades and "
+						<< shadowMaps->getCasterDrawsPerFrame() << " caster draws a frame";
+				std::cout << std::endl;
+				phaseFrame = 0;
+				if (++lightPhase == lightPhaseCount)
+				{
+					lightPhase = 0;
+					glfwSetWindowShouldClose(window, true);
+				}
+				else
+					scatterLights(lightPhases[lightPhase].lights);
+			}
+		}
 	}
  
+	unsigned long long loopAllocations = heapAllocations.load();
+	renderThread.stop();
+
+	// frame timing, run with and without --single-thread to compare
+	double loopSeconds = glfwGetTime() - loopStartTime;
+	unsigned int frames = std::max(1u, renderThread.getFrameCount());
+	std::cout << "Frame:: " << (renderThread.isThreaded() ? "render thread" : "single thread") << ", " << frames << " frames, "
+		<< loopSeconds * 1000.0 / frames << " ms/frame (" << frames / loopSeconds << " fps), main thread "
+		<< mainThreadSeconds * 1000.0 / frames << " ms, GL submission " << renderThread.getAverageRenderMs() << " ms, waiting for the render thread "
+		<< renderThread.getAverageWaitMs() << " ms" << std::endl;
+
+	// steady state heap allocations, the frame data lives in the command lists' arenas
+	unsigned long long steadyAllocations = frameIndex > warmupFrames ? loopAllocations - warmupAllocations : 0;
+	const FrameArena& frameArena = renderThread.getCommandList().getArena();
+	std::cout << "Memory:: " << steadyAllocations << " heap allocations in " << (frameIndex > warmupFrames ? frameIndex - warmupFrames : 0)
+		<< " frames after the warm-up, command list arena high water " << frameArena.getHighWater() << " bytes of "
+		<< frameArena.getCapacity() << " reserved in " << frameArena.getChunkAllocations() << " chunks" << std::endl;
+	if (streamedTex >= 0)
+		textureStreamer->report();
+	if (lighting)
+		lighting->report();
+	if (deferred)
+		deferred->report();
+	prepass->report();
+	if (occlusion)
+		occlusion->report();
+	if (shadowMaps)
+		shadowMaps->report();
+	int exitCode = 0;
+	if (checkAllocations && (frameIndex <= warmupFrames || steadyAllocations > 0))
+	{
+		std::cout << "ERROR::main:: steady-state frames allocated from the heap" << std::endl;
+		exitCode = 1;
+	}
+
+
+	// give the resources back, whatever is still alive after that is reported as a leak
+	meshes.release(cubeMeshHandle);
+	meshes.release(lightCubeHandle);
+	meshes.release(floorHandle);
+	meshes.release(boxHandle);
+	shaders.release(cubeShaderHandle);
+	shaders.release(lightShaderHandle);
+	shaders.release(depthShaderHandle);
+	if (rooms)
+		shaders.release(pyramidShaderHandle);
+	if (clustered)
+	{
+		shaders.release(gbufferShaderHandle);
+		shaders.release(deferredAmbientHandle);
+		shaders.release(deferredLightHandle);
+	}
+	if (post)
+	{
+		shaders.release(postThresholdHandle);
+		shaders.release(postDownsampleHandle);
+		shaders.release(postBlurHandle);
+		shaders.release(postUpsampleHandle);
+		shaders.release(postTonemapHandle);
+		shaders.release(postFXAAHandle);
+	}
+	meshes.destroyAll();
+	shaders.destroyAll();
+
+	delete postProcess;
+	delete shadowMaps;
+	delete occlusion;
+	delete prepass;
+	delete deferred;
+	delete lighting;
+	delete lightingPool;
+	delete textureArrays;
+	delete textureStreamer;
+	delete sceneTarget;
 
 	// Properly clean/delete all of GLFW's resources that were allocated.
 	glfwTerminate();
 
-	return 0;
+	return exitCode;
 
 }
 
 
 
 // Window resizing event callback
-void framebufferSizeCallback(GLFWwindow* window, int width, int height)
+void framebufferSizeCallback(GLFWwindow* /*window*/, int width, int height)
 {
-	glViewport(0, 0, width, height);
+	windowWidth = width; // keep the LOD selection in sync with the window
+	windowHeight = height;
+	if (height > 0)
+		camera->setAspect((float)width / (float)height);
+	// the viewport is set by the render thread, the GL context is not current here
 }
 
 
-// Keyboard events callback
-void processInput(GLFWwindow* window)
+// One fixed simulation step: apply the input events that happened before `time`,
+// then move the camera for as long as the keys are held
+void simulate(GLFWwindow* window, double time, float step)
 {
-	// Here we check whether the user has pressed the escape key (if it's not pressed, glfwGetKey returns GLFW_RELEASE)
-	if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+	InputEvent event;
+	while (input->nextEvent(time, event))
 	{
-		glfwSetWindowShouldClose(window, true);
-	} 
-	if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
+		if (event.type == INPUT_KEY && event.key == GLFW_KEY_ESCAPE && event.action == GLFW_PRESS)
+		{
+			glfwSetWindowShouldClose(window, true);
+		}
+		else if (event.type == INPUT_KEY && event.key == GLFW_KEY_TAB && event.action == GLFW_PRESS)
+		{
+			deferredShading = !deferredShading;
+		}
+		else if (event.type == INPUT_KEY && event.key == GLFW_KEY_P && event.action == GLFW_PRESS)
+		{
+			depthPrepass = !depthPrepass;
+		}
+		else if (event.type == INPUT_KEY && event.key == GLFW_KEY_O && event.action == GLFW_PRESS)
+		{
+			occlusionMode = (OcclusionMode)((occlusionMode + 1) % 3);
+		}
+		else if (event.type == INPUT_MOUSE_MOVE)
+		{
+			// raw pixel offsets, the camera sensitivity turns them into degrees
+			simulatedCamera->mouseMovement((float)event.dx, (float)-event.dy); // reversed since y-coordinates range from bottom to top
+		}
+		else if (event.type == INPUT_SCROLL)
+		{
+			simulatedCamera->scrollMovement((float)event.y);
+		}
+	}
+
+	if (input->isKeyDown(GLFW_KEY_UP))
 	{ 
-		camera->keyboardMovement(CAM_FORWARD, deltaTime);
+		simulatedCamera->keyboardMovement(CAM_FORWARD, step);
 	}
-	if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
+	if (input->isKeyDown(GLFW_KEY_DOWN))
 	{
-		camera->keyboardMovement(CAM_BACKWARD, deltaTime);
+		simulatedCamera->keyboardMovement(CAM_BACKWARD, step);
 	}
-	if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
+	if (input->isKeyDown(GLFW_KEY_LEFT))
 	{
-		camera->keyboardMovement(CAM_LEFT, deltaTime);
+		simulatedCamera->keyboardMovement(CAM_LEFT, step);
 	}
-	if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
+	if (input->isKeyDown(GLFW_KEY_RIGHT))
 	{
-		camera->keyboardMovement(CAM_RIGHT, deltaTime);
+		simulatedCamera->keyboardMovement(CAM_RIGHT, step);
 	}
 
 }
 
 
-// Mouse movement callback
-void mouseInput(GLFWwindow* window, double mouseXPos, double mouseYPos)
+// Keyboard events callback
+void keyInput(GLFWwindow* /*window*/, int key, int /*scancode*/, int action, int /*mods*/)
 {
-	// if-statement to avoid camera jumping rapidly 
-	if (firstMouse) // initially set to true
-	{
-		lastMouseX = mouseXPos;
-		lastMouseY = mouseYPos;
-		firstMouse = false;
-	}
-
-
-	float xOffset = mouseXPos - lastMouseX;
-	float yOffset = lastMouseY - mouseYPos; // reversed since y-coordinates range from bottom to top
-	
-	lastMouseX = mouseXPos;
-	lastMouseY = mouseYPos;
-
+	input->pushKey(key, action);
+}
 
-	camera->mouseMovement(xOffset * deltaTime, yOffset*deltaTime);
 
+// Mouse movement callback
+void mouseInput(GLFWwindow* /*window*/, double mouseXPos, double mouseYPos)
+{
+	input->pushMouseMove(mouseXPos, mouseYPos);
 }
 // Scroll movement callback
-void scrollInput(GLFWwindow* window, double xOffset, double yOffset)
+void scrollInput(GLFWwindow* /*window*/, double xOffset, double yOffset)
 {
-	camera->scrollMovement(yOffset);
+	input->pushScroll(xOffset, yOffset);
 }
\ No newline at end of file